@@ -27,5 +27,7 @@ enum {
     TXPC_MSG_TYPE_XON = 3,
     TXPC_MSG_TYPE_XOFF = 4,
     TXPC_MSG_TYPE_ACK = 5,
-    TXPC_MSG_TYPE_MSG = 6
+    TXPC_MSG_TYPE_MSG = 6,
+    TXPC_MSG_TYPE_STREAM = 7,
+    TXPC_MSG_TYPE_FRAG = 8
 };
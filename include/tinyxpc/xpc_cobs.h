@@ -0,0 +1,168 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tinyxpc/xpc_relay.h>
+/**
+ * XPC COBS Framing
+ *
+ * Consistent Overhead Byte Stuffing between a relay and a byte link which can
+ * drop or corrupt bytes, such as a UART.  Each frame the relay writes is
+ * encoded so that it contains no zero bytes and is followed by a zero
+ * delimiter.  The receiver collects bytes up to each delimiter, decodes them
+ * and feeds the frame to the relay with xpc_relay_feed.  Whatever corruption
+ * hits the link, the damage ends at the next delimiter: a frame which does not
+ * decode, or whose decoded length does not match its header, is dropped whole
+ * and parsing picks up again with the next one.
+ *
+ * Encoding costs one byte per 254 plus the delimiter.  Both directions scan
+ * for zero bytes a word (or, with SSE2, 16 bytes) at a time and copy the runs
+ * in between with memcpy.
+ *
+ * Both ends of a link must use the adapter.  The relay is driven with
+ * xpc_relay_feed, so it does not need a read wrapper, but it must not take
+ * receive leases: payloads point into the adapter's receive buffer, which is
+ * reused for the next frame.  Like the relay, the adapter is single threaded.
+ */
+
+// the frame delimiter, the only byte value which never appears in an encoded
+// frame.
+#define XPC_COBS_DELIM 0
+// the longest run of non-zero bytes a code byte covers
+#define XPC_COBS_BLOCK 254
+// encoded size of bytes raw bytes, at most, without the delimiter
+#define XPC_COBS_MAX_ENCODED(bytes) ((bytes) + (bytes) / XPC_COBS_BLOCK + 1)
+// returned by xpc_cobs_decode for malformed input
+#define XPC_COBS_INVALID ((size_t)-1)
+
+/**
+ * Link write function, given encoded bytes to send.
+ * @param link_ctx context passed to xpc_cobs_config.
+ * @param buf bytes to write.
+ * @param bytes the number of bytes at buf.
+ * @return the number of bytes written, which may be short.
+ */
+typedef int (xpc_cobs_link_fn)(void *link_ctx, const char *buf, size_t bytes);
+
+typedef struct xpc_cobs xpc_cobs_t;
+
+struct xpc_cobs {
+    xpc_relay_state_t *relay;
+    xpc_cobs_link_fn *link_write;
+    void *link_ctx;
+    // encoded bytes, caller-provided storage.  Bytes from tx_head are waiting
+    // for the link, up to tx_code while a frame is being encoded (whose open
+    // block starts with the code byte at tx_code), or to tx_tail otherwise.
+    char *tx_buf;
+    size_t tx_capacity;
+    size_t tx_head;
+    size_t tx_code;
+    size_t tx_tail;
+    bool tx_open;
+    // header of the frame being encoded, to tell where it ends, and the
+    // frame bytes left after it.
+    txpc_hdr_t tx_hdr;
+    size_t tx_hdr_len;
+    size_t tx_left;
+    // received bytes since the last delimiter, caller-provided storage.  Once
+    // decoded, a frame the relay has not taken all of (a declined message)
+    // is held in place as rx_frame bytes, rx_fed of them taken.
+    char *rx_buf;
+    size_t rx_capacity;
+    size_t rx_len;
+    size_t rx_frame;
+    size_t rx_fed;
+    // set after an overrun, until the next delimiter
+    bool rx_skip;
+    // set while the relay has write notifications enabled
+    bool want_write;
+    // counters
+    uint64_t frames;
+    uint64_t dropped;
+};
+
+/**
+ * Encode a buffer.  No delimiter is appended.
+ * @param src bytes to encode.
+ * @param bytes the number of bytes at src.
+ * @param dst storage for at least XPC_COBS_MAX_ENCODED(bytes) bytes, which
+ * must not overlap src.
+ * @return the number of bytes written to dst.
+ */
+size_t xpc_cobs_encode(const char *src, size_t bytes, char *dst);
+
+/**
+ * Decode a buffer, without its delimiter.  dst may be src, for decoding in
+ * place.
+ * @param src encoded bytes.
+ * @param bytes the number of bytes at src.
+ * @param dst storage for at least bytes bytes.
+ * @return the number of bytes written to dst, or XPC_COBS_INVALID if src is
+ * not a valid encoding.
+ */
+size_t xpc_cobs_decode(const char *src, size_t bytes, char *dst);
+
+/**
+ * Find the first delimiter in a buffer.
+ * @return its index, or bytes if there is none.
+ */
+size_t xpc_cobs_find_delim(const char *buf, size_t bytes);
+
+/**
+ * Set up an adapter.
+ * @param target pointer to preallocated memory for the adapter.
+ * @param tx_buf caller-provided storage for encoded bytes waiting for the link.
+ * @param tx_capacity size of tx_buf, at least XPC_COBS_BLOCK + 3.
+ * @param rx_buf caller-provided storage for a received frame.
+ * @param rx_capacity size of rx_buf, at least the encoded size of the largest
+ * frame expected.  Longer frames are dropped.
+ * @param link_write function writing encoded bytes to the link.
+ * @param link_ctx context passed to link_write.
+ * @return target, or NULL on bad arguments.
+ */
+xpc_cobs_t *xpc_cobs_config(
+    xpc_cobs_t *target, char *tx_buf, size_t tx_capacity,
+    char *rx_buf, size_t rx_capacity,
+    xpc_cobs_link_fn *link_write, void *link_ctx
+);
+
+/**
+ * Configure a relay to run over an adapter, with the adapter's IO functions
+ * (xpc_relay_config and xpc_relay_config_writev).  The relay may be
+ * configured further afterwards.
+ * @param msg_ctx, crc_ctx, msg_handle_cb, crc, crc_config as for
+ * xpc_relay_config.
+ * @return self, or NULL if self or relay is NULL.
+ */
+xpc_cobs_t *xpc_cobs_relay_config(
+    xpc_cobs_t *self, xpc_relay_state_t *relay,
+    void *msg_ctx, void *crc_ctx, dispatch_fn *msg_handle_cb,
+    crc_fn *crc, crc_polyn_config *crc_config
+);
+
+/**
+ * Take bytes received from the link, and feed the relay every frame they
+ * complete.  When the relay declines a message, the frame is held and no
+ * further bytes are taken: present the rest again, or call with no bytes, to
+ * retry it.
+ * @param data received bytes.
+ * @param bytes the number of bytes at data.
+ * @return the number of bytes taken from data.
+ */
+size_t xpc_cobs_input(xpc_cobs_t *self, const char *data, size_t bytes);
+
+/**
+ * Write encoded bytes out to the link.  Frames are written as they are
+ * encoded, so this only needs calling once the link can take more after a
+ * short write.
+ * @return true once nothing is left waiting for the link.
+ */
+bool xpc_cobs_flush(xpc_cobs_t *self);
+
+/**
+ * IO functions used by the relay.  io_ctx is the adapter.
+ */
+int xpc_cobs_write(void *io_ctx, char **buffer, int offset, size_t bytes_max);
+int xpc_cobs_writev(void *io_ctx, xpc_iovec_t *iov, int iovcnt);
+void xpc_cobs_io_reset(void *io_ctx, int which, size_t bytes);
+void xpc_cobs_io_notify(void *io_ctx, int which, bool enable);
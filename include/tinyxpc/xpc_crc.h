@@ -0,0 +1,110 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+/**
+ * XPC generic CRC engine
+ *
+ * Implementations of the XPC Relay CRC interfaces (crc_fn, crc_polyn_config
+ * and the incremental crc_init_fn/crc_update_fn/crc_finalize_fn triple) for
+ * CRCs of 8 to 64 bits, described by the usual parameters: width, generator
+ * polynomial, input/output reflection, initial value and final XOR.
+ *
+ * Lookup tables for the presets below are generated at compile time.  Any
+ * other polynomial, e.g. one received in a config message, gets a table
+ * built into the engine state when the engine is set up or configured.
+ *
+ * On the wire the CRC takes XPC_CRC_BYTES(width) bytes, least significant
+ * first when the output is reflected, most significant first otherwise.  For
+ * 32 bit reflected CRCs, xpc_crc32 is considerably faster.
+ */
+
+typedef struct {
+    // CRC width in bits, 8 to 64
+    uint8_t width;
+    bool refin;
+    bool refout;
+    // generator polynomial without the x^width term, normal representation
+    uint64_t polyn;
+    // initial register value and final XOR, normal representation
+    uint64_t init;
+    uint64_t xorout;
+    // CRC of the ASCII string "123456789"
+    uint64_t check;
+} xpc_crc_params_t;
+
+typedef enum {
+    XPC_CRC_8_SMBUS,
+    XPC_CRC_8_MAXIM_DOW,
+    // CRC-16/CCITT, as used by Kermit
+    XPC_CRC_16_KERMIT,
+    // CRC-16/CCITT-FALSE
+    XPC_CRC_16_IBM_3740,
+    XPC_CRC_16_MODBUS,
+    XPC_CRC_24_OPENPGP,
+    // the zlib/Ethernet CRC-32
+    XPC_CRC_32_ISO_HDLC,
+    // CRC-32C
+    XPC_CRC_32_ISCSI,
+    XPC_CRC_64_XZ,
+    XPC_CRC_64_ECMA_182,
+    XPC_CRC_PRESET_COUNT
+} xpc_crc_preset_t;
+
+/**
+ * CRC engine state.  This is the crc_ctx handed to the relay.  Once set up,
+ * the incremental interface only reads it, so relays on any thread may share
+ * one as long as none of them changes the parameters.  xpc_crc_fn returns its
+ * CRC in the state, so relays calling it need one each.  The state holds no
+ * pointers into itself and may be copied.
+ */
+typedef struct {
+    xpc_crc_params_t params;
+    // preset whose compile-time table fits the parameters, -1 if the table
+    // was built into lut.
+    int preset;
+    // storage for the CRC returned by xpc_crc_fn, in wire order.
+    char out[8];
+    // table storage for polynomials without a compile-time table
+    uint64_t lut[256];
+} xpc_crc_ctx_t;
+
+/**
+ * Get the parameters of a preset.
+ * @return the parameters, or NULL if preset is out of range.
+ */
+const xpc_crc_params_t *xpc_crc_preset(xpc_crc_preset_t preset);
+
+/**
+ * Set up an engine.
+ * @param ctx pointer to preallocated memory for the engine.
+ * @param params CRC parameters, copied into ctx.
+ * @return ctx, or NULL if the width is not supported.
+ */
+xpc_crc_ctx_t *xpc_crc_setup(xpc_crc_ctx_t *ctx, const xpc_crc_params_t *params);
+
+/**
+ * Compute the CRC of a buffer in one call.
+ */
+uint64_t xpc_crc_compute(xpc_crc_ctx_t *ctx, const char *buf, size_t bytes);
+
+/**
+ * crc_fn implementation.  crc_ctx must point to an xpc_crc_ctx_t.
+ */
+char *xpc_crc_fn(void *crc_ctx, char *buf, size_t bytes);
+
+/**
+ * crc_polyn_config implementation.  The width and polynomial are taken from
+ * the arguments, reflection, initial value and final XOR are kept from the
+ * engine setup, so both ends of a link must set up their engine the same
+ * way.  An initial value or final XOR of all ones stays all ones across a
+ * width change.  Widths outside 8 to 64 leave the engine unchanged.
+ */
+void xpc_crc_polyn_config(void *crc_ctx, int crc_bits, char *polyn);
+
+/**
+ * Incremental interface, see crc_init_fn, crc_update_fn and crc_finalize_fn.
+ */
+uint64_t xpc_crc_init(void *crc_ctx);
+uint64_t xpc_crc_update(void *crc_ctx, uint64_t crc, char *buf, size_t bytes);
+void xpc_crc_finalize(void *crc_ctx, uint64_t crc, char *out);
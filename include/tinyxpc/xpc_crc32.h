@@ -0,0 +1,107 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+/**
+ * XPC CRC-32 engine
+ *
+ * Implementations of the XPC Relay CRC interfaces (crc_fn, crc_polyn_config
+ * and the incremental crc_init_fn/crc_update_fn/crc_finalize_fn triple) for
+ * 32 bit CRCs in the reflected form used by zlib, Ethernet and iSCSI: input
+ * and output reflected, initial value and final XOR of 0xffffffff.  The CRC is
+ * sent little-endian.
+ *
+ * Any generator polynomial may be used.  The lookup kernel is chosen when the
+ * polynomial is set, from portable slice-by-8/16 tables, carry-less multiply
+ * folding (PCLMULQDQ) for any polynomial, or the SSE4.2 crc32 instruction for
+ * CRC-32C, depending on what the CPU supports.
+ */
+
+// well known generator polynomials, normal (msb-first) representation.
+#define XPC_CRC32_POLYN_IEEE 0x04c11db7u
+#define XPC_CRC32_POLYN_CASTAGNOLI 0x1edc6f41u
+
+typedef enum {
+    // pick the fastest kernel supported by the CPU for the polynomial
+    XPC_CRC32_KERNEL_AUTO,
+    XPC_CRC32_KERNEL_SLICE8,
+    XPC_CRC32_KERNEL_SLICE16,
+    // x86 carry-less multiply folding, any polynomial
+    XPC_CRC32_KERNEL_PCLMUL,
+    // x86 SSE4.2 crc32 instruction, XPC_CRC32_POLYN_CASTAGNOLI only
+    XPC_CRC32_KERNEL_SSE42
+} xpc_crc32_kernel_t;
+
+typedef struct xpc_crc32_ctx xpc_crc32_ctx_t;
+
+/**
+ * Kernel function type.  Advances the raw (not inverted) CRC register over
+ * bytes at buf.
+ */
+typedef uint32_t (xpc_crc32_kernel_fn)(
+    const xpc_crc32_ctx_t *ctx, uint32_t crc, const char *buf, size_t bytes
+);
+
+/**
+ * CRC-32 engine state for one polynomial.  This is the crc_ctx handed to the
+ * relay.  It holds the lookup tables (16 KiB), so it is usually allocated
+ * once per polynomial and shared between relays using it.
+ */
+struct xpc_crc32_ctx {
+    // generator polynomial, normal representation
+    uint32_t polyn;
+    xpc_crc32_kernel_t kind;
+    xpc_crc32_kernel_fn *kernel;
+    // kernel for what is left over by a block-based kernel
+    xpc_crc32_kernel_fn *tail;
+    // storage for the CRC returned by xpc_crc32_fn, in wire order.
+    char out[4];
+    // carry-less multiply constants: fold by 4, fold by 1, 64 -> 32 bit
+    // reduction, and the Barrett reduction polynomial / quotient.
+    uint64_t k1k2[2];
+    uint64_t k3k4[2];
+    uint64_t k5k0[2];
+    uint64_t poly_mu[2];
+    // slice-by-16 lookup tables, table[0] is the plain byte-wise table.
+    uint32_t table[16][256];
+};
+
+/**
+ * Set up an engine for a polynomial.
+ * @param ctx pointer to preallocated memory for the engine.
+ * @param polyn generator polynomial, normal representation.
+ * @param kernel kernel to use, XPC_CRC32_KERNEL_AUTO to pick by CPU.
+ * @return ctx, or NULL if the kernel is not supported for the polynomial on
+ * this CPU.
+ */
+xpc_crc32_ctx_t *xpc_crc32_setup(
+    xpc_crc32_ctx_t *ctx, uint32_t polyn, xpc_crc32_kernel_t kernel
+);
+
+/**
+ * Check whether a kernel can run on this CPU.
+ */
+bool xpc_crc32_kernel_supported(xpc_crc32_kernel_t kernel);
+
+/**
+ * Compute the CRC of a buffer in one call.
+ */
+uint32_t xpc_crc32(const xpc_crc32_ctx_t *ctx, const char *buf, size_t bytes);
+
+/**
+ * crc_fn implementation.  crc_ctx must point to an xpc_crc32_ctx_t.
+ */
+char *xpc_crc32_fn(void *crc_ctx, char *buf, size_t bytes);
+
+/**
+ * crc_polyn_config implementation.  Accepts 32 bit polynomials, given as four
+ * bytes, most significant first.  Other widths leave the engine unchanged.
+ */
+void xpc_crc32_polyn_config(void *crc_ctx, int crc_bits, char *polyn);
+
+/**
+ * Incremental interface, see crc_init_fn, crc_update_fn and crc_finalize_fn.
+ */
+uint64_t xpc_crc32_init(void *crc_ctx);
+uint64_t xpc_crc32_update(void *crc_ctx, uint64_t crc, char *buf, size_t bytes);
+void xpc_crc32_finalize(void *crc_ctx, uint64_t crc, char *out);
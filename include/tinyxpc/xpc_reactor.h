@@ -0,0 +1,199 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tinyxpc/xpc_relay.h>
+/**
+ * XPC Reactor
+ *
+ * An event loop for Linux driving any number of XPC Relays from one thread,
+ * built on edge-triggered epoll with a timerfd for periodic work.
+ *
+ * Each connection is a relay plus the file descriptors it talks over and a
+ * receive buffer.  The reactor provides the relay's IO functions: received
+ * bytes are read in as large chunks as the buffer allows and parsed with
+ * xpc_relay_feed, so a burst of small frames costs one read(2) and no copies,
+ * and frames are written with writev(2).
+ *
+ * Descriptors are registered once for both directions.  io_notify only
+ * changes which directions the relay wants serviced; readiness reported by
+ * epoll is remembered per connection until a read or write would block, so
+ * no epoll_ctl call is needed when the relay starts or stops sending.
+ *
+ * Relay timers (retransmission timeouts, coalescing deadlines and partial
+ * frame timeouts) are kept on a hashed timing wheel turned by the timerfd.
+ * After servicing a connection the reactor files it under its relay's next
+ * deadline (xpc_relay_next_deadline), so a tick only visits connections whose
+ * slot comes up, however many are idle.  Relays must then use
+ * xpc_reactor_clock for all their clocks.
+ *
+ * Writes to a peer that has gone away raise SIGPIPE; applications should
+ * ignore it and let the connection's close_cb report the failure.
+ *
+ * Like the relay, the reactor is single threaded: connections, relays and
+ * leases may only be used from the thread running it.
+ */
+
+// slots in the timer wheel, a power of two.  Deadlines further out than a
+// turn of the wheel are filed again when their slot comes up.
+#define XPC_REACTOR_WHEEL 64
+
+typedef struct xpc_reactor xpc_reactor_t;
+typedef struct xpc_reactor_conn xpc_reactor_conn_t;
+
+/**
+ * Called when a connection's descriptors are closed by the remote or fail.
+ * The connection has already been removed from the reactor.
+ */
+typedef void (xpc_reactor_close_fn)(xpc_reactor_conn_t *conn);
+
+/**
+ * Called on every timer tick, after the connections whose deadlines passed
+ * have been queued for servicing.
+ */
+typedef void (xpc_reactor_tick_fn)(xpc_reactor_t *reactor, void *tick_ctx);
+
+struct xpc_reactor {
+    int epoll_fd;
+    int timer_fd;
+    uint32_t tick_ms;
+    xpc_reactor_tick_fn *tick_cb;
+    void *tick_ctx;
+    // connections with work that epoll will not report again, e.g. a relay
+    // which started sending while its descriptor was already writable.
+    xpc_reactor_conn_t *ready_head;
+    xpc_reactor_conn_t *ready_tail;
+    // all connections
+    xpc_reactor_conn_t *conns;
+    size_t count;
+    // connections waiting on a relay deadline, by the tick it falls in, and
+    // the slot of the last tick.
+    xpc_reactor_conn_t *wheel[XPC_REACTOR_WHEEL];
+    size_t wheel_pos;
+    bool stop;
+};
+
+struct xpc_reactor_conn {
+    xpc_reactor_t *reactor;
+    xpc_relay_state_t *relay;
+    // descriptors, which may be the same for sockets
+    int rd_fd;
+    int wr_fd;
+    // receive buffer.  Bytes before rx_head are free, bytes up to rx_parse
+    // have been consumed by the relay but may still be leased, and bytes up
+    // to rx_tail are waiting to be parsed.
+    char *rx_buf;
+    size_t rx_cap;
+    size_t rx_head;
+    size_t rx_parse;
+    size_t rx_tail;
+    // readiness latched from epoll, and what the relay wants serviced
+    bool readable;
+    bool writable;
+    bool want_read;
+    bool want_write;
+    bool queued;
+    bool closed;
+    xpc_reactor_close_fn *close_cb;
+    void *user;
+    xpc_reactor_conn_t *next_ready;
+    xpc_reactor_conn_t *prev;
+    xpc_reactor_conn_t *next;
+    // the relay deadline the connection is filed under in the timer wheel,
+    // while armed.
+    bool armed;
+    uint32_t timer_at;
+    size_t timer_slot;
+    xpc_reactor_conn_t *timer_prev;
+    xpc_reactor_conn_t *timer_next;
+};
+
+/**
+ * Set up a reactor.
+ * @param target pointer to preallocated memory for the reactor.
+ * @param tick_ms timer period in milliseconds, 0 for no timer.
+ * @param tick_cb function called on each tick, may be NULL.  It may remove
+ * and free any connection.
+ * @param tick_ctx context passed to tick_cb.
+ * @return target, or NULL if the epoll or timer descriptors could not be
+ * created.
+ */
+xpc_reactor_t *xpc_reactor_init(
+    xpc_reactor_t *target, uint32_t tick_ms,
+    xpc_reactor_tick_fn *tick_cb, void *tick_ctx
+);
+
+/**
+ * Release the reactor's own descriptors.  Connections are left alone.
+ */
+void xpc_reactor_destroy(xpc_reactor_t *self);
+
+/**
+ * Set up a connection and the relay driven by it.  The relay is configured
+ * with the reactor's IO functions (xpc_relay_config and
+ * xpc_relay_config_writev), and may be configured further before the
+ * connection is added.
+ *
+ * @param target pointer to preallocated memory for the connection.
+ * @param relay pointer to preallocated memory for the relay.
+ * @param rd_fd descriptor to read from.
+ * @param wr_fd descriptor to write to, may be rd_fd.
+ * @param rx_buf receive buffer.  It must hold at least the largest frame the
+ * remote sends, plus whatever payloads are leased at a time.
+ * @param rx_cap size of rx_buf.
+ * @param msg_ctx, crc_ctx, msg_handle_cb, crc, crc_config as for
+ * xpc_relay_config.
+ * @return target, or NULL on bad arguments.
+ */
+xpc_reactor_conn_t *xpc_reactor_conn_config(
+    xpc_reactor_conn_t *target, xpc_relay_state_t *relay,
+    int rd_fd, int wr_fd, char *rx_buf, size_t rx_cap,
+    void *msg_ctx, void *crc_ctx, dispatch_fn *msg_handle_cb,
+    crc_fn *crc, crc_polyn_config *crc_config
+);
+
+/**
+ * Start servicing a connection.  Its descriptors are made non-blocking.
+ * @param close_cb function called when the connection closes, may be NULL.
+ * @return conn, or NULL if the descriptors could not be registered.
+ */
+xpc_reactor_conn_t *xpc_reactor_add(
+    xpc_reactor_t *self, xpc_reactor_conn_t *conn, xpc_reactor_close_fn *close_cb
+);
+
+/**
+ * Stop servicing a connection.  Descriptors are not closed.
+ */
+void xpc_reactor_remove(xpc_reactor_t *self, xpc_reactor_conn_t *conn);
+
+/**
+ * Wait for and handle one batch of events.
+ * @param timeout_ms longest time to wait, -1 to wait indefinitely.
+ * @return number of events handled, or -1 on error.
+ */
+int xpc_reactor_run_once(xpc_reactor_t *self, int timeout_ms);
+
+/**
+ * Handle events until xpc_reactor_stop is called.
+ * @return 0, or -1 on error.
+ */
+int xpc_reactor_run(xpc_reactor_t *self);
+
+/**
+ * Make xpc_reactor_run return after the current batch of events.
+ */
+void xpc_reactor_stop(xpc_reactor_t *self);
+
+/**
+ * clock_fn implementation for the reactor's relays: monotonic milliseconds.
+ * Relay deadlines are read against it.
+ */
+uint32_t xpc_reactor_clock(void *clock_ctx);
+
+/**
+ * IO functions used by the reactor's relays.  io_ctx is the connection.
+ */
+int xpc_reactor_write(void *io_ctx, char **buffer, int offset, size_t bytes_max);
+int xpc_reactor_writev(void *io_ctx, xpc_iovec_t *iov, int iovcnt);
+void xpc_reactor_io_reset(void *io_ctx, int which, size_t bytes);
+void xpc_reactor_io_notify(void *io_ctx, int which, bool enable);
@@ -1,6 +1,7 @@
 #pragma once
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <tinyxpc/tinyxpc.h>
 /**
  * XPC Relay definitions
@@ -15,7 +16,9 @@
  * The XPC Relay is implemented as two parallel state machines which interact
  * with each other through limited signals.  In TinyXPC, messages are atomic, so
  * the state of either machine cannot be interrupted until the state is
- * TXPC_OP_NONE, meaning no message is currently inflight.
+ * TXPC_OP_NONE, meaning no message is currently inflight.  Large messages sent
+ * on channels are split into fragment frames, so that others are only held up
+ * for one fragment (see Channel definitions).
  */
 
 
@@ -47,14 +50,47 @@
 typedef int (io_wrap_fn)(void *io_ctx, char **buffer, int offset, size_t bytes_max);
 
 
+/**
+ * A single contiguous region of a scattered buffer.  The layout matches
+ * struct iovec on POSIX systems, so a vectored wrapper may pass an array of
+ * these directly to writev(2).
+ */
+typedef struct {
+    char *base;
+    size_t len;
+} xpc_iovec_t;
+
+// the most segments a payload sent with xpc_send_msgv may be made of
+#define XPC_MSG_MAX_IOV 8
+
+/**
+ * Vectored IO wrapping function type declaration.  When provided, the XPC
+ * Relay uses this to hand every remaining segment of the inflight frame
+ * (header, payload and CRC) to the IO subsystem in a single call.
+ *
+ * Partial writes are allowed: the relay advances by the returned number of
+ * bytes and passes the remainder of the frame on the next call.
+ *
+ * @param io_ctx will be passed to the io wrapper when it is called.
+ * @param iov array of regions to write, in order.
+ * @param iovcnt number of entries in iov.
+ * @return the actual number of bytes written.
+ */
+typedef int (io_wrapv_fn)(void *io_ctx, xpc_iovec_t *iov, int iovcnt);
+
+
 /**
  * Function type for reset callbacks.  When a full message has been received,
  * the xpc relay will inform the IO subsystem that it can discard that size in
  * its input buffer. The same can be done when the xpc relay is finished with
  * a transmission - this allows IO calls to be buffered in systems where that
  * is advantageous.
+ *
+ * While received payloads are leased (see xpc_relay_lease), the read buffer
+ * must behave as a FIFO: a read with *buffer NULL starts a new payload after
+ * all bytes still held, and bytes are discarded from the oldest end.
  * @param io_ctx io_ctx set at initialization of xpc_relay_config
- * @param which 0 if read, 1 if write
+ * @param which 1 if read, 0 if write
  * @param bytes the number of bytes which can be discarded. -1 if all bytes
  * must be discarded.
  */
@@ -86,14 +122,135 @@ typedef bool (dispatch_fn)(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload);
  */
 typedef char *(crc_fn)(void *crc_ctx, char *buf, size_t bytes);
 
+// number of bytes a CRC of crc_bits bits occupies on the wire.
+#define XPC_CRC_BYTES(crc_bits) (((crc_bits) + 7) >> 3)
+
+/**
+ * Incremental CRC interface.  When provided, the relay folds each chunk of
+ * payload into a running CRC as it is read or written, instead of making a
+ * second pass over the whole payload with crc_fn once the last byte is in.
+ * The running value is kept by the relay, one per direction, so the CRC
+ * subsystem only needs its configuration in crc_ctx.
+ *
+ * crc_init_fn returns the initial running value.
+ * crc_update_fn folds bytes at buf into crc and returns the new value.
+ * crc_finalize_fn writes the wire representation of the CRC (the same bytes
+ * crc_fn would point to) to out, which holds at least 8 bytes.
+ *
+ * CRCs wider than 64 bits always go through crc_fn.
+ */
+typedef uint64_t (crc_init_fn)(void *crc_ctx);
+typedef uint64_t (crc_update_fn)(void *crc_ctx, uint64_t crc, char *buf, size_t bytes);
+typedef void (crc_finalize_fn)(void *crc_ctx, uint64_t crc, char *out);
+
 /**
  * Function to change the generator polynomial for the CRC subsystem.
  * @param crc_ctx context for the CRC subsystem, as passed in xpc_relay_config.
  * @param crc_bits number of bits in the CRC generator polynomial.
- * @param polyn pointer to contiguous memory containing the coefficients.
+ * @param polyn pointer to contiguous memory containing the coefficients,
+ * XPC_CRC_BYTES(crc_bits) bytes, most significant first.  The implicit
+ * x^crc_bits term is not included.
  */
 typedef void (crc_polyn_config)(void *crc_ctx, int crc_bits, char *polyn);
 
+/**
+ * Compile time bindings.  Building src/xpc_relay.c with XPC_RELAY_BIND set
+ * to a header name (e.g. -DXPC_RELAY_BIND='"my_bind.h"') includes that
+ * header, which may bind any of the calls out of the relay to a function or
+ * macro of the matching type above:
+ *
+ *   XPC_BIND_WRITE, XPC_BIND_WRITEV, XPC_BIND_READ    io_wrap_fn, io_wrapv_fn
+ *   XPC_BIND_IO_RESET, XPC_BIND_IO_NOTIFY             io_reset_fn, io_notify_config
+ *   XPC_BIND_DISPATCH                                 dispatch_fn
+ *   XPC_BIND_CRC, XPC_BIND_CRC_CONFIG                 crc_fn, crc_polyn_config
+ *   XPC_BIND_CRC_INIT, XPC_BIND_CRC_UPDATE,
+ *   XPC_BIND_CRC_FINALIZE                             the incremental CRC, all three
+ *
+ * A bound call is made directly, with the context from xpc_relay_config, and
+ * the function pointer given for it is ignored (it may be NULL).  Calls not
+ * bound still go through their pointers.  XPC_BIND_CRC_BITS fixes the CRC
+ * width: xpc_relay_send_config only turns CRCs on at that width, and a
+ * config received with another one is not applied but resets the
+ * connection, so the remote has to use it too.  Bindings are private to the
+ * relay's translation unit and leave xpc_relay_state_t as it is, so one build
+ * serves one transport, e.g. firmware with a single UART, or a server's hot
+ * path.
+ */
+
+
+/**
+ * Function type for a monotonic clock.  The unit is up to the caller (e.g.
+ * milliseconds), and only needs to match the timeouts given to the relay.
+ * The value is expected to wrap around.
+ * @param clock_ctx context for the clock, as passed in xpc_relay_config_ack.
+ * @return the current time.
+ */
+typedef uint32_t (clock_fn)(void *clock_ctx);
+
+/**
+ * Function type for delivery notification in acknowledged mode.  Called once
+ * for every message sent with a sequence number, when the remote has
+ * acknowledged it or when it was dropped by a connection reset.  The payload
+ * may be reused once this has been called.
+ * @param msg_ctx msg_ctx set at initialization of xpc_relay_config
+ * @param msg_hdr header the message was sent with.
+ * @param payload the payload the message was sent with.
+ * @param delivered true if acknowledged, false if dropped.
+ */
+typedef void (ack_fn)(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload, bool delivered);
+
+
+/**
+ * Stream definitions
+ *
+ * A stream carries an object of any size as a run of TXPC_MSG_TYPE_STREAM
+ * frames, laid out like message frames without a sequence number, and ended
+ * by one with no payload.  The receiver gets each chunk as it arrives, so
+ * neither side ever holds the whole object.
+ *
+ * Each stream frame carries a trailer of XPC_STREAM_TRAILER bytes between the
+ * payload and the CRC: the low 32 bits of the stream offset of its payload,
+ * little endian, covered by the CRC.  A chunk which fails its CRC is dropped,
+ * and the receiver learns of the gap from the offset of the next frame.
+ */
+#define XPC_STREAM_TRAILER 4
+
+/**
+ * Function type for pulling stream data on the sending side.  Called by the
+ * write state machine when it is ready for the next chunk.
+ * @param stream_ctx stream_ctx given to xpc_relay_send_stream.
+ * @param offset bytes of the stream sent so far.
+ * @param chunk set to the location of the next bytes, which must stay valid
+ * until the next call or the done callback.
+ * @param bytes_max the most bytes the frame can take.
+ * @return the number of bytes at *chunk, 0 if none are ready yet, in which
+ * case the stream waits until xpc_wr_op_continue is called again.  The relay
+ * may turn off write notifications meanwhile, see xpc_relay_stream_ready.
+ */
+typedef size_t (stream_pull_fn)(
+    void *stream_ctx, uint64_t offset, char **chunk, size_t bytes_max
+);
+
+/**
+ * Function type for the end of a sent stream.
+ * @param stream_ctx stream_ctx given to xpc_relay_send_stream.
+ * @param completed true once the end frame has been written, false if the
+ * stream was abandoned by a connection reset.
+ */
+typedef void (stream_done_fn)(void *stream_ctx, bool completed);
+
+/**
+ * Function type for received stream chunks.  Same as dispatch_fn: msg_hdr
+ * holds the chunk size and addresses, and returning false declines the chunk,
+ * which is presented again later.  A chunk of size 0 ends the stream.  Chunks
+ * may be leased with xpc_relay_lease.
+ *
+ * When chunks were lost, e.g. to a failed CRC, the handler is first called
+ * with chunk NULL and the header of the frame after the gap: the stream in
+ * progress is incomplete.  Its return value is ignored, and the frame after
+ * the gap is presented next.
+ */
+typedef bool (stream_chunk_fn)(void *msg_ctx, txpc_hdr_t *msg_hdr, char *chunk);
 
 typedef enum {
     TXPC_OP_NONE,
@@ -101,6 +258,9 @@ typedef enum {
     TXPC_OP_MSG,
     TXPC_OP_CONFIG,
     TXPC_OP_ACK,
+    TXPC_OP_FLOW,
+    TXPC_OP_STREAM,
+    TXPC_OP_FRAG,
     // these are aliased to minimize the state variable size, but are more
     // readable when looking through the read state machine.
     TXPC_OP_WAIT_RESET = TXPC_OP_RESET,
@@ -117,18 +277,240 @@ typedef enum {
     TXPC_STATUS_BAD_STATE
 } xpc_status_t;
 
+typedef enum {
+    CONFIG_MASK_RESERVED = 0xfe,
+    CONFIG_FLAGS_REQ_ACK = 0x01
+} xpc_config_flags_t;
+
 typedef struct {
     unsigned char crc_bits;
     // there has to be a better way to express this. FIXME.
     union {
         unsigned char flags;
-        enum {
-            CONFIG_MASK_RESERVED = 0xfe,
-            CONFIG_FLAGS_REQ_ACK = 0x01
-        } flag_defs;
+        // declared outside the union, which C++ allows no types in
+        xpc_config_flags_t flag_defs;
     };
 } xpc_config_t;
 
+/**
+ * A write operation waiting in the transmit queue.  The send functions fill
+ * these in, and the write state machine starts them in order.
+ */
+typedef struct {
+    xpc_sm_state_t op;
+    txpc_hdr_t msg_hdr;
+    // payload, or polynomial for a config op.  Must stay valid until sent.
+    char *buf;
+    // payload segments of a message sent with xpc_send_msgv, NULL otherwise.
+    // buf is then the first segment.
+    const xpc_iovec_t *iov;
+    int iovcnt;
+    // connection parameters, applied when a config op is started.
+    xpc_config_t config;
+} xpc_tx_desc_t;
+
+/**
+ * A received payload held by the application past its dispatch call.  The
+ * payload stays valid until the lease is passed to xpc_relay_release.
+ */
+typedef struct {
+    txpc_hdr_t msg_hdr;
+    char *payload;
+    // read buffer bytes held by the frame, and by unleased frames completed
+    // after it, which are discarded together with it.
+    size_t bytes;
+    size_t trailing;
+    bool released;
+} xpc_lease_t;
+
+/**
+ * Channel definitions
+ *
+ * Channels multiplex messages of different urgency over one relay.  Each has
+ * its own transmit queue and a strict priority, and channels of the same
+ * priority share the link by weight.  A message larger than the relay's
+ * fragment size is sent as TXPC_MSG_TYPE_FRAG frames of at most that size, so
+ * that frames of other channels go out between them, and the receiver
+ * reassembles it into the channel's receive buffer before dispatching it.
+ * Each fragment frame carries a trailer of XPC_FRAG_TRAILER bytes between the
+ * payload and the CRC, which covers it: the channel number, XPC_FRAG_* flags,
+ * and the index of the fragment in its message (modulo 256), so a fragment
+ * lost on the way breaks up the message instead of leaving a hole in it.
+ */
+#define XPC_FRAG_TRAILER 3
+
+enum {
+    XPC_FRAG_FIRST = 0x01,
+    XPC_FRAG_LAST = 0x02
+};
+
+/**
+ * A logical channel, set up with xpc_channel_config.  Both ends of a relay
+ * number their channels the same way.
+ */
+typedef struct {
+    // lower goes first.  Channels of the same priority take turns, each
+    // sending about weight fragments per turn.
+    uint8_t priority;
+    uint8_t weight;
+    // messages waiting, a ring of caller-provided storage, and the bytes of
+    // the oldest one already sent as fragments.
+    xpc_tx_desc_t *slots;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    size_t offset;
+    // bytes the channel may still send in this turn, may be negative.
+    int32_t deficit;
+    // reassembly of a fragmented message, caller-provided storage.
+    char *rx_buf;
+    size_t rx_capacity;
+    size_t rx_fill;
+    txpc_hdr_t rx_hdr;
+    bool rx_open;
+    // index the next fragment of the message being reassembled must have
+    uint8_t rx_index;
+    // fragmented messages dropped part way, because a fragment was lost or
+    // damaged or the message did not fit rx_buf.
+    uint64_t rx_dropped;
+} xpc_channel_t;
+
+/**
+ * Acknowledged mode definitions
+ *
+ * When CONFIG_FLAGS_REQ_ACK is set, each TXPC_MSG_TYPE_MSG frame carries a one
+ * byte sequence number between the payload and the CRC.  The receiver answers
+ * with TXPC_MSG_TYPE_ACK frames holding the next sequence number it expects
+ * and a bitmap of the sequence numbers received after it, so a sender may
+ * have up to XPC_ACK_WINDOW_MAX messages unacknowledged at once.  With CRCs
+ * on, the CRC of a message covers its sequence number (see tinyxpc_spec.md),
+ * and ACK frames carry one over their payload.
+ */
+#define XPC_ACK_WINDOW_MAX 32
+
+// TXPC_MSG_TYPE_ACK payload: kind, next expected sequence, 32 bit bitmap (LE),
+// followed by the CRC when CRCs are on.
+#define XPC_ACK_FRAME_SIZE 6
+
+enum {
+    XPC_ACK_KIND_ACK = 0,
+    // the receiver is missing the expected sequence number, resend it now.
+    XPC_ACK_KIND_NACK = 1
+};
+
+/**
+ * One unacknowledged message in the send window.
+ */
+typedef struct {
+    txpc_hdr_t msg_hdr;
+    char *buf;
+    // payload segments, as in xpc_tx_desc_t
+    const xpc_iovec_t *iov;
+    int iovcnt;
+    uint8_t seq;
+    enum {
+        XPC_ACK_SLOT_SENDING,
+        XPC_ACK_SLOT_SENT,
+        XPC_ACK_SLOT_RESEND,
+        XPC_ACK_SLOT_ACKED
+    } state;
+    // clock value when the last transmission finished
+    uint32_t sent_at;
+    // sent more than once, so its ACK gives no round trip sample
+    bool resent;
+    // end of its frame in the staging buffer while it waits to be written
+    // there, 0 otherwise
+    size_t staged;
+} xpc_ack_slot_t;
+
+/**
+ * Statistics definitions
+ *
+ * When the relay is built with XPC_RELAY_STATS defined (the meson option
+ * stats), it keeps the counters below.  They are written by the thread
+ * driving the relay and may be read from any other thread through
+ * xpc_relay_stats_snapshot.  Without it, no counters are kept and the relay
+ * state is the same as without statistics support.
+ */
+
+/**
+ * Counters for one direction of a relay.
+ */
+typedef struct {
+    // bytes of whole frames, header included
+    uint64_t bytes;
+    // whole frames, indexed by message type (TXPC_MSG_TYPE_*)
+    uint64_t frames[16];
+    // IO wrapper calls, and those which moved fewer bytes than asked for.
+    // Reads fed through xpc_relay_feed make no IO calls.
+    uint64_t io_calls;
+    uint64_t io_short;
+} xpc_relay_dir_stats_t;
+
+typedef struct {
+    xpc_relay_dir_stats_t tx;
+    xpc_relay_dir_stats_t rx;
+    // received messages whose CRC did not match
+    uint64_t crc_errors;
+    // completed connection resets, either side initiating
+    uint64_t resets;
+    // times the dispatch callback declined a message, which is then presented
+    // again
+    uint64_t dispatch_declined;
+    // sends and write continuations refused while flow is off
+    uint64_t inhibited;
+    // acknowledged mode: messages sent again, and received duplicates
+    uint64_t resends;
+    uint64_t duplicates;
+    // partial frames dropped after the frame timeout
+    uint64_t frame_timeouts;
+    // headers of no known type and configs which could not be applied, each
+    // ending in a reset
+    uint64_t bad_frames;
+} xpc_relay_stats_t;
+
+/**
+ * Tracing definitions
+ *
+ * The relay has tracepoints on state machine transitions, IO calls, CRC
+ * computation and dispatch, selected at build time with the meson option
+ * trace (XPC_RELAY_TRACE_USDT or XPC_RELAY_TRACE_RING).  When off, they
+ * compile to nothing.
+ *
+ * With USDT, each tracepoint is a static probe in provider tinyxpc, named
+ * as the event below in lower case without the prefix (e.g. wr_state), with
+ * the relay, a and b as arguments, for use with perf or bpftrace.  With the
+ * ring, events are recorded into caller-provided storage attached with
+ * xpc_relay_config_trace and read back with xpc_relay_trace_read.
+ */
+typedef enum {
+    // a state machine moved from state a to state b (xpc_sm_state_t)
+    XPC_TRACE_WR_STATE = 1,
+    XPC_TRACE_RD_STATE,
+    // an IO wrapper was asked for a bytes and returned b
+    XPC_TRACE_WR_IO,
+    XPC_TRACE_RD_IO,
+    // xpc_relay_feed was given a bytes and consumed b
+    XPC_TRACE_FEED,
+    // b payload bytes went through the CRC, a is 1 if read, 0 if write
+    XPC_TRACE_CRC,
+    // the dispatch callback is called for a message of a bytes, and returned
+    // b
+    XPC_TRACE_DISPATCH_START,
+    XPC_TRACE_DISPATCH_DONE
+} xpc_trace_event_t;
+
+/**
+ * A recorded tracepoint.
+ */
+typedef struct {
+    // value of the trace clock, 0 without one
+    uint32_t time;
+    uint32_t event;
+    int32_t a;
+    int32_t b;
+} xpc_trace_rec_t;
+
 typedef struct {
     // global state for the xpc connection
     xpc_config_t conn_config;
@@ -139,11 +521,20 @@ typedef struct {
     // function pointers for io, message handling, and crc subsystem.
     io_wrap_fn *write;
     io_wrap_fn *read;
+    io_wrapv_fn *writev;
     io_reset_fn *io_reset;
     io_notify_config *io_notify;
     dispatch_fn *dispatch_cb;
     crc_fn *crc;
     crc_polyn_config *crc_config;
+    // incremental crc, used instead of crc when all three are set.
+    crc_init_fn *crc_init;
+    crc_update_fn *crc_update;
+    crc_finalize_fn *crc_finalize;
+    // clock and delivery notification for acknowledged mode, may be NULL.
+    clock_fn *clock;
+    void *clock_ctx;
+    ack_fn *ack_cb;
     // These are signals between the two state machines.
     // the _SEND signals are asserted by the entry point functions, and not
     // by the write state machine.  Signals requiring acknowledgement are
@@ -161,8 +552,13 @@ typedef struct {
         SIG_CONFIG_RECVD = (1 << 2),
         SIG_CONFIG_SEND = (1 << 3),
         SIG_XOFF_RECVD = (1 << 4),
+        // a message requiring acknowledgement was received, the write state
+        // machine owes the remote an ACK.
         SIG_ACK_RECVD = (1 << 5),
-        SIG_NACK_RECVD = (1 << 6)
+        // a message was lost or out of order, the ACK owed is a NACK.
+        SIG_NACK_RECVD = (1 << 6),
+        // the remote has not been told the current receive flow state yet.
+        SIG_FLOW_SEND = (1 << 7)
     } signals;
 
     // internal state for both state machines is identical.
@@ -172,7 +568,160 @@ typedef struct {
         int bytes_complete;
         txpc_hdr_t msg_hdr;
         char *buf;
+        // payload segments of a scattered message, NULL if buf holds it all.
+        const xpc_iovec_t *iov;
+        int iovcnt;
+        // storage location of the CRC for the inflight frame, NULL until
+        // it has been computed.
+        char *crc;
+        // running value and finalized bytes for the incremental crc
+        uint64_t crc_state;
+        char crc_out[8];
+        // sequence number of the inflight message in acknowledged mode.
+        uint8_t seq;
     } inflight_wr_op, inflight_rd_op;
+
+    // span of bytes being parsed by xpc_relay_feed.  buf is NULL outside of
+    // a call, in which case the read state machine pulls through read.
+    struct xpc_span_t {
+        char *buf;
+        size_t len;
+        // bytes consumed so far, and the start of the last frame taken.
+        size_t pos;
+        size_t frame;
+    } rd_span;
+
+    // optional ring of write operations waiting behind the inflight one.
+    // Storage is provided by the caller through xpc_relay_config_tx_queue.
+    struct xpc_txq_t {
+        xpc_tx_desc_t *slots;
+        size_t capacity;
+        size_t head;
+        size_t count;
+    } tx_queue;
+
+    // leased receive payloads, a ring in arrival order.  Storage is provided
+    // by the caller through xpc_relay_config_leases.  taken is set while the
+    // frame being dispatched has been leased.
+    struct xpc_leases_t {
+        xpc_lease_t *slots;
+        size_t capacity;
+        size_t head;
+        size_t count;
+        bool taken;
+    } leases;
+
+    // acknowledged mode state.  The send window is caller-provided storage,
+    // set through xpc_relay_config_ack, and is a ring ordered by sequence.
+    struct xpc_ack_window_t {
+        xpc_ack_slot_t *slots;
+        size_t capacity;
+        size_t head;
+        size_t count;
+        // sequence number for the next new message
+        uint8_t next_seq;
+        // retransmission timeout, in clock units
+        uint32_t rto;
+        // next sequence number expected from the remote, and the bitmap of
+        // received sequence numbers following it (bit 0 is rx_next + 1).
+        uint8_t rx_next;
+        uint32_t rx_sack;
+        // payload of the ACK frame being sent
+        char frame[XPC_ACK_FRAME_SIZE];
+    } ack;
+    // round trip estimate and partial frame timeout, set through
+    // xpc_relay_config_timeouts.  srtt and rttvar are scaled by 8 and 4, and
+    // are valid once measured.  rd_held is the part of a frame last seen
+    // waiting for more bytes, unchanged since rd_since.
+    struct xpc_timers_t {
+        uint32_t rto_min;
+        uint32_t rto_max;
+        uint32_t srtt;
+        uint32_t rttvar;
+        bool measured;
+        uint32_t frame_timeout;
+        size_t rd_held;
+        uint32_t rd_since;
+    } timers;
+    // the stream being sent, if pull is set, and the handler for received
+    // chunks.  trailer holds the offset of the frame being sent, and staged
+    // the end of the end frame in the staging buffer until it is written.
+    struct xpc_stream_tx_t {
+        stream_pull_fn *pull;
+        stream_done_fn *done;
+        void *ctx;
+        uint64_t total;
+        uint64_t offset;
+        size_t chunk_max;
+        uint8_t to;
+        uint8_t from;
+        char trailer[XPC_STREAM_TRAILER];
+        size_t staged;
+    } stream_tx;
+    stream_chunk_fn *stream_cb;
+    // stream offset the next received chunk should have
+    uint32_t stream_rx;
+
+    // logical channels, caller-provided storage set through
+    // xpc_relay_config_channels.  next is where the round robin resumes, and
+    // frag holds the trailer of the fragment being sent.
+    struct xpc_channels_t {
+        xpc_channel_t *slots;
+        size_t count;
+        size_t frag_max;
+        size_t next;
+        char frag[XPC_FRAG_TRAILER];
+    } channels;
+
+    // flow control of what the remote sends us.  xoff is the state wanted,
+    // remote_xoff the one last sent.  With watermarks set (high not 0), xoff
+    // follows the receive depth: outstanding leases plus depth, which is
+    // reported by the application.
+    struct xpc_flow_t {
+        size_t high;
+        size_t low;
+        size_t depth;
+        bool xoff;
+        bool remote_xoff;
+    } flow;
+
+    // staging buffer for coalesced message frames, disabled while buf is
+    // NULL.  Storage is provided by the caller through
+    // xpc_relay_config_coalesce.  Bytes up to fill are staged, and those up
+    // to sent have been written.
+    struct xpc_coalesce_t {
+        char *buf;
+        size_t capacity;
+        size_t fill;
+        size_t sent;
+        clock_fn *clock;
+        void *clock_ctx;
+        // longest a staged byte waits, in clock units, and when the first
+        // byte now staged was.
+        uint32_t deadline;
+        uint32_t since;
+    } coalesce;
+
+#ifdef XPC_RELAY_TRACE_RING
+    // trace records, a ring overwriting the oldest.  Storage is provided by
+    // the caller through xpc_relay_config_trace.
+    struct xpc_trace_ring_t {
+        xpc_trace_rec_t *records;
+        size_t capacity;
+        // records ever emitted
+        uint64_t count;
+        clock_fn *clock;
+        void *clock_ctx;
+    } trace;
+#endif
+#ifdef XPC_RELAY_STATS
+    // counters, guarded by a sequence count which is odd while they are being
+    // updated.
+    struct xpc_stats_block_t {
+        uint32_t seq;
+        xpc_relay_stats_t counters;
+    } stats;
+#endif
 } xpc_relay_state_t;
 
 /**
@@ -204,13 +753,275 @@ xpc_relay_state_t *xpc_relay_config(
     crc_fn *crc, crc_polyn_config *crc_config
 );
 
+/**
+ * Enable vectored writes on a configured relay.  With a vectored wrapper set,
+ * the write state machine submits all remaining segments of a frame in one
+ * call instead of one write per segment.
+ *
+ * @param target relay previously set up with xpc_relay_config.
+ * @param writev the vectored IO wrapper, or NULL to use write only.
+ *
+ * @return target, or NULL on failure.
+ */
+xpc_relay_state_t *xpc_relay_config_writev(
+    xpc_relay_state_t *target, io_wrapv_fn *writev
+);
+
+/**
+ * Use an incremental CRC on a configured relay.  The payload is then only
+ * touched once per direction for CRC purposes, as it is read or written.
+ * crc_fn is no longer called once these are set.
+ *
+ * @param target relay previously set up with xpc_relay_config.
+ * @param init function returning the initial running CRC.
+ * @param update function folding a chunk into the running CRC.
+ * @param finalize function writing the final CRC bytes.
+ *
+ * @return target, or NULL if any function is missing.
+ */
+xpc_relay_state_t *xpc_relay_config_crc_incremental(
+    xpc_relay_state_t *target, crc_init_fn *init, crc_update_fn *update,
+    crc_finalize_fn *finalize
+);
+
+/**
+ * Attach a transmit queue to a configured relay.  While a write operation is
+ * inflight, up to capacity further sends are queued instead of rejected with
+ * TXPC_STATUS_INFLIGHT, and xpc_wr_op_continue writes them back-to-back.
+ *
+ * @param target relay previously set up with xpc_relay_config.
+ * @param slots caller-provided storage for capacity descriptors, or NULL to
+ * disable queueing.
+ * @param capacity number of descriptors at slots.
+ *
+ * @return target, or NULL if operations are still pending on the relay.
+ */
+xpc_relay_state_t *xpc_relay_config_tx_queue(
+    xpc_relay_state_t *target, xpc_tx_desc_t *slots, size_t capacity
+);
+
+/**
+ * Set up acknowledged delivery on a configured relay.  This takes effect while
+ * CONFIG_FLAGS_REQ_ACK is negotiated (see xpc_relay_send_config).  Up to window
+ * messages may be unacknowledged at a time; further sends are queued or
+ * rejected with TXPC_STATUS_INFLIGHT like any other busy condition.
+ *
+ * Messages are resent when the remote NACKs them, or when rto has elapsed
+ * since they were sent.  Timeouts are checked by xpc_wr_op_continue, so it
+ * should also be called periodically while messages are unacknowledged, or
+ * when xpc_relay_next_deadline says.
+ *
+ * @param target relay previously set up with xpc_relay_config.
+ * @param slots caller-provided storage for the send window.
+ * @param window number of slots, at most XPC_ACK_WINDOW_MAX.
+ * @param clock monotonic clock, or NULL to only resend on NACK.
+ * @param clock_ctx context passed to clock.
+ * @param rto retransmission timeout in clock units, the initial one if it
+ * adapts (see xpc_relay_config_timeouts).
+ * @param ack_cb delivery notification, may be NULL.
+ *
+ * @return target, or NULL on failure.
+ */
+xpc_relay_state_t *xpc_relay_config_ack(
+    xpc_relay_state_t *target, xpc_ack_slot_t *slots, size_t window,
+    clock_fn *clock, void *clock_ctx, uint32_t rto, ack_fn *ack_cb
+);
+
+/**
+ * Adapt the retransmission timeout of acknowledged mode to the link, and drop
+ * frames which stop arriving part way through.
+ *
+ * With rto_max set, the ACK for a message sent once gives a round trip
+ * sample, and the timeout becomes the smoothed round trip time plus four
+ * times its mean deviation, starting from the rto given to
+ * xpc_relay_config_ack until the first sample.  Messages sent more than once
+ * give no samples, as their ACK may be for either transmission, and every
+ * timeout doubles the timeout until the next sample.
+ *
+ * With frame_timeout set, a frame which got no further bytes for
+ * frame_timeout after part of it was received is dropped, and the connection
+ * is reset: the rest of it was lost, and the bytes after it cannot be framed.
+ * This is checked by xpc_rd_op_continue, before reading, and by
+ * xpc_relay_feed, which must be presented the partial frame again, so either
+ * must be called periodically while a frame is incomplete.
+ *
+ * @param target relay previously set up with xpc_relay_config.
+ * @param clock monotonic clock.  It replaces the one given to
+ * xpc_relay_config_ack.
+ * @param clock_ctx context passed to clock.
+ * @param rto_min, rto_max bounds of the adaptive timeout in clock units,
+ * rto_max 0 to keep the fixed one.
+ * @param frame_timeout in clock units, 0 to wait forever.
+ *
+ * @return target, or NULL if clock is NULL or rto_min is above rto_max.
+ */
+xpc_relay_state_t *xpc_relay_config_timeouts(
+    xpc_relay_state_t *target, clock_fn *clock, void *clock_ctx,
+    uint32_t rto_min, uint32_t rto_max, uint32_t frame_timeout
+);
+
+/**
+ * Allow dispatched payloads to be held past the dispatch call, see
+ * xpc_relay_lease.
+ *
+ * @param target relay previously set up with xpc_relay_config.
+ * @param slots caller-provided storage for capacity leases, or NULL to disable
+ * leasing.
+ * @param capacity number of leases at slots.
+ *
+ * @return target, or NULL if leases are still outstanding on the relay.
+ */
+xpc_relay_state_t *xpc_relay_config_leases(
+    xpc_relay_state_t *target, xpc_lease_t *slots, size_t capacity
+);
+
+/**
+ * Set the handler for received streams.  Without one, stream frames are
+ * discarded.
+ *
+ * @param target relay previously set up with xpc_relay_config.
+ * @param stream_cb handler for received chunks, called with msg_ctx.
+ *
+ * @return target, or NULL on failure.
+ */
+xpc_relay_state_t *xpc_relay_config_stream(
+    xpc_relay_state_t *target, stream_chunk_fn *stream_cb
+);
+
+/**
+ * Set up a channel.
+ *
+ * @param target pointer to preallocated memory for the channel.
+ * @param priority lower values are sent first.
+ * @param weight share of the link among channels of the same priority, at
+ * least 1.
+ * @param slots caller-provided storage for capacity waiting messages, or NULL
+ * for a channel which is only received on.
+ * @param capacity number of descriptors at slots.
+ * @param rx_buf caller-provided storage for reassembling the largest
+ * fragmented message expected, or NULL for a channel which is only sent on.
+ * @param rx_capacity size of rx_buf.
+ *
+ * @return target, or NULL on bad arguments.
+ */
+xpc_channel_t *xpc_channel_config(
+    xpc_channel_t *target, uint8_t priority, uint8_t weight,
+    xpc_tx_desc_t *slots, size_t capacity, char *rx_buf, size_t rx_capacity
+);
+
+/**
+ * Attach channels to a configured relay.  Messages sent on a channel go out
+ * after those sent with xpc_send_msg and before streams.  Those larger than
+ * frag_max are fragmented, so a channel waits for at most one fragment of a
+ * lower priority channel's message.  Fragments are not acknowledged, so in
+ * acknowledged mode messages are not fragmented: larger ones are refused by
+ * xpc_relay_send_channel, and those queued before acknowledged mode was
+ * turned on are dropped and reported to ack_fn as not delivered.
+ *
+ * @param target relay previously set up with xpc_relay_config.
+ * @param channels caller-provided array of count channels, or NULL to remove
+ * them.  Channel numbers are indexes into it.
+ * @param count number of channels, at most 256.
+ * @param frag_max largest payload per fragment, 1 to 65535.
+ *
+ * @return target, or NULL if messages are still waiting on the current
+ * channels or arguments are bad.
+ */
+xpc_relay_state_t *xpc_relay_config_channels(
+    xpc_relay_state_t *target, xpc_channel_t *channels, size_t count,
+    size_t frag_max
+);
+
+/**
+ * Turn flow control on automatically from the receive depth.  When the
+ * depth reaches high, the relay sends XOFF, and once it is back down to low,
+ * XON.  The depth is the number of outstanding leases plus the depth last
+ * given to xpc_relay_flow_depth, e.g. the length of a queue of messages
+ * copied out by the dispatch callback.
+ *
+ * @param target relay previously set up with xpc_relay_config.
+ * @param high depth at which the remote is told to stop, 0 to disable.
+ * @param low depth at which it is told to resume, below high.
+ *
+ * @return target, or NULL if low is not below high.
+ */
+xpc_relay_state_t *xpc_relay_config_flow(
+    xpc_relay_state_t *target, size_t high, size_t low
+);
+
+/**
+ * Coalesce message frames into a staging buffer, so that runs of small
+ * messages go out in one write instead of a few each.  Message and stream
+ * frames are copied into the buffer as they would be written, and the buffer
+ * is written out when it is full, when xpc_relay_flush is called, or by the
+ * first xpc_wr_op_continue once its oldest byte has waited deadline clock
+ * units.  With a deadline of 0, whatever one xpc_wr_op_continue call staged is
+ * written at the end of it, which batches a queue drained back-to-back.
+ *
+ * Other frames are never held back: the buffer is written out ahead of them.
+ * The deadline is only checked when the relay is called, so with a deadline
+ * the application must call xpc_wr_op_continue periodically while anything is
+ * staged (coalesce.fill is not 0).
+ *
+ * @param target relay previously set up with xpc_relay_config.
+ * @param buf caller-provided staging buffer, or NULL to write frames directly.
+ * @param capacity size of buf.  Frames larger than it are staged in parts.
+ * @param clock monotonic clock, or NULL if deadline is 0.
+ * @param clock_ctx context passed to clock.
+ * @param deadline longest a staged byte waits to be written, in clock units.
+ *
+ * @return target, or NULL if bytes are still staged or arguments are bad.
+ */
+xpc_relay_state_t *xpc_relay_config_coalesce(
+    xpc_relay_state_t *target, char *buf, size_t capacity,
+    clock_fn *clock, void *clock_ctx, uint32_t deadline
+);
+
+/**
+ * Record tracepoints into a ring on a relay built with XPC_RELAY_TRACE_RING.
+ * Once full, each record overwrites the oldest.
+ *
+ * @param target relay previously set up with xpc_relay_config.
+ * @param records caller-provided storage for capacity records, or NULL to stop
+ * recording.
+ * @param capacity number of records, a power of two.
+ * @param clock clock for timestamps, which may be finer than the one used for
+ * acknowledged mode, or NULL.
+ * @param clock_ctx context passed to clock.
+ *
+ * @return target, or NULL if capacity is not a power of two or the relay is
+ * built without the trace ring.
+ */
+xpc_relay_state_t *xpc_relay_config_trace(
+    xpc_relay_state_t *target, xpc_trace_rec_t *records, size_t capacity,
+    clock_fn *clock, void *clock_ctx
+);
+
+/**
+ * Copy trace records out of the ring, oldest first.  Like the rest of the
+ * relay, this must be called from the thread driving the relay.
+ * @param self the relay to read.
+ * @param cursor number of records emitted before the first one wanted, 0 at
+ * first.  It is advanced past the records copied.  If records after it have
+ * been overwritten, copying starts at the oldest one kept, so the cursor moves
+ * further than the number of records copied.
+ * @param out storage for up to max records.
+ * @param max number of records at out.
+ * @return the number of records copied.
+ */
+size_t xpc_relay_trace_read(
+    const xpc_relay_state_t *self, uint64_t *cursor,
+    xpc_trace_rec_t *out, size_t max
+);
+
 /**
  * Reset the connection. This should be called immediately after
  * configuration, before any messages are sent to ensure that buffers are in
  * sync on both ends.  Additionally, it should be sent any time that IO calls
  * become desynchronized or bytes are lost.
  * @param self the relay which should issue a new reset.
- * @return TXPC_STATUS_DONE when ready to send, TXPC_STATUS_INFLIGHT if not.
+ * @return TXPC_STATUS_DONE when ready to send or queued, TXPC_STATUS_INFLIGHT
+ * if not.
  */
 xpc_status_t xpc_relay_send_reset(xpc_relay_state_t *self);
 
@@ -221,7 +1032,10 @@ xpc_status_t xpc_relay_send_reset(xpc_relay_state_t *self);
  * @param crc_polyn pointer to the CRC polynomial.
  * @param msg_sync_ack whether or not to force synchronous acknowledgement on
  * messages (does not apply to configuration messages or streams)
- * @return TXPC_STATUS_DONE when ready to send, TXPC_STATUS_INFLIGHT if not.
+ * @return TXPC_STATUS_DONE when ready to send or queued, TXPC_STATUS_INFLIGHT
+ * if not, TXPC_STATUS_BAD_STATE for a width other than XPC_BIND_CRC_BITS in a
+ * relay built with one, or a width over 64 bits while a message sent with
+ * xpc_send_msgv may still be written.
  */
 xpc_status_t xpc_relay_send_config(
     xpc_relay_state_t *self,
@@ -234,11 +1048,37 @@ xpc_status_t xpc_relay_send_config(
  * receipt of this message from being sent by the remote, but does not cancel
  * any inflight messages. Sending an XON message allows flow to resume. Whether
  * inflight message are re-transmitted is not specified.
+ *
+ * Flow control frames go out ahead of anything queued, as soon as the frame
+ * being written is done, and only the latest state is sent.  While the remote
+ * has sent XOFF, messages are queued if there is room, or rejected with
+ * TXPC_STATUS_INHIBIT, but resets, configuration, ACKs and flow control still
+ * go out.  A connection reset turns flow back on in both directions.
  * @param self the relay which should issue the message
  * @param xon 1 to enable flow, 0 to disable.
+ * @return TXPC_STATUS_DONE, or TXPC_STATUS_BAD_STATE if self is NULL.
  */
 xpc_status_t xpc_relay_set_flow(xpc_relay_state_t *self, bool xon);
 
+/**
+ * Report the application's receive queue depth, for the watermarks set with
+ * xpc_relay_config_flow.
+ * @param self the relay receiving the messages
+ * @param depth number of received messages waiting in the application.
+ * @return TXPC_STATUS_DONE, or TXPC_STATUS_BAD_STATE if self is NULL.
+ */
+xpc_status_t xpc_relay_flow_depth(xpc_relay_state_t *self, size_t depth);
+
+/**
+ * Write out everything staged by a coalescing relay, including as much of the
+ * inflight frame as is ready, without waiting for the deadline.
+ * @param self the coalescing relay.
+ * @return TXPC_STATUS_DONE once nothing is left staged, TXPC_STATUS_INFLIGHT
+ * if the link took only part of it (write notifications are turned on for
+ * the rest), or TXPC_STATUS_BAD_STATE if the relay does not coalesce.
+ */
+xpc_status_t xpc_relay_flush(xpc_relay_state_t *self);
+
 /**
  * Send a new message with optional payload to the remote endpoint.
  * @param self the relay which should send the message
@@ -246,11 +1086,91 @@ xpc_status_t xpc_relay_set_flow(xpc_relay_state_t *self, bool xon);
  * @param from the "from" message field value
  * @param data buffer to contiguous memory containing message payload
  * @param bytes the number of bytes of payload, < 65536
- * @return TXPC_STATUS_DONE when message is being sent, TXPC_STATUS_INFLIGHT
- * if the relay is busy.
+ * @return TXPC_STATUS_DONE when message is being sent or queued,
+ * TXPC_STATUS_INFLIGHT if the relay is busy and the transmit queue is full.
  */
 xpc_status_t xpc_send_msg(xpc_relay_state_t *self, uint8_t to, uint8_t from, char *data, size_t bytes);
 
+/**
+ * Send a new message whose payload is scattered over several buffers, e.g.
+ * an application header, a body and a trailer, without copying them together
+ * first.  The segments are written in order and the CRC is computed across
+ * them, so the remote receives the same frame as from xpc_send_msg.  Both the
+ * segments and the iov array must stay valid until sent (or acknowledged, in
+ * acknowledged mode), where ack_fn is given the first segment as payload.
+ *
+ * In a relay with a CRC function, a payload of more than one segment needs
+ * the incremental CRC interface (xpc_relay_config_crc_incremental), since
+ * crc_fn only takes contiguous memory, and a CRC of at most 64 bits; this
+ * holds whether or not CRCs are on yet.  While such a message may still be
+ * written, configs for wider CRCs are refused, sent or received.
+ * @param self the relay which should send the message
+ * @param to the "to" message field value
+ * @param from the "from" message field value
+ * @param iov the payload segments, in order.  Empty segments are allowed.
+ * @param iovcnt the number of segments, at most XPC_MSG_MAX_IOV
+ * @return as xpc_send_msg, or TXPC_STATUS_BAD_STATE if there are too many
+ * segments, the payload is 65536 bytes or more, or its CRC cannot be computed.
+ */
+xpc_status_t xpc_send_msgv(
+    xpc_relay_state_t *self, uint8_t to, uint8_t from,
+    const xpc_iovec_t *iov, int iovcnt
+);
+
+/**
+ * Send a message on a channel.  It is queued behind the channel's earlier
+ * messages and goes out as the channel's priority and weight allow, whole if
+ * it fits one fragment, otherwise fragmented.  The payload must stay valid
+ * until sent.
+ * @param self the relay which should send the message
+ * @param channel the channel number
+ * @param to the "to" message field value
+ * @param from the "from" message field value
+ * @param data buffer to contiguous memory containing message payload
+ * @param bytes the number of bytes of payload, < 65536
+ * @return TXPC_STATUS_DONE when queued, TXPC_STATUS_INFLIGHT if the channel's
+ * queue is full, TXPC_STATUS_INHIBIT if it is full while flow is off, or
+ * TXPC_STATUS_BAD_STATE for a channel which does not exist or cannot send, a
+ * payload of 65536 bytes or more, or one larger than the fragment size in
+ * acknowledged mode.
+ */
+xpc_status_t xpc_relay_send_channel(
+    xpc_relay_state_t *self, uint8_t channel, uint8_t to, uint8_t from,
+    char *data, size_t bytes
+);
+
+/**
+ * Send a stream of total bytes, pulled from a producer in chunks of up to
+ * chunk_max bytes as the link can take them.  Stream frames go out after
+ * control frames, queued messages and channel messages, so messages can still
+ * be sent while a stream is in progress.  Like messages, they are held back
+ * while the remote has sent XOFF.  One stream is sent at a time.
+ * @param self the relay which should send the stream
+ * @param to the "to" field value of every frame
+ * @param from the "from" field value of every frame
+ * @param total number of bytes in the stream
+ * @param chunk_max largest payload per frame, 1 to 65535
+ * @param pull producer of the stream's bytes
+ * @param done called when the stream has been sent or abandoned, may be NULL
+ * @param stream_ctx context passed to pull and done
+ * @return TXPC_STATUS_DONE when the stream is started, TXPC_STATUS_INFLIGHT if
+ * another stream is being sent, TXPC_STATUS_BAD_STATE on bad arguments.
+ */
+xpc_status_t xpc_relay_send_stream(
+    xpc_relay_state_t *self, uint8_t to, uint8_t from, uint64_t total,
+    size_t chunk_max, stream_pull_fn *pull, stream_done_fn *done,
+    void *stream_ctx
+);
+
+/**
+ * Tell the relay that the producer of the stream being sent has bytes ready
+ * again, after its pull returned 0.  Write notifications are turned back on,
+ * since the relay may have turned them off while it had nothing to write.
+ * @param self the relay sending the stream
+ * @return TXPC_STATUS_DONE, TXPC_STATUS_BAD_STATE if no stream is being sent.
+ */
+xpc_status_t xpc_relay_stream_ready(xpc_relay_state_t *self);
+
 /**
  * Attempt to continue the currently inflight write operation.  State changes
  * are also enacted by this function for any write-related state transitions.
@@ -270,3 +1190,86 @@ xpc_status_t xpc_wr_op_continue(xpc_relay_state_t *self);
  * @return txpc_status_t
  */
 xpc_status_t xpc_rd_op_continue(xpc_relay_state_t *self);
+
+/**
+ * Parse frames from a span of received bytes, as an alternative to pulling
+ * them through the read wrapper with xpc_rd_op_continue.  Every complete frame
+ * in the span is handled in order, and messages are dispatched with a payload
+ * pointer into buf, so no copy is made.
+ *
+ * Frames are only consumed whole.  A partial frame at the end of the span is
+ * left in place, as is a message the dispatch callback declined.  The caller
+ * should keep the unconsumed tail and present it again, followed by newly
+ * received bytes, on the next call.  A relay should be driven by either this
+ * function or xpc_rd_op_continue, not both.
+ * @param self the relay which received the bytes
+ * @param buf pointer to the received bytes
+ * @param len the number of bytes at buf
+ * @return the number of bytes consumed from the start of buf.
+ */
+size_t xpc_relay_feed(xpc_relay_state_t *self, char *buf, size_t len);
+
+/**
+ * When the relay next needs calling for one of its timers to be checked: the
+ * retransmission timeout of an unacknowledged message, the coalescing
+ * deadline or the partial frame timeout.  All clocks given to the relay must
+ * be the same for this to be meaningful.
+ * @param self the relay to check
+ * @param at set to the earliest deadline, in clock units, if there is one
+ * @return true if a timer is pending.
+ */
+bool xpc_relay_next_deadline(xpc_relay_state_t *self, uint32_t *at);
+
+/**
+ * The number of bytes which follow a header on the wire, given the current
+ * connection parameters: the payload, and any sequence number and CRC.
+ * Transports which delimit frames themselves can use this to check that a
+ * frame is whole before feeding it.
+ * @param self the relay the frame is for
+ * @param hdr the frame header
+ * @return the frame length past the header.
+ */
+size_t xpc_relay_frame_bytes(xpc_relay_state_t *self, txpc_hdr_t *hdr);
+
+/**
+ * Keep the payload of the message being dispatched.  Only valid from within
+ * the dispatch callback, which should then return true: the relay moves on to
+ * the next frame without discarding the payload from the read buffer, so it
+ * can be processed later, e.g. by a worker thread, without a copy.
+ *
+ * The read buffer is reclaimed in arrival order as leases are released, so
+ * the IO subsystem must treat it as a FIFO (see io_reset_fn).  With a pulling
+ * read wrapper, the payload is whatever was read into the IO subsystem's
+ * buffer; with xpc_relay_feed, it points into the fed bytes, which must then
+ * be kept until they are discarded through io_reset.
+ * @param self the relay dispatching the message
+ * @return the lease, or NULL if leasing is not set up, all leases are taken,
+ * no message is being dispatched or the message was reassembled from
+ * fragments (its payload is in the channel's receive buffer).
+ */
+xpc_lease_t *xpc_relay_lease(xpc_relay_state_t *self);
+
+/**
+ * Give a leased payload back.  Once it and all leases older than it are
+ * released, their read buffer bytes are discarded through io_reset.  Like the
+ * rest of the relay, this must be called from the thread driving the relay;
+ * a worker done with a payload should hand the lease back to that thread.
+ * @param self the relay the lease was taken from
+ * @param lease the lease returned by xpc_relay_lease
+ * @return TXPC_STATUS_DONE, or TXPC_STATUS_BAD_STATE if lease is not
+ * outstanding on self.
+ */
+xpc_status_t xpc_relay_release(xpc_relay_state_t *self, xpc_lease_t *lease);
+
+/**
+ * Take a consistent copy of a relay's counters.  This may be called from any
+ * thread while another drives the relay: it never blocks the relay, and
+ * retries until it has read the counters between two updates.
+ * @param self the relay to read.
+ * @param out storage for the copy.
+ * @return TXPC_STATUS_DONE, or TXPC_STATUS_BAD_STATE if the relay was built
+ * without XPC_RELAY_STATS, in which case out is left unchanged.
+ */
+xpc_status_t xpc_relay_stats_snapshot(
+    const xpc_relay_state_t *self, xpc_relay_stats_t *out
+);
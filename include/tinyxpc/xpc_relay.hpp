@@ -0,0 +1,330 @@
+#pragma once
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+extern "C" {
+#include <tinyxpc/tinyxpc.h>
+#include <tinyxpc/xpc_relay.h>
+}
+/**
+ * C++ layer over the XPC Relay (C++20, header only).
+ *
+ * tinyxpc::Relay<Transport, Crc, Handler> owns a relay together with the
+ * objects it calls, and hands the C core one static trampoline per call, each
+ * instantiated for the types given.  The member functions the trampolines
+ * call are known at compile time and inline into them, so there are no
+ * per-project trampolines, no virtual calls and no allocation; the one
+ * indirect call per operation is the C core's own.
+ *
+ * Transport members, mirroring the IO functions in xpc_relay.h (the ones
+ * marked optional are detected, and left out or made no-ops when missing):
+ *
+ *   int write(std::span<const char> bytes)             bytes taken
+ *   int writev(std::span<xpc_iovec_t> iov)             optional
+ *   int read(char *&buffer, int offset, std::size_t bytes_max)
+ *                                                      optional, see io_wrap_fn;
+ *                                                      without it, feed()
+ *   void reset(int which, std::size_t bytes)           optional, io_reset_fn
+ *   void notify(int which, bool enable)                optional, io_notify_config
+ *
+ * Crc members, all optional (tinyxpc::NoCrc has none):
+ *
+ *   char *compute(std::span<const char> bytes)         crc_fn
+ *   void configure(int crc_bits, const char *polyn)    crc_polyn_config
+ *   std::uint64_t init()                               the incremental CRC,
+ *   std::uint64_t update(std::uint64_t crc, std::span<const char> bytes)
+ *   void finalize(std::uint64_t crc, char *out)        used if all three exist
+ *
+ * Handler:
+ *
+ *   bool operator()(tinyxpc::Message &&msg)            dispatch_fn
+ */
+
+namespace tinyxpc {
+
+/**
+ * A received message.  It refers to the payload in the receive buffer, which
+ * is only valid during the dispatch call, unless keep() leases it: the handle
+ * then keeps the payload until it is destroyed, and can be moved out of the
+ * handler, e.g. into a queue processed later.  Like the relay, a kept message
+ * must be destroyed on the thread driving the relay.
+ */
+class Message {
+public:
+    Message(xpc_relay_state_t *relay, const txpc_hdr_t &hdr, char *payload)
+        : relay_(relay), hdr_(hdr), payload_(payload) {}
+    Message(const Message &) = delete;
+    Message &operator=(const Message &) = delete;
+    Message(Message &&other) noexcept
+        : relay_(other.relay_), hdr_(other.hdr_), payload_(other.payload_),
+          lease_(std::exchange(other.lease_, nullptr)) {
+        other.payload_ = nullptr;
+    }
+    Message &operator=(Message &&other) noexcept {
+        if(this != &other) {
+            release();
+            relay_ = other.relay_;
+            hdr_ = other.hdr_;
+            payload_ = std::exchange(other.payload_, nullptr);
+            lease_ = std::exchange(other.lease_, nullptr);
+        }
+        return *this;
+    }
+    ~Message() {
+        release();
+    }
+
+    /**
+     * Keep the payload past the dispatch call (see xpc_relay_lease).  Only
+     * valid from within the handler, which should then return true.
+     * @return true if the payload is kept, false if it could not be leased.
+     */
+    bool keep() {
+        if(lease_ == nullptr && payload_ != nullptr) {
+            lease_ = xpc_relay_lease(relay_);
+        }
+        return lease_ != nullptr;
+    }
+
+    bool kept() const {
+        return lease_ != nullptr;
+    }
+
+    const txpc_hdr_t &header() const {
+        return hdr_;
+    }
+
+    std::uint8_t to() const {
+        return hdr_.to;
+    }
+
+    std::uint8_t from() const {
+        return hdr_.from;
+    }
+
+    std::span<char> payload() const {
+        return {payload_, payload_ != nullptr ? hdr_.size:0u};
+    }
+
+    std::string_view text() const {
+        return {payload_, payload_ != nullptr ? hdr_.size:0u};
+    }
+
+private:
+    void release() {
+        if(lease_ != nullptr) {
+            xpc_relay_release(relay_, lease_);
+            lease_ = nullptr;
+        }
+    }
+
+    xpc_relay_state_t *relay_;
+    txpc_hdr_t hdr_;
+    char *payload_;
+    xpc_lease_t *lease_ = nullptr;
+};
+
+// a Crc for relays which never turn CRCs on
+struct NoCrc {};
+
+template<typename Transport, typename Crc, typename Handler>
+class Relay {
+public:
+    /**
+     * Set up a relay as xpc_relay_config does.  The relay keeps pointers to
+     * itself in the C core, so it cannot be copied or moved.
+     */
+    explicit Relay(Transport transport = {}, Crc crc = {}, Handler handler = {})
+        : transport_(std::move(transport)), crc_(std::move(crc)),
+          handler_(std::move(handler)) {
+        xpc_relay_config(
+            &state_, this, this, &crc_,
+            write_fn, has_read ? read_fn:nullptr, reset_fn, notify_fn,
+            dispatch_fn, has_crc ? crc_fn:nullptr, crc_config_fn
+        );
+        if constexpr(has_writev) {
+            xpc_relay_config_writev(&state_, writev_fn);
+        }
+        if constexpr(has_crc_incremental) {
+            xpc_relay_config_crc_incremental(
+                &state_, crc_init_fn, crc_update_fn, crc_finalize_fn
+            );
+        }
+    }
+    Relay(const Relay &) = delete;
+    Relay &operator=(const Relay &) = delete;
+
+    /**
+     * The C relay, for everything this layer does not wrap: queues, windows,
+     * leases, channels and the rest of the xpc_relay_config_* calls.
+     */
+    xpc_relay_state_t *get() {
+        return &state_;
+    }
+
+    Transport &transport() {
+        return transport_;
+    }
+
+    Crc &crc() {
+        return crc_;
+    }
+
+    Handler &handler() {
+        return handler_;
+    }
+
+    xpc_status_t send_reset() {
+        return xpc_relay_send_reset(&state_);
+    }
+
+    // the polynomial has XPC_CRC_BYTES(crc_bits) bytes, as for
+    // xpc_relay_send_config, and must stay valid until sent.
+    xpc_status_t send_config(int crc_bits, std::span<const char> polyn, bool msg_sync_ack) {
+        if(polyn.size() < (std::size_t)XPC_CRC_BYTES(crc_bits)) {
+            return TXPC_STATUS_BAD_STATE;
+        }
+        return xpc_relay_send_config(
+            &state_, crc_bits, const_cast<char*>(polyn.data()), msg_sync_ack
+        );
+    }
+
+    /**
+     * Send a message, as xpc_send_msg: the payload is not copied, and must
+     * stay valid until it is written (or acknowledged, in acknowledged mode).
+     */
+    xpc_status_t send(std::uint8_t to, std::uint8_t from, std::span<const char> payload) {
+        // the relay only reads outgoing payloads
+        return xpc_send_msg(
+            &state_, to, from, const_cast<char*>(payload.data()), payload.size()
+        );
+    }
+
+    // text, e.g. a std::string or a string literal (without its terminator)
+    template<typename T>
+        requires std::convertible_to<const T&, std::string_view>
+    xpc_status_t send(std::uint8_t to, std::uint8_t from, const T &payload) {
+        std::string_view text = payload;
+        return send(to, from, std::span<const char>(text.data(), text.size()));
+    }
+
+    // a temporary string is gone before the relay writes it
+    template<typename T>
+        requires (!std::is_lvalue_reference_v<T>) && std::ranges::range<T>
+            && (!std::ranges::borrowed_range<T>)
+            && std::convertible_to<const T&, std::string_view>
+    xpc_status_t send(std::uint8_t to, std::uint8_t from, T &&payload) = delete;
+
+    xpc_status_t write() {
+        return xpc_wr_op_continue(&state_);
+    }
+
+    xpc_status_t read() {
+        return xpc_rd_op_continue(&state_);
+    }
+
+    std::size_t feed(std::span<char> bytes) {
+        return xpc_relay_feed(&state_, bytes.data(), bytes.size());
+    }
+
+private:
+    static constexpr bool has_read = requires(Transport &t, char *&buf) {
+        { t.read(buf, 0, std::size_t{}) } -> std::convertible_to<int>;
+    };
+    static constexpr bool has_writev = requires(Transport &t, std::span<xpc_iovec_t> iov) {
+        { t.writev(iov) } -> std::convertible_to<int>;
+    };
+    static constexpr bool has_crc = requires(Crc &c, std::span<const char> bytes) {
+        { c.compute(bytes) } -> std::convertible_to<char*>;
+    };
+    static constexpr bool has_crc_incremental = requires(
+            Crc &c, std::uint64_t crc, std::span<const char> bytes, char *out) {
+        { c.init() } -> std::convertible_to<std::uint64_t>;
+        { c.update(crc, bytes) } -> std::convertible_to<std::uint64_t>;
+        c.finalize(crc, out);
+    };
+
+    // ========= TRAMPOLINES =========
+    static int write_fn(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+        Relay *self = static_cast<Relay*>(io_ctx);
+        return self->transport_.write(
+            std::span<const char>(*buffer + offset, bytes_max)
+        );
+    }
+
+    static int writev_fn(void *io_ctx, xpc_iovec_t *iov, int iovcnt) {
+        Relay *self = static_cast<Relay*>(io_ctx);
+        return self->transport_.writev(std::span<xpc_iovec_t>(iov, iovcnt));
+    }
+
+    static int read_fn(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+        Relay *self = static_cast<Relay*>(io_ctx);
+        if constexpr(has_read) {
+            return self->transport_.read(*buffer, offset, bytes_max);
+        }
+        return 0;
+    }
+
+    static void reset_fn(void *io_ctx, int which, size_t bytes) {
+        Relay *self = static_cast<Relay*>(io_ctx);
+        if constexpr(requires { self->transport_.reset(which, bytes); }) {
+            self->transport_.reset(which, bytes);
+        }
+    }
+
+    static void notify_fn(void *io_ctx, int which, bool enable) {
+        Relay *self = static_cast<Relay*>(io_ctx);
+        if constexpr(requires { self->transport_.notify(which, enable); }) {
+            self->transport_.notify(which, enable);
+        }
+    }
+
+    static bool dispatch_fn(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload) {
+        Relay *self = static_cast<Relay*>(msg_ctx);
+        return self->handler_(Message(&self->state_, *msg_hdr, payload));
+    }
+
+    static char *crc_fn(void *crc_ctx, char *buf, size_t bytes) {
+        if constexpr(has_crc) {
+            return static_cast<Crc*>(crc_ctx)->compute(
+                std::span<const char>(buf, bytes)
+            );
+        }
+        return nullptr;
+    }
+
+    static void crc_config_fn(void *crc_ctx, int crc_bits, char *polyn) {
+        Crc *crc = static_cast<Crc*>(crc_ctx);
+        if constexpr(requires { crc->configure(crc_bits, polyn); }) {
+            crc->configure(crc_bits, polyn);
+        }
+    }
+
+    static std::uint64_t crc_init_fn(void *crc_ctx) {
+        return static_cast<Crc*>(crc_ctx)->init();
+    }
+
+    static std::uint64_t crc_update_fn(void *crc_ctx, std::uint64_t crc, char *buf, size_t bytes) {
+        return static_cast<Crc*>(crc_ctx)->update(
+            crc, std::span<const char>(buf, bytes)
+        );
+    }
+
+    static void crc_finalize_fn(void *crc_ctx, std::uint64_t crc, char *out) {
+        static_cast<Crc*>(crc_ctx)->finalize(crc, out);
+    }
+    // ========= END TRAMPOLINES =========
+
+    // first, so that messages the handler keeps are released before it goes
+    xpc_relay_state_t state_;
+    Transport transport_;
+    Crc crc_;
+    Handler handler_;
+};
+
+} // namespace tinyxpc
@@ -0,0 +1,559 @@
+#pragma once
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <tinyxpc/xpc_relay.hpp>
+/**
+ * Coroutines over the C++ relay layer (C++20, header only).
+ *
+ * tinyxpc::AsyncRelay<Transport, Crc> turns relay operations into awaitables:
+ *
+ *   co_await relay.reset()                  once the remote has answered
+ *   co_await relay.send(to, from, payload)  once the relay has taken it
+ *   tinyxpc::Message msg = co_await relay.receive()
+ *
+ * and a tinyxpc::Executor runs tinyxpc::Task coroutines together with the
+ * relays they use, all on one thread.  Each pass of the executor resumes the
+ * coroutines which became ready, then services every relay: its write side
+ * while the relay has write notifications enabled (io_notify) or a send is
+ * waiting for room, and its read side, after which waiting sends and resets
+ * are retried or completed.  Any number of operations may be outstanding,
+ * each waiting in order in its own queue; the awaiters live in the coroutine
+ * frames, so only the frames themselves are allocated.
+ *
+ * Received messages are kept as they arrive (see Message::keep), from leases
+ * the AsyncRelay provides, and handed to a waiting receive or held in an
+ * inbox until one comes, so the relay keeps reading, e.g. the answer to a
+ * reset, while nothing is received.  Only once Leases messages are held, in
+ * the inbox or by receivers, does the handler decline the next one, which
+ * the relay presents again on a later pass.  Messages reassembled from
+ * channel fragments cannot be leased: they are dropped, and counted by
+ * AsyncRelay::dropped().
+ *
+ * The transport's reads and writes must not block (return 0 when nothing
+ * can be moved).  A pass which neither resumes a coroutine nor moves a byte
+ * leaves the executor idle: run() then calls the wait hook, which blocks
+ * until a transport is ready, e.g. in poll(), or returns without one.  A
+ * payload given to send must stay valid until written, as for xpc_send_msg.
+ */
+
+namespace tinyxpc {
+
+class Executor;
+
+namespace detail {
+
+// a suspended coroutine, linked into one list at a time
+struct Waiter {
+    std::coroutine_handle<> handle;
+    Waiter *next = nullptr;
+};
+
+// a FIFO of waiters, linked through them
+struct WaitList {
+    Waiter *head = nullptr;
+    Waiter *tail = nullptr;
+
+    bool empty() const {
+        return head == nullptr;
+    }
+
+    void push(Waiter *waiter) {
+        waiter->next = nullptr;
+        if(tail != nullptr) {
+            tail->next = waiter;
+        }
+        else {
+            head = waiter;
+        }
+        tail = waiter;
+    }
+
+    Waiter *pop() {
+        Waiter *waiter = head;
+        if(waiter != nullptr) {
+            head = waiter->next;
+            if(head == nullptr) {
+                tail = nullptr;
+            }
+        }
+        return waiter;
+    }
+};
+
+struct AsyncCore;
+
+} // namespace detail
+
+/**
+ * A coroutine run by an Executor.  It starts once spawned, and its frame is
+ * freed when it returns.
+ */
+class Task {
+public:
+    struct promise_type {
+        Executor *executor = nullptr;
+        detail::Waiter start;
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {
+        }
+        void unhandled_exception() {
+            std::terminate();
+        }
+        ~promise_type();
+    };
+
+    Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() {
+        // never spawned
+        if(handle_) {
+            handle_.destroy();
+        }
+    }
+
+private:
+    friend class Executor;
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+    std::coroutine_handle<promise_type> handle_;
+};
+
+class Executor {
+public:
+    Executor() = default;
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    // start a task on the next pass
+    void spawn(Task task) {
+        auto handle = std::exchange(task.handle_, {});
+        handle.promise().executor = this;
+        handle.promise().start.handle = handle;
+        tasks_++;
+        ready(&handle.promise().start);
+    }
+
+    /**
+     * One pass: resume the coroutines which are ready, then service the
+     * relays.  For driving the executor from another event loop.
+     * @return true if a coroutine was resumed or made ready, or a relay's
+     * transport moved bytes; false if the executor is idle.
+     */
+    bool run_once();
+
+    /**
+     * Set what run() does when idle: wait(ctx) should block until a
+     * transport may be able to move bytes again, or a relay timer falls due
+     * (see xpc_relay_next_deadline), then return.  NULL, the default, makes
+     * run() return instead.
+     */
+    void set_wait(void (*wait)(void *ctx), void *ctx) {
+        wait_ = wait;
+        wait_ctx_ = ctx;
+    }
+
+    /**
+     * Run passes until every spawned task has returned, calling the wait
+     * hook whenever the executor is idle.  Without a hook, it returns once
+     * idle with tasks left, to be called again when a transport is ready.
+     */
+    void run() {
+        while(tasks_ > 0) {
+            if(!run_once()) {
+                if(wait_ == nullptr) {
+                    break;
+                }
+                wait_(wait_ctx_);
+            }
+        }
+    }
+
+    // tasks spawned and not returned yet
+    std::size_t tasks() const {
+        return tasks_;
+    }
+
+private:
+    friend struct detail::AsyncCore;
+    friend struct Task::promise_type;
+
+    void ready(detail::Waiter *waiter) {
+        ready_.push(waiter);
+    }
+
+    detail::WaitList ready_;
+    detail::AsyncCore *relays_ = nullptr;
+    std::size_t tasks_ = 0;
+    void (*wait_)(void *ctx) = nullptr;
+    void *wait_ctx_ = nullptr;
+};
+
+inline Task::promise_type::~promise_type() {
+    if(executor != nullptr) {
+        executor->tasks_--;
+    }
+}
+
+namespace detail {
+
+/**
+ * The part of an AsyncRelay which does not depend on its types: the relay,
+ * its waiting operations, and its place in the executor.
+ */
+struct AsyncCore {
+    Executor &executor;
+    xpc_relay_state_t *state = nullptr;
+    AsyncCore *next = nullptr;
+    // set while the relay has write notifications enabled
+    bool want_write = false;
+    // set when the transport moves bytes
+    bool moved = false;
+    WaitList senders;
+    WaitList receivers;
+    WaitList resets;
+    // received messages no receive was waiting for, oldest first
+    std::span<std::optional<Message>> inbox;
+    std::size_t inbox_head = 0;
+    std::size_t inbox_count = 0;
+    // reassembled messages, which could not be received
+    std::size_t dropped = 0;
+
+    explicit AsyncCore(Executor &executor) : executor(executor) {}
+
+    void attach(xpc_relay_state_t *relay) {
+        state = relay;
+        next = executor.relays_;
+        executor.relays_ = this;
+    }
+
+    void detach() {
+        for(AsyncCore **at = &executor.relays_; *at != nullptr; at = &(*at)->next) {
+            if(*at == this) {
+                *at = next;
+                break;
+            }
+        }
+    }
+
+    bool deliver(Message &&msg);
+    bool take(std::optional<Message> &message);
+    bool service();
+};
+
+// the relay took the message, or turned it away for good
+inline bool send_final(xpc_status_t status) {
+    return status != TXPC_STATUS_INFLIGHT && status != TXPC_STATUS_INHIBIT;
+}
+
+struct SendOp : Waiter {
+    AsyncCore *core;
+    std::uint8_t to;
+    std::uint8_t from;
+    std::span<const char> payload;
+    xpc_status_t status = TXPC_STATUS_INFLIGHT;
+
+    bool attempt() {
+        // the relay only reads outgoing payloads
+        status = xpc_send_msg(
+            core->state, to, from, const_cast<char*>(payload.data()),
+            payload.size()
+        );
+        return send_final(status);
+    }
+
+    bool await_ready() {
+        // behind the sends already waiting
+        return core->senders.empty() && attempt();
+    }
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        handle = awaiting;
+        core->senders.push(this);
+    }
+    xpc_status_t await_resume() {
+        return status;
+    }
+};
+
+struct ReceiveOp : Waiter {
+    AsyncCore *core;
+    std::optional<Message> message;
+
+    bool await_ready() {
+        // receives only wait while the inbox is empty
+        return core->receivers.empty() && core->take(message);
+    }
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        handle = awaiting;
+        core->receivers.push(this);
+    }
+    Message await_resume() {
+        return std::move(*message);
+    }
+};
+
+struct ResetOp : Waiter {
+    AsyncCore *core;
+    xpc_status_t status = TXPC_STATUS_INFLIGHT;
+    // whether the reset has been seen going out
+    bool started = false;
+
+    bool attempt() {
+        if(!send_final(status)) {
+            status = xpc_relay_send_reset(core->state);
+        }
+        return status == TXPC_STATUS_DONE;
+    }
+
+    /**
+     * Whether the reset is over: seen going out, and answered since.
+     */
+    bool answered() {
+        if(!attempt()) {
+            return send_final(status);
+        }
+        bool sending = core->state->signals & xpc_relay_state_t::SIG_RST_SEND;
+        if(!started) {
+            started = sending;
+            return false;
+        }
+        return !sending;
+    }
+
+    bool await_ready() {
+        return core->resets.empty() && attempt() && answered();
+    }
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        handle = awaiting;
+        core->resets.push(this);
+    }
+    xpc_status_t await_resume() {
+        return status;
+    }
+};
+
+inline bool AsyncCore::deliver(Message &&msg) {
+    if(state->inflight_rd_op.msg_hdr.type == TXPC_MSG_TYPE_FRAG) {
+        // the reassembly buffer is reused, it is never leased: declining
+        // would only present the message again
+        dropped++;
+        return true;
+    }
+    if(inbox_count == inbox.size() || !msg.keep()) {
+        // declined, presented again on a later pass
+        return false;
+    }
+    if(!receivers.empty()) {
+        ReceiveOp *op = static_cast<ReceiveOp*>(receivers.pop());
+        op->message.emplace(std::move(msg));
+        executor.ready(op);
+    }
+    else {
+        inbox[(inbox_head + inbox_count) % inbox.size()].emplace(std::move(msg));
+        inbox_count++;
+    }
+    return true;
+}
+
+inline bool AsyncCore::take(std::optional<Message> &message) {
+    if(inbox_count == 0) {
+        return false;
+    }
+    message = std::move(inbox[inbox_head]);
+    inbox[inbox_head].reset();
+    inbox_head = (inbox_head + 1) % inbox.size();
+    inbox_count--;
+    return true;
+}
+
+inline bool AsyncCore::service() {
+    moved = false;
+    if(want_write || !senders.empty() || !resets.empty()) {
+        xpc_wr_op_continue(state);
+    }
+    while(!resets.empty() && static_cast<ResetOp*>(resets.head)->answered()) {
+        executor.ready(resets.pop());
+    }
+    // also handles control frames, e.g. a reset from the remote
+    xpc_rd_op_continue(state);
+    while(!resets.empty() && static_cast<ResetOp*>(resets.head)->answered()) {
+        executor.ready(resets.pop());
+    }
+    while(!senders.empty() && static_cast<SendOp*>(senders.head)->attempt()) {
+        executor.ready(senders.pop());
+    }
+    return moved;
+}
+
+} // namespace detail
+
+inline bool Executor::run_once() {
+    bool progress = !ready_.empty();
+    // coroutines made ready from here on wait for the next pass
+    detail::WaitList now = std::exchange(ready_, detail::WaitList{});
+    while(detail::Waiter *waiter = now.pop()) {
+        // popped first: a returning task frees the waiter with its frame
+        waiter->handle.resume();
+    }
+    for(detail::AsyncCore *core = relays_; core != nullptr; core = core->next) {
+        progress |= core->service();
+    }
+    return progress || !ready_.empty();
+}
+
+template<typename Transport, typename Crc = NoCrc, std::size_t Leases = 8>
+class AsyncRelay {
+    /**
+     * The transport, with write notifications and the bytes it moves
+     * tracked for the executor.
+     */
+    struct Link : Transport {
+        detail::AsyncCore *core;
+
+        int write(std::span<const char> bytes) {
+            return track(Transport::write(bytes));
+        }
+
+        int writev(std::span<xpc_iovec_t> iov)
+            requires requires(Transport &t) { t.writev(iov); } {
+            return track(Transport::writev(iov));
+        }
+
+        int read(char *&buffer, int offset, std::size_t bytes_max)
+            requires requires(Transport &t) { t.read(buffer, offset, bytes_max); } {
+            return track(Transport::read(buffer, offset, bytes_max));
+        }
+
+        int track(int bytes) {
+            if(bytes > 0) {
+                core->moved = true;
+            }
+            return bytes;
+        }
+
+        void notify(int which, bool enable) {
+            if(which) {
+                core->want_write = enable;
+            }
+            if constexpr(requires(Transport &t) { t.notify(which, enable); }) {
+                Transport::notify(which, enable);
+            }
+        }
+    };
+
+    struct Inbox {
+        detail::AsyncCore *core;
+
+        bool operator()(Message &&msg) {
+            return core->deliver(std::move(msg));
+        }
+    };
+
+public:
+    /**
+     * Set up a relay run by executor, with storage for Leases received
+     * messages held at once, in its inbox or by receivers.  Further
+     * configuration goes through get().  An AsyncRelay must outlive the
+     * operations waiting on it and the messages it handed over.
+     */
+    explicit AsyncRelay(Executor &executor, Transport transport = {}, Crc crc = {})
+        : core_(executor),
+          relay_(Link{{std::move(transport)}, &core_}, std::move(crc), Inbox{&core_}) {
+        xpc_relay_config_leases(relay_.get(), leases_, Leases);
+        core_.inbox = inbox_;
+        core_.attach(relay_.get());
+    }
+    AsyncRelay(const AsyncRelay &) = delete;
+    AsyncRelay &operator=(const AsyncRelay &) = delete;
+    ~AsyncRelay() {
+        core_.detach();
+    }
+
+    xpc_relay_state_t *get() {
+        return relay_.get();
+    }
+
+    Transport &transport() {
+        return relay_.transport();
+    }
+
+    Crc &crc() {
+        return relay_.crc();
+    }
+
+    /**
+     * Reset the connection.  Completes with TXPC_STATUS_DONE once the remote
+     * has answered, or with the status xpc_relay_send_reset failed with.
+     */
+    detail::ResetOp reset() {
+        detail::ResetOp op;
+        op.core = &core_;
+        return op;
+    }
+
+    /**
+     * Send a message.  Completes once the relay has taken it, waiting for
+     * room in the relay (and for XON) as needed, with the status
+     * xpc_send_msg returned.
+     */
+    detail::SendOp send(std::uint8_t to, std::uint8_t from, std::span<const char> payload) {
+        detail::SendOp op;
+        op.core = &core_;
+        op.to = to;
+        op.from = from;
+        op.payload = payload;
+        return op;
+    }
+
+    // text, as for Relay::send
+    template<typename T>
+        requires std::convertible_to<const T&, std::string_view>
+    detail::SendOp send(std::uint8_t to, std::uint8_t from, const T &payload) {
+        std::string_view text = payload;
+        return send(to, from, std::span<const char>(text.data(), text.size()));
+    }
+
+    template<typename T>
+        requires (!std::is_lvalue_reference_v<T>) && std::ranges::range<T>
+            && (!std::ranges::borrowed_range<T>)
+            && std::convertible_to<const T&, std::string_view>
+    detail::SendOp send(std::uint8_t to, std::uint8_t from, T &&payload) = delete;
+
+    // receive the next message, kept, from the inbox if one is waiting there
+    detail::ReceiveOp receive() {
+        detail::ReceiveOp op;
+        op.core = &core_;
+        return op;
+    }
+
+    // messages reassembled from channel fragments, dropped unreceived
+    std::size_t dropped() const {
+        return core_.dropped;
+    }
+
+private:
+    detail::AsyncCore core_;
+    Relay<Link, Crc, Inbox> relay_;
+    xpc_lease_t leases_[Leases];
+    // last, so that held messages are released before their leases go
+    std::optional<Message> inbox_[Leases];
+};
+
+} // namespace tinyxpc
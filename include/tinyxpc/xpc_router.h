@@ -0,0 +1,145 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tinyxpc/tinyxpc.h>
+#include <tinyxpc/xpc_relay.h>
+/**
+ * XPC Router
+ *
+ * Forwards messages between relays by their to address, so that a hub with
+ * one link per node can stand in for a link between every pair of nodes.
+ *
+ * Each relay is attached to the router as a port, with its own table mapping
+ * destination addresses to the egress port, to local delivery, or to nowhere.
+ * A message is forwarded without a copy: its payload is leased on the ingress
+ * relay and sent from the ingress read buffer by the egress relay, and the
+ * lease is released once the egress relay has written the frame.
+ *
+ * When an egress port has no room, the message is declined and stays in the
+ * ingress relay's read buffer, so the ingress link stops being read and the
+ * sender is held back by its transport.  The ingress relay is asked to read
+ * again (io_notify with which 0) once the egress port drains.
+ *
+ * Ingress relays need receive leases (xpc_relay_config_leases), and egress
+ * relays a transmit queue (xpc_relay_config_tx_queue).  Acknowledged mode is
+ * not supported on egress links, since the relay keeps sent payloads for
+ * resending past the point the router releases them.  Nor are channels on
+ * ingress links: messages reassembled from fragments cannot be leased, so
+ * they are only delivered locally, and dropped when routed to a port.  Like
+ * the relay, the router is single threaded and needs nothing from the
+ * standard library.
+ */
+
+// route table entries which are not a port index
+#define XPC_ROUTE_LOCAL 0xfe
+#define XPC_ROUTE_DROP 0xff
+
+typedef struct xpc_router xpc_router_t;
+typedef struct xpc_router_port xpc_router_port_t;
+
+/**
+ * Handler for messages routed to XPC_ROUTE_LOCAL.  Same as dispatch_fn, with
+ * the port the message came in on.
+ */
+typedef bool (xpc_router_local_fn)(
+    void *local_ctx, xpc_router_port_t *ingress, txpc_hdr_t *msg_hdr,
+    char *payload
+);
+
+/**
+ * A forwarded message waiting to be written by its egress port.
+ */
+typedef struct {
+    xpc_lease_t *lease;
+    xpc_router_port_t *ingress;
+} xpc_router_fwd_t;
+
+struct xpc_router_port {
+    xpc_router_t *router;
+    xpc_relay_state_t *relay;
+    uint8_t index;
+    // where messages arriving on this port go, by destination address
+    uint8_t routes[256];
+    // messages forwarded out of this port, oldest first.  Storage is provided
+    // by the caller through xpc_router_port_config.
+    struct xpc_router_fwdq_t {
+        xpc_router_fwd_t *slots;
+        size_t capacity;
+        size_t head;
+        size_t count;
+    } egress;
+    // set while a message from this port is declined for want of room
+    bool blocked;
+    // counters.  dropped counts messages routed nowhere, and reassembled
+    // ones routed to a port.
+    uint64_t forwarded;
+    uint64_t dropped;
+    uint64_t declined;
+};
+
+struct xpc_router {
+    // ports by index, storage provided by the caller
+    xpc_router_port_t **ports;
+    size_t capacity;
+    size_t count;
+    xpc_router_local_fn *local_cb;
+    void *local_ctx;
+};
+
+/**
+ * Set up a router.
+ * @param target pointer to preallocated memory for the router.
+ * @param ports caller-provided storage for capacity port pointers.
+ * @param capacity maximum number of ports, at most XPC_ROUTE_LOCAL.
+ * @param local_cb handler for messages routed to XPC_ROUTE_LOCAL, may be NULL
+ * to drop them.
+ * @param local_ctx context passed to local_cb.
+ * @return target, or NULL on bad arguments.
+ */
+xpc_router_t *xpc_router_config(
+    xpc_router_t *target, xpc_router_port_t **ports, size_t capacity,
+    xpc_router_local_fn *local_cb, void *local_ctx
+);
+
+/**
+ * Set up a port and attach it to a router.  The relay must be configured
+ * with the port as msg_ctx and xpc_router_dispatch as msg_handle_cb.  All
+ * destinations are routed to XPC_ROUTE_DROP until set with
+ * xpc_router_set_route.
+ * @param target pointer to preallocated memory for the port.
+ * @param router router to attach to.
+ * @param relay the port's relay.
+ * @param slots caller-provided storage for messages being forwarded out of
+ * this port.
+ * @param capacity number of slots, the most messages waiting on this port.
+ * @return target, or NULL if the router is full or arguments are bad.
+ */
+xpc_router_port_t *xpc_router_port_config(
+    xpc_router_port_t *target, xpc_router_t *router, xpc_relay_state_t *relay,
+    xpc_router_fwd_t *slots, size_t capacity
+);
+
+/**
+ * Route messages arriving on a port for a range of destination addresses.
+ * @param self the ingress port.
+ * @param first, last destination addresses, inclusive.
+ * @param route egress port index, XPC_ROUTE_LOCAL or XPC_ROUTE_DROP.
+ * @return TXPC_STATUS_DONE, or TXPC_STATUS_BAD_STATE for an unknown port.
+ */
+xpc_status_t xpc_router_set_route(
+    xpc_router_port_t *self, uint8_t first, uint8_t last, uint8_t route
+);
+
+/**
+ * dispatch_fn for relays attached to a router.  msg_ctx is the port.
+ */
+bool xpc_router_dispatch(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload);
+
+/**
+ * Release the payloads of forwarded messages that have been written, and ask
+ * ingress relays held back by full ports to read again.  Call after servicing
+ * the relays' writes, e.g. once per pass of the event loop.
+ * @return the number of payloads released.
+ */
+size_t xpc_router_poll(xpc_router_t *self);
@@ -0,0 +1,152 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tinyxpc/xpc_relay.h>
+/**
+ * XPC Shared Memory Transport
+ *
+ * A transport for relays in processes on the same host, made of two lock-free
+ * single producer / single consumer byte rings, one per direction, in a memfd
+ * shared between the two processes.
+ *
+ * Each ring's data area is mapped twice, back to back, so any run of bytes in
+ * the ring is contiguous in memory.  Writes copy frames into the ring once;
+ * received frames are parsed in place with xpc_relay_feed and dispatched with
+ * a payload pointer into the ring, which also works with receive leases.
+ *
+ * Waiting is adaptive: a waiter spins for a while before sleeping on a futex
+ * in the shared mapping, and the spin budget grows when spinning pays off and
+ * shrinks when it does not.  The peer only makes a wake syscall when the other
+ * side is actually asleep, so a busy link costs no syscalls at all.
+ *
+ * Each endpoint is single threaded, like the relay it drives.
+ */
+
+// identifies a mapping made by xpc_shm_create
+#define XPC_SHM_MAGIC 0x78706373u
+
+/**
+ * Indices of one ring, in shared memory.  The producer and consumer halves
+ * are kept on separate cache lines so the two sides do not contend.
+ */
+struct xpc_shm_ring {
+    // bytes ever written, and a futex word bumped when the consumer sleeps
+    _Alignas(64) _Atomic uint64_t head;
+    _Atomic uint32_t head_seq;
+    _Atomic uint32_t consumer_waiting;
+    // bytes ever released, and a futex word bumped when the producer sleeps
+    _Alignas(64) _Atomic uint64_t tail;
+    _Atomic uint32_t tail_seq;
+    _Atomic uint32_t producer_waiting;
+};
+
+/**
+ * Start of the shared mapping.  Side 0 sends on ring[0] and side 1 on ring[1].
+ */
+struct xpc_shm_shared {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t capacity;
+    struct xpc_shm_ring ring[2];
+};
+
+typedef struct xpc_shm xpc_shm_t;
+
+struct xpc_shm {
+    int fd;
+    int side;
+    // data bytes per ring, a power of two and a multiple of the page size
+    size_t capacity;
+    // the shared indices, and the size of their mapping
+    struct xpc_shm_shared *shared;
+    size_t map_bytes;
+    struct xpc_shm_ring *tx;
+    struct xpc_shm_ring *rx;
+    char *tx_data;
+    char *rx_data;
+    // producer: local head and the last tail seen
+    uint64_t tx_head;
+    uint64_t tx_tail;
+    // consumer: bytes up to rx_parse have been fed to the relay, and bytes up
+    // to rx_tail are known to have been written.
+    uint64_t rx_head;
+    uint64_t rx_parse;
+    uint64_t rx_tail;
+    // spin iterations before sleeping, adapted between the limits
+    uint32_t spin;
+    uint32_t spin_min;
+    uint32_t spin_max;
+    bool want_write;
+    xpc_relay_state_t *relay;
+};
+
+/**
+ * Create a shared mapping for a pair of endpoints.  The descriptor is passed
+ * to the other process by inheritance or over a unix socket, and both sides
+ * call xpc_shm_attach with it.
+ * @param capacity bytes per direction, rounded up to a power of two of at
+ * least a page.  It must hold the largest frame plus any leased payloads.
+ * @return a memfd descriptor, or -1 on error.
+ */
+int xpc_shm_create(size_t capacity);
+
+/**
+ * Map an endpoint of a shared mapping.
+ * @param target pointer to preallocated memory for the endpoint.
+ * @param fd descriptor from xpc_shm_create, which may be closed afterwards.
+ * @param side 0 or 1, each used by exactly one endpoint.
+ * @return target, or NULL if the mapping failed or is not from
+ * xpc_shm_create.
+ */
+xpc_shm_t *xpc_shm_attach(xpc_shm_t *target, int fd, int side);
+
+/**
+ * Unmap an endpoint.
+ */
+void xpc_shm_detach(xpc_shm_t *self);
+
+/**
+ * Configure a relay to run over an endpoint, with the endpoint's IO functions
+ * (xpc_relay_config and xpc_relay_config_writev).  The relay may be
+ * configured further afterwards.
+ * @param msg_ctx, crc_ctx, msg_handle_cb, crc, crc_config as for
+ * xpc_relay_config.
+ * @return self, or NULL if self or relay is NULL.
+ */
+xpc_shm_t *xpc_shm_relay_config(
+    xpc_shm_t *self, xpc_relay_state_t *relay,
+    void *msg_ctx, void *crc_ctx, dispatch_fn *msg_handle_cb,
+    crc_fn *crc, crc_polyn_config *crc_config
+);
+
+/**
+ * Service the relay without blocking: feed it whatever has been received and
+ * continue any write it has pending.
+ * @return the number of received bytes consumed.
+ */
+size_t xpc_shm_poll(xpc_shm_t *self);
+
+/**
+ * Wait for received bytes which have not been fed to the relay yet.
+ * @param timeout_ms longest time to wait, -1 to wait indefinitely.
+ * @return the number of bytes waiting, 0 on timeout.
+ */
+size_t xpc_shm_wait(xpc_shm_t *self, int timeout_ms);
+
+/**
+ * Wait for room to write, for a relay whose write returned short.
+ * @param bytes free bytes wanted, at most the capacity.
+ * @param timeout_ms longest time to wait, -1 to wait indefinitely.
+ * @return the number of free bytes, 0 on timeout.
+ */
+size_t xpc_shm_wait_writable(xpc_shm_t *self, size_t bytes, int timeout_ms);
+
+/**
+ * IO functions used by the relay.  io_ctx is the endpoint.
+ */
+int xpc_shm_write(void *io_ctx, char **buffer, int offset, size_t bytes_max);
+int xpc_shm_writev(void *io_ctx, xpc_iovec_t *iov, int iovcnt);
+void xpc_shm_io_reset(void *io_ctx, int which, size_t bytes);
+void xpc_shm_io_notify(void *io_ctx, int which, bool enable);
@@ -0,0 +1,356 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <tinyxpc/tinyxpc.h>
+#include <tinyxpc/xpc_relay.h>
+#include <tinyxpc/xpc_cobs.h>
+
+// ========= KERNELS =========
+size_t xpc_cobs_find_delim(const char *buf, size_t bytes) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i delim = _mm_setzero_si128();
+    for(; i + 16 <= bytes; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(buf + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, delim));
+        if(mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    // a word has a zero byte iff subtracting 1 from each byte borrows into
+    // the top bit of one that did not have it set.
+    for(; i + 8 <= bytes; i += 8) {
+        uint64_t word;
+        memcpy(&word, buf + i, sizeof(word));
+        if((word - 0x0101010101010101ull) & ~word & 0x8080808080808080ull) {
+            break;
+        }
+    }
+    for(; i < bytes; i++) {
+        if(buf[i] == XPC_COBS_DELIM) {
+            break;
+        }
+    }
+    return i;
+}
+
+/**
+ * Stuff bytes into an encoding whose open block has its code byte at *code
+ * and ends at *out.  Runs between zeros are copied whole.
+ * @param room bytes which may be written at dst from *out, two of which are
+ * kept for a code byte and the delimiter.
+ * @return the number of bytes of src taken.
+ */
+static size_t xpc_cobs_stuff(
+        const char *src, size_t bytes, char *dst, size_t *code, size_t *out,
+        size_t room) {
+    size_t in = 0;
+    size_t end = *out + room;
+    while(in < bytes && end - *out > 2) {
+        size_t run = *out - *code - 1;
+        size_t n = bytes - in;
+        if(n > XPC_COBS_BLOCK - run) {
+            n = XPC_COBS_BLOCK - run;
+        }
+        if(n > end - *out - 2) {
+            n = end - *out - 2;
+        }
+        size_t zero = xpc_cobs_find_delim(src + in, n);
+        memcpy(dst + *out, src + in, zero);
+        *out += zero;
+        in += zero;
+        if(zero < n) {
+            // the zero ends the block, and is implied by its code
+            dst[*code] = *out - *code;
+            *code = (*out)++;
+            in++;
+        }
+        else if(*out - *code - 1 == XPC_COBS_BLOCK) {
+            // a full block implies no zero
+            dst[*code] = (char)0xff;
+            *code = (*out)++;
+        }
+    }
+    return in;
+}
+
+size_t xpc_cobs_encode(const char *src, size_t bytes, char *dst) {
+    size_t code = 0;
+    size_t out = 1;
+    // enough that the room xpc_cobs_stuff keeps free never limits it, the
+    // encoding itself stays within XPC_COBS_MAX_ENCODED.
+    xpc_cobs_stuff(
+        src, bytes, dst, &code, &out, XPC_COBS_MAX_ENCODED(bytes) + 2
+    );
+    dst[code] = out - code;
+    return out;
+}
+
+size_t xpc_cobs_decode(const char *src, size_t bytes, char *dst) {
+    size_t in = 0;
+    size_t out = 0;
+    while(in < bytes) {
+        size_t code = (uint8_t)src[in++];
+        if(code == 0 || code - 1 > bytes - in) {
+            return XPC_COBS_INVALID;
+        }
+        // dst trails src by at least the code byte
+        memmove(dst + out, src + in, code - 1);
+        in += code - 1;
+        out += code - 1;
+        if(code != 0xff && in < bytes) {
+            dst[out++] = 0;
+        }
+    }
+    return out;
+}
+// ========= END KERNELS =========
+
+xpc_cobs_t *xpc_cobs_config(
+    xpc_cobs_t *target, char *tx_buf, size_t tx_capacity,
+    char *rx_buf, size_t rx_capacity,
+    xpc_cobs_link_fn *link_write, void *link_ctx
+) {
+    if(target == NULL || tx_buf == NULL || rx_buf == NULL
+            || link_write == NULL || tx_capacity < XPC_COBS_BLOCK + 3
+            || rx_capacity < sizeof(txpc_hdr_t) + 1) {
+        return NULL;
+    }
+    *target = (xpc_cobs_t){
+        .link_write = link_write, .link_ctx = link_ctx,
+        .tx_buf = tx_buf, .tx_capacity = tx_capacity,
+        .rx_buf = rx_buf, .rx_capacity = rx_capacity
+    };
+    return target;
+}
+
+xpc_cobs_t *xpc_cobs_relay_config(
+    xpc_cobs_t *self, xpc_relay_state_t *relay,
+    void *msg_ctx, void *crc_ctx, dispatch_fn *msg_handle_cb,
+    crc_fn *crc, crc_polyn_config *crc_config
+) {
+    if(self == NULL || relay == NULL) {
+        return NULL;
+    }
+    self->relay = relay;
+    // frames are fed to the relay as they are decoded, there is no read
+    // wrapper
+    xpc_relay_config(
+        relay, self, msg_ctx, crc_ctx,
+        xpc_cobs_write, NULL, xpc_cobs_io_reset, xpc_cobs_io_notify,
+        msg_handle_cb, crc, crc_config
+    );
+    xpc_relay_config_writev(relay, xpc_cobs_writev);
+    return self;
+}
+
+// ========= TRANSMIT =========
+bool xpc_cobs_flush(xpc_cobs_t *self) {
+    // the open block's code byte is not known until the block ends
+    size_t ready = self->tx_open ? self->tx_code:self->tx_tail;
+    if(self->tx_head < ready) {
+        int bytes = self->link_write(
+            self->link_ctx, self->tx_buf + self->tx_head, ready - self->tx_head
+        );
+        if(bytes > 0) {
+            self->tx_head += bytes;
+        }
+    }
+    if(self->tx_head == self->tx_tail) {
+        self->tx_head = self->tx_code = self->tx_tail = 0;
+    }
+    return self->tx_head == ready;
+}
+
+/**
+ * Make as much room as possible at the end of the transmit buffer.
+ */
+static void xpc_cobs_compact(xpc_cobs_t *self) {
+    xpc_cobs_flush(self);
+    if(self->tx_head > 0) {
+        memmove(
+            self->tx_buf, self->tx_buf + self->tx_head,
+            self->tx_tail - self->tx_head
+        );
+        self->tx_code -= self->tx_head;
+        self->tx_tail -= self->tx_head;
+        self->tx_head = 0;
+    }
+}
+
+/**
+ * Encode the next bytes of the frames the relay is writing.  Frames are
+ * delimited by their headers, so one ends even where the relay does not
+ * reset its write side after it (an initiated reset).
+ * @return the number of bytes taken.
+ */
+static size_t xpc_cobs_take(xpc_cobs_t *self, const char *src, size_t bytes) {
+    size_t taken = 0;
+    while(taken < bytes) {
+        if(self->tx_capacity - self->tx_tail < 3) {
+            xpc_cobs_compact(self);
+            if(self->tx_capacity - self->tx_tail < 3) {
+                break;
+            }
+        }
+        if(!self->tx_open) {
+            self->tx_code = self->tx_tail++;
+            self->tx_open = true;
+        }
+        size_t n = bytes - taken;
+        if(self->tx_hdr_len < sizeof(txpc_hdr_t)) {
+            if(n > sizeof(txpc_hdr_t) - self->tx_hdr_len) {
+                n = sizeof(txpc_hdr_t) - self->tx_hdr_len;
+            }
+        }
+        else if(n > self->tx_left) {
+            n = self->tx_left;
+        }
+        n = xpc_cobs_stuff(
+            src + taken, n, self->tx_buf, &self->tx_code, &self->tx_tail,
+            self->tx_capacity - self->tx_tail
+        );
+        if(self->tx_hdr_len < sizeof(txpc_hdr_t)) {
+            memcpy((char*)&self->tx_hdr + self->tx_hdr_len, src + taken, n);
+            self->tx_hdr_len += n;
+            if(self->tx_hdr_len == sizeof(txpc_hdr_t)) {
+                self->tx_left = xpc_relay_frame_bytes(
+                    self->relay, &self->tx_hdr
+                );
+            }
+        }
+        else {
+            self->tx_left -= n;
+        }
+        taken += n;
+        if(self->tx_hdr_len == sizeof(txpc_hdr_t) && self->tx_left == 0) {
+            // end of frame: close the block and delimit, room was kept
+            self->tx_buf[self->tx_code] = self->tx_tail - self->tx_code;
+            self->tx_buf[self->tx_tail++] = XPC_COBS_DELIM;
+            self->tx_open = false;
+            self->tx_hdr_len = 0;
+        }
+    }
+    xpc_cobs_flush(self);
+    return taken;
+}
+// ========= END TRANSMIT =========
+
+// ========= RECEIVE =========
+/**
+ * Whether a decoded frame is made of whole relay frames.  A corrupted size
+ * field shows up here rather than leaving the relay waiting for bytes from
+ * the frames after it.
+ */
+static bool xpc_cobs_whole(xpc_cobs_t *self, size_t len) {
+    size_t pos = 0;
+    while(pos < len) {
+        txpc_hdr_t hdr;
+        if(len - pos < sizeof(txpc_hdr_t)) {
+            return false;
+        }
+        memcpy(&hdr, self->rx_buf + pos, sizeof(hdr));
+        pos += sizeof(txpc_hdr_t) + xpc_relay_frame_bytes(self->relay, &hdr);
+    }
+    return pos == len;
+}
+
+/**
+ * Feed the relay what it has not taken of the decoded frame.
+ * @return false if it declined a message.
+ */
+static bool xpc_cobs_deliver(xpc_cobs_t *self) {
+    self->rx_fed += xpc_relay_feed(
+        self->relay, self->rx_buf + self->rx_fed, self->rx_frame - self->rx_fed
+    );
+    if(self->rx_fed < self->rx_frame) {
+        return false;
+    }
+    self->rx_frame = 0;
+    self->rx_fed = 0;
+    return true;
+}
+
+size_t xpc_cobs_input(xpc_cobs_t *self, const char *data, size_t bytes) {
+    size_t used = 0;
+    if(self->rx_frame && !xpc_cobs_deliver(self)) {
+        goto done;
+    }
+    while(used < bytes) {
+        size_t run = xpc_cobs_find_delim(data + used, bytes - used);
+        bool delimited = run < bytes - used;
+        if(self->rx_skip || self->rx_len + run > self->rx_capacity) {
+            // too long for any frame, drop it all up to the next delimiter
+            if(!self->rx_skip) {
+                self->dropped++;
+            }
+            self->rx_skip = !delimited;
+            self->rx_len = 0;
+            used += run + delimited;
+            continue;
+        }
+        memcpy(self->rx_buf + self->rx_len, data + used, run);
+        self->rx_len += run;
+        used += run;
+        if(!delimited) {
+            break;
+        }
+        used++;
+        size_t len = self->rx_len;
+        self->rx_len = 0;
+        if(len == 0) {
+            // back-to-back delimiters, e.g. sent to flush a noisy line
+            continue;
+        }
+        len = xpc_cobs_decode(self->rx_buf, len, self->rx_buf);
+        if(len == XPC_COBS_INVALID || !xpc_cobs_whole(self, len)) {
+            self->dropped++;
+            continue;
+        }
+        self->frames++;
+        self->rx_frame = len;
+        if(!xpc_cobs_deliver(self)) {
+            break;
+        }
+    }
+done:
+    return used;
+}
+// ========= END RECEIVE =========
+
+// ========= IO FUNCTIONS =========
+int xpc_cobs_write(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+    xpc_cobs_t *self = (xpc_cobs_t*)io_ctx;
+    return xpc_cobs_take(self, *buffer + offset, bytes_max);
+}
+
+int xpc_cobs_writev(void *io_ctx, xpc_iovec_t *iov, int iovcnt) {
+    xpc_cobs_t *self = (xpc_cobs_t*)io_ctx;
+    size_t bytes = 0;
+    for(int i = 0; i < iovcnt; i++) {
+        size_t taken = xpc_cobs_take(self, iov[i].base, iov[i].len);
+        bytes += taken;
+        if(taken < iov[i].len) {
+            break;
+        }
+    }
+    return bytes;
+}
+
+void xpc_cobs_io_reset(void *io_ctx, int which, size_t bytes) {
+    // frames are encoded as they are written, and received frames are
+    // dropped once fed
+}
+
+void xpc_cobs_io_notify(void *io_ctx, int which, bool enable) {
+    xpc_cobs_t *self = (xpc_cobs_t*)io_ctx;
+    if(which) {
+        self->want_write = enable;
+    }
+}
+// ========= END IO FUNCTIONS =========
@@ -0,0 +1,281 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tinyxpc/xpc_crc.h>
+
+// ========= COMPILE-TIME TABLES =========
+// reflected tables take the bit-reversed polynomial.
+#define XPC_CRC_TABLE_NAME xpc_crc_table_8_07
+#define XPC_CRC_TABLE_WIDTH 8
+#define XPC_CRC_TABLE_POLYN UINT64_C(0x07)
+#define XPC_CRC_TABLE_REFLECTED 0
+#include "xpc_crc_table.h"
+
+#define XPC_CRC_TABLE_NAME xpc_crc_table_8_31_r
+#define XPC_CRC_TABLE_WIDTH 8
+#define XPC_CRC_TABLE_POLYN UINT64_C(0x8c)
+#define XPC_CRC_TABLE_REFLECTED 1
+#include "xpc_crc_table.h"
+
+#define XPC_CRC_TABLE_NAME xpc_crc_table_16_1021
+#define XPC_CRC_TABLE_WIDTH 16
+#define XPC_CRC_TABLE_POLYN UINT64_C(0x1021)
+#define XPC_CRC_TABLE_REFLECTED 0
+#include "xpc_crc_table.h"
+
+#define XPC_CRC_TABLE_NAME xpc_crc_table_16_1021_r
+#define XPC_CRC_TABLE_WIDTH 16
+#define XPC_CRC_TABLE_POLYN UINT64_C(0x8408)
+#define XPC_CRC_TABLE_REFLECTED 1
+#include "xpc_crc_table.h"
+
+#define XPC_CRC_TABLE_NAME xpc_crc_table_16_8005_r
+#define XPC_CRC_TABLE_WIDTH 16
+#define XPC_CRC_TABLE_POLYN UINT64_C(0xa001)
+#define XPC_CRC_TABLE_REFLECTED 1
+#include "xpc_crc_table.h"
+
+#define XPC_CRC_TABLE_NAME xpc_crc_table_24_864cfb
+#define XPC_CRC_TABLE_WIDTH 24
+#define XPC_CRC_TABLE_POLYN UINT64_C(0x864cfb)
+#define XPC_CRC_TABLE_REFLECTED 0
+#include "xpc_crc_table.h"
+
+#define XPC_CRC_TABLE_NAME xpc_crc_table_32_04c11db7_r
+#define XPC_CRC_TABLE_WIDTH 32
+#define XPC_CRC_TABLE_POLYN UINT64_C(0xedb88320)
+#define XPC_CRC_TABLE_REFLECTED 1
+#include "xpc_crc_table.h"
+
+#define XPC_CRC_TABLE_NAME xpc_crc_table_32_1edc6f41_r
+#define XPC_CRC_TABLE_WIDTH 32
+#define XPC_CRC_TABLE_POLYN UINT64_C(0x82f63b78)
+#define XPC_CRC_TABLE_REFLECTED 1
+#include "xpc_crc_table.h"
+
+#define XPC_CRC_TABLE_NAME xpc_crc_table_64_42f0e1eba9ea3693
+#define XPC_CRC_TABLE_WIDTH 64
+#define XPC_CRC_TABLE_POLYN UINT64_C(0x42f0e1eba9ea3693)
+#define XPC_CRC_TABLE_REFLECTED 0
+#include "xpc_crc_table.h"
+
+#define XPC_CRC_TABLE_NAME xpc_crc_table_64_42f0e1eba9ea3693_r
+#define XPC_CRC_TABLE_WIDTH 64
+#define XPC_CRC_TABLE_POLYN UINT64_C(0xc96c5795d7870f42)
+#define XPC_CRC_TABLE_REFLECTED 1
+#include "xpc_crc_table.h"
+
+static const struct {
+    xpc_crc_params_t params;
+    const uint64_t *table;
+} xpc_crc_presets[XPC_CRC_PRESET_COUNT] = {
+    [XPC_CRC_8_SMBUS] = {
+        {8, false, false, 0x07, 0, 0, 0xf4},
+        xpc_crc_table_8_07
+    },
+    [XPC_CRC_8_MAXIM_DOW] = {
+        {8, true, true, 0x31, 0, 0, 0xa1},
+        xpc_crc_table_8_31_r
+    },
+    [XPC_CRC_16_KERMIT] = {
+        {16, true, true, 0x1021, 0, 0, 0x2189},
+        xpc_crc_table_16_1021_r
+    },
+    [XPC_CRC_16_IBM_3740] = {
+        {16, false, false, 0x1021, 0xffff, 0, 0x29b1},
+        xpc_crc_table_16_1021
+    },
+    [XPC_CRC_16_MODBUS] = {
+        {16, true, true, 0x8005, 0xffff, 0, 0x4b37},
+        xpc_crc_table_16_8005_r
+    },
+    [XPC_CRC_24_OPENPGP] = {
+        {24, false, false, 0x864cfb, 0xb704ce, 0, 0x21cf02},
+        xpc_crc_table_24_864cfb
+    },
+    [XPC_CRC_32_ISO_HDLC] = {
+        {32, true, true, 0x04c11db7, 0xffffffff, 0xffffffff, 0xcbf43926},
+        xpc_crc_table_32_04c11db7_r
+    },
+    [XPC_CRC_32_ISCSI] = {
+        {32, true, true, 0x1edc6f41, 0xffffffff, 0xffffffff, 0xe3069283},
+        xpc_crc_table_32_1edc6f41_r
+    },
+    [XPC_CRC_64_XZ] = {
+        {
+            64, true, true, UINT64_C(0x42f0e1eba9ea3693),
+            ~UINT64_C(0), ~UINT64_C(0), UINT64_C(0x995dc9bbdf1939fa)
+        },
+        xpc_crc_table_64_42f0e1eba9ea3693_r
+    },
+    [XPC_CRC_64_ECMA_182] = {
+        {
+            64, false, false, UINT64_C(0x42f0e1eba9ea3693),
+            0, 0, UINT64_C(0x6c40df5f0b497347)
+        },
+        xpc_crc_table_64_42f0e1eba9ea3693
+    },
+};
+// ========= END COMPILE-TIME TABLES =========
+
+static uint64_t xpc_crc_mask(int width) {
+    return ~UINT64_C(0) >> (64 - width);
+}
+
+static uint64_t xpc_crc_reflect(uint64_t value, int width) {
+    uint64_t out = 0;
+    for(int i = 0; i < width; i++) {
+        out = (out << 1) | ((value >> i) & 1);
+    }
+    return out;
+}
+
+/**
+ * Pick the compile-time table for the engine parameters, or build one into
+ * the engine state if there is none.
+ */
+static void xpc_crc_table_setup(xpc_crc_ctx_t *ctx) {
+    const xpc_crc_params_t *params = &ctx->params;
+    for(int i = 0; i < XPC_CRC_PRESET_COUNT; i++) {
+        const xpc_crc_params_t *preset = &xpc_crc_presets[i].params;
+        if(preset->width == params->width && preset->polyn == params->polyn
+                && preset->refin == params->refin) {
+            ctx->preset = i;
+            return;
+        }
+    }
+
+    uint64_t mask = xpc_crc_mask(params->width);
+    if(params->refin) {
+        uint64_t polyn = xpc_crc_reflect(params->polyn, params->width);
+        for(int n = 0; n < 256; n++) {
+            uint64_t crc = n;
+            for(int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ polyn:crc >> 1;
+            }
+            ctx->lut[n] = crc;
+        }
+    }
+    else {
+        uint64_t top = UINT64_C(1) << (params->width - 1);
+        for(int n = 0; n < 256; n++) {
+            uint64_t crc = (uint64_t)n << (params->width - 8);
+            for(int bit = 0; bit < 8; bit++) {
+                crc = (crc & top) ? (crc << 1) ^ params->polyn:crc << 1;
+            }
+            ctx->lut[n] = crc & mask;
+        }
+    }
+    ctx->preset = -1;
+}
+
+/**
+ * Get the lookup table for the engine parameters.  Looked up by index, so a
+ * copied engine uses its own lut.
+ */
+static const uint64_t *xpc_crc_table(const xpc_crc_ctx_t *ctx) {
+    return ctx->preset < 0 ? ctx->lut:xpc_crc_presets[ctx->preset].table;
+}
+
+const xpc_crc_params_t *xpc_crc_preset(xpc_crc_preset_t preset) {
+    if(preset < 0 || preset >= XPC_CRC_PRESET_COUNT) {
+        return NULL;
+    }
+    return &xpc_crc_presets[preset].params;
+}
+
+xpc_crc_ctx_t *xpc_crc_setup(xpc_crc_ctx_t *ctx, const xpc_crc_params_t *params) {
+    if(ctx == NULL || params == NULL || params->width < 8 || params->width > 64) {
+        ctx = NULL;
+        goto done;
+    }
+    ctx->params = *params;
+    uint64_t mask = xpc_crc_mask(params->width);
+    ctx->params.polyn &= mask;
+    ctx->params.init &= mask;
+    ctx->params.xorout &= mask;
+    xpc_crc_table_setup(ctx);
+done:
+    return ctx;
+}
+
+uint64_t xpc_crc_compute(xpc_crc_ctx_t *ctx, const char *buf, size_t bytes) {
+    uint64_t crc = xpc_crc_update(ctx, xpc_crc_init(ctx), (char*)buf, bytes);
+    if(ctx->params.refin != ctx->params.refout) {
+        crc = xpc_crc_reflect(crc, ctx->params.width);
+    }
+    return crc ^ ctx->params.xorout;
+}
+
+char *xpc_crc_fn(void *crc_ctx, char *buf, size_t bytes) {
+    xpc_crc_ctx_t *ctx = (xpc_crc_ctx_t*)crc_ctx;
+    xpc_crc_finalize(ctx, xpc_crc_update(ctx, xpc_crc_init(ctx), buf, bytes), ctx->out);
+    return ctx->out;
+}
+
+void xpc_crc_polyn_config(void *crc_ctx, int crc_bits, char *polyn) {
+    xpc_crc_ctx_t *ctx = (xpc_crc_ctx_t*)crc_ctx;
+    if(crc_bits < 8 || crc_bits > 64 || polyn == NULL) {
+        return;
+    }
+    const unsigned char *p = (const unsigned char*)polyn;
+    uint64_t value = 0;
+    for(int i = 0; i < ((crc_bits + 7) >> 3); i++) {
+        value = (value << 8) | p[i];
+    }
+    xpc_crc_params_t params = ctx->params;
+    uint64_t old_mask = xpc_crc_mask(params.width);
+    uint64_t mask = xpc_crc_mask(crc_bits);
+    params.width = crc_bits;
+    params.polyn = value;
+    if(params.init == old_mask) {
+        params.init = mask;
+    }
+    if(params.xorout == old_mask) {
+        params.xorout = mask;
+    }
+    // no longer known
+    params.check = 0;
+    xpc_crc_setup(ctx, &params);
+}
+
+uint64_t xpc_crc_init(void *crc_ctx) {
+    xpc_crc_ctx_t *ctx = (xpc_crc_ctx_t*)crc_ctx;
+    if(ctx->params.refin) {
+        return xpc_crc_reflect(ctx->params.init, ctx->params.width);
+    }
+    return ctx->params.init;
+}
+
+uint64_t xpc_crc_update(void *crc_ctx, uint64_t crc, char *buf, size_t bytes) {
+    xpc_crc_ctx_t *ctx = (xpc_crc_ctx_t*)crc_ctx;
+    const uint64_t *table = xpc_crc_table(ctx);
+    const unsigned char *p = (const unsigned char*)buf;
+    if(ctx->params.refin) {
+        while(bytes--) {
+            crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        }
+    }
+    else {
+        int shift = ctx->params.width - 8;
+        uint64_t mask = xpc_crc_mask(ctx->params.width);
+        while(bytes--) {
+            crc = (table[((crc >> shift) ^ *p++) & 0xff] ^ (crc << 8)) & mask;
+        }
+    }
+    return crc;
+}
+
+void xpc_crc_finalize(void *crc_ctx, uint64_t crc, char *out) {
+    xpc_crc_ctx_t *ctx = (xpc_crc_ctx_t*)crc_ctx;
+    int width = ctx->params.width;
+    if(ctx->params.refin != ctx->params.refout) {
+        crc = xpc_crc_reflect(crc, width);
+    }
+    crc ^= ctx->params.xorout;
+    int bytes = (width + 7) >> 3;
+    for(int i = 0; i < bytes; i++) {
+        int byte = ctx->params.refout ? i:bytes - 1 - i;
+        out[byte] = (crc >> (8 * i)) & 0xff;
+    }
+}
@@ -0,0 +1,374 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <tinyxpc/xpc_crc32.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XPC_CRC32_X86 1
+#include <immintrin.h>
+#endif
+
+static uint32_t xpc_crc32_reflect(uint32_t value) {
+    uint32_t out = 0;
+    for(int i = 0; i < 32; i++) {
+        out = (out << 1) | ((value >> i) & 1);
+    }
+    return out;
+}
+
+static uint32_t xpc_crc32_load32(const char *buf) {
+    const unsigned char *p = (const unsigned char*)buf;
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8
+        | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// ========= PORTABLE KERNELS =========
+static uint32_t xpc_crc32_bytewise(
+        const xpc_crc32_ctx_t *ctx, uint32_t crc,
+        const char *buf, size_t bytes) {
+    const unsigned char *p = (const unsigned char*)buf;
+    while(bytes--) {
+        crc = ctx->table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static uint32_t xpc_crc32_slice8(
+        const xpc_crc32_ctx_t *ctx, uint32_t crc,
+        const char *buf, size_t bytes) {
+    const uint32_t (*t)[256] = ctx->table;
+    while(bytes >= 8) {
+        uint32_t one = xpc_crc32_load32(buf) ^ crc;
+        uint32_t two = xpc_crc32_load32(buf + 4);
+        crc = t[7][one & 0xff] ^ t[6][(one >> 8) & 0xff]
+            ^ t[5][(one >> 16) & 0xff] ^ t[4][one >> 24]
+            ^ t[3][two & 0xff] ^ t[2][(two >> 8) & 0xff]
+            ^ t[1][(two >> 16) & 0xff] ^ t[0][two >> 24];
+        buf += 8;
+        bytes -= 8;
+    }
+    return xpc_crc32_bytewise(ctx, crc, buf, bytes);
+}
+
+static uint32_t xpc_crc32_slice16(
+        const xpc_crc32_ctx_t *ctx, uint32_t crc,
+        const char *buf, size_t bytes) {
+    const uint32_t (*t)[256] = ctx->table;
+    while(bytes >= 16) {
+        uint32_t one = xpc_crc32_load32(buf) ^ crc;
+        uint32_t two = xpc_crc32_load32(buf + 4);
+        uint32_t three = xpc_crc32_load32(buf + 8);
+        uint32_t four = xpc_crc32_load32(buf + 12);
+        crc = t[15][one & 0xff] ^ t[14][(one >> 8) & 0xff]
+            ^ t[13][(one >> 16) & 0xff] ^ t[12][one >> 24]
+            ^ t[11][two & 0xff] ^ t[10][(two >> 8) & 0xff]
+            ^ t[9][(two >> 16) & 0xff] ^ t[8][two >> 24]
+            ^ t[7][three & 0xff] ^ t[6][(three >> 8) & 0xff]
+            ^ t[5][(three >> 16) & 0xff] ^ t[4][three >> 24]
+            ^ t[3][four & 0xff] ^ t[2][(four >> 8) & 0xff]
+            ^ t[1][(four >> 16) & 0xff] ^ t[0][four >> 24];
+        buf += 16;
+        bytes -= 16;
+    }
+    return xpc_crc32_slice8(ctx, crc, buf, bytes);
+}
+// ========= END PORTABLE KERNELS =========
+
+// ========= X86 KERNELS =========
+#ifdef XPC_CRC32_X86
+/**
+ * Carry-less multiply folding, after Intel's "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction".  Folds four 128 bit lanes
+ * per 64 byte block, then reduces to 32 bits with a Barrett reduction.  The
+ * constants are derived from the polynomial in xpc_crc32_setup.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t xpc_crc32_pclmul(
+        const xpc_crc32_ctx_t *ctx, uint32_t crc,
+        const char *buf, size_t bytes) {
+    if(bytes < 64) {
+        return ctx->tail(ctx, crc, buf, bytes);
+    }
+    size_t left = bytes & 15;
+    bytes -= left;
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+    __m128i y5, y6, y7, y8;
+    x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_loadu_si128((const __m128i*)ctx->k1k2);
+    buf += 64;
+    bytes -= 64;
+
+    // fold by 4
+    while(bytes >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        buf += 64;
+        bytes -= 64;
+    }
+
+    // fold the four lanes into one
+    x0 = _mm_loadu_si128((const __m128i*)ctx->k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // fold by 1 for the remaining 16 byte blocks
+    while(bytes >= 16) {
+        x2 = _mm_loadu_si128((const __m128i*)buf);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        buf += 16;
+        bytes -= 16;
+    }
+
+    // 128 -> 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i*)ctx->k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction, 64 -> 32 bits
+    x0 = _mm_loadu_si128((const __m128i*)ctx->poly_mu);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    crc = _mm_extract_epi32(x1, 1);
+
+    return ctx->tail(ctx, crc, buf, left);
+}
+
+/**
+ * SSE4.2 crc32 instruction, which implements CRC-32C only.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t xpc_crc32_sse42(
+        const xpc_crc32_ctx_t *ctx, uint32_t crc,
+        const char *buf, size_t bytes) {
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while(bytes >= 8) {
+        uint64_t word;
+        memcpy(&word, buf, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        buf += 8;
+        bytes -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while(bytes >= 4) {
+        uint32_t word;
+        memcpy(&word, buf, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+        buf += 4;
+        bytes -= 4;
+    }
+    while(bytes--) {
+        crc = _mm_crc32_u8(crc, (unsigned char)*buf++);
+    }
+    return crc;
+}
+#endif
+// ========= END X86 KERNELS =========
+
+bool xpc_crc32_kernel_supported(xpc_crc32_kernel_t kernel) {
+    switch(kernel) {
+        case XPC_CRC32_KERNEL_AUTO:
+        case XPC_CRC32_KERNEL_SLICE8:
+        case XPC_CRC32_KERNEL_SLICE16:
+            return true;
+#ifdef XPC_CRC32_X86
+        case XPC_CRC32_KERNEL_PCLMUL:
+            return __builtin_cpu_supports("pclmul")
+                && __builtin_cpu_supports("sse4.1");
+        case XPC_CRC32_KERNEL_SSE42:
+            return __builtin_cpu_supports("sse4.2");
+#endif
+        default:
+            return false;
+    }
+}
+
+/**
+ * x^n mod P, for a polynomial in normal representation.
+ */
+static uint32_t xpc_crc32_xpow_mod(uint32_t polyn, unsigned n) {
+    uint32_t r = 1;
+    while(n--) {
+        r = (r & 0x80000000u) ? (r << 1) ^ polyn:r << 1;
+    }
+    return r;
+}
+
+/**
+ * Derive the folding constants for the pclmul kernel.  Each is x^n mod P,
+ * bit-reflected and shifted into 33 bits to match the reflected data.
+ */
+static void xpc_crc32_fold_constants(xpc_crc32_ctx_t *ctx) {
+    static const unsigned powers[] = {4*128 + 32, 4*128 - 32, 128 + 32, 128 - 32, 64};
+    uint64_t k[5];
+    for(int i = 0; i < 5; i++) {
+        k[i] = (uint64_t)xpc_crc32_reflect(
+            xpc_crc32_xpow_mod(ctx->polyn, powers[i])
+        ) << 1;
+    }
+    // mu = floor(x^64 / P), 33 bits.  The leading quotient bit is always set,
+    // which leaves polyn * x^32 as the first remainder.
+    uint64_t full = ((uint64_t)1 << 32) | ctx->polyn;
+    uint64_t rem = (uint64_t)ctx->polyn << 32;
+    uint64_t mu = (uint64_t)1 << 32;
+    for(int i = 63; i >= 32; i--) {
+        if(rem & ((uint64_t)1 << i)) {
+            mu |= (uint64_t)1 << (i - 32);
+            rem ^= full << (i - 32);
+        }
+    }
+    uint64_t mu_reflected = 0;
+    for(int i = 0; i < 33; i++) {
+        mu_reflected = (mu_reflected << 1) | ((mu >> i) & 1);
+    }
+    ctx->k1k2[0] = k[0];
+    ctx->k1k2[1] = k[1];
+    ctx->k3k4[0] = k[2];
+    ctx->k3k4[1] = k[3];
+    ctx->k5k0[0] = k[4];
+    ctx->k5k0[1] = 0;
+    ctx->poly_mu[0] = ((uint64_t)xpc_crc32_reflect(ctx->polyn) << 1) | 1;
+    ctx->poly_mu[1] = mu_reflected;
+}
+
+xpc_crc32_ctx_t *xpc_crc32_setup(
+    xpc_crc32_ctx_t *ctx, uint32_t polyn, xpc_crc32_kernel_t kernel
+) {
+    if(ctx == NULL) goto done;
+    if(!xpc_crc32_kernel_supported(kernel) || (
+                kernel == XPC_CRC32_KERNEL_SSE42
+                && polyn != XPC_CRC32_POLYN_CASTAGNOLI)) {
+        ctx = NULL;
+        goto done;
+    }
+    ctx->polyn = polyn;
+    uint32_t reflected = xpc_crc32_reflect(polyn);
+    for(int n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for(int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ reflected:crc >> 1;
+        }
+        ctx->table[0][n] = crc;
+    }
+    for(int n = 0; n < 256; n++) {
+        for(int slice = 1; slice < 16; slice++) {
+            uint32_t prev = ctx->table[slice - 1][n];
+            ctx->table[slice][n] = (prev >> 8) ^ ctx->table[0][prev & 0xff];
+        }
+    }
+    xpc_crc32_fold_constants(ctx);
+
+    if(kernel == XPC_CRC32_KERNEL_AUTO) {
+        kernel = XPC_CRC32_KERNEL_SLICE16;
+        if(xpc_crc32_kernel_supported(XPC_CRC32_KERNEL_PCLMUL)) {
+            kernel = XPC_CRC32_KERNEL_PCLMUL;
+        }
+        else if(polyn == XPC_CRC32_POLYN_CASTAGNOLI
+                && xpc_crc32_kernel_supported(XPC_CRC32_KERNEL_SSE42)) {
+            kernel = XPC_CRC32_KERNEL_SSE42;
+        }
+    }
+    ctx->kind = kernel;
+    ctx->tail = xpc_crc32_slice8;
+    switch(kernel) {
+        case XPC_CRC32_KERNEL_SLICE8:
+            ctx->kernel = xpc_crc32_slice8;
+        break;
+#ifdef XPC_CRC32_X86
+        case XPC_CRC32_KERNEL_PCLMUL:
+            ctx->kernel = xpc_crc32_pclmul;
+            if(polyn == XPC_CRC32_POLYN_CASTAGNOLI
+                    && xpc_crc32_kernel_supported(XPC_CRC32_KERNEL_SSE42)) {
+                ctx->tail = xpc_crc32_sse42;
+            }
+        break;
+        case XPC_CRC32_KERNEL_SSE42:
+            ctx->kernel = xpc_crc32_sse42;
+        break;
+#endif
+        default:
+            ctx->kernel = xpc_crc32_slice16;
+        break;
+    }
+done:
+    return ctx;
+}
+
+uint32_t xpc_crc32(const xpc_crc32_ctx_t *ctx, const char *buf, size_t bytes) {
+    return ctx->kernel(ctx, 0xffffffffu, buf, bytes) ^ 0xffffffffu;
+}
+
+char *xpc_crc32_fn(void *crc_ctx, char *buf, size_t bytes) {
+    xpc_crc32_ctx_t *ctx = (xpc_crc32_ctx_t*)crc_ctx;
+    xpc_crc32_finalize(ctx, xpc_crc32_update(ctx, xpc_crc32_init(ctx), buf, bytes), ctx->out);
+    return ctx->out;
+}
+
+void xpc_crc32_polyn_config(void *crc_ctx, int crc_bits, char *polyn) {
+    xpc_crc32_ctx_t *ctx = (xpc_crc32_ctx_t*)crc_ctx;
+    if(crc_bits != 32 || polyn == NULL) {
+        return;
+    }
+    const unsigned char *p = (const unsigned char*)polyn;
+    uint32_t value = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16
+        | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+    if(value != ctx->polyn) {
+        xpc_crc32_setup(ctx, value, XPC_CRC32_KERNEL_AUTO);
+    }
+}
+
+uint64_t xpc_crc32_init(void *crc_ctx) {
+    return 0xffffffffu;
+}
+
+uint64_t xpc_crc32_update(void *crc_ctx, uint64_t crc, char *buf, size_t bytes) {
+    const xpc_crc32_ctx_t *ctx = (const xpc_crc32_ctx_t*)crc_ctx;
+    return ctx->kernel(ctx, (uint32_t)crc, buf, bytes);
+}
+
+void xpc_crc32_finalize(void *crc_ctx, uint64_t crc, char *out) {
+    uint32_t value = (uint32_t)crc ^ 0xffffffffu;
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+    out[3] = (value >> 24) & 0xff;
+}
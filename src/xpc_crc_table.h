@@ -0,0 +1,164 @@
+/**
+ * Compile-time CRC lookup table generator.  This file has no include guard:
+ * it is included once per table, with these defined beforehand:
+ *
+ *  XPC_CRC_TABLE_NAME       identifier of the generated uint64_t[256] table
+ *  XPC_CRC_TABLE_WIDTH      CRC width in bits, 8 to 64
+ *  XPC_CRC_TABLE_POLYN      generator polynomial without the x^width term,
+ *                           bit-reversed when XPC_CRC_TABLE_REFLECTED is 1
+ *  XPC_CRC_TABLE_REFLECTED  1 for reflected input, 0 otherwise
+ *
+ * All of them are undefined again at the end.
+ *
+ * Table entries are linear in the index, so each one is the XOR of the
+ * entries for its set bits.  Those eight basis entries in turn only depend
+ * on which of the eight shifts of the byte feed the polynomial back in.  The
+ * feedback bits are computed with #if, so that they are plain 0/1 literals by
+ * the time the 256 entries are expanded, and the expansion stays small.
+ */
+
+#define XPC_CRC_TABLE_MASK (~UINT64_C(0) >> (64 - XPC_CRC_TABLE_WIDTH))
+
+// polynomial bit checked for feedback j shifts after the one that set it.
+#if XPC_CRC_TABLE_REFLECTED
+#define XPC_CRC_TABLE_TAP(j) ((XPC_CRC_TABLE_POLYN >> (j)) & 1)
+#define XPC_CRC_TABLE_SHIFT(s) (XPC_CRC_TABLE_POLYN >> (s))
+#else
+#define XPC_CRC_TABLE_TAP(j) \
+    ((XPC_CRC_TABLE_POLYN >> (XPC_CRC_TABLE_WIDTH - 1 - (j))) & 1)
+#define XPC_CRC_TABLE_SHIFT(s) ((XPC_CRC_TABLE_POLYN << (s)) & XPC_CRC_TABLE_MASK)
+#endif
+
+// XPC_CRC_TABLE_Gk: whether the polynomial is fed back k shifts after the
+// first time.
+#define XPC_CRC_TABLE_G0 1
+#if XPC_CRC_TABLE_TAP(0)
+#define XPC_CRC_TABLE_G1 1
+#else
+#define XPC_CRC_TABLE_G1 0
+#endif
+#if XPC_CRC_TABLE_TAP(1) ^ (XPC_CRC_TABLE_G1 & XPC_CRC_TABLE_TAP(0))
+#define XPC_CRC_TABLE_G2 1
+#else
+#define XPC_CRC_TABLE_G2 0
+#endif
+#if XPC_CRC_TABLE_TAP(2) ^ (XPC_CRC_TABLE_G1 & XPC_CRC_TABLE_TAP(1)) \
+        ^ (XPC_CRC_TABLE_G2 & XPC_CRC_TABLE_TAP(0))
+#define XPC_CRC_TABLE_G3 1
+#else
+#define XPC_CRC_TABLE_G3 0
+#endif
+#if XPC_CRC_TABLE_TAP(3) ^ (XPC_CRC_TABLE_G1 & XPC_CRC_TABLE_TAP(2)) \
+        ^ (XPC_CRC_TABLE_G2 & XPC_CRC_TABLE_TAP(1)) \
+        ^ (XPC_CRC_TABLE_G3 & XPC_CRC_TABLE_TAP(0))
+#define XPC_CRC_TABLE_G4 1
+#else
+#define XPC_CRC_TABLE_G4 0
+#endif
+#if XPC_CRC_TABLE_TAP(4) ^ (XPC_CRC_TABLE_G1 & XPC_CRC_TABLE_TAP(3)) \
+        ^ (XPC_CRC_TABLE_G2 & XPC_CRC_TABLE_TAP(2)) \
+        ^ (XPC_CRC_TABLE_G3 & XPC_CRC_TABLE_TAP(1)) \
+        ^ (XPC_CRC_TABLE_G4 & XPC_CRC_TABLE_TAP(0))
+#define XPC_CRC_TABLE_G5 1
+#else
+#define XPC_CRC_TABLE_G5 0
+#endif
+#if XPC_CRC_TABLE_TAP(5) ^ (XPC_CRC_TABLE_G1 & XPC_CRC_TABLE_TAP(4)) \
+        ^ (XPC_CRC_TABLE_G2 & XPC_CRC_TABLE_TAP(3)) \
+        ^ (XPC_CRC_TABLE_G3 & XPC_CRC_TABLE_TAP(2)) \
+        ^ (XPC_CRC_TABLE_G4 & XPC_CRC_TABLE_TAP(1)) \
+        ^ (XPC_CRC_TABLE_G5 & XPC_CRC_TABLE_TAP(0))
+#define XPC_CRC_TABLE_G6 1
+#else
+#define XPC_CRC_TABLE_G6 0
+#endif
+#if XPC_CRC_TABLE_TAP(6) ^ (XPC_CRC_TABLE_G1 & XPC_CRC_TABLE_TAP(5)) \
+        ^ (XPC_CRC_TABLE_G2 & XPC_CRC_TABLE_TAP(4)) \
+        ^ (XPC_CRC_TABLE_G3 & XPC_CRC_TABLE_TAP(3)) \
+        ^ (XPC_CRC_TABLE_G4 & XPC_CRC_TABLE_TAP(2)) \
+        ^ (XPC_CRC_TABLE_G5 & XPC_CRC_TABLE_TAP(1)) \
+        ^ (XPC_CRC_TABLE_G6 & XPC_CRC_TABLE_TAP(0))
+#define XPC_CRC_TABLE_G7 1
+#else
+#define XPC_CRC_TABLE_G7 0
+#endif
+
+// C_j: entry for a single bit which sees j more shifts once it first feeds
+// back.
+#define XPC_CRC_TABLE_T(k, s) (XPC_CRC_TABLE_G##k ? XPC_CRC_TABLE_SHIFT(s):0)
+#define XPC_CRC_TABLE_C0 XPC_CRC_TABLE_T(0, 0)
+#define XPC_CRC_TABLE_C1 (XPC_CRC_TABLE_T(0, 1) ^ XPC_CRC_TABLE_T(1, 0))
+#define XPC_CRC_TABLE_C2 (XPC_CRC_TABLE_T(0, 2) ^ XPC_CRC_TABLE_T(1, 1) \
+    ^ XPC_CRC_TABLE_T(2, 0))
+#define XPC_CRC_TABLE_C3 (XPC_CRC_TABLE_T(0, 3) ^ XPC_CRC_TABLE_T(1, 2) \
+    ^ XPC_CRC_TABLE_T(2, 1) ^ XPC_CRC_TABLE_T(3, 0))
+#define XPC_CRC_TABLE_C4 (XPC_CRC_TABLE_T(0, 4) ^ XPC_CRC_TABLE_T(1, 3) \
+    ^ XPC_CRC_TABLE_T(2, 2) ^ XPC_CRC_TABLE_T(3, 1) ^ XPC_CRC_TABLE_T(4, 0))
+#define XPC_CRC_TABLE_C5 (XPC_CRC_TABLE_T(0, 5) ^ XPC_CRC_TABLE_T(1, 4) \
+    ^ XPC_CRC_TABLE_T(2, 3) ^ XPC_CRC_TABLE_T(3, 2) ^ XPC_CRC_TABLE_T(4, 1) \
+    ^ XPC_CRC_TABLE_T(5, 0))
+#define XPC_CRC_TABLE_C6 (XPC_CRC_TABLE_T(0, 6) ^ XPC_CRC_TABLE_T(1, 5) \
+    ^ XPC_CRC_TABLE_T(2, 4) ^ XPC_CRC_TABLE_T(3, 3) ^ XPC_CRC_TABLE_T(4, 2) \
+    ^ XPC_CRC_TABLE_T(5, 1) ^ XPC_CRC_TABLE_T(6, 0))
+#define XPC_CRC_TABLE_C7 (XPC_CRC_TABLE_T(0, 7) ^ XPC_CRC_TABLE_T(1, 6) \
+    ^ XPC_CRC_TABLE_T(2, 5) ^ XPC_CRC_TABLE_T(3, 4) ^ XPC_CRC_TABLE_T(4, 3) \
+    ^ XPC_CRC_TABLE_T(5, 2) ^ XPC_CRC_TABLE_T(6, 1) ^ XPC_CRC_TABLE_T(7, 0))
+
+// entry for index bit i.  Reflected, bit 7 is shifted out first.
+#if XPC_CRC_TABLE_REFLECTED
+#define XPC_CRC_TABLE_B(n, i, j) (((n) >> (i)) & 1 ? XPC_CRC_TABLE_C##j:0)
+#define XPC_CRC_TABLE_E(n) ( \
+    XPC_CRC_TABLE_B(n, 0, 7) ^ XPC_CRC_TABLE_B(n, 1, 6) \
+    ^ XPC_CRC_TABLE_B(n, 2, 5) ^ XPC_CRC_TABLE_B(n, 3, 4) \
+    ^ XPC_CRC_TABLE_B(n, 4, 3) ^ XPC_CRC_TABLE_B(n, 5, 2) \
+    ^ XPC_CRC_TABLE_B(n, 6, 1) ^ XPC_CRC_TABLE_B(n, 7, 0))
+#else
+#define XPC_CRC_TABLE_B(n, i, j) (((n) >> (i)) & 1 ? XPC_CRC_TABLE_C##j:0)
+#define XPC_CRC_TABLE_E(n) ( \
+    XPC_CRC_TABLE_B(n, 0, 0) ^ XPC_CRC_TABLE_B(n, 1, 1) \
+    ^ XPC_CRC_TABLE_B(n, 2, 2) ^ XPC_CRC_TABLE_B(n, 3, 3) \
+    ^ XPC_CRC_TABLE_B(n, 4, 4) ^ XPC_CRC_TABLE_B(n, 5, 5) \
+    ^ XPC_CRC_TABLE_B(n, 6, 6) ^ XPC_CRC_TABLE_B(n, 7, 7))
+#endif
+
+#define XPC_CRC_TABLE_R4(n) XPC_CRC_TABLE_E(n), XPC_CRC_TABLE_E(n + 1), \
+    XPC_CRC_TABLE_E(n + 2), XPC_CRC_TABLE_E(n + 3)
+#define XPC_CRC_TABLE_R16(n) XPC_CRC_TABLE_R4(n), XPC_CRC_TABLE_R4(n + 4), \
+    XPC_CRC_TABLE_R4(n + 8), XPC_CRC_TABLE_R4(n + 12)
+#define XPC_CRC_TABLE_R64(n) XPC_CRC_TABLE_R16(n), XPC_CRC_TABLE_R16(n + 16), \
+    XPC_CRC_TABLE_R16(n + 32), XPC_CRC_TABLE_R16(n + 48)
+
+static const uint64_t XPC_CRC_TABLE_NAME[256] = {
+    XPC_CRC_TABLE_R64(0), XPC_CRC_TABLE_R64(64),
+    XPC_CRC_TABLE_R64(128), XPC_CRC_TABLE_R64(192)
+};
+
+#undef XPC_CRC_TABLE_R64
+#undef XPC_CRC_TABLE_R16
+#undef XPC_CRC_TABLE_R4
+#undef XPC_CRC_TABLE_E
+#undef XPC_CRC_TABLE_B
+#undef XPC_CRC_TABLE_C7
+#undef XPC_CRC_TABLE_C6
+#undef XPC_CRC_TABLE_C5
+#undef XPC_CRC_TABLE_C4
+#undef XPC_CRC_TABLE_C3
+#undef XPC_CRC_TABLE_C2
+#undef XPC_CRC_TABLE_C1
+#undef XPC_CRC_TABLE_C0
+#undef XPC_CRC_TABLE_T
+#undef XPC_CRC_TABLE_G7
+#undef XPC_CRC_TABLE_G6
+#undef XPC_CRC_TABLE_G5
+#undef XPC_CRC_TABLE_G4
+#undef XPC_CRC_TABLE_G3
+#undef XPC_CRC_TABLE_G2
+#undef XPC_CRC_TABLE_G1
+#undef XPC_CRC_TABLE_G0
+#undef XPC_CRC_TABLE_SHIFT
+#undef XPC_CRC_TABLE_TAP
+#undef XPC_CRC_TABLE_MASK
+#undef XPC_CRC_TABLE_REFLECTED
+#undef XPC_CRC_TABLE_POLYN
+#undef XPC_CRC_TABLE_WIDTH
+#undef XPC_CRC_TABLE_NAME
@@ -0,0 +1,547 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <tinyxpc/xpc_relay.h>
+#include <tinyxpc/xpc_reactor.h>
+
+// events taken from epoll per call
+#define XPC_REACTOR_BATCH 256
+// rounds of read/parse/write per connection before others get a turn
+#define XPC_REACTOR_ROUNDS 16
+
+static void xpc_reactor_enqueue(xpc_reactor_conn_t *conn) {
+    xpc_reactor_t *self = conn->reactor;
+    if(self == NULL || conn->queued) {
+        return;
+    }
+    conn->queued = true;
+    conn->next_ready = NULL;
+    if(self->ready_tail == NULL) {
+        self->ready_head = conn;
+    }
+    else {
+        self->ready_tail->next_ready = conn;
+    }
+    self->ready_tail = conn;
+}
+
+static xpc_reactor_conn_t *xpc_reactor_dequeue(xpc_reactor_t *self) {
+    xpc_reactor_conn_t *conn = self->ready_head;
+    if(conn != NULL) {
+        self->ready_head = conn->next_ready;
+        if(self->ready_head == NULL) {
+            self->ready_tail = NULL;
+        }
+        conn->queued = false;
+        conn->next_ready = NULL;
+    }
+    return conn;
+}
+
+static void xpc_reactor_fail(xpc_reactor_conn_t *conn) {
+    // closed from the ready list, never from inside an epoll batch, so that
+    // close_cb may free the connection.
+    conn->closed = true;
+    xpc_reactor_enqueue(conn);
+}
+
+static int xpc_reactor_nonblock(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if(flags == -1) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// ========= IO FUNCTIONS =========
+int xpc_reactor_write(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+    xpc_reactor_conn_t *conn = (xpc_reactor_conn_t*)io_ctx;
+    ssize_t bytes = write(conn->wr_fd, *buffer + offset, bytes_max);
+    if(bytes < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            conn->writable = false;
+        }
+        else if(errno != EINTR) {
+            xpc_reactor_fail(conn);
+        }
+        bytes = 0;
+    }
+    return bytes;
+}
+
+int xpc_reactor_writev(void *io_ctx, xpc_iovec_t *iov, int iovcnt) {
+    xpc_reactor_conn_t *conn = (xpc_reactor_conn_t*)io_ctx;
+    // xpc_iovec_t is laid out like struct iovec
+    ssize_t bytes = writev(conn->wr_fd, (struct iovec*)iov, iovcnt);
+    if(bytes < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            conn->writable = false;
+        }
+        else if(errno != EINTR) {
+            xpc_reactor_fail(conn);
+        }
+        bytes = 0;
+    }
+    return bytes;
+}
+
+void xpc_reactor_io_reset(void *io_ctx, int which, size_t bytes) {
+    xpc_reactor_conn_t *conn = (xpc_reactor_conn_t*)io_ctx;
+    if(!which) {
+        // frames are written straight from the relay, nothing is buffered
+        return;
+    }
+    if(bytes != (size_t)-1) {
+        // a lease was released, oldest bytes first
+        conn->rx_head += bytes;
+    }
+    else if(conn->relay->rd_span.buf != NULL) {
+        // everything up to the end of the frame being fed
+        conn->rx_head = conn->relay->rd_span.buf - conn->rx_buf
+            + conn->relay->rd_span.pos;
+    }
+    else {
+        conn->rx_head = conn->rx_parse;
+    }
+    if(conn->rx_tail == conn->rx_cap) {
+        // reading may have stopped for want of space
+        xpc_reactor_enqueue(conn);
+    }
+}
+
+void xpc_reactor_io_notify(void *io_ctx, int which, bool enable) {
+    xpc_reactor_conn_t *conn = (xpc_reactor_conn_t*)io_ctx;
+    if(which) {
+        conn->want_write = enable;
+        if(enable && conn->writable) {
+            // epoll will not report a descriptor that stays writable
+            xpc_reactor_enqueue(conn);
+        }
+    }
+    else {
+        conn->want_read = enable;
+        if(enable && (conn->readable || conn->rx_parse < conn->rx_tail)) {
+            xpc_reactor_enqueue(conn);
+        }
+    }
+}
+// ========= END IO FUNCTIONS =========
+
+/**
+ * Read as much as fits into the receive buffer.
+ * @return true if bytes were read.
+ */
+static bool xpc_reactor_receive(xpc_reactor_conn_t *conn) {
+    if(conn->rx_head == conn->rx_tail) {
+        conn->rx_head = conn->rx_parse = conn->rx_tail = 0;
+    }
+    else if(conn->rx_tail == conn->rx_cap && conn->rx_head == conn->rx_parse
+            && conn->rx_head > 0) {
+        // nothing is leased, move the partial frame to the front
+        memmove(
+            conn->rx_buf, conn->rx_buf + conn->rx_parse,
+            conn->rx_tail - conn->rx_parse
+        );
+        conn->rx_tail -= conn->rx_parse;
+        conn->rx_head = conn->rx_parse = 0;
+    }
+    if(conn->rx_tail == conn->rx_cap) {
+        // wait for leases to be released
+        return false;
+    }
+    ssize_t bytes = read(
+        conn->rd_fd, conn->rx_buf + conn->rx_tail, conn->rx_cap - conn->rx_tail
+    );
+    if(bytes > 0) {
+        conn->rx_tail += bytes;
+        return true;
+    }
+    if(bytes == 0) {
+        xpc_reactor_fail(conn);
+    }
+    else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+        conn->readable = false;
+    }
+    else if(errno != EINTR) {
+        xpc_reactor_fail(conn);
+    }
+    return false;
+}
+
+/**
+ * Run the relay over the connection until it stops making progress or has
+ * used up its turn.
+ * @return true if the turn was used up with work left.
+ */
+static bool xpc_reactor_service(xpc_reactor_conn_t *conn) {
+    xpc_relay_state_t *relay = conn->relay;
+    for(int round = 0; round < XPC_REACTOR_ROUNDS; round++) {
+        bool progress = false;
+        if(conn->closed) {
+            return false;
+        }
+        if(conn->want_read) {
+            if(conn->readable) {
+                progress |= xpc_reactor_receive(conn);
+            }
+            // also runs the read state machine when it waits on the write
+            // one, e.g. for a reset reply to go out.
+            size_t consumed = xpc_relay_feed(
+                relay, conn->rx_buf + conn->rx_parse,
+                conn->rx_tail - conn->rx_parse
+            );
+            conn->rx_parse += consumed;
+            progress |= consumed > 0;
+        }
+        if(conn->want_write && conn->writable) {
+            int starting_state = relay->inflight_wr_op.op;
+            int starting_bytes = relay->inflight_wr_op.bytes_complete;
+            xpc_wr_op_continue(relay);
+            progress |= relay->inflight_wr_op.op != starting_state
+                || relay->inflight_wr_op.bytes_complete != starting_bytes;
+        }
+        if(!progress) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ========= TIMER WHEEL =========
+static void xpc_reactor_disarm(xpc_reactor_conn_t *conn) {
+    xpc_reactor_t *self = conn->reactor;
+    if(!conn->armed) {
+        return;
+    }
+    if(conn->timer_prev != NULL) {
+        conn->timer_prev->timer_next = conn->timer_next;
+    }
+    else {
+        self->wheel[conn->timer_slot] = conn->timer_next;
+    }
+    if(conn->timer_next != NULL) {
+        conn->timer_next->timer_prev = conn->timer_prev;
+    }
+    conn->timer_prev = conn->timer_next = NULL;
+    conn->armed = false;
+}
+
+/**
+ * File a connection under the first tick at or after at, at least the next
+ * one.  Past a turn of the wheel, it comes up early and is filed again.
+ */
+static void xpc_reactor_file(xpc_reactor_conn_t *conn, uint32_t at, uint32_t now) {
+    xpc_reactor_t *self = conn->reactor;
+    int32_t wait = (int32_t)(at - now);
+    uint32_t ticks = wait > 0 ? ((uint32_t)wait + self->tick_ms - 1) / self->tick_ms:1;
+    if(ticks >= XPC_REACTOR_WHEEL) {
+        ticks = XPC_REACTOR_WHEEL - 1;
+    }
+    if(ticks == 0) {
+        ticks = 1;
+    }
+    conn->timer_at = at;
+    conn->timer_slot = (self->wheel_pos + ticks) & (XPC_REACTOR_WHEEL - 1);
+    conn->timer_prev = NULL;
+    conn->timer_next = self->wheel[conn->timer_slot];
+    if(conn->timer_next != NULL) {
+        conn->timer_next->timer_prev = conn;
+    }
+    self->wheel[conn->timer_slot] = conn;
+    conn->armed = true;
+}
+
+/**
+ * Re-arm a connection for its relay's next deadline, after servicing it.
+ */
+static void xpc_reactor_arm(xpc_reactor_conn_t *conn) {
+    uint32_t at = 0;
+    bool pending = conn->reactor->tick_ms
+        && xpc_relay_next_deadline(conn->relay, &at);
+    if(conn->armed && pending && at == conn->timer_at) {
+        return;
+    }
+    xpc_reactor_disarm(conn);
+    if(pending) {
+        xpc_reactor_file(conn, at, xpc_reactor_clock(NULL));
+    }
+}
+
+static void xpc_reactor_tick(xpc_reactor_t *self) {
+    uint64_t expirations = 0;
+    if(read(self->timer_fd, &expirations, sizeof(expirations)) < 0) {
+        return;
+    }
+    uint32_t now = xpc_reactor_clock(NULL);
+    // a late tick covers every slot it skipped, up to a turn of the wheel
+    for(uint64_t i = 0; i < expirations && i < XPC_REACTOR_WHEEL; i++) {
+        self->wheel_pos = (self->wheel_pos + 1) & (XPC_REACTOR_WHEEL - 1);
+        xpc_reactor_conn_t *conn = self->wheel[self->wheel_pos];
+        self->wheel[self->wheel_pos] = NULL;
+        while(conn != NULL) {
+            xpc_reactor_conn_t *next = conn->timer_next;
+            conn->armed = false;
+            conn->timer_prev = conn->timer_next = NULL;
+            if((int32_t)(now - conn->timer_at) >= 0) {
+                // timers are checked by the state machines as they run
+                conn->want_write = true;
+                xpc_reactor_enqueue(conn);
+            }
+            else {
+                xpc_reactor_file(conn, conn->timer_at, now);
+            }
+            conn = next;
+        }
+    }
+    if(self->tick_cb != NULL) {
+        self->tick_cb(self, self->tick_ctx);
+    }
+}
+// ========= END TIMER WHEEL =========
+
+xpc_reactor_t *xpc_reactor_init(
+    xpc_reactor_t *target, uint32_t tick_ms,
+    xpc_reactor_tick_fn *tick_cb, void *tick_ctx
+) {
+    if(target == NULL) goto done;
+    *target = (xpc_reactor_t){
+        .epoll_fd = -1, .timer_fd = -1, .tick_ms = tick_ms,
+        .tick_cb = tick_cb, .tick_ctx = tick_ctx
+    };
+    target->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(target->epoll_fd == -1) {
+        target = NULL;
+        goto done;
+    }
+    if(tick_ms) {
+        target->timer_fd = timerfd_create(
+            CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC
+        );
+        struct timespec period = {
+            .tv_sec = tick_ms / 1000, .tv_nsec = (tick_ms % 1000) * 1000000L
+        };
+        struct itimerspec spec = {.it_interval = period, .it_value = period};
+        // the timer is the only registration with a NULL pointer
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+        if(target->timer_fd == -1
+                || timerfd_settime(target->timer_fd, 0, &spec, NULL) == -1
+                || epoll_ctl(
+                    target->epoll_fd, EPOLL_CTL_ADD, target->timer_fd, &event
+                ) == -1) {
+            xpc_reactor_destroy(target);
+            target = NULL;
+            goto done;
+        }
+    }
+done:
+    return target;
+}
+
+void xpc_reactor_destroy(xpc_reactor_t *self) {
+    if(self == NULL) {
+        return;
+    }
+    if(self->timer_fd != -1) {
+        close(self->timer_fd);
+        self->timer_fd = -1;
+    }
+    if(self->epoll_fd != -1) {
+        close(self->epoll_fd);
+        self->epoll_fd = -1;
+    }
+}
+
+xpc_reactor_conn_t *xpc_reactor_conn_config(
+    xpc_reactor_conn_t *target, xpc_relay_state_t *relay,
+    int rd_fd, int wr_fd, char *rx_buf, size_t rx_cap,
+    void *msg_ctx, void *crc_ctx, dispatch_fn *msg_handle_cb,
+    crc_fn *crc, crc_polyn_config *crc_config
+) {
+    if(target == NULL) goto done;
+    if(relay == NULL || rd_fd < 0 || wr_fd < 0 || rx_buf == NULL || rx_cap == 0) {
+        target = NULL;
+        goto done;
+    }
+    *target = (xpc_reactor_conn_t){
+        .relay = relay, .rd_fd = rd_fd, .wr_fd = wr_fd,
+        .rx_buf = rx_buf, .rx_cap = rx_cap, .want_read = true
+    };
+    // frames are parsed with xpc_relay_feed, there is no read wrapper
+    xpc_relay_config(
+        relay, target, msg_ctx, crc_ctx,
+        xpc_reactor_write, NULL, xpc_reactor_io_reset, xpc_reactor_io_notify,
+        msg_handle_cb, crc, crc_config
+    );
+    xpc_relay_config_writev(relay, xpc_reactor_writev);
+done:
+    return target;
+}
+
+xpc_reactor_conn_t *xpc_reactor_add(
+    xpc_reactor_t *self, xpc_reactor_conn_t *conn, xpc_reactor_close_fn *close_cb
+) {
+    if(self == NULL || conn == NULL || conn->reactor != NULL) {
+        return NULL;
+    }
+    if(xpc_reactor_nonblock(conn->rd_fd) == -1
+            || xpc_reactor_nonblock(conn->wr_fd) == -1) {
+        return NULL;
+    }
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLRDHUP | EPOLLET, .data.ptr = conn
+    };
+    if(conn->wr_fd == conn->rd_fd) {
+        event.events |= EPOLLOUT;
+    }
+    if(epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, conn->rd_fd, &event) == -1) {
+        return NULL;
+    }
+    if(conn->wr_fd != conn->rd_fd) {
+        event.events = EPOLLOUT | EPOLLET;
+        if(epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, conn->wr_fd, &event) == -1) {
+            epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, conn->rd_fd, NULL);
+            return NULL;
+        }
+    }
+    conn->reactor = self;
+    conn->close_cb = close_cb;
+    conn->closed = false;
+    conn->armed = false;
+    conn->prev = NULL;
+    conn->next = self->conns;
+    if(self->conns != NULL) {
+        self->conns->prev = conn;
+    }
+    self->conns = conn;
+    self->count++;
+    return conn;
+}
+
+void xpc_reactor_remove(xpc_reactor_t *self, xpc_reactor_conn_t *conn) {
+    if(self == NULL || conn == NULL || conn->reactor != self) {
+        return;
+    }
+    epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, conn->rd_fd, NULL);
+    if(conn->wr_fd != conn->rd_fd) {
+        epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, conn->wr_fd, NULL);
+    }
+    if(conn->queued) {
+        xpc_reactor_conn_t **link = &self->ready_head;
+        xpc_reactor_conn_t *prev = NULL;
+        while(*link != conn) {
+            prev = *link;
+            link = &(*link)->next_ready;
+        }
+        *link = conn->next_ready;
+        if(self->ready_tail == conn) {
+            self->ready_tail = prev;
+        }
+        conn->queued = false;
+    }
+    xpc_reactor_disarm(conn);
+    if(conn->prev != NULL) {
+        conn->prev->next = conn->next;
+    }
+    else {
+        self->conns = conn->next;
+    }
+    if(conn->next != NULL) {
+        conn->next->prev = conn->prev;
+    }
+    conn->prev = conn->next = NULL;
+    conn->reactor = NULL;
+    self->count--;
+}
+
+int xpc_reactor_run_once(xpc_reactor_t *self, int timeout_ms) {
+    struct epoll_event events[XPC_REACTOR_BATCH];
+    if(self == NULL) {
+        return -1;
+    }
+    if(self->ready_head != NULL) {
+        timeout_ms = 0;
+    }
+    int count = epoll_wait(self->epoll_fd, events, XPC_REACTOR_BATCH, timeout_ms);
+    if(count == -1) {
+        if(errno != EINTR) {
+            return -1;
+        }
+        count = 0;
+    }
+    // no callbacks are made while walking the batch: one could remove and
+    // free a connection with an event further on.
+    bool ticked = false;
+    for(int i = 0; i < count; i++) {
+        xpc_reactor_conn_t *conn = (xpc_reactor_conn_t*)events[i].data.ptr;
+        if(conn == NULL) {
+            ticked = true;
+            continue;
+        }
+        uint32_t flags = events[i].events;
+        if(flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            conn->readable = true;
+        }
+        if(flags & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            // errors are picked up by the next write
+            conn->writable = true;
+        }
+        xpc_reactor_enqueue(conn);
+    }
+    if(ticked) {
+        // removing a connection takes it off the ready list
+        xpc_reactor_tick(self);
+    }
+
+    // connections queued during this pass wait for the next one
+    size_t pending = 0;
+    for(xpc_reactor_conn_t *conn = self->ready_head; conn; conn = conn->next_ready) {
+        pending++;
+    }
+    while(pending-- && self->ready_head != NULL) {
+        xpc_reactor_conn_t *conn = xpc_reactor_dequeue(self);
+        bool more = xpc_reactor_service(conn);
+        if(conn->closed) {
+            xpc_reactor_remove(self, conn);
+            if(conn->close_cb != NULL) {
+                conn->close_cb(conn);
+            }
+        }
+        else {
+            xpc_reactor_arm(conn);
+            if(more) {
+                xpc_reactor_enqueue(conn);
+            }
+        }
+    }
+    return count;
+}
+
+int xpc_reactor_run(xpc_reactor_t *self) {
+    int status = 0;
+    while(!self->stop) {
+        if(xpc_reactor_run_once(self, -1) == -1) {
+            status = -1;
+            break;
+        }
+    }
+    self->stop = false;
+    return status;
+}
+
+void xpc_reactor_stop(xpc_reactor_t *self) {
+    self->stop = true;
+}
+
+uint32_t xpc_reactor_clock(void *clock_ctx) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
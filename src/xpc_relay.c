@@ -6,9 +6,129 @@
 // notes:
 //  - we can make resets/flow controls async by calling io_reset mid-msg, but
 //  that would be living life dangerously.
-//  - crc_bits >> 3 is wrong.  Consider the case of a 33 bit crc.
 //  - crc_config should support seed settings, inversion, byte swapping...
 
+// ========= TRACING =========
+// XPC_TRACE(self, probe, event, a, b) marks a tracepoint.  probe is the USDT
+// probe name, event the matching xpc_trace_event_t.
+#if defined(XPC_RELAY_TRACE_USDT)
+#include <sys/sdt.h>
+#define XPC_TRACE(self, probe, event, a, b) \
+    DTRACE_PROBE3(tinyxpc, probe, (self), (int32_t)(a), (int32_t)(b))
+#elif defined(XPC_RELAY_TRACE_RING)
+static void xpc_trace_emit(
+        xpc_relay_state_t *self, xpc_trace_event_t event, int32_t a, int32_t b) {
+    struct xpc_trace_ring_t *ring = &self->trace;
+    if(ring->records == NULL) {
+        return;
+    }
+    ring->records[ring->count & (ring->capacity - 1)] = (xpc_trace_rec_t){
+        .time = ring->clock != NULL ? ring->clock(ring->clock_ctx):0,
+        .event = event, .a = a, .b = b
+    };
+    ring->count++;
+}
+#define XPC_TRACE(self, probe, event, a, b) \
+    xpc_trace_emit((self), (event), (int32_t)(a), (int32_t)(b))
+#else
+#define XPC_TRACE(self, probe, event, a, b) ((void)0)
+#endif
+// ========= END TRACING =========
+
+// ========= BINDINGS =========
+// Calls out of the relay go through the function pointers it was configured
+// with, unless XPC_RELAY_BIND names a header binding them at compile time
+// (see "Compile time bindings" in xpc_relay.h).  A bound call is a direct
+// one the compiler can inline, and a bound CRC width folds to constants.
+#if defined(XPC_RELAY_BIND)
+#include XPC_RELAY_BIND
+#endif
+#if defined(XPC_BIND_WRITE)
+#define XPC_HAS_WRITE(self) true
+#define XPC_IO_WRITE(self, buffer, offset, bytes_max) \
+    XPC_BIND_WRITE((self)->io_ctx, (buffer), (offset), (bytes_max))
+#else
+#define XPC_HAS_WRITE(self) ((self)->write != NULL)
+#define XPC_IO_WRITE(self, buffer, offset, bytes_max) \
+    (self)->write((self)->io_ctx, (buffer), (offset), (bytes_max))
+#endif
+#if defined(XPC_BIND_WRITEV)
+#define XPC_HAS_WRITEV(self) true
+#define XPC_IO_WRITEV(self, iov, iovcnt) \
+    XPC_BIND_WRITEV((self)->io_ctx, (iov), (iovcnt))
+#else
+#define XPC_HAS_WRITEV(self) ((self)->writev != NULL)
+#define XPC_IO_WRITEV(self, iov, iovcnt) \
+    (self)->writev((self)->io_ctx, (iov), (iovcnt))
+#endif
+#if defined(XPC_BIND_READ)
+#define XPC_HAS_READ(self) true
+#define XPC_IO_READ(self, buffer, offset, bytes_max) \
+    XPC_BIND_READ((self)->io_ctx, (buffer), (offset), (bytes_max))
+#else
+#define XPC_HAS_READ(self) ((self)->read != NULL)
+#define XPC_IO_READ(self, buffer, offset, bytes_max) \
+    (self)->read((self)->io_ctx, (buffer), (offset), (bytes_max))
+#endif
+#if defined(XPC_BIND_IO_RESET)
+#define XPC_IO_RESET(self, which, bytes) \
+    XPC_BIND_IO_RESET((self)->io_ctx, (which), (bytes))
+#else
+#define XPC_IO_RESET(self, which, bytes) \
+    (self)->io_reset((self)->io_ctx, (which), (bytes))
+#endif
+#if defined(XPC_BIND_IO_NOTIFY)
+#define XPC_IO_NOTIFY(self, which, enable) \
+    XPC_BIND_IO_NOTIFY((self)->io_ctx, (which), (enable))
+#else
+#define XPC_IO_NOTIFY(self, which, enable) \
+    (self)->io_notify((self)->io_ctx, (which), (enable))
+#endif
+#if defined(XPC_BIND_DISPATCH)
+#define XPC_DISPATCH(self, msg_hdr, payload) \
+    XPC_BIND_DISPATCH((self)->msg_ctx, (msg_hdr), (payload))
+#else
+#define XPC_DISPATCH(self, msg_hdr, payload) \
+    (self)->dispatch_cb((self)->msg_ctx, (msg_hdr), (payload))
+#endif
+#if defined(XPC_BIND_CRC)
+#define XPC_HAS_CRC(self) true
+#define XPC_CRC(self, buf, bytes) XPC_BIND_CRC((self)->crc_ctx, (buf), (bytes))
+#else
+#define XPC_HAS_CRC(self) ((self)->crc != NULL)
+#define XPC_CRC(self, buf, bytes) (self)->crc((self)->crc_ctx, (buf), (bytes))
+#endif
+#if defined(XPC_BIND_CRC_CONFIG)
+#define XPC_CRC_CONFIG(self, crc_bits, polyn) \
+    XPC_BIND_CRC_CONFIG((self)->crc_ctx, (crc_bits), (polyn))
+#else
+#define XPC_CRC_CONFIG(self, crc_bits, polyn) \
+    (self)->crc_config((self)->crc_ctx, (crc_bits), (polyn))
+#endif
+// the running crc is bound as a whole, or not at all
+#if defined(XPC_BIND_CRC_UPDATE)
+#define XPC_HAS_CRC_UPDATE(self) true
+#define XPC_CRC_INIT(self) XPC_BIND_CRC_INIT((self)->crc_ctx)
+#define XPC_CRC_UPDATE(self, crc, buf, bytes) \
+    XPC_BIND_CRC_UPDATE((self)->crc_ctx, (crc), (buf), (bytes))
+#define XPC_CRC_FINALIZE(self, crc, out) \
+    XPC_BIND_CRC_FINALIZE((self)->crc_ctx, (crc), (out))
+#else
+#define XPC_HAS_CRC_UPDATE(self) ((self)->crc_update != NULL)
+#define XPC_CRC_INIT(self) (self)->crc_init((self)->crc_ctx)
+#define XPC_CRC_UPDATE(self, crc, buf, bytes) \
+    (self)->crc_update((self)->crc_ctx, (crc), (buf), (bytes))
+#define XPC_CRC_FINALIZE(self, crc, out) \
+    (self)->crc_finalize((self)->crc_ctx, (crc), (out))
+#endif
+// the CRC width in use: 0 until a config turns CRCs on, then the bound width
+#if defined(XPC_BIND_CRC_BITS)
+#define XPC_CRC_WIDTH(self) ((self)->conn_config.crc_bits ? XPC_BIND_CRC_BITS:0)
+#else
+#define XPC_CRC_WIDTH(self) ((self)->conn_config.crc_bits)
+#endif
+// ========= END BINDINGS =========
+
 xpc_relay_state_t *xpc_relay_config(
     xpc_relay_state_t *target, void *io_ctx, void *msg_ctx, void *crc_ctx,
     io_wrap_fn *write, io_wrap_fn *read, io_reset_fn *reset,
@@ -25,55 +145,1757 @@ xpc_relay_state_t *xpc_relay_config(
     // function pointers
     target->write = write;
     target->read = read;
+    target->writev = NULL;
     target->io_reset = reset;
     target->io_notify = io_notify;
     target->dispatch_cb = msg_handle_cb;
     target->crc = crc;
     target->crc_config = crc_config;
+    target->crc_init = NULL;
+    target->crc_update = NULL;
+    target->crc_finalize = NULL;
+    target->clock = NULL;
+    target->clock_ctx = NULL;
+    target->ack_cb = NULL;
     // write operation
     target->inflight_wr_op.op = TXPC_OP_NONE;
     target->inflight_wr_op.total_bytes = 0;
     target->inflight_wr_op.bytes_complete = 0;
     target->inflight_wr_op.msg_hdr = (txpc_hdr_t){0};
     target->inflight_wr_op.buf = NULL;
+    target->inflight_wr_op.iov = NULL;
+    target->inflight_wr_op.iovcnt = 0;
+    target->inflight_wr_op.crc = NULL;
     // read operation
     target->inflight_rd_op.op = TXPC_OP_NONE;
     target->inflight_rd_op.total_bytes = 0;
     target->inflight_rd_op.bytes_complete = 0;
     target->inflight_rd_op.msg_hdr = (txpc_hdr_t){0};
     target->inflight_rd_op.buf = NULL;
+    target->inflight_rd_op.iov = NULL;
+    target->inflight_rd_op.iovcnt = 0;
+    target->inflight_rd_op.crc = NULL;
+    target->rd_span = (struct xpc_span_t){0};
+    // transmit queue, disabled until storage is provided
+    target->tx_queue = (struct xpc_txq_t){0};
+    // acknowledged mode, no send window until storage is provided
+    target->ack = (struct xpc_ack_window_t){0};
+    // fixed retransmission timeout, partial frames wait forever
+    target->timers = (struct xpc_timers_t){0};
+    // receive leases, disabled until storage is provided
+    target->leases = (struct xpc_leases_t){0};
+    // no stream being sent, received streams discarded
+    target->stream_tx = (struct xpc_stream_tx_t){0};
+    target->stream_cb = NULL;
+    target->stream_rx = 0;
+    // no channels until storage is provided
+    target->channels = (struct xpc_channels_t){0};
+    // flow on, no watermarks
+    target->flow = (struct xpc_flow_t){0};
+    // frames written directly
+    target->coalesce = (struct xpc_coalesce_t){0};
     // signal config
     target->signals = 0;
+#ifdef XPC_RELAY_STATS
+    target->stats = (struct xpc_stats_block_t){0};
+#endif
+#ifdef XPC_RELAY_TRACE_RING
+    // not recording until storage is provided
+    target->trace = (struct xpc_trace_ring_t){0};
+#endif
+done:
+    return target;
+}
+
+xpc_relay_state_t *xpc_relay_config_writev(
+    xpc_relay_state_t *target, io_wrapv_fn *writev
+) {
+    if(target == NULL) goto done;
+    target->writev = writev;
+done:
+    return target;
+}
+
+xpc_relay_state_t *xpc_relay_config_crc_incremental(
+    xpc_relay_state_t *target, crc_init_fn *init, crc_update_fn *update,
+    crc_finalize_fn *finalize
+) {
+    if(target == NULL) goto done;
+    if(init == NULL || update == NULL || finalize == NULL) {
+        target = NULL;
+        goto done;
+    }
+    target->crc_init = init;
+    target->crc_update = update;
+    target->crc_finalize = finalize;
+done:
+    return target;
+}
+
+/**
+ * Whether the running crc is used.  The finalized bytes are kept in crc_out,
+ * which limits it to CRCs of up to 64 bits.
+ */
+static bool xpc_crc_incremental(xpc_relay_state_t *self) {
+    return XPC_HAS_CRC_UPDATE(self) && XPC_CRC_WIDTH(self) <= 64;
+}
+
+/**
+ * Fold payload bytes start to end into a running crc, walking the segments
+ * of a scattered payload.
+ */
+static uint64_t xpc_crc_payload(
+        xpc_relay_state_t *self, struct xpc_sm_t *op, uint64_t crc,
+        size_t start, size_t end) {
+    if(op->iov == NULL) {
+        return XPC_CRC_UPDATE(self, crc, op->buf + start, end - start);
+    }
+    size_t seg_start = 0;
+    for(int i = 0; i < op->iovcnt && seg_start < end; i++) {
+        size_t seg_end = seg_start + op->iov[i].len;
+        if(seg_end > start) {
+            size_t from = start > seg_start ? start:seg_start;
+            size_t to = end < seg_end ? end:seg_end;
+            crc = XPC_CRC_UPDATE(
+                self, crc, op->iov[i].base + (from - seg_start), to - from
+            );
+        }
+        seg_start = seg_end;
+    }
+    return crc;
+}
+
+/**
+ * Fold the payload bytes in a range of a frame into the running crc of a
+ * state machine.  The range is in frame offsets (header included), and
+ * whatever part of it lies outside the payload is ignored.
+ */
+static void xpc_crc_fold(
+        xpc_relay_state_t *self, struct xpc_sm_t *op,
+        size_t from, size_t bytes) {
+    size_t start = from > sizeof(txpc_hdr_t) ? from - sizeof(txpc_hdr_t):0;
+    size_t end = from + bytes > sizeof(txpc_hdr_t) ?
+        from + bytes - sizeof(txpc_hdr_t):0;
+    if(end > op->msg_hdr.size) {
+        end = op->msg_hdr.size;
+    }
+    if(start < end) {
+        XPC_TRACE(self, crc, XPC_TRACE_CRC,
+            op == &self->inflight_rd_op, end - start);
+        op->crc_state = xpc_crc_payload(self, op, op->crc_state, start, end);
+    }
+}
+
+/**
+ * Compute the crc of a whole payload in one go.
+ * @return storage location of the computed CRC.
+ */
+static char *xpc_crc_whole(xpc_relay_state_t *self, struct xpc_sm_t *op) {
+    XPC_TRACE(self, crc, XPC_TRACE_CRC,
+        op == &self->inflight_rd_op, op->msg_hdr.size);
+    if(!xpc_crc_incremental(self)) {
+        // never a scattered payload, see xpc_scattered_pending
+        return XPC_CRC(self, op->buf, op->msg_hdr.size);
+    }
+    op->crc_state = xpc_crc_payload(
+        self, op, XPC_CRC_INIT(self), 0, op->msg_hdr.size
+    );
+    XPC_CRC_FINALIZE(self, op->crc_state, op->crc_out);
+    return op->crc_out;
+}
+
+// the longest trailer covered by the crc of a frame
+#define XPC_TRAILER_MAX (XPC_STREAM_TRAILER > XPC_FRAG_TRAILER ? \
+    XPC_STREAM_TRAILER:XPC_FRAG_TRAILER)
+
+/**
+ * Extend the crc of a payload over the trailer which follows it on the wire.
+ * The frame then carries the crc of the payload crc followed by the trailer,
+ * which crc_fn computes as well as the running crc, without the payload and
+ * trailer having to be contiguous.
+ * @param crc the crc of the payload.
+ * @return storage location of the CRC of the frame, crc if there is no
+ * trailer.
+ */
+static char *xpc_crc_seal(
+        xpc_relay_state_t *self, struct xpc_sm_t *op, char *crc,
+        const char *trailer, size_t trailer_bytes) {
+    char seal[XPC_CRC_BYTES(255) + XPC_TRAILER_MAX];
+    size_t bytes = 0;
+    if(trailer_bytes == 0) {
+        return crc;
+    }
+    for(size_t i = 0; i < XPC_CRC_BYTES(XPC_CRC_WIDTH(self)); i++) {
+        seal[bytes++] = crc[i];
+    }
+    for(size_t i = 0; i < trailer_bytes; i++) {
+        seal[bytes++] = trailer[i];
+    }
+    if(!xpc_crc_incremental(self)) {
+        return XPC_CRC(self, seal, bytes);
+    }
+    XPC_CRC_FINALIZE(
+        self, XPC_CRC_UPDATE(self, XPC_CRC_INIT(self), seal, bytes),
+        op->crc_out
+    );
+    return op->crc_out;
+}
+
+/**
+ * Keep a crc to be written with the write state machine.  crc_fn may hand
+ * back storage which the read side reuses before a short write has sent all
+ * of it; CRCs wider than crc_out are left there.
+ * @return storage location of the CRC.
+ */
+static char *xpc_crc_keep(
+        xpc_relay_state_t *self, struct xpc_sm_t *op, char *crc) {
+    size_t bytes = XPC_CRC_BYTES(XPC_CRC_WIDTH(self));
+    if(crc == op->crc_out || bytes > sizeof(op->crc_out)) {
+        return crc;
+    }
+    for(size_t i = 0; i < bytes; i++) {
+        op->crc_out[i] = crc[i];
+    }
+    return op->crc_out;
+}
+
+static bool xpc_ack_mode(xpc_relay_state_t *self);
+
+/**
+ * Find the trailer of the frame held by the write state machine, which goes
+ * between its payload and its crc: the sequence number of a message in
+ * acknowledged mode, the offset of a stream chunk, or the channel, flags and
+ * index of a fragment.
+ * @return the trailer, NULL with *bytes 0 if there is none.
+ */
+static char *xpc_wr_trailer(
+        xpc_relay_state_t *self, struct xpc_sm_t *op, size_t *bytes) {
+    char *trailer = NULL;
+    *bytes = 0;
+    if(op->op == TXPC_OP_MSG && xpc_ack_mode(self)) {
+        trailer = (char*)&op->seq;
+        *bytes = 1;
+    }
+    else if(op->op == TXPC_OP_STREAM) {
+        trailer = self->stream_tx.trailer;
+        *bytes = XPC_STREAM_TRAILER;
+    }
+    else if(op->op == TXPC_OP_FRAG) {
+        trailer = self->channels.frag;
+        *bytes = XPC_FRAG_TRAILER;
+    }
+    return trailer;
+}
+
+/**
+ * Seal the payload crc of the frame held by the write state machine with its
+ * trailer, see xpc_crc_seal.
+ * @return storage location of the CRC of the frame.
+ */
+static char *xpc_wr_crc_seal(
+        xpc_relay_state_t *self, struct xpc_sm_t *op, char *crc) {
+    size_t bytes = 0;
+    char *trailer = xpc_wr_trailer(self, op, &bytes);
+    return xpc_crc_keep(
+        self, op, xpc_crc_seal(self, op, crc, trailer, bytes)
+    );
+}
+
+/**
+ * Get the crc of a message ready as it is loaded into the write state
+ * machine, which may write it out in the same pass: computed up front when
+ * the whole frame goes out in one vectored write or is staged in one copy,
+ * otherwise started so the payload can be folded in as it is written.  The
+ * trailer must be in place by then.
+ */
+static void xpc_crc_begin(xpc_relay_state_t *self, struct xpc_sm_t *op) {
+    op->crc = NULL;
+    if(!self->conn_config.crc_bits) {
+        return;
+    }
+    if(XPC_HAS_WRITEV(self) || self->coalesce.buf != NULL) {
+        op->crc = xpc_wr_crc_seal(self, op, xpc_crc_whole(self, op));
+    }
+    else if(xpc_crc_incremental(self)) {
+        op->crc_state = XPC_CRC_INIT(self);
+    }
+}
+
+xpc_relay_state_t *xpc_relay_config_tx_queue(
+    xpc_relay_state_t *target, xpc_tx_desc_t *slots, size_t capacity
+) {
+    if(target == NULL) goto done;
+    if(target->inflight_wr_op.op != TXPC_OP_NONE || target->tx_queue.count) {
+        // pending descriptors would be lost
+        target = NULL;
+        goto done;
+    }
+    target->tx_queue.slots = slots;
+    target->tx_queue.capacity = slots == NULL ? 0:capacity;
+    target->tx_queue.head = 0;
+    target->tx_queue.count = 0;
+done:
+    return target;
+}
+
+xpc_relay_state_t *xpc_relay_config_ack(
+    xpc_relay_state_t *target, xpc_ack_slot_t *slots, size_t window,
+    clock_fn *clock, void *clock_ctx, uint32_t rto, ack_fn *ack_cb
+) {
+    if(target == NULL) goto done;
+    if(window > XPC_ACK_WINDOW_MAX || target->ack.count) {
+        target = NULL;
+        goto done;
+    }
+    target->ack.slots = slots;
+    target->ack.capacity = slots == NULL ? 0:window;
+    target->ack.head = 0;
+    target->ack.count = 0;
+    target->ack.rto = rto;
+    target->clock = clock;
+    target->clock_ctx = clock_ctx;
+    target->ack_cb = ack_cb;
+done:
+    return target;
+}
+
+xpc_relay_state_t *xpc_relay_config_timeouts(
+    xpc_relay_state_t *target, clock_fn *clock, void *clock_ctx,
+    uint32_t rto_min, uint32_t rto_max, uint32_t frame_timeout
+) {
+    if(target == NULL) goto done;
+    if(clock == NULL || (rto_max && rto_min > rto_max)) {
+        target = NULL;
+        goto done;
+    }
+    target->clock = clock;
+    target->clock_ctx = clock_ctx;
+    target->timers = (struct xpc_timers_t){
+        .rto_min = rto_min, .rto_max = rto_max, .frame_timeout = frame_timeout
+    };
+done:
+    return target;
+}
+
+xpc_relay_state_t *xpc_relay_config_leases(
+    xpc_relay_state_t *target, xpc_lease_t *slots, size_t capacity
+) {
+    if(target == NULL) goto done;
+    if(target->leases.count) {
+        // outstanding leases would never be reclaimed
+        target = NULL;
+        goto done;
+    }
+    target->leases.slots = slots;
+    target->leases.capacity = slots == NULL ? 0:capacity;
+    target->leases.head = 0;
+    target->leases.count = 0;
+    target->leases.taken = false;
+done:
+    return target;
+}
+
+xpc_relay_state_t *xpc_relay_config_stream(
+    xpc_relay_state_t *target, stream_chunk_fn *stream_cb
+) {
+    if(target == NULL) goto done;
+    target->stream_cb = stream_cb;
+done:
+    return target;
+}
+
+xpc_channel_t *xpc_channel_config(
+    xpc_channel_t *target, uint8_t priority, uint8_t weight,
+    xpc_tx_desc_t *slots, size_t capacity, char *rx_buf, size_t rx_capacity
+) {
+    if(target == NULL) goto done;
+    if(weight == 0) {
+        target = NULL;
+        goto done;
+    }
+    *target = (xpc_channel_t){
+        .priority = priority, .weight = weight,
+        .slots = slots, .capacity = slots == NULL ? 0:capacity,
+        .rx_buf = rx_buf, .rx_capacity = rx_buf == NULL ? 0:rx_capacity
+    };
+done:
+    return target;
+}
+
+xpc_relay_state_t *xpc_relay_config_channels(
+    xpc_relay_state_t *target, xpc_channel_t *channels, size_t count,
+    size_t frag_max
+) {
+    if(target == NULL) goto done;
+    if(count > 256 || (channels != NULL
+            && (count == 0 || frag_max == 0 || frag_max > 0xffff))) {
+        target = NULL;
+        goto done;
+    }
+    for(size_t i = 0; i < target->channels.count; i++) {
+        if(target->channels.slots[i].count) {
+            // waiting messages would be lost
+            target = NULL;
+            goto done;
+        }
+    }
+    target->channels = (struct xpc_channels_t){
+        .slots = channels, .count = channels == NULL ? 0:count,
+        .frag_max = frag_max
+    };
 done:
     return target;
 }
 
-xpc_status_t xpc_relay_send_reset(xpc_relay_state_t *self) {
+xpc_relay_state_t *xpc_relay_config_flow(
+    xpc_relay_state_t *target, size_t high, size_t low
+) {
+    if(target == NULL) goto done;
+    if(high && low >= high) {
+        target = NULL;
+        goto done;
+    }
+    target->flow.high = high;
+    target->flow.low = low;
+done:
+    return target;
+}
+
+xpc_relay_state_t *xpc_relay_config_coalesce(
+    xpc_relay_state_t *target, char *buf, size_t capacity,
+    clock_fn *clock, void *clock_ctx, uint32_t deadline
+) {
+    if(target == NULL) goto done;
+    if(target->coalesce.fill
+            || (buf != NULL && (capacity == 0 || (deadline && clock == NULL)))) {
+        // staged bytes would be lost
+        target = NULL;
+        goto done;
+    }
+    target->coalesce = (struct xpc_coalesce_t){
+        .buf = buf, .capacity = buf == NULL ? 0:capacity,
+        .clock = clock, .clock_ctx = clock_ctx, .deadline = deadline
+    };
+done:
+    return target;
+}
+
+xpc_relay_state_t *xpc_relay_config_trace(
+    xpc_relay_state_t *target, xpc_trace_rec_t *records, size_t capacity,
+    clock_fn *clock, void *clock_ctx
+) {
+    if(target == NULL) goto done;
+#ifdef XPC_RELAY_TRACE_RING
+    if(records != NULL && (capacity == 0 || (capacity & (capacity - 1)))) {
+        target = NULL;
+        goto done;
+    }
+    target->trace = (struct xpc_trace_ring_t){
+        .records = records, .capacity = records == NULL ? 0:capacity,
+        .count = 0, .clock = clock, .clock_ctx = clock_ctx
+    };
+#else
+    target = NULL;
+#endif
+done:
+    return target;
+}
+
+size_t xpc_relay_trace_read(
+        const xpc_relay_state_t *self, uint64_t *cursor,
+        xpc_trace_rec_t *out, size_t max) {
+    size_t copied = 0;
+    if(self == NULL || cursor == NULL || out == NULL) {
+        goto done;
+    }
+#ifdef XPC_RELAY_TRACE_RING
+    const struct xpc_trace_ring_t *ring = &self->trace;
+    if(ring->records == NULL) {
+        goto done;
+    }
+    if(ring->count - *cursor > ring->capacity) {
+        // overwritten, skip to the oldest record kept
+        *cursor = ring->count - ring->capacity;
+    }
+    while(copied < max && *cursor < ring->count) {
+        out[copied++] = ring->records[*cursor & (ring->capacity - 1)];
+        (*cursor)++;
+    }
+#endif
+done:
+    return copied;
+}
+
+// ========= STATISTICS =========
+#ifdef XPC_RELAY_STATS
+/**
+ * Counter updates are the write side of a seqlock: the sequence count is odd
+ * while counters change, so xpc_relay_stats_snapshot can tell a torn read.
+ * Only the thread driving the relay writes, so the read-modify-write needs no
+ * atomic instruction, only stores a concurrent reader sees whole.
+ */
+static void xpc_stats_begin(xpc_relay_state_t *self) {
+    __atomic_store_n(&self->stats.seq, self->stats.seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void xpc_stats_end(xpc_relay_state_t *self) {
+    __atomic_store_n(&self->stats.seq, self->stats.seq + 1, __ATOMIC_RELEASE);
+}
+
+static void xpc_stats_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static void xpc_stats_count(xpc_relay_state_t *self, uint64_t *counter) {
+    xpc_stats_begin(self);
+    xpc_stats_add(counter, 1);
+    xpc_stats_end(self);
+}
+
+/**
+ * Count a whole frame, its type and bytes together.
+ */
+static void xpc_stats_frame(
+        xpc_relay_state_t *self, xpc_relay_dir_stats_t *dir,
+        txpc_hdr_t *hdr, size_t bytes) {
+    xpc_stats_begin(self);
+    xpc_stats_add(&dir->frames[hdr->type & 15], 1);
+    xpc_stats_add(&dir->bytes, bytes);
+    xpc_stats_end(self);
+}
+
+/**
+ * Count an IO wrapper call which was asked to move asked bytes.
+ */
+static void xpc_stats_io(
+        xpc_relay_state_t *self, xpc_relay_dir_stats_t *dir,
+        size_t asked, int bytes) {
+    xpc_stats_begin(self);
+    xpc_stats_add(&dir->io_calls, 1);
+    if(bytes < 0 || (size_t)bytes < asked) {
+        xpc_stats_add(&dir->io_short, 1);
+    }
+    xpc_stats_end(self);
+}
+
+#define XPC_STAT(self, field) \
+    xpc_stats_count((self), &(self)->stats.counters.field)
+#define XPC_STAT_FRAME(self, dir, hdr, bytes) \
+    xpc_stats_frame((self), &(self)->stats.counters.dir, (hdr), (bytes))
+#define XPC_STAT_IO(self, dir, asked, bytes) \
+    xpc_stats_io((self), &(self)->stats.counters.dir, (asked), (bytes))
+#else
+#define XPC_STAT(self, field) ((void)0)
+#define XPC_STAT_FRAME(self, dir, hdr, bytes) ((void)0)
+#define XPC_STAT_IO(self, dir, asked, bytes) ((void)(asked))
+#endif
+
+xpc_status_t xpc_relay_stats_snapshot(
+        const xpc_relay_state_t *self, xpc_relay_stats_t *out) {
+    int status = TXPC_STATUS_DONE;
+    if(self == NULL || out == NULL) {
+        status = TXPC_STATUS_BAD_STATE;
+        goto done;
+    }
+#ifdef XPC_RELAY_STATS
+    // the counters are all uint64_t, so they are copied as an array.
+    const uint64_t *src = (const uint64_t*)&self->stats.counters;
+    uint64_t *dst = (uint64_t*)out;
+    uint32_t seq = 0;
+    do {
+        seq = __atomic_load_n(&self->stats.seq, __ATOMIC_ACQUIRE);
+        for(size_t i = 0; i < sizeof(xpc_relay_stats_t) / sizeof(uint64_t); i++) {
+            dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        // retry if an update was under way or happened while copying
+    } while((seq & 1) || seq != __atomic_load_n(&self->stats.seq, __ATOMIC_RELAXED));
+#else
+    status = TXPC_STATUS_BAD_STATE;
+#endif
+done:
+    return status;
+}
+// ========= END STATISTICS =========
+
+// ========= FLOW CONTROL =========
+/**
+ * Change the receive flow state wanted, and have the write state machine tell
+ * the remote if it does not know it yet.
+ */
+static void xpc_flow_want(xpc_relay_state_t *self, bool xoff) {
+    self->flow.xoff = xoff;
+    if(self->flow.xoff == self->flow.remote_xoff) {
+        // e.g. XOFF then XON before either went out
+        self->signals &= ~SIG_FLOW_SEND;
+    }
+    else if(!(self->signals & SIG_FLOW_SEND)) {
+        self->signals |= SIG_FLOW_SEND;
+        XPC_IO_NOTIFY(self, 1, true);
+    }
+}
+
+/**
+ * Apply the watermarks to the current receive depth.
+ */
+static void xpc_flow_check(xpc_relay_state_t *self) {
+    if(!self->flow.high) {
+        return;
+    }
+    size_t depth = self->flow.depth + self->leases.count;
+    if(!self->flow.xoff && depth >= self->flow.high) {
+        xpc_flow_want(self, true);
+    }
+    else if(self->flow.xoff && depth <= self->flow.low) {
+        xpc_flow_want(self, false);
+    }
+}
+
+/**
+ * Load the XON or XOFF frame owed to the remote into the write state machine.
+ */
+static void xpc_flow_send_start(xpc_relay_state_t *self) {
+    self->signals &= ~SIG_FLOW_SEND;
+    self->flow.remote_xoff = self->flow.xoff;
+    self->inflight_wr_op.msg_hdr = (txpc_hdr_t){
+        .type = self->flow.xoff ? TXPC_MSG_TYPE_XOFF:TXPC_MSG_TYPE_XON,
+        .size = 0, .to = 0, .from = 0
+    };
+    self->inflight_wr_op.buf = NULL;
+    self->inflight_wr_op.crc = NULL;
+    self->inflight_wr_op.bytes_complete = 0;
+    self->inflight_wr_op.total_bytes = sizeof(txpc_hdr_t);
+    self->inflight_wr_op.op = TXPC_OP_FLOW;
+}
+
+/**
+ * Both ends start with flow on after a reset.  If we still want the remote
+ * held off, it has to be told again.
+ */
+static void xpc_flow_reset(xpc_relay_state_t *self) {
+    self->signals &= ~(SIG_XOFF_RECVD | SIG_FLOW_SEND);
+    self->flow.remote_xoff = false;
+    if(self->flow.xoff) {
+        xpc_flow_want(self, true);
+    }
+}
+
+xpc_status_t xpc_relay_set_flow(xpc_relay_state_t *self, bool xon) {
+    int status = TXPC_STATUS_DONE;
+    if(self == NULL) {
+        status = TXPC_STATUS_BAD_STATE;
+        goto done;
+    }
+    xpc_flow_want(self, !xon);
+done:
+    return status;
+}
+
+xpc_status_t xpc_relay_flow_depth(xpc_relay_state_t *self, size_t depth) {
+    int status = TXPC_STATUS_DONE;
+    if(self == NULL) {
+        status = TXPC_STATUS_BAD_STATE;
+        goto done;
+    }
+    self->flow.depth = depth;
+    xpc_flow_check(self);
+done:
+    return status;
+}
+// ========= END FLOW CONTROL =========
+
+// ========= RECEIVE LEASES =========
+static xpc_lease_t *xpc_lease_slot(xpc_relay_state_t *self, size_t i) {
+    return &self->leases.slots[(self->leases.head + i) % self->leases.capacity];
+}
+
+/**
+ * Read buffer bytes taken by the frame held by the read state machine.  A
+ * pulled frame's header is read into the relay state, a fed one's is part of
+ * the fed bytes.
+ */
+static size_t xpc_rd_footprint(xpc_relay_state_t *self) {
+    size_t bytes = self->inflight_rd_op.bytes_complete;
+    if(self->rd_span.buf == NULL) {
+        bytes = bytes > sizeof(txpc_hdr_t) ? bytes - sizeof(txpc_hdr_t):0;
+    }
+    return bytes;
+}
+
+/**
+ * Let the IO subsystem discard the frame the read state machine is done with.
+ * While payloads are leased, the frame is discarded along with the newest
+ * lease instead, so that nothing still held is thrown away.
+ */
+static void xpc_rd_discard(xpc_relay_state_t *self) {
+    if(self->leases.count) {
+        xpc_lease_slot(self, self->leases.count - 1)->trailing +=
+            xpc_rd_footprint(self);
+    }
+    else {
+        XPC_IO_RESET(self, 1, -1);
+    }
+}
+
+xpc_lease_t *xpc_relay_lease(xpc_relay_state_t *self) {
+    xpc_lease_t *lease = NULL;
+    if(self == NULL || self->inflight_rd_op.op != TXPC_OP_WAIT_DISPATCH
+            || self->inflight_rd_op.msg_hdr.type == TXPC_MSG_TYPE_FRAG
+            || self->leases.taken
+            || self->leases.count == self->leases.capacity) {
+        goto done;
+    }
+    lease = xpc_lease_slot(self, self->leases.count);
+    lease->msg_hdr = self->inflight_rd_op.msg_hdr;
+    lease->payload = self->inflight_rd_op.buf;
+    lease->bytes = xpc_rd_footprint(self);
+    lease->trailing = 0;
+    lease->released = false;
+    self->leases.count++;
+    self->leases.taken = true;
+    xpc_flow_check(self);
+done:
+    return lease;
+}
+
+xpc_status_t xpc_relay_release(xpc_relay_state_t *self, xpc_lease_t *lease) {
+    int status = TXPC_STATUS_DONE;
+    if(self == NULL || lease == NULL || self->leases.count == 0
+            || lease < self->leases.slots
+            || lease >= self->leases.slots + self->leases.capacity
+            || lease->released) {
+        status = TXPC_STATUS_BAD_STATE;
+        goto done;
+    }
+    size_t age = (lease - self->leases.slots + self->leases.capacity
+        - self->leases.head) % self->leases.capacity;
+    if(age >= self->leases.count
+            || (self->leases.taken && age == self->leases.count - 1)) {
+        // not outstanding, or still being dispatched
+        status = TXPC_STATUS_BAD_STATE;
+        goto done;
+    }
+    lease->released = true;
+    // reclaim in arrival order
+    while(self->leases.count && xpc_lease_slot(self, 0)->released) {
+        xpc_lease_t *oldest = xpc_lease_slot(self, 0);
+        if(oldest->bytes + oldest->trailing) {
+            XPC_IO_RESET(self, 1, oldest->bytes + oldest->trailing);
+        }
+        self->leases.head = (self->leases.head + 1) % self->leases.capacity;
+        self->leases.count--;
+    }
+    xpc_flow_check(self);
+done:
+    return status;
+}
+// ========= END RECEIVE LEASES =========
+
+// ========= ACKNOWLEDGED MODE =========
+static bool xpc_ack_mode(xpc_relay_state_t *self) {
+    return self->conn_config.flags & CONFIG_FLAGS_REQ_ACK;
+}
+
+static xpc_ack_slot_t *xpc_ack_slot(xpc_relay_state_t *self, size_t i) {
+    return &self->ack.slots[(self->ack.head + i) % self->ack.capacity];
+}
+
+/**
+ * Find the send window slot for a sequence number.
+ * @return the slot, or NULL if the sequence number is not in the window.
+ */
+static xpc_ack_slot_t *xpc_ack_find(xpc_relay_state_t *self, uint8_t seq) {
+    if(self->ack.count == 0) {
+        return NULL;
+    }
+    size_t i = (uint8_t)(seq - xpc_ack_slot(self, 0)->seq);
+    return i < self->ack.count ? xpc_ack_slot(self, i):NULL;
+}
+
+static bool xpc_ack_window_full(xpc_relay_state_t *self) {
+    return xpc_ack_mode(self) && self->ack.capacity > 0
+        && self->ack.count == self->ack.capacity;
+}
+
+/**
+ * Release acknowledged messages from the front of the send window.  A slot
+ * whose payload is still being written (a resend racing its ACK) is kept
+ * until the write completes.
+ */
+static void xpc_ack_window_advance(xpc_relay_state_t *self) {
+    while(self->ack.count > 0) {
+        xpc_ack_slot_t *slot = xpc_ack_slot(self, 0);
+        if(slot->state != XPC_ACK_SLOT_ACKED ||
+                (self->inflight_wr_op.op == TXPC_OP_MSG
+                 && self->inflight_wr_op.seq == slot->seq)) {
+            break;
+        }
+        // copy out first, the callback may send into the freed slot.
+        txpc_hdr_t msg_hdr = slot->msg_hdr;
+        char *buf = slot->buf;
+        self->ack.head = (self->ack.head + 1) % self->ack.capacity;
+        self->ack.count--;
+        if(self->ack_cb != NULL) {
+            self->ack_cb(self->msg_ctx, &msg_hdr, buf, true);
+        }
+    }
+}
+
+/**
+ * Drop all sequencing state, called when a connection reset completes.
+ * Messages still in the send window are reported as not delivered.
+ */
+static void xpc_ack_reset(xpc_relay_state_t *self) {
+    while(self->ack.count > 0) {
+        xpc_ack_slot_t *slot = xpc_ack_slot(self, 0);
+        txpc_hdr_t msg_hdr = slot->msg_hdr;
+        char *buf = slot->buf;
+        self->ack.head = (self->ack.head + 1) % self->ack.capacity;
+        self->ack.count--;
+        if(self->ack_cb != NULL) {
+            self->ack_cb(self->msg_ctx, &msg_hdr, buf, false);
+        }
+    }
+    self->ack.next_seq = 0;
+    self->ack.rx_next = 0;
+    self->ack.rx_sack = 0;
+    self->signals &= ~(SIG_ACK_RECVD | SIG_NACK_RECVD);
+}
+
+/**
+ * Set the retransmission timeout, within the bounds of the adaptive one.
+ */
+static void xpc_ack_rto_set(xpc_relay_state_t *self, uint64_t rto) {
+    if(rto < self->timers.rto_min) {
+        rto = self->timers.rto_min;
+    }
+    if(rto > self->timers.rto_max) {
+        rto = self->timers.rto_max;
+    }
+    self->ack.rto = rto;
+}
+
+/**
+ * Fold a round trip sample into the estimate, and take the retransmission
+ * timeout from it (Jacobson/Karels, as in RFC 6298).
+ */
+static void xpc_ack_rtt_sample(xpc_relay_state_t *self, uint32_t rtt) {
+    struct xpc_timers_t *timers = &self->timers;
+    if(rtt > timers->rto_max) {
+        rtt = timers->rto_max;
+    }
+    if(!timers->measured) {
+        timers->srtt = rtt << 3;
+        timers->rttvar = rtt << 1;
+        timers->measured = true;
+    }
+    else {
+        // gains of 1/8 and 1/4, folded into the scaling
+        int32_t delta = (int32_t)(rtt - (timers->srtt >> 3));
+        timers->srtt += delta;
+        timers->rttvar += (uint32_t)(delta < 0 ? -delta:delta)
+            - (timers->rttvar >> 2);
+    }
+    xpc_ack_rto_set(
+        self, (uint64_t)(timers->srtt >> 3)
+        + (timers->rttvar ? timers->rttvar:1)
+    );
+}
+
+/**
+ * Apply an ACK frame from the remote to the send window.  The newest message
+ * it acknowledges which was sent only once gives a round trip sample.
+ */
+static void xpc_ack_recv(xpc_relay_state_t *self, char *frame) {
+    uint8_t kind = frame[0];
+    uint8_t cum = frame[1];
+    uint32_t sack = (uint32_t)(uint8_t)frame[2]
+        | (uint32_t)(uint8_t)frame[3] << 8
+        | (uint32_t)(uint8_t)frame[4] << 16
+        | (uint32_t)(uint8_t)frame[5] << 24;
+    bool sampled = false;
+    uint32_t sent_at = 0;
+    for(size_t i = 0; i < self->ack.count; i++) {
+        xpc_ack_slot_t *slot = xpc_ack_slot(self, i);
+        uint8_t dist = slot->seq - cum;
+        if((int8_t)dist < 0 || (dist >= 1 && dist <= XPC_ACK_WINDOW_MAX
+                    && (sack >> (dist - 1)) & 1)) {
+            // covered by the cumulative ack, or selectively acked
+            if(slot->state == XPC_ACK_SLOT_SENT && !slot->resent) {
+                sampled = true;
+                sent_at = slot->sent_at;
+            }
+            slot->state = XPC_ACK_SLOT_ACKED;
+        }
+        else if(dist == 0 && kind == XPC_ACK_KIND_NACK
+                && slot->state == XPC_ACK_SLOT_SENT) {
+            slot->state = XPC_ACK_SLOT_RESEND;
+        }
+    }
+    if(sampled && self->timers.rto_max && self->clock != NULL) {
+        xpc_ack_rtt_sample(self, self->clock(self->clock_ctx) - sent_at);
+    }
+    xpc_ack_window_advance(self);
+    // the window may have room now, or a resend may be due.
+    XPC_IO_NOTIFY(self, 1, true);
+}
+
+/**
+ * Find the next message in the send window which must be sent again, either
+ * because it was NACKed or because its retransmission timeout elapsed.  An
+ * adaptive timeout doubles once for all the messages which time out together.
+ */
+static xpc_ack_slot_t *xpc_ack_next_resend(xpc_relay_state_t *self) {
+    xpc_ack_slot_t *next = NULL;
+    bool expired = false;
+    uint32_t now = self->clock != NULL ? self->clock(self->clock_ctx):0;
+    for(size_t i = 0; i < self->ack.count; i++) {
+        xpc_ack_slot_t *slot = xpc_ack_slot(self, i);
+        if(slot->state == XPC_ACK_SLOT_SENT && self->clock != NULL
+                && (int32_t)(now - slot->sent_at) >= (int32_t)self->ack.rto) {
+            slot->state = XPC_ACK_SLOT_RESEND;
+            expired = true;
+        }
+        if(slot->state == XPC_ACK_SLOT_RESEND && next == NULL) {
+            next = slot;
+        }
+    }
+    if(expired && self->timers.rto_max) {
+        xpc_ack_rto_set(self, (uint64_t)self->ack.rto * 2);
+    }
+    return next;
+}
+
+/**
+ * Start the retransmission timeout of a message whose frame has been written.
+ */
+static void xpc_ack_slot_sent(xpc_relay_state_t *self, xpc_ack_slot_t *slot) {
+    slot->staged = 0;
+    if(slot->state == XPC_ACK_SLOT_SENDING) {
+        slot->state = XPC_ACK_SLOT_SENT;
+        slot->sent_at = self->clock != NULL ? self->clock(self->clock_ctx):0;
+    }
+}
+
+/**
+ * Called by the write state machine when a sequenced message has been
+ * written, starts the retransmission timeout.  A staged frame has not been
+ * written yet: its timeout starts once the staging buffer is, see
+ * xpc_coalesce_written.
+ */
+static void xpc_ack_sent(xpc_relay_state_t *self, uint8_t seq) {
+    xpc_ack_slot_t *slot = xpc_ack_find(self, seq);
+    if(slot != NULL && self->coalesce.fill) {
+        slot->staged = self->coalesce.fill;
+    }
+    else if(slot != NULL) {
+        xpc_ack_slot_sent(self, slot);
+    }
+    xpc_ack_window_advance(self);
+}
+
+/**
+ * Whether a received sequence number has not been delivered yet.
+ */
+static bool xpc_ack_rx_is_new(xpc_relay_state_t *self, uint8_t seq) {
+    uint8_t dist = seq - self->ack.rx_next;
+    return dist == 0 || (dist <= XPC_ACK_WINDOW_MAX
+            && !((self->ack.rx_sack >> (dist - 1)) & 1));
+}
+
+/**
+ * Record delivery of a sequenced message and have the write state machine
+ * acknowledge it.  A message arriving ahead of the expected one means that
+ * one was lost, so a NACK is sent for it.
+ */
+static void xpc_ack_rx_record(xpc_relay_state_t *self, uint8_t seq) {
+    uint8_t dist = seq - self->ack.rx_next;
+    if(dist == 0) {
+        self->ack.rx_next++;
+        // bit 0 is now the expected sequence number, skip what already came
+        while(self->ack.rx_sack & 1) {
+            self->ack.rx_sack >>= 1;
+            self->ack.rx_next++;
+        }
+        self->ack.rx_sack >>= 1;
+    }
+    else {
+        self->ack.rx_sack |= (uint32_t)1 << (dist - 1);
+        self->signals |= SIG_NACK_RECVD;
+    }
+    self->signals |= SIG_ACK_RECVD;
+    XPC_IO_NOTIFY(self, 1, true);
+}
+
+/**
+ * Load an ACK frame for the remote into the write state machine.
+ */
+static void xpc_ack_send_start(xpc_relay_state_t *self) {
+    char *frame = self->ack.frame;
+    frame[0] = self->signals & SIG_NACK_RECVD ?
+        XPC_ACK_KIND_NACK:XPC_ACK_KIND_ACK;
+    frame[1] = self->ack.rx_next;
+    frame[2] = self->ack.rx_sack & 0xff;
+    frame[3] = (self->ack.rx_sack >> 8) & 0xff;
+    frame[4] = (self->ack.rx_sack >> 16) & 0xff;
+    frame[5] = (self->ack.rx_sack >> 24) & 0xff;
+    self->signals &= ~(SIG_ACK_RECVD | SIG_NACK_RECVD);
+    self->inflight_wr_op.msg_hdr = (txpc_hdr_t){
+        .type = TXPC_MSG_TYPE_ACK, .size = XPC_ACK_FRAME_SIZE,
+        .to = 0, .from = 0
+    };
+    self->inflight_wr_op.buf = frame;
+    self->inflight_wr_op.iov = NULL;
+    self->inflight_wr_op.crc = NULL;
+    self->inflight_wr_op.bytes_complete = 0;
+    self->inflight_wr_op.total_bytes = sizeof(txpc_hdr_t) + XPC_ACK_FRAME_SIZE;
+    self->inflight_wr_op.op = TXPC_OP_ACK;
+    if(self->conn_config.crc_bits) {
+        // a damaged ACK would acknowledge messages the remote never got
+        self->inflight_wr_op.crc = xpc_crc_keep(
+            self, &self->inflight_wr_op,
+            xpc_crc_whole(self, &self->inflight_wr_op)
+        );
+        self->inflight_wr_op.total_bytes += XPC_CRC_BYTES(XPC_CRC_WIDTH(self));
+    }
+}
+
+/**
+ * Load a message from the send window into the write state machine again.
+ */
+static void xpc_ack_resend_start(xpc_relay_state_t *self, xpc_ack_slot_t *slot) {
+    self->inflight_wr_op.msg_hdr = slot->msg_hdr;
+    self->inflight_wr_op.buf = slot->buf;
+    self->inflight_wr_op.iov = slot->iov;
+    self->inflight_wr_op.iovcnt = slot->iovcnt;
+    self->inflight_wr_op.crc = NULL;
+    self->inflight_wr_op.seq = slot->seq;
+    self->inflight_wr_op.bytes_complete = 0;
+    self->inflight_wr_op.total_bytes = sizeof(txpc_hdr_t)
+        + slot->msg_hdr.size + 1 + XPC_CRC_BYTES(XPC_CRC_WIDTH(self));
+    self->inflight_wr_op.op = TXPC_OP_MSG;
+    xpc_crc_begin(self, &self->inflight_wr_op);
+    slot->state = XPC_ACK_SLOT_SENDING;
+    slot->resent = true;
+    XPC_STAT(self, resends);
+}
+// ========= END ACKNOWLEDGED MODE =========
+
+// ========= TIMERS =========
+/**
+ * Bytes held of a frame the read state machine is part way through pulling,
+ * 0 if it is between frames or waiting on something other than the remote.
+ */
+static size_t xpc_rd_partial(xpc_relay_state_t *self) {
+    size_t held = 0;
+    struct xpc_sm_t *op = &self->inflight_rd_op;
+    switch(op->op) {
+        case TXPC_OP_NONE:
+            held = op->bytes_complete;
+        break;
+
+        case TXPC_OP_WAIT_MSG:
+        case TXPC_OP_WAIT_CONFIG:
+        case TXPC_OP_WAIT_ACK:
+            held = op->bytes_complete < op->total_bytes ? op->bytes_complete:0;
+        break;
+
+        default:
+        break;
+    }
+    return held;
+}
+
+/**
+ * Track the partial frame timeout.  The timeout restarts whenever the part
+ * held changes, or the read state machine took bytes since the last check.
+ * @param held bytes held of an incomplete frame, 0 if none.
+ * @return true if the frame has waited frame_timeout for its next byte.
+ */
+static bool xpc_rd_timed_out(xpc_relay_state_t *self, size_t held) {
+    bool expired = false;
+    struct xpc_timers_t *timers = &self->timers;
+    if(!timers->frame_timeout || self->clock == NULL) {
+        goto done;
+    }
+    uint32_t now = self->clock(self->clock_ctx);
+    if(held == 0 || held != timers->rd_held) {
+        timers->rd_held = held;
+        timers->rd_since = now;
+    }
+    else if((int32_t)(now - timers->rd_since) >= (int32_t)timers->frame_timeout) {
+        timers->rd_held = 0;
+        expired = true;
+        XPC_STAT(self, frame_timeouts);
+    }
+done:
+    return expired;
+}
+
+/**
+ * Drop a frame whose rest never came, and reset the connection: the bytes
+ * after it cannot be framed.  A fed partial frame is the rest of the span,
+ * which is taken whole.
+ */
+static void xpc_rd_abandon(xpc_relay_state_t *self) {
+    struct xpc_span_t *span = &self->rd_span;
+    if(span->buf != NULL) {
+        size_t tail = span->len - span->pos;
+        span->pos = span->len;
+        if(self->leases.count) {
+            xpc_lease_slot(self, self->leases.count - 1)->trailing += tail;
+        }
+        else {
+            XPC_IO_RESET(self, 1, -1);
+        }
+    }
+    else {
+        xpc_rd_discard(self);
+    }
+    XPC_TRACE(self, rd_state, XPC_TRACE_RD_STATE,
+        self->inflight_rd_op.op, TXPC_OP_NONE);
+    self->inflight_rd_op.op = TXPC_OP_NONE;
+    self->inflight_rd_op.total_bytes = 0;
+    self->inflight_rd_op.bytes_complete = 0;
+    if(!(self->signals & SIG_RST_SEND)) {
+        xpc_relay_send_reset(self);
+    }
+}
+
+static void xpc_deadline_merge(bool *pending, uint32_t *at, uint32_t deadline) {
+    if(!*pending || (int32_t)(deadline - *at) < 0) {
+        *at = deadline;
+    }
+    *pending = true;
+}
+
+bool xpc_relay_next_deadline(xpc_relay_state_t *self, uint32_t *at) {
+    bool pending = false;
+    if(self == NULL || at == NULL) {
+        goto done;
+    }
+    if(self->clock != NULL) {
+        for(size_t i = 0; i < self->ack.count; i++) {
+            xpc_ack_slot_t *slot = xpc_ack_slot(self, i);
+            if(slot->state == XPC_ACK_SLOT_SENT) {
+                xpc_deadline_merge(&pending, at, slot->sent_at + self->ack.rto);
+            }
+        }
+    }
+    struct xpc_coalesce_t *co = &self->coalesce;
+    if(co->fill && co->deadline && co->clock != NULL) {
+        xpc_deadline_merge(&pending, at, co->since + co->deadline);
+    }
+    struct xpc_timers_t *timers = &self->timers;
+    if(timers->frame_timeout && timers->rd_held) {
+        xpc_deadline_merge(
+            &pending, at, timers->rd_since + timers->frame_timeout
+        );
+    }
+done:
+    return pending;
+}
+// ========= END TIMERS =========
+
+// ========= STREAMS =========
+/**
+ * Load the next frame of the stream being sent into the write state machine:
+ * a chunk from the producer, or the end frame once all bytes are sent.
+ * @return false if the producer has nothing ready.
+ */
+static bool xpc_stream_next(xpc_relay_state_t *self) {
+    struct xpc_stream_tx_t *stream = &self->stream_tx;
+    char *chunk = NULL;
+    size_t bytes = 0;
+    if(stream->offset < stream->total) {
+        size_t bytes_max = stream->chunk_max;
+        if(stream->total - stream->offset < bytes_max) {
+            bytes_max = stream->total - stream->offset;
+        }
+        bytes = stream->pull(stream->ctx, stream->offset, &chunk, bytes_max);
+        if(bytes == 0) {
+            return false;
+        }
+        if(bytes > bytes_max) {
+            bytes = bytes_max;
+        }
+    }
+    self->inflight_wr_op.msg_hdr = (txpc_hdr_t){
+        .type = TXPC_MSG_TYPE_STREAM, .size = bytes,
+        .to = stream->to, .from = stream->from
+    };
+    for(size_t i = 0; i < XPC_STREAM_TRAILER; i++) {
+        stream->trailer[i] = (char)(stream->offset >> (8 * i));
+    }
+    self->inflight_wr_op.buf = chunk;
+    self->inflight_wr_op.iov = NULL;
+    self->inflight_wr_op.bytes_complete = 0;
+    self->inflight_wr_op.total_bytes = sizeof(txpc_hdr_t) + bytes
+        + XPC_STREAM_TRAILER + XPC_CRC_BYTES(XPC_CRC_WIDTH(self));
+    self->inflight_wr_op.op = TXPC_OP_STREAM;
+    xpc_crc_begin(self, &self->inflight_wr_op);
+    return true;
+}
+
+/**
+ * Complete the stream being sent, once its end frame has been written.
+ */
+static void xpc_stream_end(xpc_relay_state_t *self) {
+    struct xpc_stream_tx_t *stream = &self->stream_tx;
+    // copy out first, the callback may start another stream.
+    stream_done_fn *done = stream->done;
+    void *ctx = stream->ctx;
+    *stream = (struct xpc_stream_tx_t){0};
+    if(done != NULL) {
+        done(ctx, true);
+    }
+}
+
+/**
+ * Called by the write state machine when a stream frame has been written.
+ */
+static void xpc_stream_sent(xpc_relay_state_t *self) {
+    struct xpc_stream_tx_t *stream = &self->stream_tx;
+    if(self->inflight_wr_op.msg_hdr.size) {
+        stream->offset += self->inflight_wr_op.msg_hdr.size;
+    }
+    else if(self->coalesce.fill) {
+        // staged, the stream ends once the staging buffer is written
+        stream->staged = self->coalesce.fill;
+    }
+    else {
+        xpc_stream_end(self);
+    }
+}
+
+/**
+ * Offer a received chunk to the stream handler, reporting any chunks lost
+ * ahead of it first.
+ * @return true if the chunk was taken.
+ */
+static bool xpc_stream_recv(xpc_relay_state_t *self) {
+    txpc_hdr_t *hdr = &self->inflight_rd_op.msg_hdr;
+    const unsigned char *trailer =
+        (const unsigned char*)self->inflight_rd_op.buf + hdr->size;
+    uint32_t offset = 0;
+    bool dispatched = true;
+    for(size_t i = 0; i < XPC_STREAM_TRAILER; i++) {
+        offset |= (uint32_t)trailer[i] << (8 * i);
+    }
+    if(offset != self->stream_rx) {
+        // reported once, the chunk is expected from here on
+        self->stream_rx = offset;
+        if(self->stream_cb != NULL) {
+            self->stream_cb(self->msg_ctx, hdr, NULL);
+        }
+    }
+    // without a handler, chunks are dropped
+    if(self->stream_cb != NULL) {
+        dispatched = self->stream_cb(
+            self->msg_ctx, hdr, self->inflight_rd_op.buf
+        );
+    }
+    if(dispatched) {
+        // the next stream starts over
+        self->stream_rx = hdr->size ? offset + hdr->size:0;
+    }
+    return dispatched;
+}
+
+/**
+ * Abandon the streams in progress, called when a connection reset completes.
+ */
+static void xpc_stream_reset(xpc_relay_state_t *self) {
+    struct xpc_stream_tx_t *stream = &self->stream_tx;
+    self->stream_rx = 0;
+    if(stream->pull == NULL) {
+        return;
+    }
+    stream_done_fn *done = stream->done;
+    void *ctx = stream->ctx;
+    *stream = (struct xpc_stream_tx_t){0};
+    if(done != NULL) {
+        done(ctx, false);
+    }
+}
+
+xpc_status_t xpc_relay_send_stream(
+        xpc_relay_state_t *self, uint8_t to, uint8_t from, uint64_t total,
+        size_t chunk_max, stream_pull_fn *pull, stream_done_fn *done,
+        void *stream_ctx) {
+    int status = TXPC_STATUS_DONE;
+    if(self == NULL || pull == NULL || chunk_max == 0 || chunk_max > 0xffff) {
+        status = TXPC_STATUS_BAD_STATE;
+        goto done;
+    }
+    if(self->stream_tx.pull != NULL) {
+        status = TXPC_STATUS_INFLIGHT;
+        goto done;
+    }
+    self->stream_tx = (struct xpc_stream_tx_t){
+        .pull = pull, .done = done, .ctx = stream_ctx,
+        .total = total, .offset = 0, .chunk_max = chunk_max,
+        .to = to, .from = from
+    };
+    XPC_IO_NOTIFY(self, 1, true);
+done:
+    return status;
+}
+
+xpc_status_t xpc_relay_stream_ready(xpc_relay_state_t *self) {
+    int status = TXPC_STATUS_DONE;
+    if(self == NULL || self->stream_tx.pull == NULL) {
+        status = TXPC_STATUS_BAD_STATE;
+        goto done;
+    }
+    XPC_IO_NOTIFY(self, 1, true);
+done:
+    return status;
+}
+// ========= END STREAMS =========
+
+// ========= CHANNELS =========
+static void xpc_wr_op_start(xpc_relay_state_t *self, xpc_tx_desc_t *desc);
+
+/**
+ * Whether the oldest message on a channel would go out as a plain message
+ * frame rather than as fragments.
+ */
+static bool xpc_channel_whole(xpc_relay_state_t *self, xpc_channel_t *ch) {
+    return ch->offset == 0
+        && ch->slots[ch->head].msg_hdr.size <= self->channels.frag_max;
+}
+
+/**
+ * Whether a channel has a frame which may be sent now.  Flow control is
+ * checked by the caller.
+ */
+static bool xpc_channel_ready(xpc_relay_state_t *self, xpc_channel_t *ch) {
+    return ch->count > 0
+        && !(xpc_channel_whole(self, ch) && xpc_ack_window_full(self));
+}
+
+/**
+ * Pick the channel to send the next frame from: the highest priority with
+ * anything ready, and among channels of that priority, deficit round robin.
+ * Each channel keeps its turn while it has credit left, and all of them are
+ * given weight fragments worth once none has.
+ * @return the channel, or NULL if none is ready.
+ */
+static xpc_channel_t *xpc_channel_pick(xpc_relay_state_t *self) {
+    struct xpc_channels_t *chs = &self->channels;
+    xpc_channel_t *pick = NULL;
+    int priority = -1;
+    for(size_t i = 0; i < chs->count; i++) {
+        if(xpc_channel_ready(self, &chs->slots[i])
+                && (priority < 0 || chs->slots[i].priority < priority)) {
+            priority = chs->slots[i].priority;
+        }
+    }
+    if(priority < 0) {
+        goto done;
+    }
+    // a fragment costs at most one quantum, so one refill is enough
+    int32_t quantum = chs->frag_max + sizeof(txpc_hdr_t);
+    for(int refill = 0; refill < 2 && pick == NULL; refill++) {
+        for(size_t n = 0; n < chs->count; n++) {
+            size_t i = (chs->next + n) % chs->count;
+            xpc_channel_t *ch = &chs->slots[i];
+            if(ch->priority != priority || !xpc_channel_ready(self, ch)) {
+                continue;
+            }
+            if(refill) {
+                ch->deficit += ch->weight * quantum;
+            }
+            if(pick == NULL && ch->deficit > 0) {
+                pick = ch;
+                chs->next = i;
+            }
+        }
+    }
+done:
+    return pick;
+}
+
+/**
+ * Drop the oldest message of a channel, which would have to be fragmented in
+ * acknowledged mode, and report it as not delivered.
+ */
+static void xpc_channel_drop(xpc_relay_state_t *self, xpc_channel_t *ch) {
+    // copy out first, the callback may send on the channel.
+    txpc_hdr_t msg_hdr = ch->slots[ch->head].msg_hdr;
+    char *buf = ch->slots[ch->head].buf;
+    ch->head = (ch->head + 1) % ch->capacity;
+    ch->count--;
+    ch->offset = 0;
+    if(self->ack_cb != NULL) {
+        self->ack_cb(self->msg_ctx, &msg_hdr, buf, false);
+    }
+}
+
+/**
+ * Load the next frame from the channels into the write state machine: the
+ * oldest message of the channel picked, whole if it fits a fragment,
+ * otherwise its next fragment.
+ * @return false if no channel has anything ready.
+ */
+static bool xpc_channel_next(xpc_relay_state_t *self) {
+    struct xpc_channels_t *chs = &self->channels;
+    xpc_channel_t *ch = xpc_channel_pick(self);
+    // fragments are not acknowledged, see xpc_relay_config_channels
+    while(ch != NULL && xpc_ack_mode(self) && !xpc_channel_whole(self, ch)) {
+        xpc_channel_drop(self, ch);
+        ch = xpc_channel_pick(self);
+    }
+    if(ch == NULL) {
+        return false;
+    }
+    xpc_tx_desc_t *desc = &ch->slots[ch->head];
+    size_t bytes = desc->msg_hdr.size - ch->offset;
+    bool last = true;
+    if(xpc_channel_whole(self, ch)) {
+        xpc_wr_op_start(self, desc);
+    }
+    else {
+        uint8_t flags = ch->offset == 0 ? XPC_FRAG_FIRST:0;
+        if(bytes > chs->frag_max) {
+            bytes = chs->frag_max;
+            last = false;
+        }
+        else {
+            flags |= XPC_FRAG_LAST;
+        }
+        chs->frag[0] = ch - chs->slots;
+        chs->frag[1] = flags;
+        // all but the last fragment are frag_max bytes
+        chs->frag[2] = (uint8_t)(ch->offset / chs->frag_max);
+        self->inflight_wr_op.msg_hdr = (txpc_hdr_t){
+            .type = TXPC_MSG_TYPE_FRAG, .size = bytes,
+            .to = desc->msg_hdr.to, .from = desc->msg_hdr.from
+        };
+        self->inflight_wr_op.buf = desc->buf + ch->offset;
+        self->inflight_wr_op.iov = NULL;
+        self->inflight_wr_op.bytes_complete = 0;
+        self->inflight_wr_op.total_bytes = sizeof(txpc_hdr_t) + bytes
+            + XPC_FRAG_TRAILER + XPC_CRC_BYTES(XPC_CRC_WIDTH(self));
+        self->inflight_wr_op.op = TXPC_OP_FRAG;
+        xpc_crc_begin(self, &self->inflight_wr_op);
+        ch->offset += bytes;
+    }
+    ch->deficit -= bytes + sizeof(txpc_hdr_t);
+    if(last) {
+        ch->head = (ch->head + 1) % ch->capacity;
+        ch->count--;
+        ch->offset = 0;
+    }
+    if(ch->count == 0) {
+        // no credit is saved up while idle
+        ch->deficit = 0;
+    }
+    if(ch->deficit <= 0) {
+        chs->next = (ch - chs->slots + 1) % chs->count;
+    }
+    return true;
+}
+
+/**
+ * Abandon every partly reassembled message, when a fragment failed its CRC:
+ * the channel in its trailer cannot be trusted, so any of them may be
+ * missing it.
+ */
+static void xpc_channel_rx_abandon(xpc_relay_state_t *self) {
+    for(size_t i = 0; i < self->channels.count; i++) {
+        xpc_channel_t *ch = &self->channels.slots[i];
+        if(ch->rx_open) {
+            ch->rx_open = false;
+            ch->rx_dropped++;
+        }
+    }
+}
+
+/**
+ * Take the fragment held by the read state machine into its channel's
+ * reassembly buffer, and dispatch the message once it is complete.
+ * Fragments which cannot be placed are dropped.
+ * @return false if the dispatch callback declined the message, in which case
+ * the last fragment is presented again.
+ */
+static bool xpc_channel_recv(xpc_relay_state_t *self) {
+    struct xpc_sm_t *op = &self->inflight_rd_op;
+    uint8_t id = op->buf[op->msg_hdr.size];
+    uint8_t flags = op->buf[op->msg_hdr.size + 1];
+    uint8_t index = op->buf[op->msg_hdr.size + 2];
+    bool taken = true;
+    if(id >= self->channels.count || self->channels.slots[id].rx_buf == NULL) {
+        goto done;
+    }
+    xpc_channel_t *ch = &self->channels.slots[id];
+    if(flags & XPC_FRAG_FIRST) {
+        if(ch->rx_open && ch->rx_fill > 0) {
+            // the end of the one before was lost
+            ch->rx_dropped++;
+        }
+        ch->rx_open = index == 0;
+        ch->rx_fill = 0;
+        ch->rx_index = 0;
+        ch->rx_hdr = (txpc_hdr_t){
+            .type = TXPC_MSG_TYPE_MSG,
+            .to = op->msg_hdr.to, .from = op->msg_hdr.from
+        };
+    }
+    if(!ch->rx_open) {
+        goto done;
+    }
+    if(index != ch->rx_index) {
+        // fragments in between were lost
+        ch->rx_open = false;
+        ch->rx_dropped++;
+        goto done;
+    }
+    if(op->msg_hdr.size > ch->rx_capacity - ch->rx_fill
+            || ch->rx_fill + op->msg_hdr.size > 0xffff) {
+        ch->rx_open = false;
+        ch->rx_dropped++;
+        goto done;
+    }
+    for(size_t i = 0; i < op->msg_hdr.size; i++) {
+        ch->rx_buf[ch->rx_fill + i] = op->buf[i];
+    }
+    if(!(flags & XPC_FRAG_LAST)) {
+        ch->rx_fill += op->msg_hdr.size;
+        ch->rx_index++;
+        goto done;
+    }
+    // a declined message keeps rx_fill, so the retry copies to the same place
+    ch->rx_hdr.size = ch->rx_fill + op->msg_hdr.size;
+    taken = XPC_DISPATCH(self, &ch->rx_hdr, ch->rx_buf);
+    if(taken) {
+        ch->rx_open = false;
+        ch->rx_fill = 0;
+    }
+done:
+    return taken;
+}
+
+/**
+ * Called when a connection reset completes.  A message part way through
+ * being fragmented starts over, and partly reassembled ones are dropped.
+ */
+static void xpc_channel_reset(xpc_relay_state_t *self) {
+    for(size_t i = 0; i < self->channels.count; i++) {
+        xpc_channel_t *ch = &self->channels.slots[i];
+        ch->offset = 0;
+        ch->deficit = 0;
+        ch->rx_open = false;
+        ch->rx_fill = 0;
+    }
+}
+
+xpc_status_t xpc_relay_send_channel(
+        xpc_relay_state_t *self, uint8_t channel, uint8_t to, uint8_t from,
+        char *data, size_t bytes) {
+    int status = TXPC_STATUS_DONE;
+    if(self == NULL || channel >= self->channels.count
+            || self->channels.slots[channel].capacity == 0 || bytes > 0xffff) {
+        status = TXPC_STATUS_BAD_STATE;
+        goto done;
+    }
+    xpc_channel_t *ch = &self->channels.slots[channel];
+    if(xpc_ack_mode(self) && bytes > self->channels.frag_max) {
+        // fragments are not acknowledged
+        status = TXPC_STATUS_BAD_STATE;
+        goto done;
+    }
+    if(ch->count == ch->capacity) {
+        if(self->signals & SIG_XOFF_RECVD) {
+            status = TXPC_STATUS_INHIBIT;
+            XPC_STAT(self, inhibited);
+        }
+        else {
+            status = TXPC_STATUS_INFLIGHT;
+        }
+        goto done;
+    }
+    ch->slots[(ch->head + ch->count) % ch->capacity] = (xpc_tx_desc_t){
+        .op = TXPC_OP_MSG,
+        .msg_hdr = {
+            .size = bytes, .to = to, .from = from, .type = TXPC_MSG_TYPE_MSG
+        },
+        .buf = data
+    };
+    ch->count++;
+    XPC_IO_NOTIFY(self, 1, true);
+done:
+    return status;
+}
+// ========= END CHANNELS =========
+
+/**
+ * Drop the state tied to the connection once a reset completes, on either
+ * side.
+ */
+static void xpc_reset_complete(xpc_relay_state_t *self) {
+    XPC_STAT(self, resets);
+    xpc_ack_reset(self);
+    xpc_flow_reset(self);
+    xpc_stream_reset(self);
+    xpc_channel_reset(self);
+}
+
+/**
+ * Load a descriptor into the write state machine.  Connection parameters
+ * carried by a config descriptor take effect here, so that queued messages
+ * ahead of it are still framed with the old ones.
+ */
+static void xpc_wr_op_start(xpc_relay_state_t *self, xpc_tx_desc_t *desc) {
+    self->inflight_wr_op.msg_hdr = desc->msg_hdr;
+    self->inflight_wr_op.buf = desc->buf;
+    self->inflight_wr_op.iov = desc->iov;
+    self->inflight_wr_op.iovcnt = desc->iovcnt;
+    self->inflight_wr_op.crc = NULL;
+    self->inflight_wr_op.bytes_complete = 0;
+    self->inflight_wr_op.total_bytes =
+        sizeof(txpc_hdr_t) + desc->msg_hdr.size;
+    self->inflight_wr_op.op = desc->op;
+    switch(desc->op) {
+        case TXPC_OP_RESET:
+            self->signals |= SIG_RST_SEND;
+        break;
+
+        case TXPC_OP_CONFIG:
+            self->conn_config.crc_bits = desc->config.crc_bits;
+            self->conn_config.flags = desc->config.flags;
+            XPC_CRC_CONFIG(self, self->conn_config.crc_bits, desc->buf);
+        break;
+
+        case TXPC_OP_MSG:
+            // no crc when crc_bits is 0
+            self->inflight_wr_op.total_bytes += XPC_CRC_BYTES(XPC_CRC_WIDTH(self));
+            if(xpc_ack_mode(self)) {
+                // sequence number trailer, tracked in the window if there is
+                // one.
+                self->inflight_wr_op.total_bytes += 1;
+                self->inflight_wr_op.seq = self->ack.next_seq++;
+                if(self->ack.capacity > 0) {
+                    *xpc_ack_slot(self, self->ack.count++) = (xpc_ack_slot_t){
+                        .msg_hdr = desc->msg_hdr, .buf = desc->buf,
+                        .iov = desc->iov, .iovcnt = desc->iovcnt,
+                        .seq = self->inflight_wr_op.seq,
+                        .state = XPC_ACK_SLOT_SENDING
+                    };
+                }
+            }
+            xpc_crc_begin(self, &self->inflight_wr_op);
+        break;
+
+        default:
+        break;
+    }
+}
+
+/**
+ * Start a write operation, or queue it behind the inflight one if the relay
+ * has a transmit queue with room.
+ * @return TXPC_STATUS_DONE if started or queued, TXPC_STATUS_INFLIGHT if the
+ * relay is busy and cannot queue, TXPC_STATUS_INHIBIT while flow is off.
+ */
+static xpc_status_t xpc_wr_op_submit(xpc_relay_state_t *self, xpc_tx_desc_t *desc) {
     int status = TXPC_STATUS_DONE;
-    if(self == NULL) {
-        status = TXPC_STATUS_BAD_STATE;
+    struct xpc_txq_t *queue = &self->tx_queue;
+    // only messages are held back by flow control
+    bool held = desc->op == TXPC_OP_MSG && (self->signals & SIG_XOFF_RECVD);
+    bool busy = self->inflight_wr_op.op != TXPC_OP_NONE || queue->count > 0
+        || held || (desc->op == TXPC_OP_MSG && xpc_ack_window_full(self));
+    if(busy && queue->count == queue->capacity) {
+        status = held ? TXPC_STATUS_INHIBIT:TXPC_STATUS_INFLIGHT;
+        if(held) {
+            XPC_STAT(self, inhibited);
+        }
         goto done;
     }
-    if(self->inflight_wr_op.op != TXPC_OP_NONE) { // || self->inflight_rd_op.op != TXPC_OP_NONE) {
-        status = TXPC_STATUS_INFLIGHT;
+    if(busy) {
+        // write notifications are already enabled for the inflight op
+        queue->slots[(queue->head + queue->count) % queue->capacity] = *desc;
+        queue->count++;
         goto done;
     }
-    else if(self->signals & SIG_XOFF_RECVD) {
-        status = TXPC_STATUS_INHIBIT;
+    xpc_wr_op_start(self, desc);
+    XPC_TRACE(self, wr_state, XPC_TRACE_WR_STATE, TXPC_OP_NONE, desc->op);
+    XPC_IO_NOTIFY(self, 1, true);
+done:
+    return status;
+}
+
+xpc_status_t xpc_relay_send_reset(xpc_relay_state_t *self) {
+    int status = TXPC_STATUS_DONE;
+    if(self == NULL) {
+        status = TXPC_STATUS_BAD_STATE;
         goto done;
     }
-    self->inflight_wr_op.op = TXPC_OP_RESET;
-    self->inflight_wr_op.bytes_complete = 0;
-    self->inflight_wr_op.total_bytes = sizeof(txpc_hdr_t);
-    self->inflight_wr_op.msg_hdr = (txpc_hdr_t){
-        .type = TXPC_MSG_TYPE_RESET, .size = 0, .to = 0, .from = 0
+    xpc_tx_desc_t desc = {
+        .op = TXPC_OP_RESET,
+        .msg_hdr = {.type = TXPC_MSG_TYPE_RESET, .size = 0, .to = 0, .from = 0},
+        .buf = NULL
     };
-    self->io_notify(self->io_ctx, 1, true);
-    self->signals |= SIG_RST_SEND;
+    status = xpc_wr_op_submit(self, &desc);
 done:
     return status;
 }
 
+/**
+ * Whether a scattered payload may still be written: by the write state
+ * machine, from the transmit queue, or as a resend from the send window.
+ * Its crc can only be computed with the running crc, so the CRC width must
+ * not go past 64 bits meanwhile.
+ */
+static bool xpc_scattered_pending(xpc_relay_state_t *self) {
+    bool pending = self->inflight_wr_op.op == TXPC_OP_MSG
+        && self->inflight_wr_op.iov != NULL;
+    for(size_t i = 0; !pending && i < self->tx_queue.count; i++) {
+        pending = self->tx_queue.slots[
+            (self->tx_queue.head + i) % self->tx_queue.capacity
+        ].iov != NULL;
+    }
+    for(size_t i = 0; !pending && i < self->ack.count; i++) {
+        xpc_ack_slot_t *slot = xpc_ack_slot(self, i);
+        pending = slot->iov != NULL && slot->state != XPC_ACK_SLOT_ACKED;
+    }
+    return pending;
+}
+
+/**
+ * Whether a config received from the remote can be applied: its CRC width
+ * must be one this relay checks frames with, and cover everything it may
+ * still write.
+ */
+static bool xpc_rd_config_usable(xpc_relay_state_t *self, int crc_bits) {
+#if defined(XPC_BIND_CRC_BITS)
+    if(crc_bits != 0 && crc_bits != XPC_BIND_CRC_BITS) {
+        // frames are only ever checked with the bound width
+        return false;
+    }
+#endif
+    return crc_bits <= 64 || !xpc_scattered_pending(self);
+}
+
+/**
+ * The CRC width of messages sent now, once the configs queued ahead of them
+ * have taken effect.
+ */
+static int xpc_wr_crc_width(xpc_relay_state_t *self) {
+    int crc_bits = XPC_CRC_WIDTH(self);
+    for(size_t i = 0; i < self->tx_queue.count; i++) {
+        xpc_tx_desc_t *desc = &self->tx_queue.slots[
+            (self->tx_queue.head + i) % self->tx_queue.capacity
+        ];
+        if(desc->op == TXPC_OP_CONFIG) {
+            crc_bits = desc->config.crc_bits;
+        }
+    }
+    return crc_bits;
+}
+
 xpc_status_t xpc_relay_send_config(
         xpc_relay_state_t *self,
         int crc_bits, char *crc_polyn,
@@ -83,29 +1905,28 @@ xpc_status_t xpc_relay_send_config(
         status = TXPC_STATUS_BAD_STATE;
         goto done;
     }
-    if(self->inflight_wr_op.op != TXPC_OP_NONE) {
-        status = TXPC_STATUS_INFLIGHT;
+#if defined(XPC_BIND_CRC_BITS)
+    if(crc_bits != 0 && crc_bits != XPC_BIND_CRC_BITS) {
+        // frames are only ever checked with the bound width
+        status = TXPC_STATUS_BAD_STATE;
         goto done;
     }
-    else if(self->signals & SIG_XOFF_RECVD) {
-        status = TXPC_STATUS_INHIBIT;
+#endif
+    if(crc_bits > 64 && xpc_scattered_pending(self)) {
+        status = TXPC_STATUS_BAD_STATE;
         goto done;
     }
-    self->inflight_wr_op.msg_hdr = (txpc_hdr_t) {
-        .type = TXPC_MSG_TYPE_CONFIG, .size = 1 + 1 + (crc_bits >> 3),
-        .to = 0, .from = 0
+    xpc_tx_desc_t desc = {
+        .op = TXPC_OP_CONFIG,
+        .msg_hdr = {
+            .type = TXPC_MSG_TYPE_CONFIG, .size = 1 + 1 + XPC_CRC_BYTES(crc_bits),
+            .to = 0, .from = 0
+        },
+        .buf = crc_polyn,
+        .config = {.crc_bits = crc_bits, .flags = msg_sync_ack}
     };
-    self->inflight_wr_op.buf = crc_polyn;
-    self->inflight_wr_op.total_bytes = sizeof(txpc_hdr_t) + self->inflight_wr_op.msg_hdr.size;
-    self->inflight_wr_op.bytes_complete = 0;
-    self->inflight_wr_op.op = TXPC_OP_CONFIG;
-
-    self->conn_config.crc_bits = crc_bits;
-    self->conn_config.flags = msg_sync_ack;
-
-    self->crc_config(self->crc_ctx, crc_bits, crc_polyn);
     /*self->signals |= SIG_CONFIG_SEND; // XXX what is this for?*/
-    self->io_notify(self->io_ctx, 1, true);
+    status = xpc_wr_op_submit(self, &desc);
 done:
     return status;
     
@@ -118,59 +1939,307 @@ xpc_status_t xpc_send_msg(xpc_relay_state_t *self, uint8_t to, uint8_t from, cha
         status = TXPC_STATUS_BAD_STATE;
         goto done;
     }
-    if(self->inflight_wr_op.op != TXPC_OP_NONE) {
-        status = TXPC_STATUS_INFLIGHT;
+    xpc_tx_desc_t desc = {
+        .op = TXPC_OP_MSG,
+        .msg_hdr = {
+            .size = bytes, .to = to, .from = from, .type = TXPC_MSG_TYPE_MSG
+        },
+        .buf = data
+    };
+    status = xpc_wr_op_submit(self, &desc);
+done:
+    return status;
+}
+
+xpc_status_t xpc_send_msgv(
+        xpc_relay_state_t *self, uint8_t to, uint8_t from,
+        const xpc_iovec_t *iov, int iovcnt) {
+    int status = TXPC_STATUS_DONE;
+    size_t bytes = 0;
+    if(self == NULL || iovcnt < 0 || iovcnt > XPC_MSG_MAX_IOV
+            || (iovcnt > 0 && iov == NULL)) {
+        status = TXPC_STATUS_BAD_STATE;
         goto done;
     }
-    else if(self->signals & SIG_XOFF_RECVD) {
-        status = TXPC_STATUS_INHIBIT;
+    for(int i = 0; i < iovcnt; i++) {
+        bytes += iov[i].len;
+    }
+    if(bytes > 0xffff) {
+        status = TXPC_STATUS_BAD_STATE;
         goto done;
     }
-    self->inflight_wr_op.msg_hdr = (txpc_hdr_t){
-        .size = bytes, .to = to, .from = from, .type = TXPC_MSG_TYPE_MSG
+    xpc_tx_desc_t desc = {
+        .op = TXPC_OP_MSG,
+        .msg_hdr = {
+            .size = bytes, .to = to, .from = from, .type = TXPC_MSG_TYPE_MSG
+        },
+        .buf = iovcnt > 0 ? iov[0].base:NULL
     };
-    self->inflight_wr_op.buf = data;
-    self->inflight_wr_op.bytes_complete = 0;
-    // the >> 3 divides by 8 to go from bits -> bytes, and 0 >> 3 = 0 -> no crc.
-    self->inflight_wr_op.total_bytes =
-        sizeof(txpc_hdr_t) + bytes + (self->conn_config.crc_bits >> 3);
-    self->inflight_wr_op.op = TXPC_OP_MSG;
-    self->io_notify(self->io_ctx, 1, true);
+    if(iovcnt > 1) {
+        // crc_fn cannot see past the first segment, and CRCs may be turned
+        // on before the message is written
+        if(XPC_HAS_CRC(self) && (!XPC_HAS_CRC_UPDATE(self)
+                || xpc_wr_crc_width(self) > 64)) {
+            status = TXPC_STATUS_BAD_STATE;
+            goto done;
+        }
+        desc.iov = iov;
+        desc.iovcnt = iovcnt;
+    }
+    status = xpc_wr_op_submit(self, &desc);
+done:
+    return status;
+}
+
+// the most segments a single frame is made of (config: hdr, mode, bits, polyn,
+// msg: hdr, payload segments, seq, crc, stream: hdr, payload, offset, crc,
+// fragment: hdr, payload, trailer, crc)
+#define XPC_WR_MAX_SEGS (3 + XPC_MSG_MAX_IOV)
+
+/**
+ * List the wire segments of the frame held by the write state machine, in
+ * transmission order.  Segments which have not been produced yet (e.g. a CRC
+ * that is not computed) have a NULL base, but are only reached once they are.
+ * @return the number of entries written to segs.
+ */
+static int xpc_wr_segments(xpc_relay_state_t *self, xpc_iovec_t *segs) {
+    struct xpc_sm_t *op = &self->inflight_wr_op;
+    int count = 0;
+    segs[count++] = (xpc_iovec_t){(char*)&op->msg_hdr, sizeof(txpc_hdr_t)};
+    switch(op->op) {
+        case TXPC_OP_MSG:
+        case TXPC_OP_STREAM:
+        case TXPC_OP_FRAG:
+            if(op->iov != NULL) {
+                for(int i = 0; i < op->iovcnt; i++) {
+                    segs[count++] = op->iov[i];
+                }
+            }
+            else {
+                segs[count++] = (xpc_iovec_t){op->buf, op->msg_hdr.size};
+            }
+            size_t bytes = 0;
+            char *trailer = xpc_wr_trailer(self, op, &bytes);
+            if(bytes) {
+                segs[count++] = (xpc_iovec_t){trailer, bytes};
+            }
+            segs[count++] = (xpc_iovec_t){
+                op->crc, XPC_CRC_BYTES(XPC_CRC_WIDTH(self))
+            };
+        break;
+
+        case TXPC_OP_ACK:
+            segs[count++] = (xpc_iovec_t){op->buf, op->msg_hdr.size};
+            if(self->conn_config.crc_bits) {
+                segs[count++] = (xpc_iovec_t){
+                    op->crc, XPC_CRC_BYTES(XPC_CRC_WIDTH(self))
+                };
+            }
+        break;
+
+        case TXPC_OP_CONFIG:
+            segs[count++] = (xpc_iovec_t){(char*)&self->conn_config.flags, 1};
+            segs[count++] = (xpc_iovec_t){
+                (char*)&self->conn_config.crc_bits, 1
+            };
+            segs[count++] = (xpc_iovec_t){
+                op->buf, XPC_CRC_BYTES(XPC_CRC_WIDTH(self))
+            };
+        break;
+
+        default:
+        break;
+    }
+    return count;
+}
+
+// ========= COALESCING =========
+/**
+ * Catch up with the frames the staging buffer has written in full: start the
+ * retransmission timeouts of sequenced messages.
+ * @return true if the end frame of the stream being sent has been written.
+ */
+static bool xpc_coalesce_written(xpc_relay_state_t *self) {
+    struct xpc_coalesce_t *co = &self->coalesce;
+    for(size_t i = 0; i < self->ack.count; i++) {
+        xpc_ack_slot_t *slot = xpc_ack_slot(self, i);
+        if(slot->staged && slot->staged <= co->sent) {
+            xpc_ack_slot_sent(self, slot);
+        }
+    }
+    return self->stream_tx.staged && self->stream_tx.staged <= co->sent;
+}
+
+/**
+ * Write out staged bytes, as far as the link takes them.
+ * @return true once nothing is left staged.
+ */
+static bool xpc_coalesce_flush(xpc_relay_state_t *self) {
+    struct xpc_coalesce_t *co = &self->coalesce;
+    if(co->sent < co->fill) {
+        size_t asked = co->fill - co->sent;
+        int bytes = 0;
+        if(XPC_HAS_WRITE(self)) {
+            bytes = XPC_IO_WRITE(self, &co->buf, co->sent, asked);
+        }
+        else {
+            xpc_iovec_t iov = {co->buf + co->sent, asked};
+            bytes = XPC_IO_WRITEV(self, &iov, 1);
+        }
+        XPC_STAT_IO(self, tx, asked, bytes);
+        XPC_TRACE(self, wr_io, XPC_TRACE_WR_IO, asked, bytes);
+        co->sent += bytes;
+    }
+    bool ended = xpc_coalesce_written(self);
+    bool flushed = co->sent == co->fill;
+    if(flushed && co->fill) {
+        co->fill = 0;
+        co->sent = 0;
+        XPC_IO_RESET(self, 0, -1);
+    }
+    // the callback may start another stream, so it comes last
+    if(ended) {
+        xpc_stream_end(self);
+    }
+    return flushed;
+}
+
+/**
+ * Copy what is left of the inflight frame into the staging buffer, after
+ * writing the buffer out if it is full.
+ * @return the number of bytes staged.
+ */
+static int xpc_coalesce_stage(
+        xpc_relay_state_t *self, xpc_iovec_t *segs, int nsegs) {
+    struct xpc_coalesce_t *co = &self->coalesce;
+    size_t skip = self->inflight_wr_op.bytes_complete;
+    int staged = 0;
+    if(co->fill == co->capacity && !xpc_coalesce_flush(self)) {
+        return 0;
+    }
+    if(co->fill == 0 && co->clock != NULL) {
+        co->since = co->clock(co->clock_ctx);
+    }
+    for(int i = 0; i < nsegs && co->fill < co->capacity; i++) {
+        if(skip >= segs[i].len) {
+            skip -= segs[i].len;
+            continue;
+        }
+        size_t bytes = segs[i].len - skip;
+        if(bytes > co->capacity - co->fill) {
+            bytes = co->capacity - co->fill;
+        }
+        // a plain loop, the relay needs nothing but memcmp from libc
+        for(size_t j = 0; j < bytes; j++) {
+            co->buf[co->fill + j] = segs[i].base[skip + j];
+        }
+        co->fill += bytes;
+        staged += bytes;
+        skip = 0;
+    }
+    return staged;
+}
+
+/**
+ * Whether the staged bytes should be written out at the end of this call.
+ */
+static bool xpc_coalesce_due(xpc_relay_state_t *self) {
+    struct xpc_coalesce_t *co = &self->coalesce;
+    return co->deadline == 0 || co->clock == NULL || (int32_t)(
+        co->clock(co->clock_ctx) - co->since) >= (int32_t)co->deadline;
+}
+
+xpc_status_t xpc_relay_flush(xpc_relay_state_t *self) {
+    int status = TXPC_STATUS_DONE;
+    if(self == NULL || self->coalesce.buf == NULL) {
+        status = TXPC_STATUS_BAD_STATE;
+        goto done;
+    }
+    // stage the inflight frame and anything queued first
+    xpc_wr_op_continue(self);
+    if(!xpc_coalesce_flush(self)) {
+        XPC_IO_NOTIFY(self, 1, true);
+        status = TXPC_STATUS_INFLIGHT;
+    }
 done:
     return status;
 }
+// ========= END COALESCING =========
+
+/**
+ * Issue the next IO call for the inflight write operation.  Without a
+ * vectored wrapper, only the remainder of the current segment is written.
+ * With one, everything left in the frame is submitted at once.
+ * @return the number of bytes written.
+ */
+static int xpc_wr_io(xpc_relay_state_t *self) {
+    struct xpc_sm_t *op = &self->inflight_wr_op;
+    xpc_iovec_t segs[XPC_WR_MAX_SEGS];
+    xpc_iovec_t iov[XPC_WR_MAX_SEGS];
+    int iovcnt = 0;
+    if(op->op == TXPC_OP_NONE || op->bytes_complete >= op->total_bytes) {
+        return 0;
+    }
+    int nsegs = xpc_wr_segments(self, segs);
+    if(self->coalesce.buf != NULL) {
+        if(op->op == TXPC_OP_MSG || op->op == TXPC_OP_STREAM
+                || op->op == TXPC_OP_FRAG) {
+            return xpc_coalesce_stage(self, segs, nsegs);
+        }
+        // other frames are not held back, but go after what is staged
+        if(!xpc_coalesce_flush(self)) {
+            return 0;
+        }
+    }
+    size_t skip = op->bytes_complete;
+    size_t asked = 0;
+    int bytes = 0;
+    for(int i = 0; i < nsegs; i++) {
+        if(skip >= segs[i].len) {
+            skip -= segs[i].len;
+            continue;
+        }
+        if(!XPC_HAS_WRITEV(self)) {
+            bytes = XPC_IO_WRITE(
+                self, &segs[i].base, skip, segs[i].len - skip
+            );
+            XPC_STAT_IO(self, tx, segs[i].len - skip, bytes);
+            XPC_TRACE(self, wr_io, XPC_TRACE_WR_IO, segs[i].len - skip, bytes);
+            return bytes;
+        }
+        iov[iovcnt++] = (xpc_iovec_t){segs[i].base + skip, segs[i].len - skip};
+        asked += segs[i].len - skip;
+        skip = 0;
+    }
+    if(iovcnt > 0) {
+        bytes = XPC_IO_WRITEV(self, iov, iovcnt);
+        XPC_STAT_IO(self, tx, asked, bytes);
+        XPC_TRACE(self, wr_io, XPC_TRACE_WR_IO, asked, bytes);
+    }
+    return bytes;
+}
 
 // changes:
 //  - no link with flow control, this is problematic 
 
 xpc_status_t xpc_wr_op_continue(xpc_relay_state_t *self) {
     int status = TXPC_STATUS_DONE;
-    if(self == NULL || self->read == NULL) {
+    if(self == NULL || (!XPC_HAS_WRITE(self) && !XPC_HAS_WRITEV(self))) {
         status = TXPC_STATUS_BAD_STATE;
         goto done;
     }
 
     int starting_state = -1;
-    bool do_payload_write = false;
-    bool prev_payload_write = false;
-    bool do_crc_write = false;
-    char *crc_location = NULL;
-    char *payload_location = NULL;
-    int write_size = 0;
-    int write_offset = 0;
     int bytes = 0;
+    xpc_ack_slot_t *resend = NULL;
     do {
         bytes = 0;
         starting_state = self->inflight_wr_op.op;
 
         switch(self->inflight_wr_op.op) {
             case TXPC_OP_NONE:
-                // check rd signals here
-                if(self->signals & SIG_XOFF_RECVD) {
-                    // inhibit all operations until this signal is de-asserted.
-                    status = TXPC_STATUS_INHIBIT;
-                    goto done; // short circuit to the end
-                }
+                // check rd signals here.  Control frames go first, and are
+                // not held back by flow control.
                 if(self->signals & SIG_RST_RECVD) {
                     self->inflight_wr_op.op = TXPC_OP_RESET;
                     self->inflight_wr_op.bytes_complete = 0;
@@ -179,8 +2248,48 @@ xpc_status_t xpc_wr_op_continue(xpc_relay_state_t *self) {
                         .type = 1, .size = 0, .to = 0, .from = 0
                     };
                 }
-                // turn off write notifications if there is no msg to send
-                self->io_notify(self->io_ctx, 1, false);
+                else if(self->signals & SIG_FLOW_SEND) {
+                    xpc_flow_send_start(self);
+                }
+                else if(self->signals & (SIG_ACK_RECVD | SIG_NACK_RECVD)) {
+                    xpc_ack_send_start(self);
+                }
+                else if(!(self->signals & SIG_XOFF_RECVD)
+                        && (resend = xpc_ack_next_resend(self)) != NULL) {
+                    xpc_ack_resend_start(self, resend);
+                }
+                else if(self->tx_queue.count > 0 && !(
+                        self->tx_queue.slots[self->tx_queue.head].op
+                        == TXPC_OP_MSG && (xpc_ack_window_full(self)
+                            || (self->signals & SIG_XOFF_RECVD)))) {
+                    // drain the queue back-to-back within this call
+                    xpc_wr_op_start(
+                        self, &self->tx_queue.slots[self->tx_queue.head]
+                    );
+                    self->tx_queue.head =
+                        (self->tx_queue.head + 1) % self->tx_queue.capacity;
+                    self->tx_queue.count--;
+                }
+                else if(self->channels.count > 0
+                        && !(self->signals & SIG_XOFF_RECVD)
+                        && xpc_channel_next(self)) {
+                    // channel messages go after the queue, by priority
+                }
+                else if(self->stream_tx.pull != NULL
+                        && !self->stream_tx.staged
+                        && !(self->signals & SIG_XOFF_RECVD)
+                        && xpc_stream_next(self)) {
+                    // stream frames only go when nothing else is waiting
+                }
+                else {
+                    // turn off write notifications if there is no msg to send
+                    XPC_IO_NOTIFY(self, 1, false);
+                    if(self->signals & SIG_XOFF_RECVD) {
+                        // until XON is received
+                        status = TXPC_STATUS_INHIBIT;
+                        XPC_STAT(self, inhibited);
+                    }
+                }
             break;
 
             case TXPC_OP_RESET:
@@ -191,8 +2300,9 @@ xpc_status_t xpc_wr_op_continue(xpc_relay_state_t *self) {
                         self->inflight_wr_op.op = TXPC_OP_NONE;
                         self->inflight_wr_op.bytes_complete = 0;
                         self->inflight_wr_op.total_bytes = 0;
-                        self->io_reset(self->io_ctx, 0, -1);
-                        self->io_reset(self->io_ctx, 1, -1);
+                        XPC_IO_RESET(self, 0, -1);
+                        xpc_rd_discard(self);
+                        xpc_reset_complete(self);
                     }
                     else if(!(self->signals & SIG_RST_SEND)){
                         // we did initiate, rx sm will de-assert send signal
@@ -206,117 +2316,214 @@ xpc_status_t xpc_wr_op_continue(xpc_relay_state_t *self) {
             break;
 
             case TXPC_OP_MSG:
-                write_offset = self->inflight_wr_op.bytes_complete - sizeof(txpc_hdr_t);
-                prev_payload_write = do_payload_write;
-                do_payload_write = true;
-                payload_location = self->inflight_wr_op.buf;
-                write_size = self->inflight_wr_op.total_bytes - self->inflight_wr_op.bytes_complete - (self->conn_config.crc_bits >> 3);
+            case TXPC_OP_STREAM:
+            case TXPC_OP_FRAG:
                 if(self->inflight_wr_op.bytes_complete
                         == self->inflight_wr_op.total_bytes) {
-                    // if the currently inflight message has finished
-                    self->io_reset(self->io_ctx, 0, -1);
-                    // set state to none
-                    self->inflight_wr_op.op = TXPC_OP_NONE;
-                    prev_payload_write = do_payload_write;
-                    do_payload_write = false;
-                    do_crc_write = false;
-                    /*goto done;*/
+                    // if the currently inflight message has finished.  A
+                    // staged frame is reset once the buffer is written.
+                    if(self->coalesce.buf == NULL) {
+                        XPC_IO_RESET(self, 0, -1);
+                    }
+                    if(self->inflight_wr_op.op == TXPC_OP_STREAM) {
+                        self->inflight_wr_op.op = TXPC_OP_NONE;
+                        xpc_stream_sent(self);
+                    }
+                    else if(self->inflight_wr_op.op == TXPC_OP_FRAG) {
+                        // the channel moved on when the fragment was loaded
+                        self->inflight_wr_op.op = TXPC_OP_NONE;
+                    }
+                    else {
+                        // set state to none
+                        self->inflight_wr_op.op = TXPC_OP_NONE;
+                        if(xpc_ack_mode(self)) {
+                            xpc_ack_sent(self, self->inflight_wr_op.seq);
+                        }
+                    }
                 }
-                // this case must come after the above case, otherwise crc write
-                // will trigger even when there is no crc being used.
-                else if(self->inflight_wr_op.bytes_complete
+                // without a vectored write (see xpc_crc_begin), the crc is
+                // needed once hdr + payload are sent.
+                else if(self->conn_config.crc_bits
+                        && self->inflight_wr_op.crc == NULL
+                        && self->inflight_wr_op.bytes_complete
                         == self->inflight_wr_op.msg_hdr.size
                         + sizeof(txpc_hdr_t)) {
-                    // hdr + payload sent, but not crc
-                    write_offset = 0;
-                    self->io_reset(self->io_ctx, 0, -1);
-                    crc_location = self->crc(
-                        self->crc_ctx,
-                        self->inflight_wr_op.buf,
-                        self->inflight_wr_op.msg_hdr.size
+                    char *crc = self->inflight_wr_op.crc_out;
+                    if(!xpc_crc_incremental(self)) {
+                        crc = xpc_crc_whole(self, &self->inflight_wr_op);
+                    }
+                    else {
+                        // payload was folded in as it was written
+                        XPC_CRC_FINALIZE(
+                            self, self->inflight_wr_op.crc_state, crc
+                        );
+                    }
+                    self->inflight_wr_op.crc = xpc_wr_crc_seal(
+                        self, &self->inflight_wr_op, crc
                     );
-                    prev_payload_write = do_payload_write;
-                    do_payload_write = false;
-                    do_crc_write = true;
                 }
             break;
 
             case TXPC_OP_CONFIG:
-                do_payload_write = true;
                 if(self->inflight_wr_op.bytes_complete
                         == self->inflight_wr_op.total_bytes) {
                     // if the currently inflight message has finished
-                    self->io_reset(self->io_ctx, 0, -1);
+                    XPC_IO_RESET(self, 0, -1);
                     // set state to none
                     self->inflight_wr_op.op = TXPC_OP_NONE;
-                    prev_payload_write = do_payload_write;
                     self->inflight_wr_op.total_bytes = 0;
                     self->inflight_wr_op.bytes_complete = 0;
-                    do_payload_write = false;
-                    do_crc_write = false;
-                }
-                else if(self->inflight_wr_op.bytes_complete == sizeof(txpc_hdr_t) + 2) {
-                    // hdr + mode + crc_bits sent, send polyn now
-                    payload_location = self->inflight_wr_op.buf;
-                    write_size = self->conn_config.crc_bits >> 3;
-                }
-                else if(self->inflight_wr_op.bytes_complete == sizeof(txpc_hdr_t) + 1) {
-                    // hdr + mode sent
-                    payload_location = (char*)&self->conn_config.crc_bits;
-                    write_size = 1;
-
-                }
-                else if(self->inflight_wr_op.bytes_complete == sizeof(txpc_hdr_t)) {
-                    // hdr only
-                    payload_location = (char*)&self->conn_config.flags;
-                    write_size = 1;
                 }
             break;
 
             case TXPC_OP_ACK:
+            case TXPC_OP_FLOW:
+                if(self->inflight_wr_op.bytes_complete
+                        == self->inflight_wr_op.total_bytes) {
+                    XPC_IO_RESET(self, 0, -1);
+                    self->inflight_wr_op.op = TXPC_OP_NONE;
+                    self->inflight_wr_op.total_bytes = 0;
+                    self->inflight_wr_op.bytes_complete = 0;
+                }
+            break;
 
+            default:
             break;
         }
-
-        if(self->inflight_wr_op.bytes_complete < sizeof(txpc_hdr_t) && self->inflight_wr_op.total_bytes > 0) {
-            char *buf = (char*)&self->inflight_wr_op.msg_hdr;
-            bytes = self->write(self->io_ctx, &buf, self->inflight_wr_op.bytes_complete, sizeof(txpc_hdr_t) - self->inflight_wr_op.bytes_complete);
+        if(self->inflight_wr_op.op != starting_state) {
+            XPC_TRACE(self, wr_state, XPC_TRACE_WR_STATE,
+                starting_state, self->inflight_wr_op.op);
         }
-        else if(do_payload_write) {
-            bytes = self->write(
-                self->io_ctx,
-                &payload_location,
-                write_offset,
-                write_size
+
+        bytes = xpc_wr_io(self);
+        if((self->inflight_wr_op.op == TXPC_OP_MSG
+                    || self->inflight_wr_op.op == TXPC_OP_STREAM
+                    || self->inflight_wr_op.op == TXPC_OP_FRAG)
+                && xpc_crc_incremental(self)
+                && self->conn_config.crc_bits
+                && self->inflight_wr_op.crc == NULL) {
+            xpc_crc_fold(
+                self, &self->inflight_wr_op,
+                self->inflight_wr_op.bytes_complete, bytes
             );
         }
-        else if(do_crc_write) {
-            bytes = self->write(
-                self->io_ctx,
-                &crc_location,
-                0,
-                (self->conn_config.crc_bits >> 3)
+        self->inflight_wr_op.bytes_complete += bytes;
+        if(bytes > 0 && self->inflight_wr_op.bytes_complete
+                == self->inflight_wr_op.total_bytes) {
+            XPC_STAT_FRAME(
+                self, tx, &self->inflight_wr_op.msg_hdr,
+                self->inflight_wr_op.total_bytes
             );
         }
-        self->inflight_wr_op.bytes_complete += bytes;
-    } while(self->inflight_wr_op.op != starting_state || bytes > 0);// || prev_payload_write != do_payload_write);
+    } while(self->inflight_wr_op.op != starting_state || bytes > 0);
+    if(self->coalesce.fill && xpc_coalesce_due(self)
+            && !xpc_coalesce_flush(self)) {
+        // until the link takes the rest
+        XPC_IO_NOTIFY(self, 1, true);
+    }
 done:
     return status;
 }
 
-xpc_status_t xpc_rd_op_continue(xpc_relay_state_t *self) {
-    int status = TXPC_STATUS_DONE;
-    if(self == NULL || self->read == NULL) {
-        status = TXPC_STATUS_BAD_STATE;
-        goto done;
+/**
+ * Number of bytes which follow the header on the wire for a frame.
+ */
+static size_t xpc_rd_frame_bytes(xpc_relay_state_t *self, txpc_hdr_t *hdr) {
+    size_t bytes = hdr->size;
+    if(hdr->type == TXPC_MSG_TYPE_MSG) {
+        bytes += XPC_CRC_BYTES(XPC_CRC_WIDTH(self)) + (xpc_ack_mode(self) ? 1:0);
+    }
+    else if(hdr->type == TXPC_MSG_TYPE_STREAM) {
+        // streams are not acknowledged, chunks carry their offset instead
+        bytes += XPC_STREAM_TRAILER + XPC_CRC_BYTES(XPC_CRC_WIDTH(self));
+    }
+    else if(hdr->type == TXPC_MSG_TYPE_FRAG) {
+        // nor are fragments, which carry their channel instead
+        bytes += XPC_FRAG_TRAILER + XPC_CRC_BYTES(XPC_CRC_WIDTH(self));
+    }
+    else if(hdr->type == TXPC_MSG_TYPE_ACK) {
+        bytes += XPC_CRC_BYTES(XPC_CRC_WIDTH(self));
+    }
+    return bytes;
+}
+
+/**
+ * Whether a header could have been sent: a known type, no payload on the
+ * header only control frames, and room for the flags and CRC width in a
+ * config.
+ */
+static bool xpc_rd_hdr_sane(txpc_hdr_t *hdr) {
+    bool sane = false;
+    switch(hdr->type) {
+        case TXPC_MSG_TYPE_RESET:
+        case TXPC_MSG_TYPE_XON:
+        case TXPC_MSG_TYPE_XOFF:
+            sane = hdr->size == 0;
+        break;
+
+        case TXPC_MSG_TYPE_CONFIG:
+            sane = hdr->size >= 2;
+        break;
+
+        case TXPC_MSG_TYPE_ACK:
+        case TXPC_MSG_TYPE_MSG:
+        case TXPC_MSG_TYPE_STREAM:
+        case TXPC_MSG_TYPE_FRAG:
+            sane = true;
+        break;
+    }
+    return sane;
+}
+
+/**
+ * Issue a read on behalf of the read state machine.  Without a span from
+ * xpc_relay_feed this is the read wrapper.  With one, a header is only taken
+ * once the whole frame is present in the span (unless it is not sane), and
+ * payloads are not copied: *buffer is pointed into the span instead.
+ */
+static int xpc_rd_io(xpc_relay_state_t *self, char **buffer, int offset, size_t bytes_max) {
+    struct xpc_span_t *span = &self->rd_span;
+    if(span->buf == NULL) {
+        int bytes = XPC_IO_READ(self, buffer, offset, bytes_max);
+        XPC_STAT_IO(self, rx, bytes_max, bytes);
+        XPC_TRACE(self, rd_io, XPC_TRACE_RD_IO, bytes_max, bytes);
+        return bytes;
     }
+    char *src = span->buf + span->pos;
+    if(span->len - span->pos < bytes_max) {
+        return 0;
+    }
+    if(self->inflight_rd_op.bytes_complete < sizeof(txpc_hdr_t)) {
+        txpc_hdr_t hdr = self->inflight_rd_op.msg_hdr;
+        for(size_t i = 0; i < bytes_max; i++) {
+            ((char*)&hdr)[offset + i] = src[i];
+        }
+        // a header no endpoint sends is taken at once, and the input
+        // abandoned, rather than waiting for a body it may never get
+        if(xpc_rd_hdr_sane(&hdr)
+                && span->len - span->pos - bytes_max < xpc_rd_frame_bytes(self, &hdr)) {
+            return 0;
+        }
+        self->inflight_rd_op.msg_hdr = hdr;
+        span->frame = span->pos;
+    }
+    else {
+        *buffer = src - offset;
+    }
+    span->pos += bytes_max;
+    return bytes_max;
+}
 
+/**
+ * Body of the read state machine, shared by the pull (read wrapper) and push
+ * (xpc_relay_feed) entry points.
+ */
+static xpc_status_t xpc_rd_sm_run(xpc_relay_state_t *self) {
+    int status = TXPC_STATUS_DONE;
     int starting_state = -1;
-    bool do_payload_read = false;
-    bool prev_payload_read = false;
-    bool do_crc_read = false;
     char *crc_location = NULL;
     int bytes = 0;
+    bool dispatched = false;
 
     do {
         bytes = 0;
@@ -324,22 +2531,38 @@ xpc_status_t xpc_rd_op_continue(xpc_relay_state_t *self) {
         // read in new bytes
         if(self->inflight_rd_op.bytes_complete < sizeof(txpc_hdr_t)) {
             char *buf = (char*)&self->inflight_rd_op.msg_hdr;
-            bytes = self->read(
-                self->io_ctx,
+            bytes = xpc_rd_io(
+                self,
                 &buf,
                 self->inflight_rd_op.bytes_complete,
                 sizeof(txpc_hdr_t) - self->inflight_rd_op.bytes_complete
             );
         }
-        else if(do_payload_read || do_crc_read){
-            bytes = self->read(
-                self->io_ctx,
+        else if((self->inflight_rd_op.op == TXPC_OP_WAIT_MSG
+                    || self->inflight_rd_op.op == TXPC_OP_WAIT_CONFIG
+                    || self->inflight_rd_op.op == TXPC_OP_WAIT_ACK)
+                && self->inflight_rd_op.bytes_complete
+                < self->inflight_rd_op.total_bytes) {
+            // payload and possible crc in transit
+            bytes = xpc_rd_io(
+                self,
                 &self->inflight_rd_op.buf,
                 self->inflight_rd_op.bytes_complete - sizeof(txpc_hdr_t),
                 self->inflight_rd_op.total_bytes - self->inflight_rd_op.bytes_complete
             );
+            if(self->inflight_rd_op.op == TXPC_OP_WAIT_MSG
+                    && xpc_crc_incremental(self) && self->conn_config.crc_bits) {
+                xpc_crc_fold(
+                    self, &self->inflight_rd_op,
+                    self->inflight_rd_op.bytes_complete, bytes
+                );
+            }
         }
         self->inflight_rd_op.bytes_complete += bytes;
+        if(bytes > 0) {
+            // restarts the partial frame timeout
+            self->timers.rd_held = 0;
+        }
         // inflight message read complete
         // do state update
         switch(self->inflight_rd_op.op) {
@@ -348,14 +2571,29 @@ xpc_status_t xpc_rd_op_continue(xpc_relay_state_t *self) {
                 // because we're in the none state), figure out what state
                 // we should go to.
                 if(self->inflight_rd_op.bytes_complete >= sizeof(txpc_hdr_t)) {
+                    // the IO subsystem places each payload, the last one may
+                    // still be leased.
+                    self->inflight_rd_op.buf = NULL;
+                    if(!xpc_rd_hdr_sane(&self->inflight_rd_op.msg_hdr)) {
+                        // a damaged header: neither it nor its size can be
+                        // trusted, so nothing after it can be framed.
+                        XPC_STAT(self, bad_frames);
+                        xpc_rd_abandon(self);
+                        break;
+                    }
                     switch(self->inflight_rd_op.msg_hdr.type) {
                         case TXPC_MSG_TYPE_RESET:
+                            XPC_STAT_FRAME(
+                                self, rx, &self->inflight_rd_op.msg_hdr,
+                                sizeof(txpc_hdr_t)
+                            );
                             // if we initiated, just de-assert the send signal
                             // on recv
                             if(self->signals & SIG_RST_SEND) {
                                 self->signals &= ~SIG_RST_SEND;
-                                self->io_reset(self->io_ctx, 0, -1);
-                                self->io_reset(self->io_ctx, 1, -1);
+                                XPC_IO_RESET(self, 0, -1);
+                                xpc_rd_discard(self);
+                                xpc_reset_complete(self);
                                 self->inflight_rd_op.bytes_complete = 0;
                                 self->inflight_rd_op.total_bytes = 5;
                             }
@@ -363,27 +2601,54 @@ xpc_status_t xpc_rd_op_continue(xpc_relay_state_t *self) {
                                 // we got a reset, have to wait for completion
                                 self->signals |= SIG_RST_RECVD;
                                 self->inflight_rd_op.op = TXPC_OP_WAIT_RESET;
+                                // the reply is sent by the write state machine
+                                XPC_IO_NOTIFY(self, 1, true);
                             }
                         break;
 
                         case TXPC_MSG_TYPE_CONFIG:
                             self->inflight_rd_op.op = TXPC_OP_WAIT_CONFIG;
-                            self->inflight_rd_op.total_bytes = self->inflight_rd_op.msg_hdr.size + sizeof(txpc_hdr_t);
-                            prev_payload_read = do_payload_read;
-                            do_payload_read = true;
+                            self->inflight_rd_op.total_bytes = sizeof(txpc_hdr_t)
+                                + xpc_rd_frame_bytes(self, &self->inflight_rd_op.msg_hdr);
                         break;
 
                         case TXPC_MSG_TYPE_MSG:
+                        case TXPC_MSG_TYPE_STREAM:
+                        case TXPC_MSG_TYPE_FRAG:
                             self->inflight_rd_op.op = TXPC_OP_WAIT_MSG;
-                            self->inflight_rd_op.total_bytes = self->inflight_rd_op.msg_hdr.size + sizeof(txpc_hdr_t) + (self->conn_config.crc_bits >> 3);
-                            prev_payload_read = do_payload_read;
-                            do_payload_read = true;
+                            self->inflight_rd_op.total_bytes = sizeof(txpc_hdr_t)
+                                + xpc_rd_frame_bytes(self, &self->inflight_rd_op.msg_hdr);
+                            if(xpc_crc_incremental(self)) {
+                                self->inflight_rd_op.crc_state =
+                                    XPC_CRC_INIT(self);
+                            }
+                        break;
+
+                        case TXPC_MSG_TYPE_ACK:
+                            self->inflight_rd_op.op = TXPC_OP_WAIT_ACK;
+                            self->inflight_rd_op.total_bytes = sizeof(txpc_hdr_t)
+                                + xpc_rd_frame_bytes(self, &self->inflight_rd_op.msg_hdr);
                         break;
 
                         case TXPC_MSG_TYPE_XON:
                         case TXPC_MSG_TYPE_XOFF:
-                        case TXPC_MSG_TYPE_ACK:
-                            // currently unimplemented.
+                            XPC_STAT_FRAME(
+                                self, rx, &self->inflight_rd_op.msg_hdr,
+                                sizeof(txpc_hdr_t)
+                            );
+                            if(self->inflight_rd_op.msg_hdr.type
+                                    == TXPC_MSG_TYPE_XOFF) {
+                                self->signals |= SIG_XOFF_RECVD;
+                            }
+                            else if(self->signals & SIG_XOFF_RECVD) {
+                                self->signals &= ~SIG_XOFF_RECVD;
+                                // held messages may go now
+                                XPC_IO_NOTIFY(self, 1, true);
+                            }
+                            // header only, on to the next frame.
+                            xpc_rd_discard(self);
+                            self->inflight_rd_op.bytes_complete = 0;
+                            self->inflight_rd_op.total_bytes = 0;
                         break;
                     }
                 }
@@ -399,8 +2664,9 @@ xpc_status_t xpc_rd_op_continue(xpc_relay_state_t *self) {
                     // if we initiated, we just received the reply - go back to norm
                     if(self->signals & SIG_RST_SEND) {
                         self->signals &= ~(SIG_RST_SEND | SIG_RST_RECVD);
-                        self->io_reset(self->io_ctx, 0, -1);
-                        self->io_reset(self->io_ctx, 1, -1);
+                        XPC_IO_RESET(self, 0, -1);
+                        xpc_rd_discard(self);
+                        xpc_reset_complete(self);
                     }
                     else {
                         // we did not initiate, stay here until SIG_RST_RECVD
@@ -418,7 +2684,15 @@ xpc_status_t xpc_rd_op_continue(xpc_relay_state_t *self) {
                 }
                 else {
                     // incorrect sequence received, reset read ctx, try again.
-                    self->io_reset(self->io_ctx, 1, 5);
+                    // only the header was read, so only it is discarded, after
+                    // anything still leased.
+                    if(self->leases.count) {
+                        xpc_lease_slot(self, self->leases.count - 1)->trailing +=
+                            sizeof(txpc_hdr_t);
+                    }
+                    else {
+                        XPC_IO_RESET(self, 1, sizeof(txpc_hdr_t));
+                    }
                     self->inflight_rd_op.bytes_complete = 0;
                     self->inflight_rd_op.total_bytes = 0;
                 }
@@ -427,86 +2701,281 @@ xpc_status_t xpc_rd_op_continue(xpc_relay_state_t *self) {
             case TXPC_OP_WAIT_MSG:
                 if(self->inflight_rd_op.bytes_complete == self->inflight_rd_op.total_bytes) {
                     // msg complete
-                    do_crc_read = false;
+                    bool valid = true;
+                    size_t seq_bytes = xpc_ack_mode(self)
+                        && self->inflight_rd_op.msg_hdr.type
+                        == TXPC_MSG_TYPE_MSG ? 1:0;
+                    bool frag = self->inflight_rd_op.msg_hdr.type
+                        == TXPC_MSG_TYPE_FRAG;
+                    size_t stream_bytes = self->inflight_rd_op.msg_hdr.type
+                        == TXPC_MSG_TYPE_STREAM ? XPC_STREAM_TRAILER:0;
+                    // the crc follows the sequence number, stream offset or
+                    // fragment trailer, and covers it
+                    size_t trailer = frag ? XPC_FRAG_TRAILER
+                        :seq_bytes + stream_bytes;
                     if(self->conn_config.crc_bits) {
-                        crc_location = self->crc(
-                            self->crc_ctx,
-                            self->inflight_rd_op.buf,
-                            self->inflight_rd_op.msg_hdr.size
+                        if(xpc_crc_incremental(self)) {
+                            // payload was folded in as it was read
+                            XPC_CRC_FINALIZE(
+                                self,
+                                self->inflight_rd_op.crc_state,
+                                self->inflight_rd_op.crc_out
+                            );
+                            crc_location = self->inflight_rd_op.crc_out;
+                        }
+                        else {
+                            XPC_TRACE(self, crc, XPC_TRACE_CRC,
+                                1, self->inflight_rd_op.msg_hdr.size);
+                            crc_location = XPC_CRC(
+                                self,
+                                self->inflight_rd_op.buf,
+                                self->inflight_rd_op.msg_hdr.size
+                            );
+                        }
+                        crc_location = xpc_crc_seal(
+                            self, &self->inflight_rd_op, crc_location,
+                            self->inflight_rd_op.buf
+                                + self->inflight_rd_op.msg_hdr.size,
+                            trailer
                         );
                         // verify crc
-                        if(!memcmp(
-                                crc_location,
-                                self->inflight_rd_op.buf
-                                    + self->inflight_rd_op.msg_hdr.size,
-                                self->conn_config.crc_bits >> 3)) {
-                            
-                            self->inflight_rd_op.op = TXPC_OP_WAIT_DISPATCH;
-                            // TODO ack here in forced ack mode
+                        valid = !memcmp(
+                            crc_location,
+                            self->inflight_rd_op.buf
+                                + self->inflight_rd_op.msg_hdr.size + trailer,
+                            XPC_CRC_BYTES(XPC_CRC_WIDTH(self))
+                        );
+                        if(!valid) {
+                            XPC_STAT(self, crc_errors);
                         }
-                        else {
-                            // TODO nack here in forced ack mode
-                            self->io_reset(self->io_ctx, 1, -1);
+                        if(!valid && seq_bytes) {
+                            // the expected message may be the one we lost
+                            self->signals |= SIG_ACK_RECVD | SIG_NACK_RECVD;
+                        }
+                        if(!valid && frag) {
+                            // nor can its channel
+                            xpc_channel_rx_abandon(self);
                         }
                     }
-                    else {
-                        // crc disabled, go to dispatch state.
+                    if(valid && seq_bytes) {
+                        self->inflight_rd_op.seq = self->inflight_rd_op.buf[
+                            self->inflight_rd_op.msg_hdr.size
+                        ];
+                        // a duplicate means our ACK was lost, send it again.
+                        valid = xpc_ack_rx_is_new(self, self->inflight_rd_op.seq);
+                        if(!valid) {
+                            self->signals |= SIG_ACK_RECVD;
+                            XPC_STAT(self, duplicates);
+                        }
+                    }
+                    if(valid) {
                         self->inflight_rd_op.op = TXPC_OP_WAIT_DISPATCH;
                     }
+                    else {
+                        // drop the frame and wait for the next header.
+                        XPC_STAT_FRAME(
+                            self, rx, &self->inflight_rd_op.msg_hdr,
+                            self->inflight_rd_op.total_bytes
+                        );
+                        xpc_rd_discard(self);
+                        self->inflight_rd_op.op = TXPC_OP_NONE;
+                        self->inflight_rd_op.bytes_complete = 0;
+                        self->inflight_rd_op.total_bytes = 0;
+                        if(seq_bytes) {
+                            XPC_IO_NOTIFY(self, 1, true);
+                        }
+                    }
                 }
-                else if(self->inflight_rd_op.bytes_complete
-                        >= self->inflight_rd_op.msg_hdr.size
-                        + sizeof(txpc_hdr_t)) {
-                    // hdr + payload recv'd, crc in transit
-                    prev_payload_read = do_payload_read;
-                    do_payload_read = false;
-                    do_crc_read = true;
-                }
-                else {
-                    // hdr recv'd, payload and possible crc in transit.
-                    prev_payload_read = do_payload_read;
-                    do_payload_read = true;
-                }
-
             break;
 
             case TXPC_OP_WAIT_DISPATCH:
-                if(self->dispatch_cb(self->msg_ctx, &self->inflight_rd_op.msg_hdr, self->inflight_rd_op.buf)) {
+                XPC_TRACE(self, dispatch_start, XPC_TRACE_DISPATCH_START,
+                    self->inflight_rd_op.msg_hdr.size, 0);
+                if(self->inflight_rd_op.msg_hdr.type == TXPC_MSG_TYPE_STREAM) {
+                    dispatched = xpc_stream_recv(self);
+                }
+                else if(self->inflight_rd_op.msg_hdr.type
+                        == TXPC_MSG_TYPE_FRAG) {
+                    dispatched = xpc_channel_recv(self);
+                }
+                else {
+                    dispatched = XPC_DISPATCH(
+                        self, &self->inflight_rd_op.msg_hdr,
+                        self->inflight_rd_op.buf
+                    );
+                }
+                XPC_TRACE(self, dispatch_done, XPC_TRACE_DISPATCH_DONE,
+                    self->inflight_rd_op.msg_hdr.size, dispatched);
+                if(dispatched) {
+                    // counted once taken, a declined message is read again
+                    // when fed.
+                    XPC_STAT_FRAME(
+                        self, rx, &self->inflight_rd_op.msg_hdr,
+                        self->inflight_rd_op.total_bytes
+                    );
+                    if(xpc_ack_mode(self) && self->inflight_rd_op.msg_hdr.type
+                            == TXPC_MSG_TYPE_MSG) {
+                        xpc_ack_rx_record(self, self->inflight_rd_op.seq);
+                    }
+                    if(self->leases.taken) {
+                        // the payload stays in the read buffer for the lease
+                        self->leases.taken = false;
+                    }
+                    else {
+                        xpc_rd_discard(self);
+                    }
                     self->inflight_rd_op.op = TXPC_OP_NONE;
                     self->inflight_rd_op.total_bytes = 0;
                     self->inflight_rd_op.bytes_complete = 0;
-                    self->io_reset(self->io_ctx, 1, -1);
                     goto done;
                 }
+                XPC_STAT(self, dispatch_declined);
             break;
 
             case TXPC_OP_WAIT_CONFIG:
-                prev_payload_read = do_payload_read;
-                do_payload_read = true;
-                do_crc_read = false;
                 if(self->inflight_rd_op.bytes_complete
                         == self->inflight_rd_op.total_bytes) {
+                    XPC_STAT_FRAME(
+                        self, rx, &self->inflight_rd_op.msg_hdr,
+                        self->inflight_rd_op.total_bytes
+                    );
                     // if the currently inflight message has finished
+                    xpc_rd_discard(self);
                     self->inflight_rd_op.total_bytes = 0;
                     self->inflight_rd_op.bytes_complete = 0;
-                    self->io_reset(self->io_ctx, 1, -1);
                     // set state to none
                     self->inflight_rd_op.op = TXPC_OP_NONE;
-                    prev_payload_read = do_payload_read;
-                    do_payload_read = false;
-                    do_crc_read = false;
+                    uint8_t crc_bits = self->inflight_rd_op.buf[1];
+                    if(self->inflight_rd_op.msg_hdr.size
+                                != 2 + XPC_CRC_BYTES(crc_bits)
+                            || !xpc_rd_config_usable(self, crc_bits)) {
+                        // a polynomial of another size, or a width which
+                        // cannot be used: not applied, and the connection
+                        // starts over
+                        XPC_STAT(self, bad_frames);
+                        if(!(self->signals & SIG_RST_SEND)) {
+                            xpc_relay_send_reset(self);
+                        }
+                        goto done;
+                    }
                     self->conn_config.flags = self->inflight_rd_op.buf[0];
                     self->conn_config.crc_bits = self->inflight_rd_op.buf[1];
-                    self->crc_config(self->crc_ctx, self->conn_config.crc_bits, self->inflight_rd_op.buf + 2);
+                    XPC_CRC_CONFIG(self, self->conn_config.crc_bits, self->inflight_rd_op.buf + 2);
+                    goto done;
+                }
+            break;
+
+            case TXPC_OP_WAIT_ACK:
+                if(self->inflight_rd_op.bytes_complete
+                        == self->inflight_rd_op.total_bytes) {
+                    XPC_STAT_FRAME(
+                        self, rx, &self->inflight_rd_op.msg_hdr,
+                        self->inflight_rd_op.total_bytes
+                    );
+                    bool valid = self->inflight_rd_op.msg_hdr.size
+                        >= XPC_ACK_FRAME_SIZE;
+                    if(valid && self->conn_config.crc_bits) {
+                        valid = !memcmp(
+                            xpc_crc_whole(self, &self->inflight_rd_op),
+                            self->inflight_rd_op.buf
+                                + self->inflight_rd_op.msg_hdr.size,
+                            XPC_CRC_BYTES(XPC_CRC_WIDTH(self))
+                        );
+                        if(!valid) {
+                            // dropped, the sender times out instead
+                            XPC_STAT(self, crc_errors);
+                        }
+                    }
+                    if(valid) {
+                        xpc_ack_recv(self, self->inflight_rd_op.buf);
+                    }
+                    xpc_rd_discard(self);
+                    self->inflight_rd_op.total_bytes = 0;
+                    self->inflight_rd_op.bytes_complete = 0;
+                    self->inflight_rd_op.op = TXPC_OP_NONE;
                     goto done;
                 }
             break;
 
+            default:
+            break;
+        }
+        if(self->inflight_rd_op.op != starting_state) {
+            XPC_TRACE(self, rd_state, XPC_TRACE_RD_STATE,
+                starting_state, self->inflight_rd_op.op);
         }
 
     // loop while state changed
     } while(self->inflight_rd_op.op != starting_state);
 
+done:
+    if(self->inflight_rd_op.op != starting_state) {
+        // left from within a state, after moving on from it
+        XPC_TRACE(self, rd_state, XPC_TRACE_RD_STATE,
+            starting_state, self->inflight_rd_op.op);
+    }
+    return status;
+}
+
+xpc_status_t xpc_rd_op_continue(xpc_relay_state_t *self) {
+    int status = TXPC_STATUS_DONE;
+    if(self == NULL || !XPC_HAS_READ(self)) {
+        status = TXPC_STATUS_BAD_STATE;
+        goto done;
+    }
+    // checked first, a read wrapper may block waiting for the rest
+    if(xpc_rd_timed_out(self, xpc_rd_partial(self))) {
+        xpc_rd_abandon(self);
+        goto done;
+    }
+    status = xpc_rd_sm_run(self);
+    if(xpc_rd_timed_out(self, xpc_rd_partial(self))) {
+        xpc_rd_abandon(self);
+    }
 done:
     return status;
 }
+
+size_t xpc_relay_feed(xpc_relay_state_t *self, char *buf, size_t len) {
+    size_t consumed = 0;
+    size_t pos = 0;
+    bool declined = false;
+    if(self == NULL || buf == NULL) {
+        goto done;
+    }
+    self->rd_span = (struct xpc_span_t){
+        .buf = buf, .len = len, .pos = 0, .frame = 0
+    };
+    // run the state machine for as long as it keeps taking bytes
+    do {
+        pos = self->rd_span.pos;
+        xpc_rd_sm_run(self);
+        if(self->inflight_rd_op.op == TXPC_OP_WAIT_DISPATCH) {
+            // the handler declined the message.  Hand the frame back so it
+            // is presented again by the next call, instead of holding a
+            // pointer into a span the caller may reuse.
+            self->inflight_rd_op.op = TXPC_OP_NONE;
+            self->inflight_rd_op.total_bytes = 0;
+            self->inflight_rd_op.bytes_complete = 0;
+            self->rd_span.pos = self->rd_span.frame;
+            XPC_TRACE(self, rd_state, XPC_TRACE_RD_STATE,
+                TXPC_OP_WAIT_DISPATCH, TXPC_OP_NONE);
+            declined = true;
+            break;
+        }
+    } while(self->rd_span.pos != pos);
+    // bytes left over between frames are the start of one still arriving
+    bool partial = !declined && self->inflight_rd_op.op == TXPC_OP_NONE;
+    if(xpc_rd_timed_out(self, partial ? len - self->rd_span.pos:0)) {
+        xpc_rd_abandon(self);
+    }
+    consumed = self->rd_span.pos;
+    XPC_TRACE(self, feed, XPC_TRACE_FEED, len, consumed);
+    self->rd_span = (struct xpc_span_t){0};
+done:
+    return consumed;
+}
+
+size_t xpc_relay_frame_bytes(xpc_relay_state_t *self, txpc_hdr_t *hdr) {
+    return self == NULL || hdr == NULL ? 0:xpc_rd_frame_bytes(self, hdr);
+}
@@ -0,0 +1,157 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tinyxpc/tinyxpc.h>
+#include <tinyxpc/xpc_relay.h>
+#include <tinyxpc/xpc_router.h>
+
+xpc_router_t *xpc_router_config(
+    xpc_router_t *target, xpc_router_port_t **ports, size_t capacity,
+    xpc_router_local_fn *local_cb, void *local_ctx
+) {
+    if(target == NULL) goto done;
+    if(ports == NULL || capacity == 0 || capacity > XPC_ROUTE_LOCAL) {
+        target = NULL;
+        goto done;
+    }
+    target->ports = ports;
+    target->capacity = capacity;
+    target->count = 0;
+    target->local_cb = local_cb;
+    target->local_ctx = local_ctx;
+done:
+    return target;
+}
+
+xpc_router_port_t *xpc_router_port_config(
+    xpc_router_port_t *target, xpc_router_t *router, xpc_relay_state_t *relay,
+    xpc_router_fwd_t *slots, size_t capacity
+) {
+    if(target == NULL) goto done;
+    if(router == NULL || relay == NULL || slots == NULL || capacity == 0
+            || router->count == router->capacity) {
+        target = NULL;
+        goto done;
+    }
+    target->router = router;
+    target->relay = relay;
+    target->index = router->count;
+    for(int i = 0; i < 256; i++) {
+        target->routes[i] = XPC_ROUTE_DROP;
+    }
+    target->egress = (struct xpc_router_fwdq_t){
+        .slots = slots, .capacity = capacity, .head = 0, .count = 0
+    };
+    target->blocked = false;
+    target->forwarded = 0;
+    target->dropped = 0;
+    target->declined = 0;
+    router->ports[router->count++] = target;
+done:
+    return target;
+}
+
+xpc_status_t xpc_router_set_route(
+    xpc_router_port_t *self, uint8_t first, uint8_t last, uint8_t route
+) {
+    int status = TXPC_STATUS_DONE;
+    if(self == NULL || (route < XPC_ROUTE_LOCAL && route >= self->router->count)) {
+        status = TXPC_STATUS_BAD_STATE;
+        goto done;
+    }
+    for(int addr = first; addr <= last; addr++) {
+        self->routes[addr] = route;
+    }
+done:
+    return status;
+}
+
+/**
+ * Messages the egress relay has yet to finish writing.  Messages submitted by
+ * the application are counted too, which only holds leases longer.
+ */
+static size_t xpc_router_unsent(xpc_relay_state_t *relay) {
+    size_t unsent = relay->inflight_wr_op.op == TXPC_OP_MSG ? 1:0;
+    struct xpc_txq_t *queue = &relay->tx_queue;
+    for(size_t i = 0; i < queue->count; i++) {
+        if(queue->slots[(queue->head + i) % queue->capacity].op == TXPC_OP_MSG) {
+            unsent++;
+        }
+    }
+    return unsent;
+}
+
+/**
+ * Release the leases of messages this port has written, oldest first.
+ */
+static size_t xpc_router_reap(xpc_router_port_t *self) {
+    struct xpc_router_fwdq_t *fifo = &self->egress;
+    size_t unsent = xpc_router_unsent(self->relay);
+    size_t released = 0;
+    while(fifo->count > unsent) {
+        xpc_router_fwd_t *fwd = &fifo->slots[fifo->head];
+        xpc_relay_release(fwd->ingress->relay, fwd->lease);
+        fifo->head = (fifo->head + 1) % fifo->capacity;
+        fifo->count--;
+        released++;
+    }
+    return released;
+}
+
+size_t xpc_router_poll(xpc_router_t *self) {
+    size_t released = 0;
+    if(self == NULL) goto done;
+    for(size_t i = 0; i < self->count; i++) {
+        released += xpc_router_reap(self->ports[i]);
+    }
+    if(released == 0) goto done;
+    for(size_t i = 0; i < self->count; i++) {
+        xpc_router_port_t *port = self->ports[i];
+        if(port->blocked) {
+            // the declined message is retried when the relay reads again
+            port->blocked = false;
+            port->relay->io_notify(port->relay->io_ctx, 0, true);
+        }
+    }
+done:
+    return released;
+}
+
+bool xpc_router_dispatch(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload) {
+    xpc_router_port_t *self = (xpc_router_port_t*)msg_ctx;
+    xpc_router_t *router = self->router;
+    uint8_t route = self->routes[msg_hdr->to];
+    if(route == XPC_ROUTE_LOCAL && router->local_cb != NULL) {
+        return router->local_cb(router->local_ctx, self, msg_hdr, payload);
+    }
+    if(route >= router->count) {
+        self->dropped++;
+        return true;
+    }
+    if(self->relay->inflight_rd_op.msg_hdr.type == TXPC_MSG_TYPE_FRAG) {
+        // reassembled from channel fragments into a buffer the next fragment
+        // overwrites, so it can be neither leased nor forwarded
+        self->dropped++;
+        return true;
+    }
+    xpc_router_port_t *egress = router->ports[route];
+    struct xpc_router_fwdq_t *fifo = &egress->egress;
+    xpc_router_reap(egress);
+    // the lease is only taken once the egress relay has accepted the message,
+    // so a declined message leaves nothing behind.
+    if(fifo->count == fifo->capacity
+            || self->relay->leases.count == self->relay->leases.capacity
+            || xpc_send_msg(
+                egress->relay, msg_hdr->to, msg_hdr->from, payload, msg_hdr->size
+            ) != TXPC_STATUS_DONE) {
+        self->blocked = true;
+        self->declined++;
+        return false;
+    }
+    xpc_router_fwd_t *fwd = &fifo->slots[(fifo->head + fifo->count) % fifo->capacity];
+    fwd->lease = xpc_relay_lease(self->relay);
+    fwd->ingress = self;
+    fifo->count++;
+    self->forwarded++;
+    return true;
+}
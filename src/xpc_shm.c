@@ -0,0 +1,386 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <tinyxpc/xpc_relay.h>
+#include <tinyxpc/xpc_shm.h>
+
+// spin budget limits, in polls of the peer's index
+#define XPC_SHM_SPIN_MIN 64
+#define XPC_SHM_SPIN_MAX 65536
+
+static inline void xpc_shm_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+static size_t xpc_shm_page(void) {
+    long page = sysconf(_SC_PAGESIZE);
+    return page > 0 ? (size_t)page:4096;
+}
+
+// the futex words are shared between processes, so no FUTEX_PRIVATE_FLAG
+static void xpc_shm_futex_wait(_Atomic uint32_t *word, uint32_t value, int timeout_ms) {
+    struct timespec timeout = {
+        .tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000L
+    };
+    syscall(
+        SYS_futex, word, FUTEX_WAIT, value, timeout_ms < 0 ? NULL:&timeout,
+        NULL, 0
+    );
+}
+
+static void xpc_shm_signal(_Atomic uint32_t *seq, _Atomic uint32_t *waiting) {
+    // pairs with the store to waiting and load of the index in xpc_shm_await
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(waiting, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(seq, 1, memory_order_seq_cst);
+        syscall(SYS_futex, seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+static uint64_t xpc_shm_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Wait for a ring index moved by the peer to pass a value, spinning first and
+ * then sleeping on the index's futex word.
+ * @return the index, which is no greater than past on timeout.
+ */
+static uint64_t xpc_shm_await(
+    xpc_shm_t *self, _Atomic uint64_t *index, uint64_t past,
+    _Atomic uint32_t *seq, _Atomic uint32_t *waiting, int timeout_ms
+) {
+    uint64_t value = atomic_load_explicit(index, memory_order_acquire);
+    for(uint32_t i = 0; value <= past && i < self->spin; i++) {
+        xpc_shm_relax();
+        value = atomic_load_explicit(index, memory_order_acquire);
+    }
+    if(value > past) {
+        if(self->spin < self->spin_max) {
+            self->spin <<= 1;
+        }
+        return value;
+    }
+    // the peer is slower than the spin budget, spin less next time
+    if(self->spin > self->spin_min) {
+        self->spin >>= 1;
+    }
+    uint64_t deadline = timeout_ms < 0 ? 0:xpc_shm_now_ms() + timeout_ms;
+    for(;;) {
+        uint32_t ticket = atomic_load_explicit(seq, memory_order_seq_cst);
+        atomic_store_explicit(waiting, 1, memory_order_seq_cst);
+        value = atomic_load_explicit(index, memory_order_seq_cst);
+        if(value > past) {
+            break;
+        }
+        int remaining = -1;
+        if(timeout_ms >= 0) {
+            uint64_t now = xpc_shm_now_ms();
+            if(now >= deadline) {
+                break;
+            }
+            remaining = deadline - now;
+        }
+        xpc_shm_futex_wait(seq, ticket, remaining);
+    }
+    atomic_store_explicit(waiting, 0, memory_order_relaxed);
+    return value;
+}
+
+/**
+ * Map a ring's data area twice in a row, so that reads and writes running off
+ * the end continue at the start.
+ */
+static char *xpc_shm_map_ring(int fd, off_t offset, size_t capacity) {
+    char *base = mmap(
+        NULL, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    if(base == MAP_FAILED) {
+        return NULL;
+    }
+    for(int copy = 0; copy < 2; copy++) {
+        if(mmap(
+                base + copy * capacity, capacity, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, offset
+            ) == MAP_FAILED) {
+            munmap(base, 2 * capacity);
+            return NULL;
+        }
+    }
+    return base;
+}
+
+int xpc_shm_create(size_t capacity) {
+    size_t page = xpc_shm_page();
+    size_t ring = page;
+    while(ring < capacity) {
+        ring <<= 1;
+        if(ring == 0) {
+            return -1;
+        }
+    }
+    int fd = memfd_create("tinyxpc", MFD_CLOEXEC);
+    if(fd == -1) {
+        return -1;
+    }
+    struct xpc_shm_shared *shared = MAP_FAILED;
+    if(ftruncate(fd, page + 2 * ring) == -1) {
+        goto fail;
+    }
+    shared = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(shared == MAP_FAILED) {
+        goto fail;
+    }
+    // a fresh memfd is zero filled, so the indices start at 0
+    shared->capacity = ring;
+    shared->magic = XPC_SHM_MAGIC;
+    munmap(shared, page);
+    return fd;
+fail:
+    close(fd);
+    return -1;
+}
+
+xpc_shm_t *xpc_shm_attach(xpc_shm_t *target, int fd, int side) {
+    if(target == NULL) goto done;
+    size_t page = xpc_shm_page();
+    struct stat info;
+    *target = (xpc_shm_t){
+        .fd = fd, .side = side, .shared = MAP_FAILED, .map_bytes = page,
+        .spin = XPC_SHM_SPIN_MIN,
+        .spin_min = XPC_SHM_SPIN_MIN, .spin_max = XPC_SHM_SPIN_MAX
+    };
+    if(sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        // the peer cannot run while we spin
+        target->spin = target->spin_min = target->spin_max = 0;
+    }
+    if((side != 0 && side != 1) || fstat(fd, &info) == -1
+            || (size_t)info.st_size < page) {
+        goto fail;
+    }
+    target->shared = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(target->shared == MAP_FAILED) {
+        goto fail;
+    }
+    size_t capacity = target->shared->capacity;
+    if(target->shared->magic != XPC_SHM_MAGIC || capacity < page
+            || (capacity & (capacity - 1)) != 0
+            || (size_t)info.st_size != page + 2 * capacity) {
+        goto fail;
+    }
+    target->capacity = capacity;
+    target->tx = &target->shared->ring[side];
+    target->rx = &target->shared->ring[!side];
+    target->tx_data = xpc_shm_map_ring(fd, page + side * capacity, capacity);
+    target->rx_data = xpc_shm_map_ring(fd, page + !side * capacity, capacity);
+    if(target->tx_data == NULL || target->rx_data == NULL) {
+        goto fail;
+    }
+    // pick up where a previous endpoint on this side left off
+    target->tx_head = atomic_load(&target->tx->head);
+    target->tx_tail = atomic_load(&target->tx->tail);
+    target->rx_head = target->rx_parse = target->rx_tail =
+        atomic_load(&target->rx->tail);
+    goto done;
+fail:
+    xpc_shm_detach(target);
+    target = NULL;
+done:
+    return target;
+}
+
+void xpc_shm_detach(xpc_shm_t *self) {
+    if(self == NULL) {
+        return;
+    }
+    if(self->tx_data != NULL) {
+        munmap(self->tx_data, 2 * self->capacity);
+        self->tx_data = NULL;
+    }
+    if(self->rx_data != NULL) {
+        munmap(self->rx_data, 2 * self->capacity);
+        self->rx_data = NULL;
+    }
+    if(self->shared != MAP_FAILED && self->shared != NULL) {
+        munmap(self->shared, self->map_bytes);
+    }
+    self->shared = NULL;
+    self->tx = self->rx = NULL;
+}
+
+xpc_shm_t *xpc_shm_relay_config(
+    xpc_shm_t *self, xpc_relay_state_t *relay,
+    void *msg_ctx, void *crc_ctx, dispatch_fn *msg_handle_cb,
+    crc_fn *crc, crc_polyn_config *crc_config
+) {
+    if(self == NULL || relay == NULL) {
+        return NULL;
+    }
+    self->relay = relay;
+    // frames are parsed in place with xpc_relay_feed, there is no read wrapper
+    xpc_relay_config(
+        relay, self, msg_ctx, crc_ctx,
+        xpc_shm_write, NULL, xpc_shm_io_reset, xpc_shm_io_notify,
+        msg_handle_cb, crc, crc_config
+    );
+    xpc_relay_config_writev(relay, xpc_shm_writev);
+    return self;
+}
+
+// ========= IO FUNCTIONS =========
+static size_t xpc_shm_tx_space(xpc_shm_t *self, size_t wanted) {
+    size_t space = self->capacity - (self->tx_head - self->tx_tail);
+    if(space < wanted) {
+        self->tx_tail = atomic_load_explicit(&self->tx->tail, memory_order_acquire);
+        space = self->capacity - (self->tx_head - self->tx_tail);
+    }
+    return space;
+}
+
+static void xpc_shm_publish(xpc_shm_t *self) {
+    atomic_store_explicit(&self->tx->head, self->tx_head, memory_order_release);
+    xpc_shm_signal(&self->tx->head_seq, &self->tx->consumer_waiting);
+}
+
+int xpc_shm_write(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+    xpc_shm_t *self = (xpc_shm_t*)io_ctx;
+    size_t bytes = xpc_shm_tx_space(self, bytes_max);
+    if(bytes > bytes_max) {
+        bytes = bytes_max;
+    }
+    if(bytes == 0) {
+        return 0;
+    }
+    // the second mapping takes whatever runs off the end
+    memcpy(
+        self->tx_data + (self->tx_head & (self->capacity - 1)),
+        *buffer + offset, bytes
+    );
+    self->tx_head += bytes;
+    xpc_shm_publish(self);
+    return bytes;
+}
+
+int xpc_shm_writev(void *io_ctx, xpc_iovec_t *iov, int iovcnt) {
+    xpc_shm_t *self = (xpc_shm_t*)io_ctx;
+    size_t wanted = 0;
+    for(int i = 0; i < iovcnt; i++) {
+        wanted += iov[i].len;
+    }
+    size_t space = xpc_shm_tx_space(self, wanted);
+    size_t bytes = 0;
+    for(int i = 0; i < iovcnt && bytes < space; i++) {
+        size_t len = iov[i].len;
+        if(len > space - bytes) {
+            len = space - bytes;
+        }
+        memcpy(
+            self->tx_data + ((self->tx_head + bytes) & (self->capacity - 1)),
+            iov[i].base, len
+        );
+        bytes += len;
+    }
+    if(bytes > 0) {
+        // one index update and at most one wakeup for the whole frame
+        self->tx_head += bytes;
+        xpc_shm_publish(self);
+    }
+    return bytes;
+}
+
+void xpc_shm_io_reset(void *io_ctx, int which, size_t bytes) {
+    xpc_shm_t *self = (xpc_shm_t*)io_ctx;
+    if(!which) {
+        // frames are copied into the ring as they are written
+        return;
+    }
+    if(bytes != (size_t)-1) {
+        // a lease was released, oldest bytes first
+        self->rx_head += bytes;
+    }
+    else if(self->relay->rd_span.buf != NULL) {
+        // everything up to the end of the frame being fed
+        self->rx_head = self->rx_parse + self->relay->rd_span.pos;
+    }
+    else {
+        self->rx_head = self->rx_parse;
+    }
+    atomic_store_explicit(&self->rx->tail, self->rx_head, memory_order_release);
+    xpc_shm_signal(&self->rx->tail_seq, &self->rx->producer_waiting);
+}
+
+void xpc_shm_io_notify(void *io_ctx, int which, bool enable) {
+    xpc_shm_t *self = (xpc_shm_t*)io_ctx;
+    if(which) {
+        self->want_write = enable;
+    }
+}
+// ========= END IO FUNCTIONS =========
+
+static size_t xpc_shm_feed(xpc_shm_t *self) {
+    size_t consumed = xpc_relay_feed(
+        self->relay, self->rx_data + (self->rx_parse & (self->capacity - 1)),
+        self->rx_tail - self->rx_parse
+    );
+    self->rx_parse += consumed;
+    return consumed;
+}
+
+size_t xpc_shm_poll(xpc_shm_t *self) {
+    if(self == NULL || self->relay == NULL) {
+        return 0;
+    }
+    self->rx_tail = atomic_load_explicit(&self->rx->head, memory_order_acquire);
+    size_t consumed = xpc_shm_feed(self);
+    if(self->want_write) {
+        xpc_wr_op_continue(self->relay);
+        // the read state machine may have waited on a reply going out
+        consumed += xpc_shm_feed(self);
+    }
+    return consumed;
+}
+
+size_t xpc_shm_wait(xpc_shm_t *self, int timeout_ms) {
+    // anything past what the last poll saw is new
+    uint64_t head = xpc_shm_await(
+        self, &self->rx->head, self->rx_tail,
+        &self->rx->head_seq, &self->rx->consumer_waiting, timeout_ms
+    );
+    return head > self->rx_tail ? head - self->rx_parse:0;
+}
+
+size_t xpc_shm_wait_writable(xpc_shm_t *self, size_t bytes, int timeout_ms) {
+    if(bytes > self->capacity) {
+        bytes = self->capacity;
+    }
+    if(xpc_shm_tx_space(self, bytes) >= bytes) {
+        return self->capacity - (self->tx_head - self->tx_tail);
+    }
+    // the consumer has to release up to here
+    uint64_t needed = self->tx_head + bytes - self->capacity;
+    self->tx_tail = xpc_shm_await(
+        self, &self->tx->tail, needed - 1,
+        &self->tx->tail_seq, &self->tx->producer_waiting, timeout_ms
+    );
+    if(self->tx_tail < needed) {
+        return 0;
+    }
+    return self->capacity - (self->tx_head - self->tx_tail);
+}
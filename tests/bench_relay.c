@@ -0,0 +1,381 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <tinyxpc/tinyxpc.h>
+#include <tinyxpc/xpc_relay.h>
+#include <tinyxpc/xpc_crc.h>
+/**
+ * Relay benchmark.  Drives a pair of relays from one thread over pipes,
+ * socketpairs or an in-memory link, sweeping payload size, CRC and
+ * acknowledged mode, and prints the results as JSON:
+ *  - throughput: one side streams messages to the other.
+ *  - latency: one side sends a message, the other echoes it back; the round
+ *    trip time is recorded for each message.
+ *
+ * Usage: bench_relay [--quick]
+ */
+
+#define RX_CAP (1 << 20)
+#define QUEUE 32
+#define WINDOW 32
+#define MAX_PAYLOAD 65535
+// give up on a run after this many passes without progress
+#define STALL_LIMIT 1000000
+
+typedef enum {
+    BENCH_PIPE,
+    BENCH_SOCKETPAIR,
+    BENCH_MEMORY
+} bench_transport_t;
+
+static const char *transport_names[] = {"pipe", "socketpair", "memory"};
+
+typedef struct bench_end bench_end_t;
+struct bench_end {
+    xpc_relay_state_t relay;
+    xpc_crc_ctx_t crc;
+    bench_transport_t transport;
+    bench_end_t *peer;
+    int rd_fd;
+    int wr_fd;
+    // receive buffer, reclaimed in order: free up to head, parsed up to
+    // parse, received up to tail.
+    char *rx;
+    size_t head;
+    size_t parse;
+    size_t tail;
+    xpc_tx_desc_t queue[QUEUE];
+    xpc_ack_slot_t window[WINDOW];
+    // an echo end answers each message with one of the same size
+    bool echo;
+    uint64_t received;
+};
+
+static char payload[MAX_PAYLOAD];
+// CRC-32/ISO-HDLC generator, most significant byte first
+static char crc_polyn[4] = {0x04, (char)0xc1, 0x1d, (char)0xb7};
+
+
+static uint64_t bench_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+uint32_t bench_clock_fn(void *clock_ctx) {
+    return bench_now_ns() / 1000000;
+}
+
+// ========= IO FUNCTIONS =========
+static size_t bench_rx_room(bench_end_t *end) {
+    if(end->head == end->tail) {
+        end->head = end->parse = end->tail = 0;
+    }
+    else if(end->head == end->parse && end->tail > RX_CAP / 2) {
+        // nothing held, move the partial frame to the front
+        memmove(end->rx, end->rx + end->parse, end->tail - end->parse);
+        end->tail -= end->parse;
+        end->head = end->parse = 0;
+    }
+    return RX_CAP - end->tail;
+}
+
+static size_t bench_deliver(bench_end_t *end, const char *buf, size_t bytes) {
+    size_t room = bench_rx_room(end);
+    if(bytes > room) {
+        bytes = room;
+    }
+    memcpy(end->rx + end->tail, buf, bytes);
+    end->tail += bytes;
+    return bytes;
+}
+
+int bench_write(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+    bench_end_t *end = (bench_end_t*)io_ctx;
+    if(end->transport == BENCH_MEMORY) {
+        return bench_deliver(end->peer, *buffer + offset, bytes_max);
+    }
+    ssize_t bytes = write(end->wr_fd, *buffer + offset, bytes_max);
+    return bytes < 0 ? 0:bytes;
+}
+
+int bench_writev(void *io_ctx, xpc_iovec_t *iov, int iovcnt) {
+    bench_end_t *end = (bench_end_t*)io_ctx;
+    if(end->transport == BENCH_MEMORY) {
+        size_t bytes = 0;
+        for(int i = 0; i < iovcnt; i++) {
+            size_t copied = bench_deliver(end->peer, iov[i].base, iov[i].len);
+            bytes += copied;
+            if(copied < iov[i].len) {
+                break;
+            }
+        }
+        return bytes;
+    }
+    // xpc_iovec_t is laid out like struct iovec
+    ssize_t bytes = writev(end->wr_fd, (struct iovec*)iov, iovcnt);
+    return bytes < 0 ? 0:bytes;
+}
+
+void bench_io_reset(void *io_ctx, int which, size_t bytes) {
+    bench_end_t *end = (bench_end_t*)io_ctx;
+    if(!which) {
+        return;
+    }
+    if(bytes != (size_t)-1) {
+        end->head += bytes;
+    }
+    else if(end->relay.rd_span.buf != NULL) {
+        end->head = end->parse + end->relay.rd_span.pos;
+    }
+    else {
+        end->head = end->parse;
+    }
+}
+
+void bench_io_notify(void *io_ctx, int which, bool enable) {
+}
+// ========= END IO FUNCTIONS =========
+
+bool bench_dispatch_fn(void *msg_ctx, txpc_hdr_t *msg_hdr, char *buf) {
+    bench_end_t *end = (bench_end_t*)msg_ctx;
+    // the received bytes are only valid during the call, but the sender
+    // takes them from the same static buffer.
+    if(end->echo && xpc_send_msg(
+            &end->relay, msg_hdr->from, msg_hdr->to, payload, msg_hdr->size
+        ) != TXPC_STATUS_DONE) {
+        return false;
+    }
+    end->received++;
+    return true;
+}
+
+/**
+ * Write, read and parse whatever the end can without blocking.
+ */
+static void bench_pump(bench_end_t *end) {
+    xpc_wr_op_continue(&end->relay);
+    if(end->transport != BENCH_MEMORY) {
+        size_t room = bench_rx_room(end);
+        ssize_t bytes = read(end->rd_fd, end->rx + end->tail, room);
+        if(bytes > 0) {
+            end->tail += bytes;
+        }
+    }
+    end->parse += xpc_relay_feed(
+        &end->relay, end->rx + end->parse, end->tail - end->parse
+    );
+}
+
+static void bench_end_config(bench_end_t *end, bench_end_t *peer, bench_transport_t transport) {
+    end->transport = transport;
+    end->peer = peer;
+    end->head = end->parse = end->tail = 0;
+    end->echo = false;
+    end->received = 0;
+    xpc_crc_setup(&end->crc, xpc_crc_preset(XPC_CRC_32_ISO_HDLC));
+    xpc_relay_config(
+        &end->relay, end, end, &end->crc,
+        bench_write, NULL, bench_io_reset, bench_io_notify,
+        bench_dispatch_fn, xpc_crc_fn, xpc_crc_polyn_config
+    );
+    xpc_relay_config_writev(&end->relay, bench_writev);
+    xpc_relay_config_crc_incremental(
+        &end->relay, xpc_crc_init, xpc_crc_update, xpc_crc_finalize
+    );
+    xpc_relay_config_tx_queue(&end->relay, end->queue, QUEUE);
+    xpc_relay_config_ack(
+        &end->relay, end->window, WINDOW, bench_clock_fn, NULL, 200, NULL
+    );
+}
+
+static int bench_nonblock(int fd) {
+    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/**
+ * Connect two ends and negotiate CRC and acknowledged mode.
+ * @return 0, or -1 if the transport could not be set up.
+ */
+static int bench_connect(bench_end_t *a, bench_end_t *b, bench_transport_t transport, bool crc, bool ack) {
+    int fds[4] = {-1, -1, -1, -1};
+    bench_end_config(a, b, transport);
+    bench_end_config(b, a, transport);
+    if(transport == BENCH_PIPE) {
+        if(pipe(fds) || pipe(fds + 2)) {
+            return -1;
+        }
+        a->rd_fd = fds[0];
+        b->wr_fd = fds[1];
+        b->rd_fd = fds[2];
+        a->wr_fd = fds[3];
+    }
+    else if(transport == BENCH_SOCKETPAIR) {
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+            return -1;
+        }
+        a->rd_fd = a->wr_fd = fds[0];
+        b->rd_fd = b->wr_fd = fds[1];
+    }
+    for(int i = 0; i < 4; i++) {
+        if(fds[i] != -1) {
+            bench_nonblock(fds[i]);
+        }
+    }
+    xpc_relay_send_reset(&a->relay);
+    if(crc || ack) {
+        xpc_relay_send_config(&a->relay, crc ? 32:0, crc_polyn, ack);
+    }
+    for(int i = 0; i < 100; i++) {
+        bench_pump(a);
+        bench_pump(b);
+    }
+    return 0;
+}
+
+static void bench_disconnect(bench_end_t *a, bench_end_t *b) {
+    if(a->transport == BENCH_MEMORY) {
+        return;
+    }
+    close(a->rd_fd);
+    close(b->rd_fd);
+    if(a->transport == BENCH_PIPE) {
+        close(a->wr_fd);
+        close(b->wr_fd);
+    }
+}
+
+/**
+ * Stream count messages from a to b.
+ * @return elapsed nanoseconds, or 0 if the run stalled.
+ */
+static uint64_t bench_stream(bench_end_t *a, bench_end_t *b, size_t size, uint64_t count) {
+    uint64_t sent = 0;
+    uint64_t stalls = 0;
+    uint64_t start = bench_now_ns();
+    while(b->received < count) {
+        while(sent < count && xpc_send_msg(
+                &a->relay, 1, 2, payload, size) == TXPC_STATUS_DONE) {
+            sent++;
+        }
+        uint64_t before = b->received;
+        bench_pump(a);
+        bench_pump(b);
+        stalls = b->received == before ? stalls + 1:0;
+        if(stalls == STALL_LIMIT) {
+            return 0;
+        }
+    }
+    return bench_now_ns() - start;
+}
+
+/**
+ * Bounce count messages off b, recording each round trip.
+ * @return 0, or -1 if the run stalled.
+ */
+static int bench_ping(bench_end_t *a, bench_end_t *b, size_t size, uint64_t *rtt, size_t count) {
+    b->echo = true;
+    for(size_t i = 0; i < count; i++) {
+        uint64_t start = bench_now_ns();
+        uint64_t stalls = 0;
+        while(xpc_send_msg(&a->relay, 1, 2, payload, size) != TXPC_STATUS_DONE) {
+            bench_pump(a);
+            bench_pump(b);
+            if(++stalls == STALL_LIMIT) {
+                return -1;
+            }
+        }
+        while(a->received == i) {
+            bench_pump(a);
+            bench_pump(b);
+            if(++stalls == STALL_LIMIT) {
+                return -1;
+            }
+        }
+        rtt[i] = bench_now_ns() - start;
+    }
+    b->echo = false;
+    return 0;
+}
+
+static int bench_cmp(const void *x, const void *y) {
+    uint64_t a = *(const uint64_t*)x, b = *(const uint64_t*)y;
+    return (a > b) - (a < b);
+}
+
+static uint64_t bench_percentile(uint64_t *sorted, size_t count, double p) {
+    size_t i = (size_t)(p * count);
+    return sorted[i < count ? i:count - 1];
+}
+
+
+int main(int argc, char **argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    static const size_t sizes[] = {0, 16, 64, 256, 1024, 4096, 16384, MAX_PAYLOAD};
+    size_t pings = quick ? 200:5000;
+    // bytes streamed per run, at least min_count messages
+    uint64_t stream_bytes = quick ? (4u << 20):(64u << 20);
+    uint64_t min_count = quick ? 1000:20000;
+    static bench_end_t a, b;
+    int failures = 0;
+
+    a.rx = malloc(RX_CAP);
+    b.rx = malloc(RX_CAP);
+    uint64_t *rtt = malloc(pings * sizeof(uint64_t));
+    for(size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = i * 31 + 7;
+    }
+
+    printf("{\n  \"benchmark\": \"relay\",\n  \"results\": [");
+    const char *sep = "\n";
+    for(int transport = BENCH_PIPE; transport <= BENCH_MEMORY; transport++) {
+        for(int mode = 0; mode < 4; mode++) {
+            bool crc = mode & 1, ack = mode & 2;
+            for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+                size_t size = sizes[s];
+                uint64_t count = stream_bytes / (size + sizeof(txpc_hdr_t) + 5);
+                count = count < min_count ? min_count:count;
+                if(bench_connect(&a, &b, transport, crc, ack)) {
+                    failures++;
+                    continue;
+                }
+                uint64_t elapsed = bench_stream(&a, &b, size, count);
+                int ping_status = bench_ping(&a, &b, size, rtt, pings);
+                bench_disconnect(&a, &b);
+                if(elapsed == 0 || ping_status) {
+                    fprintf(stderr, "%s size %zu crc %i ack %i stalled\n",
+                        transport_names[transport], size, crc, ack);
+                    failures++;
+                    continue;
+                }
+                qsort(rtt, pings, sizeof(uint64_t), bench_cmp);
+                double seconds = elapsed / 1e9;
+                printf("%s    {\"transport\": \"%s\", \"payload_bytes\": %zu, "
+                    "\"crc\": %s, \"ack\": %s, \"messages\": %llu, "
+                    "\"msgs_per_s\": %.0f, \"mb_per_s\": %.2f, "
+                    "\"rtt_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu}}",
+                    sep, transport_names[transport], size,
+                    crc ? "true":"false", ack ? "true":"false",
+                    (unsigned long long)count, count / seconds,
+                    count * size / seconds / 1e6,
+                    (unsigned long long)bench_percentile(rtt, pings, 0.5),
+                    (unsigned long long)bench_percentile(rtt, pings, 0.99),
+                    (unsigned long long)bench_percentile(rtt, pings, 0.999));
+                sep = ",\n";
+                fflush(stdout);
+            }
+        }
+    }
+    printf("\n  ],\n  \"failures\": %i\n}\n", failures);
+    free(a.rx);
+    free(b.rx);
+    free(rtt);
+    return failures != 0;
+}
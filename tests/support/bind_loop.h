@@ -0,0 +1,123 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tinyxpc/tinyxpc.h>
+#include <tinyxpc/xpc_relay.h>
+#include <crc.h>
+/**
+ * Compile time bindings for test_bind: relays joined by in-memory byte
+ * queues, with a 32 bit CRC.  The relay includes this through
+ * XPC_RELAY_BIND, so every IO, dispatch and CRC call it makes lands here
+ * directly.  Each context is the end, which counts the calls.
+ */
+
+#define BIND_LOOP_BYTES 4096
+
+typedef struct bind_loop_end bind_loop_end_t;
+struct bind_loop_end {
+    bind_loop_end_t *peer;
+    // bytes written by the peer, read from head
+    char rx[BIND_LOOP_BYTES];
+    size_t head;
+    size_t tail;
+    // payloads read without a destination
+    char payload[BIND_LOOP_BYTES];
+    int received;
+    char last[BIND_LOOP_BYTES];
+    size_t last_size;
+    crc_t crc;
+    int crc_calls;
+};
+
+static inline int bind_loop_write(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+    bind_loop_end_t *peer = ((bind_loop_end_t*)io_ctx)->peer;
+    size_t bytes = 0;
+    for(; bytes < bytes_max && peer->tail < BIND_LOOP_BYTES; bytes++) {
+        peer->rx[peer->tail++] = (*buffer)[offset + bytes];
+    }
+    return bytes;
+}
+
+static inline int bind_loop_writev(void *io_ctx, xpc_iovec_t *iov, int iovcnt) {
+    int bytes = 0;
+    for(int i = 0; i < iovcnt; i++) {
+        int n = bind_loop_write(io_ctx, &iov[i].base, 0, iov[i].len);
+        bytes += n;
+        if((size_t)n < iov[i].len) {
+            break;
+        }
+    }
+    return bytes;
+}
+
+static inline int bind_loop_read(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+    bind_loop_end_t *end = (bind_loop_end_t*)io_ctx;
+    if(*buffer == NULL) {
+        *buffer = end->payload;
+    }
+    size_t bytes = 0;
+    for(; bytes < bytes_max && end->head < end->tail; bytes++) {
+        (*buffer)[offset + bytes] = end->rx[end->head++];
+    }
+    if(end->head == end->tail) {
+        end->head = end->tail = 0;
+    }
+    return bytes;
+}
+
+static inline void bind_loop_io_reset(void *io_ctx, int which, size_t bytes) {
+    // bytes are read straight into place, nothing is buffered
+}
+
+static inline void bind_loop_io_notify(void *io_ctx, int which, bool enable) {
+}
+
+static inline bool bind_loop_dispatch(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload) {
+    bind_loop_end_t *end = (bind_loop_end_t*)msg_ctx;
+    end->received++;
+    end->last_size = msg_hdr->size;
+    for(size_t i = 0; i < msg_hdr->size; i++) {
+        end->last[i] = payload[i];
+    }
+    return true;
+}
+
+static inline char *bind_loop_crc(void *crc_ctx, char *buf, size_t bytes) {
+    bind_loop_end_t *end = (bind_loop_end_t*)crc_ctx;
+    end->crc_calls++;
+    end->crc = crc_finalize(crc_update(crc_init(), buf, bytes));
+    return (char*)&end->crc;
+}
+
+static inline void bind_loop_crc_config(void *crc_ctx, int crc_bits, char *polyn) {
+}
+
+static inline uint64_t bind_loop_crc_init(void *crc_ctx) {
+    return crc_init();
+}
+
+static inline uint64_t bind_loop_crc_update(void *crc_ctx, uint64_t crc, char *buf, size_t bytes) {
+    ((bind_loop_end_t*)crc_ctx)->crc_calls++;
+    return crc_update(crc, buf, bytes);
+}
+
+static inline void bind_loop_crc_finalize(void *crc_ctx, uint64_t crc, char *out) {
+    crc_t value = crc_finalize(crc);
+    for(size_t i = 0; i < sizeof(value); i++) {
+        out[i] = ((char*)&value)[i];
+    }
+}
+
+#define XPC_BIND_WRITE bind_loop_write
+#define XPC_BIND_WRITEV bind_loop_writev
+#define XPC_BIND_READ bind_loop_read
+#define XPC_BIND_IO_RESET bind_loop_io_reset
+#define XPC_BIND_IO_NOTIFY bind_loop_io_notify
+#define XPC_BIND_DISPATCH bind_loop_dispatch
+#define XPC_BIND_CRC bind_loop_crc
+#define XPC_BIND_CRC_CONFIG bind_loop_crc_config
+#define XPC_BIND_CRC_INIT bind_loop_crc_init
+#define XPC_BIND_CRC_UPDATE bind_loop_crc_update
+#define XPC_BIND_CRC_FINALIZE bind_loop_crc_finalize
+#define XPC_BIND_CRC_BITS 32
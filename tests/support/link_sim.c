@@ -0,0 +1,232 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <link_sim.h>
+
+// xorshift64*, plenty for picking errors and delays
+static uint64_t link_sim_rand(link_sim_t *self) {
+    uint64_t x = self->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    self->rng = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+static uint32_t link_sim_draw(link_sim_t *self) {
+    return link_sim_rand(self) >> 32;
+}
+
+// a probability as a threshold for link_sim_draw
+static uint32_t link_sim_threshold(double p) {
+    if(p <= 0) {
+        return 0;
+    }
+    return p >= 1 ? UINT32_MAX:(uint32_t)(p * 4294967296.0);
+}
+
+link_sim_t *link_sim_init(link_sim_t *target, const link_sim_params_t *params, uint64_t seed) {
+    if(target == NULL) goto done;
+    if(params == NULL) {
+        target = NULL;
+        goto done;
+    }
+    *target = (link_sim_t){
+        .params = *params, .now = 0,
+        // the generator must not start at 0
+        .rng = seed ? seed:0x9e3779b97f4a7c15ull,
+        // a byte is hit by roughly eight times the bit error rate
+        .byte_error = link_sim_threshold(params->bit_error_rate * 8),
+        .drop = link_sim_threshold(params->drop_rate)
+    };
+    for(int i = 0; i < 2; i++) {
+        target->end[i].sim = target;
+        target->end[i].tx = &target->dir[i];
+        target->end[i].rx = &target->dir[1 - i];
+    }
+done:
+    return target;
+}
+
+void link_sim_advance(link_sim_t *self, uint64_t us) {
+    self->now += us;
+}
+
+bool link_sim_next_arrival(link_sim_t *self, uint64_t *at) {
+    bool pending = false;
+    for(int i = 0; i < 2; i++) {
+        link_sim_dir_t *dir = &self->dir[i];
+        // writes arrive in order, the first not arrived is the next
+        for(size_t s = 0; s < dir->seg_count; s++) {
+            link_sim_seg_t *seg = &dir->segs[(dir->seg_head + s) % LINK_SIM_SEGS];
+            if(seg->arrive_at > self->now) {
+                if(!pending || seg->arrive_at < *at) {
+                    *at = seg->arrive_at;
+                }
+                pending = true;
+                break;
+            }
+        }
+    }
+    return pending;
+}
+
+/**
+ * Send gathered bytes as one write.
+ * @return the number of bytes taken.
+ */
+static size_t link_sim_put(link_sim_end_t *end, const xpc_iovec_t *iov, int iovcnt) {
+    link_sim_t *sim = end->sim;
+    link_sim_dir_t *dir = end->tx;
+    size_t bytes = 0;
+    for(int i = 0; i < iovcnt; i++) {
+        bytes += iov[i].len;
+    }
+    if(sim->params.max_write && bytes > sim->params.max_write) {
+        bytes = sim->params.max_write;
+    }
+    if(bytes > LINK_SIM_WIRE - dir->fill) {
+        bytes = LINK_SIM_WIRE - dir->fill;
+    }
+    // sent once what was written before has gone
+    uint64_t start = dir->busy_until > sim->now ? dir->busy_until:sim->now;
+    uint32_t bandwidth = sim->params.bandwidth;
+    if(bandwidth && sim->params.tx_buffer) {
+        size_t waiting = (start - sim->now) * bandwidth / 1000000;
+        size_t room = sim->params.tx_buffer > waiting
+            ? sim->params.tx_buffer - waiting:0;
+        if(bytes > room) {
+            bytes = room;
+        }
+    }
+    if(bytes == 0 || dir->seg_count == LINK_SIM_SEGS) {
+        return 0;
+    }
+    dir->busy_until = start
+        + (bandwidth ? ((uint64_t)bytes * 1000000 + bandwidth - 1) / bandwidth:0);
+    dir->bytes_sent += bytes;
+    if(sim->drop && link_sim_draw(sim) < sim->drop) {
+        dir->writes_dropped++;
+        return bytes;
+    }
+    uint64_t arrive_at = dir->busy_until + sim->params.delay;
+    if(sim->params.jitter) {
+        arrive_at += link_sim_rand(sim) % (sim->params.jitter + 1);
+    }
+    if(arrive_at < dir->last_arrival) {
+        arrive_at = dir->last_arrival;
+    }
+    dir->last_arrival = arrive_at;
+    size_t at = (dir->head + dir->fill) % LINK_SIM_WIRE;
+    size_t left = bytes;
+    for(int i = 0; i < iovcnt && left; i++) {
+        const char *src = iov[i].base;
+        size_t n = iov[i].len < left ? iov[i].len:left;
+        for(size_t j = 0; j < n; j++) {
+            char c = src[j];
+            if(sim->byte_error && link_sim_draw(sim) < sim->byte_error) {
+                c ^= 1 << (link_sim_rand(sim) % 8);
+                dir->bits_flipped++;
+            }
+            dir->wire[at] = c;
+            at = (at + 1) % LINK_SIM_WIRE;
+        }
+        left -= n;
+    }
+    dir->fill += bytes;
+    dir->segs[(dir->seg_head + dir->seg_count) % LINK_SIM_SEGS] = (link_sim_seg_t){
+        .len = bytes, .arrive_at = arrive_at
+    };
+    dir->seg_count++;
+    return bytes;
+}
+
+size_t link_sim_send(link_sim_end_t *end, const char *buf, size_t bytes) {
+    xpc_iovec_t iov = {.base = (char*)buf, .len = bytes};
+    return link_sim_put(end, &iov, 1);
+}
+
+size_t link_sim_recv(link_sim_end_t *end, char *buf, size_t bytes) {
+    link_sim_t *sim = end->sim;
+    link_sim_dir_t *dir = end->rx;
+    size_t n = 0;
+    if(sim->params.max_read && bytes > sim->params.max_read) {
+        bytes = sim->params.max_read;
+    }
+    while(n < bytes && dir->seg_count) {
+        link_sim_seg_t *seg = &dir->segs[dir->seg_head];
+        if(seg->arrive_at > sim->now) {
+            break;
+        }
+        size_t chunk = seg->len - dir->taken;
+        if(chunk > bytes - n) {
+            chunk = bytes - n;
+        }
+        for(size_t i = 0; i < chunk; i++) {
+            buf[n + i] = dir->wire[(dir->head + i) % LINK_SIM_WIRE];
+        }
+        dir->head = (dir->head + chunk) % LINK_SIM_WIRE;
+        dir->fill -= chunk;
+        dir->taken += chunk;
+        n += chunk;
+        if(dir->taken == seg->len) {
+            dir->seg_head = (dir->seg_head + 1) % LINK_SIM_SEGS;
+            dir->seg_count--;
+            dir->taken = 0;
+        }
+    }
+    dir->bytes_received += n;
+    return n;
+}
+
+uint32_t link_sim_clock(void *clock_ctx) {
+    return (uint32_t)((link_sim_t*)clock_ctx)->now;
+}
+
+xpc_relay_state_t *link_sim_relay_config(
+    link_sim_end_t *end, xpc_relay_state_t *relay,
+    void *msg_ctx, void *crc_ctx, dispatch_fn *msg_handle_cb,
+    crc_fn *crc, crc_polyn_config *crc_config
+) {
+    if(end == NULL || relay == NULL) {
+        return NULL;
+    }
+    xpc_relay_config(
+        relay, end, msg_ctx, crc_ctx,
+        link_sim_write, link_sim_read, link_sim_io_reset, link_sim_io_notify,
+        msg_handle_cb, crc, crc_config
+    );
+    // a frame goes out as one write, and so is lost whole
+    xpc_relay_config_writev(relay, link_sim_writev);
+    return relay;
+}
+
+// ========= IO FUNCTIONS =========
+int link_sim_write(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+    return link_sim_send((link_sim_end_t*)io_ctx, *buffer + offset, bytes_max);
+}
+
+int link_sim_writev(void *io_ctx, xpc_iovec_t *iov, int iovcnt) {
+    return link_sim_put((link_sim_end_t*)io_ctx, iov, iovcnt);
+}
+
+int link_sim_read(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+    link_sim_end_t *end = (link_sim_end_t*)io_ctx;
+    if(*buffer == NULL) {
+        // a payload, placed in the end's buffer
+        *buffer = end->rx_buf;
+    }
+    return link_sim_recv(end, *buffer + offset, bytes_max);
+}
+
+void link_sim_io_reset(void *io_ctx, int which, size_t bytes) {
+    // bytes are read straight into place, nothing is buffered
+}
+
+void link_sim_io_notify(void *io_ctx, int which, bool enable) {
+    link_sim_end_t *end = (link_sim_end_t*)io_ctx;
+    if(which) {
+        end->want_write = enable;
+    }
+}
+// ========= END IO FUNCTIONS =========
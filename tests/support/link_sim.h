@@ -0,0 +1,161 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tinyxpc/xpc_relay.h>
+/**
+ * Simulated link for tests and measurements.
+ *
+ * Two ends joined by a full duplex link with a bandwidth, a propagation
+ * delay, jitter, bit errors and lost writes, running on a virtual clock in
+ * microseconds which only moves when link_sim_advance is called.  Every
+ * random choice comes from a generator seeded at link_sim_init, so a run is
+ * reproduced exactly by its seed and parameters.
+ *
+ * Each write is sent as a unit: it waits for the bytes written before it to
+ * go out, takes its own length over the bandwidth to send, and arrives after
+ * the delay plus up to the jitter, never ahead of earlier writes.  A lost
+ * write is dropped whole, so a relay writing whole frames loses whole frames.
+ * Reads return what has arrived, which can end part way through a write.
+ *
+ * An end provides the relay's IO functions, for relays pulling with
+ * xpc_rd_op_continue, and link_sim_send and link_sim_recv for anything else
+ * which moves bytes, e.g. the COBS adapter.
+ */
+
+// bytes in flight per direction, and writes
+#define LINK_SIM_WIRE 65536
+#define LINK_SIM_SEGS 4096
+// payloads read without a destination are placed in the end's receive
+// buffer, which holds the largest frame.
+#define LINK_SIM_RX (65535 + 64)
+
+typedef struct {
+    // bytes per second, 0 for no limit
+    uint32_t bandwidth;
+    // propagation delay, and the most extra delay added to a write, in us
+    uint32_t delay;
+    uint32_t jitter;
+    // chance of any one bit being flipped, and of a write being lost
+    double bit_error_rate;
+    double drop_rate;
+    // most bytes taken by a write and returned by a read, 0 for no limit
+    size_t max_write;
+    size_t max_read;
+    // most bytes waiting to be sent, as in a UART FIFO, 0 for no limit
+    size_t tx_buffer;
+} link_sim_params_t;
+
+typedef struct {
+    uint32_t len;
+    uint64_t arrive_at;
+} link_sim_seg_t;
+
+/**
+ * One direction of the link: a ring of bytes in flight, split into the
+ * writes they came in.  head is the next byte to read, and taken how much of
+ * the first write has been read.
+ */
+typedef struct {
+    char wire[LINK_SIM_WIRE];
+    size_t head;
+    size_t fill;
+    link_sim_seg_t segs[LINK_SIM_SEGS];
+    size_t seg_head;
+    size_t seg_count;
+    size_t taken;
+    // when the sender is done sending what it wrote, and when the last write
+    // arrives
+    uint64_t busy_until;
+    uint64_t last_arrival;
+    // counters
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t writes_dropped;
+    uint64_t bits_flipped;
+} link_sim_dir_t;
+
+typedef struct link_sim link_sim_t;
+
+typedef struct {
+    link_sim_t *sim;
+    link_sim_dir_t *tx;
+    link_sim_dir_t *rx;
+    char rx_buf[LINK_SIM_RX];
+    // set while the relay has write notifications enabled
+    bool want_write;
+} link_sim_end_t;
+
+struct link_sim {
+    link_sim_params_t params;
+    uint64_t now;
+    uint64_t rng;
+    // thresholds for the random draws, out of 2^32
+    uint32_t byte_error;
+    uint32_t drop;
+    link_sim_dir_t dir[2];
+    link_sim_end_t end[2];
+};
+
+/**
+ * Set up a link, at time 0.
+ * @param target pointer to preallocated memory for the link.
+ * @param params link parameters, copied.
+ * @param seed seed for every random choice made.
+ * @return target, or NULL on bad arguments.
+ */
+link_sim_t *link_sim_init(link_sim_t *target, const link_sim_params_t *params, uint64_t seed);
+
+/**
+ * Move the virtual clock forward.
+ */
+void link_sim_advance(link_sim_t *self, uint64_t us);
+
+/**
+ * When the next write in flight in either direction arrives.
+ * @param at set to the time, if there is one.
+ * @return true if a write is in flight and has not arrived yet.
+ */
+bool link_sim_next_arrival(link_sim_t *self, uint64_t *at);
+
+/**
+ * Write bytes into the link from an end.
+ * @return the number of bytes taken, short when the link or tx_buffer is
+ * full, or with max_write.
+ */
+size_t link_sim_send(link_sim_end_t *end, const char *buf, size_t bytes);
+
+/**
+ * Read bytes which have arrived at an end.
+ * @return the number of bytes read, short with max_read.
+ */
+size_t link_sim_recv(link_sim_end_t *end, char *buf, size_t bytes);
+
+/**
+ * clock_fn for relays on the link: the virtual clock, in us.  clock_ctx is
+ * the link.
+ */
+uint32_t link_sim_clock(void *clock_ctx);
+
+/**
+ * Configure a relay to pull from an end, with the end's IO functions
+ * (xpc_relay_config and xpc_relay_config_writev).  The relay may be
+ * configured further afterwards.
+ * @param msg_ctx, crc_ctx, msg_handle_cb, crc, crc_config as for
+ * xpc_relay_config.
+ * @return relay, or NULL if end or relay is NULL.
+ */
+xpc_relay_state_t *link_sim_relay_config(
+    link_sim_end_t *end, xpc_relay_state_t *relay,
+    void *msg_ctx, void *crc_ctx, dispatch_fn *msg_handle_cb,
+    crc_fn *crc, crc_polyn_config *crc_config
+);
+
+/**
+ * IO functions used by the relay.  io_ctx is the end.
+ */
+int link_sim_write(void *io_ctx, char **buffer, int offset, size_t bytes_max);
+int link_sim_writev(void *io_ctx, xpc_iovec_t *iov, int iovcnt);
+int link_sim_read(void *io_ctx, char **buffer, int offset, size_t bytes_max);
+void link_sim_io_reset(void *io_ctx, int which, size_t bytes);
+void link_sim_io_notify(void *io_ctx, int which, bool enable);
@@ -0,0 +1,69 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <crc.h>
+/**
+ * Transport and CRC for the C++ layer's tests: relays joined by in-memory
+ * byte queues.  Payloads are read in place, so the bytes of one stay where
+ * they are until the relay discards them, leased or not.  The queues are not
+ * reclaimed, a test moves at most sizeof(rx) bytes each way.
+ */
+struct Loop {
+    Loop *peer = nullptr;
+    char rx[16384];
+    std::size_t head = 0;
+    std::size_t tail = 0;
+    std::size_t discarded = 0;
+
+    int write(std::span<const char> bytes) {
+        std::size_t n = std::min(bytes.size(), sizeof(peer->rx) - peer->tail);
+        std::memcpy(peer->rx + peer->tail, bytes.data(), n);
+        peer->tail += n;
+        return n;
+    }
+
+    int read(char *&buffer, int offset, std::size_t bytes_max) {
+        std::size_t n = std::min(bytes_max, tail - head);
+        if(buffer == nullptr) {
+            buffer = rx + head;
+        }
+        std::memmove(buffer + offset, rx + head, n);
+        head += n;
+        return n;
+    }
+
+    void reset(int which, std::size_t bytes) {
+        if(which == 1 && bytes != (std::size_t)-1) {
+            discarded += bytes;
+        }
+    }
+};
+
+struct Crc32 {
+    crc_t value;
+    int configured = 0;
+
+    char *compute(std::span<const char> bytes) {
+        value = crc_finalize(crc_update(crc_init(), bytes.data(), bytes.size()));
+        return (char*)&value;
+    }
+
+    void configure(int crc_bits, const char *polyn) {
+        configured = crc_bits;
+    }
+
+    std::uint64_t init() {
+        return crc_init();
+    }
+
+    std::uint64_t update(std::uint64_t crc, std::span<const char> bytes) {
+        return crc_update(crc, bytes.data(), bytes.size());
+    }
+
+    void finalize(std::uint64_t crc, char *out) {
+        crc_t final = crc_finalize(crc);
+        std::memcpy(out, &final, sizeof(final));
+    }
+};
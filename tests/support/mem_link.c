@@ -0,0 +1,105 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <mem_link.h>
+
+void mem_link_init(mem_link_t *link, mem_link_t *peer) {
+    memset(link, 0, sizeof(*link));
+    link->peer = peer;
+    link->capacity = MEM_LINK_RX;
+}
+
+void mem_link_config(
+        mem_link_t *link, mem_link_t *peer, void *msg_ctx, dispatch_fn *msg_handle_cb,
+        bool crc) {
+    mem_link_init(link, peer);
+    xpc_relay_config(
+        &link->relay, link, msg_ctx, link,
+        mem_link_write, NULL, mem_link_io_reset, mem_link_io_notify,
+        msg_handle_cb, crc ? mem_link_crc:NULL, crc ? mem_link_polyn_config:NULL
+    );
+}
+
+void mem_link_pair(mem_link_t *a, mem_link_t *b, bool crc) {
+    mem_link_config(a, b, a, mem_link_dispatch, crc);
+    mem_link_config(b, a, b, mem_link_dispatch, crc);
+}
+
+int mem_link_send(void *link_ctx, const char *buf, size_t bytes) {
+    mem_link_t *link = (mem_link_t*)link_ctx;
+    mem_link_t *peer = link->peer;
+    if(peer->head == peer->tail) {
+        peer->head = peer->parse = peer->tail = 0;
+    }
+    else if(peer->head == peer->parse && peer->tail == peer->capacity) {
+        // nothing held, move the partial frame to the front
+        memmove(peer->rx, peer->rx + peer->parse, peer->tail - peer->parse);
+        peer->tail -= peer->parse;
+        peer->head = peer->parse = 0;
+    }
+    if(bytes > peer->capacity - peer->tail) {
+        bytes = peer->capacity - peer->tail;
+    }
+    if(link->write_max && bytes > link->write_max) {
+        bytes = link->write_max;
+    }
+    memcpy(peer->rx + peer->tail, buf, bytes);
+    peer->tail += bytes;
+    return bytes;
+}
+
+void mem_link_pump(mem_link_t *link) {
+    if(link->paused) {
+        return;
+    }
+    xpc_wr_op_continue(&link->relay);
+    link->parse += xpc_relay_feed(
+        &link->relay, link->rx + link->parse, link->tail - link->parse
+    );
+}
+
+int mem_link_write(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+    return mem_link_send(io_ctx, *buffer + offset, bytes_max);
+}
+
+void mem_link_io_reset(void *io_ctx, int which, size_t bytes) {
+    mem_link_t *link = (mem_link_t*)io_ctx;
+    if(!which) {
+        return;
+    }
+    if(bytes != (size_t)-1) {
+        link->head += bytes;
+    }
+    else if(link->relay.rd_span.buf != NULL) {
+        link->head = link->parse + link->relay.rd_span.pos;
+    }
+    else {
+        link->head = link->parse;
+    }
+}
+
+void mem_link_io_notify(void *io_ctx, int which, bool enable) {
+}
+
+bool mem_link_dispatch(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload) {
+    mem_link_t *link = (mem_link_t*)msg_ctx;
+    if(link->decline > 0) {
+        link->decline--;
+        return false;
+    }
+    link->received++;
+    link->last_size = msg_hdr->size < MEM_LINK_LAST ? msg_hdr->size:MEM_LINK_LAST;
+    if(link->last_size) {
+        memcpy(link->last, payload, link->last_size);
+    }
+    return true;
+}
+
+char *mem_link_crc(void *crc_ctx, char *buf, size_t bytes) {
+    mem_link_t *link = (mem_link_t*)crc_ctx;
+    link->crc = crc_finalize(crc_update(crc_init(), buf, bytes));
+    return (char*)&link->crc;
+}
+
+void mem_link_polyn_config(void *crc_ctx, int crc_bits, char *polyn) {
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tinyxpc/xpc_relay.h>
+#include <crc.h>
+/**
+ * In-memory link for tests.
+ *
+ * Two ends, each with a relay parsing its receive buffer in place with
+ * xpc_relay_feed.  Writes land in the peer's receive buffer, which is
+ * reclaimed in order like a FIFO: bytes up to head have been discarded by
+ * the relay, bytes up to parse fed to it, and bytes up to tail written.
+ * Nothing is moved while the relay holds bytes (e.g. leased payloads), so a
+ * full buffer holds back its writer.
+ *
+ * mem_link_send takes bytes for anything else which writes to the link, e.g.
+ * the COBS adapter, in which case the test takes them from the receive
+ * buffer itself.
+ */
+
+// receive buffer size, and the most of the last payload kept
+#define MEM_LINK_RX 4096
+#define MEM_LINK_LAST 1024
+
+typedef struct mem_link mem_link_t;
+struct mem_link {
+    xpc_relay_state_t relay;
+    mem_link_t *peer;
+    char rx[MEM_LINK_RX];
+    // bytes of rx used, MEM_LINK_RX unless lowered for a smaller link
+    size_t capacity;
+    size_t head;
+    size_t parse;
+    size_t tail;
+    // most bytes taken by a write to the peer, 0 for no limit
+    size_t write_max;
+    // a paused end neither reads nor writes, like a busy node
+    bool paused;
+    // mem_link_dispatch declines this many messages first, then counts them
+    // and keeps a copy of the last one
+    int decline;
+    int received;
+    char last[MEM_LINK_LAST];
+    size_t last_size;
+    crc_t crc;
+};
+
+/**
+ * Clear an end and join it to peer, without configuring its relay.
+ */
+void mem_link_init(mem_link_t *link, mem_link_t *peer);
+
+/**
+ * Clear an end, join it to peer, and configure its relay to be fed from the
+ * end, writing to peer.
+ * @param msg_ctx, msg_handle_cb as for xpc_relay_config.
+ * @param crc whether to configure CRC-32 (crc.c), computed into link->crc.
+ */
+void mem_link_config(
+    mem_link_t *link, mem_link_t *peer, void *msg_ctx, dispatch_fn *msg_handle_cb,
+    bool crc
+);
+
+/**
+ * Configure both ends of a link, dispatching to mem_link_dispatch.
+ */
+void mem_link_pair(mem_link_t *a, mem_link_t *b, bool crc);
+
+/**
+ * Write bytes into the peer's receive buffer, an xpc_cobs_link_fn.
+ * @param link_ctx the writing end.
+ * @return the number of bytes taken, short when the peer is full, or with
+ * write_max.
+ */
+int mem_link_send(void *link_ctx, const char *buf, size_t bytes);
+
+/**
+ * Let an end write what it has pending, then feed it what it received.
+ * Paused ends are left alone.
+ */
+void mem_link_pump(mem_link_t *link);
+
+/**
+ * Functions used by the relay.  io_ctx is the end, as are msg_ctx and
+ * crc_ctx for mem_link_dispatch and mem_link_crc.
+ */
+int mem_link_write(void *io_ctx, char **buffer, int offset, size_t bytes_max);
+void mem_link_io_reset(void *io_ctx, int which, size_t bytes);
+void mem_link_io_notify(void *io_ctx, int which, bool enable);
+bool mem_link_dispatch(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload);
+char *mem_link_crc(void *crc_ctx, char *buf, size_t bytes);
+void mem_link_polyn_config(void *crc_ctx, int crc_bits, char *polyn);
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <tinyxpc/tinyxpc.h>
+#include <tinyxpc/xpc_relay.h>
+#include <bind_loop.h>
+
+#define QUEUE 4
+
+// CRC-32/ISO-HDLC generator, most significant byte first
+static char crc_polyn[4] = {0x04, (char)0xc1, 0x1d, (char)0xb7};
+
+typedef struct {
+    bind_loop_end_t loop;
+    xpc_relay_state_t relay;
+    xpc_tx_desc_t queue[QUEUE];
+} test_end_t;
+
+static void test_pump(test_end_t *a, test_end_t *b) {
+    for(int i = 0; i < 4; i++) {
+        xpc_wr_op_continue(&a->relay);
+        xpc_wr_op_continue(&b->relay);
+        xpc_rd_op_continue(&a->relay);
+        xpc_rd_op_continue(&b->relay);
+    }
+}
+
+/**
+ * Relays configured without any function pointers, which only work if every
+ * call is bound.
+ */
+static void test_pair(test_end_t *a, test_end_t *b) {
+    test_end_t *ends[2] = {a, b};
+    for(int i = 0; i < 2; i++) {
+        memset(ends[i], 0, sizeof(*ends[i]));
+        ends[i]->loop.peer = &ends[1 - i]->loop;
+        xpc_relay_config(
+            &ends[i]->relay, &ends[i]->loop, &ends[i]->loop, &ends[i]->loop,
+            NULL, NULL, NULL, NULL, NULL, NULL, NULL
+        );
+        xpc_relay_config_tx_queue(&ends[i]->relay, ends[i]->queue, QUEUE);
+    }
+    xpc_relay_send_reset(&a->relay);
+    test_pump(a, b);
+}
+
+int test_bound_calls(void) {
+    test_end_t a, b;
+    test_pair(&a, &b);
+    int config = xpc_relay_send_config(&a.relay, 32, crc_polyn, false);
+    test_pump(&a, &b);
+    xpc_send_msg(&a.relay, 1, 2, "to b", 4);
+    xpc_send_msg(&b.relay, 2, 1, "to a", 4);
+    test_pump(&a, &b);
+    printf("config %i, crc bits %i/%i\n", config,
+        a.relay.conn_config.crc_bits, b.relay.conn_config.crc_bits);
+    printf("a received %i: %.*s\n", a.loop.received, (int)a.loop.last_size, a.loop.last);
+    printf("b received %i: %.*s\n", b.loop.received, (int)b.loop.last_size, b.loop.last);
+    printf("crc calls %i/%i\n", a.loop.crc_calls, b.loop.crc_calls);
+    return config != TXPC_STATUS_DONE || b.relay.conn_config.crc_bits != 32
+        || a.loop.received != 1 || memcmp(a.loop.last, "to a", 4)
+        || b.loop.received != 1 || memcmp(b.loop.last, "to b", 4)
+        || !a.loop.crc_calls || !b.loop.crc_calls;
+}
+
+/**
+ * The width is fixed: other widths are turned away, and a damaged payload is
+ * still caught with the bound one.
+ */
+int test_bound_width(void) {
+    test_end_t a, b;
+    test_pair(&a, &b);
+    int narrow = xpc_relay_send_config(&a.relay, 16, crc_polyn, false);
+    printf("16 bit config: %s\n",
+        narrow == TXPC_STATUS_BAD_STATE ? "rejected":"accepted");
+    xpc_relay_send_config(&a.relay, 32, crc_polyn, false);
+    test_pump(&a, &b);
+    xpc_send_msg(&a.relay, 1, 2, "damaged", 7);
+    xpc_wr_op_continue(&a.relay);
+    // the first payload byte follows the header
+    b.loop.rx[b.loop.head + sizeof(txpc_hdr_t)] ^= 0x20;
+    xpc_send_msg(&a.relay, 1, 2, "intact", 6);
+    test_pump(&a, &b);
+    printf("received %i: %.*s\n", b.loop.received, (int)b.loop.last_size, b.loop.last);
+    return narrow != TXPC_STATUS_BAD_STATE || b.loop.received != 1
+        || memcmp(b.loop.last, "intact", 6);
+}
+
+/**
+ * A config from the remote with another width is not applied either: the
+ * connection is reset instead, and frames are still checked with the bound
+ * width.
+ */
+int test_received_width(void) {
+    test_end_t a, b;
+    test_pair(&a, &b);
+    xpc_relay_send_config(&a.relay, 32, crc_polyn, false);
+    test_pump(&a, &b);
+    txpc_hdr_t hdr = {
+        .type = TXPC_MSG_TYPE_CONFIG, .size = 1 + 1 + XPC_CRC_BYTES(16)
+    };
+    char config[sizeof(txpc_hdr_t) + 1 + 1 + XPC_CRC_BYTES(16)] = {0};
+    memcpy(config, &hdr, sizeof(txpc_hdr_t));
+    config[sizeof(txpc_hdr_t) + 1] = 16;
+    char *frame = config;
+    bind_loop_write(&a.loop, &frame, 0, sizeof(config));
+    xpc_rd_op_continue(&b.relay);
+    bool reset = b.relay.signals & SIG_RST_SEND;
+    printf("16 bit config received: crc bits %i, reset %i\n",
+        b.relay.conn_config.crc_bits, reset);
+    test_pump(&a, &b);
+    xpc_send_msg(&a.relay, 1, 2, "after", 5);
+    test_pump(&a, &b);
+    printf("received %i: %.*s\n", b.loop.received, (int)b.loop.last_size, b.loop.last);
+    return b.relay.conn_config.crc_bits != 32 || !reset
+        || b.loop.received != 1 || memcmp(b.loop.last, "after", 5);
+}
+
+int main(void) {
+    int r = 0;
+    printf("***TESTING BOUND CALLS\n");
+    r |= test_bound_calls();
+    printf("***TESTING BOUND CRC WIDTH\n");
+    r |= test_bound_width();
+    printf("***TESTING RECEIVED CRC WIDTH\n");
+    r |= test_received_width();
+    return r;
+}
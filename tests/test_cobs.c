@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tinyxpc/tinyxpc.h>
+#include <tinyxpc/xpc_relay.h>
+#include <tinyxpc/xpc_cobs.h>
+#include <mem_link.h>
+
+#define BIG_PAYLOAD 1000
+
+/**
+ * One end of an in-memory link, written through a COBS adapter.  Encoded
+ * bytes land in the peer's receive buffer, where the test can damage them
+ * before they are taken.
+ */
+typedef struct {
+    mem_link_t link;
+    xpc_cobs_t cobs;
+    char tx[XPC_COBS_BLOCK + 16];
+    char rx[BIG_PAYLOAD + 64];
+} test_end_t;
+
+// write what is pending, without delivering it
+static void test_end_send(test_end_t *end) {
+    xpc_wr_op_continue(&end->link.relay);
+    xpc_cobs_flush(&end->cobs);
+}
+
+// take everything received
+static void test_end_receive(test_end_t *end) {
+    mem_link_t *link = &end->link;
+    link->parse += xpc_cobs_input(
+        &end->cobs, link->rx + link->parse, link->tail - link->parse
+    );
+    link->head = link->parse;
+}
+
+static void test_end_pump(test_end_t *end) {
+    test_end_send(end);
+    test_end_receive(end);
+}
+
+static void test_end_pair(test_end_t *a, test_end_t *b) {
+    test_end_t *ends[2] = {a, b};
+    for(int i = 0; i < 2; i++) {
+        memset(ends[i], 0, sizeof(*ends[i]));
+        mem_link_init(&ends[i]->link, &ends[1 - i]->link);
+        xpc_cobs_config(
+            &ends[i]->cobs, ends[i]->tx, sizeof(ends[i]->tx),
+            ends[i]->rx, sizeof(ends[i]->rx), mem_link_send, &ends[i]->link
+        );
+        xpc_cobs_relay_config(
+            &ends[i]->cobs, &ends[i]->link.relay, &ends[i]->link, &ends[i]->link,
+            mem_link_dispatch, mem_link_crc, mem_link_polyn_config
+        );
+        ends[i]->link.relay.conn_config.crc_bits = 32;
+    }
+    xpc_relay_send_reset(&a->link.relay);
+    for(int i = 0; i < 4; i++) {
+        test_end_pump(a);
+        test_end_pump(b);
+    }
+}
+
+/**
+ * Round trip buffers of every length up to a few blocks, from all zeros to
+ * none, and check the delimiter scan against a plain loop.
+ */
+int test_kernels(void) {
+    static char raw[1100], enc[XPC_COBS_MAX_ENCODED(1100)];
+    static char dec[sizeof(enc)];
+    int bad = 0;
+    srand(1);
+    for(int density = 0; density <= 4; density++) {
+        for(size_t len = 0; len <= sizeof(raw); len += density ? 7:1) {
+            for(size_t i = 0; i < len; i++) {
+                // density 0: no zeros, 4: all zeros
+                raw[i] = rand() % 4 < density ? 0:(char)(rand() % 255 + 1);
+            }
+            size_t enc_len = xpc_cobs_encode(raw, len, enc);
+            if(enc_len > XPC_COBS_MAX_ENCODED(len)
+                    || xpc_cobs_find_delim(enc, enc_len) != enc_len) {
+                bad++;
+                continue;
+            }
+            size_t dec_len = xpc_cobs_decode(enc, enc_len, dec);
+            if(dec_len != len || memcmp(raw, dec, len)) {
+                bad++;
+            }
+            // in place
+            memcpy(dec, enc, enc_len);
+            if(xpc_cobs_decode(dec, enc_len, dec) != len || memcmp(raw, dec, len)) {
+                bad++;
+            }
+        }
+    }
+    printf("round trips failed: %i\n", bad);
+
+    int scan_bad = 0;
+    for(int i = 0; i < 10000; i++) {
+        size_t offset = rand() % 16;
+        size_t len = rand() % 200;
+        for(size_t j = 0; j < len; j++) {
+            raw[offset + j] = rand() % 64 ? (char)(rand() % 255 + 1):0;
+        }
+        size_t expect = 0;
+        while(expect < len && raw[offset + expect] != 0) {
+            expect++;
+        }
+        scan_bad += xpc_cobs_find_delim(raw + offset, len) != expect;
+    }
+    printf("delimiter scans wrong: %i\n", scan_bad);
+
+    // a code byte running past the end
+    char truncated[] = {0x05, 'a', 'b'};
+    int invalid = xpc_cobs_decode(truncated, 3, dec) == XPC_COBS_INVALID;
+    printf("truncated block rejected: %i\n", invalid);
+    return bad || scan_bad || !invalid;
+}
+
+/**
+ * Damage one of three frames in flight in different ways.  Each time, only
+ * the damaged frame is lost, and noise delimited on its own costs nothing.
+ */
+int test_resync(void) {
+    int r = 0;
+    test_end_t a, b;
+    test_end_pair(&a, &b);
+    const char *kinds[] = {
+        "payload byte flipped", "size field flipped", "bytes lost",
+        "noise between frames"
+    };
+    for(int kind = 0; kind < 4; kind++) {
+        int received = b.link.received;
+        uint64_t dropped = b.cobs.dropped;
+        xpc_send_msg(&a.link.relay, 1, 2, "first", 5);
+        test_end_send(&a);
+        size_t second = b.link.tail;
+        xpc_send_msg(&a.link.relay, 1, 2, "second", 6);
+        test_end_send(&a);
+        size_t third = b.link.tail;
+        switch(kind) {
+            case 0:
+                // the encoded header is a code byte and five bytes
+                b.link.rx[second + 7] ^= 0x40;
+            break;
+
+            case 1:
+                // size is the second header field
+                b.link.rx[second + 2] ^= 0x04;
+            break;
+
+            case 2:
+                memmove(b.link.rx + second + 3, b.link.rx + second + 6, third - second - 6);
+                b.link.tail -= 3;
+            break;
+
+            case 3:
+                memmove(b.link.rx + second + 5, b.link.rx + second, third - second);
+                memcpy(b.link.rx + second, "\x13\x37\xbe\xef\x00", 5);
+                b.link.tail += 5;
+            break;
+        }
+        xpc_send_msg(&a.link.relay, 1, 2, "third", 5);
+        test_end_send(&a);
+        test_end_receive(&b);
+        printf("%s: received %i, dropped %llu, last %.*s\n", kinds[kind],
+            b.link.received - received,
+            (unsigned long long)(b.cobs.dropped - dropped),
+            (int)b.link.last_size, b.link.last);
+        r |= b.link.received - received != (kind == 3 ? 3:2)
+            || memcmp(b.link.last, "third", 5);
+    }
+    return r;
+}
+
+/**
+ * A payload several blocks long, with zeros, through a transmit buffer not
+ * much bigger than a block and a link taking a few bytes per write.
+ */
+int test_short_writes(void) {
+    test_end_t a, b;
+    static char payload[BIG_PAYLOAD];
+    test_end_pair(&a, &b);
+    for(size_t i = 0; i < BIG_PAYLOAD; i++) {
+        payload[i] = i % 300 < 10 ? 0:(char)(i * 7);
+    }
+    a.link.write_max = 7;
+    xpc_send_msg(&a.link.relay, 1, 2, payload, BIG_PAYLOAD);
+    int passes = 0;
+    while(b.link.received == 0 && passes < 1000) {
+        test_end_pump(&a);
+        test_end_pump(&b);
+        passes++;
+    }
+    int intact = b.link.last_size == BIG_PAYLOAD && !memcmp(b.link.last, payload, BIG_PAYLOAD);
+    printf("received %i in %i passes, intact: %i, dropped %llu\n",
+        b.link.received, passes, intact, (unsigned long long)b.cobs.dropped);
+    return b.link.received != 1 || !intact || b.cobs.dropped;
+}
+
+int main(void) {
+    int r = 0;
+    printf("***TESTING KERNELS\n");
+    r |= test_kernels();
+    printf("***TESTING RESYNCHRONIZATION\n");
+    r |= test_resync();
+    printf("***TESTING SHORT WRITES\n");
+    r |= test_short_writes();
+    return r;
+}
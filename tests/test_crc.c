@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tinyxpc/xpc_relay.h>
+#include <tinyxpc/xpc_crc.h>
+
+
+static const char *preset_names[] = {
+    "CRC-8/SMBUS", "CRC-8/MAXIM-DOW", "CRC-16/KERMIT", "CRC-16/IBM-3740",
+    "CRC-16/MODBUS", "CRC-24/OPENPGP", "CRC-32/ISO-HDLC", "CRC-32/ISCSI",
+    "CRC-64/XZ", "CRC-64/ECMA-182"
+};
+
+static xpc_crc_ctx_t uut;
+
+
+/**
+ * Bit at a time reference implementation, straight from the parameters.
+ */
+uint64_t reference_crc(const xpc_crc_params_t *params, const char *buf, size_t bytes) {
+    uint64_t top = UINT64_C(1) << (params->width - 1);
+    uint64_t mask = ~UINT64_C(0) >> (64 - params->width);
+    uint64_t crc = params->init;
+    for(size_t i = 0; i < bytes; i++) {
+        for(int bit = 0; bit < 8; bit++) {
+            int in = params->refin ? (buf[i] >> bit) & 1:(buf[i] >> (7 - bit)) & 1;
+            int feedback = ((crc & top) ? 1:0) ^ in;
+            crc = (crc << 1) & mask;
+            if(feedback) {
+                crc ^= params->polyn;
+            }
+        }
+    }
+    if(params->refout) {
+        uint64_t out = 0;
+        for(int i = 0; i < params->width; i++) {
+            out = (out << 1) | ((crc >> i) & 1);
+        }
+        crc = out;
+    }
+    return crc ^ params->xorout;
+}
+
+
+/**
+ * Compare an engine with the reference over random data, in one call and in
+ * two pieces through the incremental interface, then check the wire bytes.
+ */
+int check_engine(const char *name, xpc_crc_ctx_t *ctx) {
+    int mismatches = 0;
+    char data[512];
+    for(size_t i = 0; i < sizeof(data); i++) {
+        data[i] = rand();
+    }
+    int width = ctx->params.width;
+    for(size_t bytes = 0; bytes <= sizeof(data); bytes += 13) {
+        uint64_t expected = reference_crc(&ctx->params, data, bytes);
+        size_t split = bytes / 3;
+        uint64_t crc = xpc_crc_init(ctx);
+        crc = xpc_crc_update(ctx, crc, data, split);
+        crc = xpc_crc_update(ctx, crc, data + split, bytes - split);
+        char out[8];
+        xpc_crc_finalize(ctx, crc, out);
+        char *wire = xpc_crc_fn(ctx, data, bytes);
+        uint64_t decoded = 0;
+        for(int i = 0; i < XPC_CRC_BYTES(width); i++) {
+            int byte = ctx->params.refout ? XPC_CRC_BYTES(width) - 1 - i:i;
+            decoded = (decoded << 8) | (unsigned char)wire[byte];
+        }
+        if(xpc_crc_compute(ctx, data, bytes) != expected || decoded != expected
+                || memcmp(out, wire, XPC_CRC_BYTES(width)) != 0) {
+            mismatches++;
+        }
+    }
+    printf("%s: %i mismatches\n", name, mismatches);
+    return mismatches;
+}
+
+
+int test_presets(void) {
+    int failures = 0;
+    for(int i = 0; i < XPC_CRC_PRESET_COUNT; i++) {
+        const xpc_crc_params_t *params = xpc_crc_preset(i);
+        xpc_crc_setup(&uut, params);
+        uint64_t check = xpc_crc_compute(&uut, "123456789", 9);
+        printf("%s check: %llx\n", preset_names[i], (unsigned long long)check);
+        if(check != params->check) {
+            printf("MISMATCH, expected %llx\n", (unsigned long long)params->check);
+            failures++;
+        }
+        failures += check_engine(preset_names[i], &uut);
+    }
+    if(xpc_crc_preset(XPC_CRC_PRESET_COUNT) != NULL) {
+        failures++;
+    }
+    return failures;
+}
+
+
+int test_custom(void) {
+    int failures = 0;
+    struct {
+        const char *name;
+        xpc_crc_params_t params;
+    } custom[] = {
+        {"CRC-12/DECT", {12, false, false, 0x80f, 0, 0, 0xf5b}},
+        {"CRC-17/CAN-FD", {17, false, false, 0x1685b, 0, 0, 0x04f03}},
+        {"CRC-21/CAN-FD", {21, false, false, 0x102899, 0, 0, 0x0ed841}},
+        {"CRC-24/BLE", {24, true, true, 0x65b, 0x555555, 0, 0xc25a56}},
+        {"CRC-40/GSM", {40, false, false, 0x0004820009, 0, 0xffffffffff, 0xd4164fc646}},
+        {"CRC-64/GO-ISO", {64, true, true, 0x1b, ~UINT64_C(0), ~UINT64_C(0), 0xb90956c775a41001}},
+    };
+    for(size_t i = 0; i < sizeof(custom) / sizeof(custom[0]); i++) {
+        xpc_crc_setup(&uut, &custom[i].params);
+        uint64_t check = xpc_crc_compute(&uut, "123456789", 9);
+        printf("%s check: %llx\n", custom[i].name, (unsigned long long)check);
+        if(check != custom[i].params.check) {
+            printf("MISMATCH, expected %llx\n", (unsigned long long)custom[i].params.check);
+            failures++;
+        }
+        failures += check_engine(custom[i].name, &uut);
+    }
+    xpc_crc_params_t narrow = {7, false, false, 0x09, 0, 0, 0};
+    if(xpc_crc_setup(&uut, &narrow) != NULL) {
+        printf("7 bit crc accepted\n");
+        failures++;
+    }
+    return failures;
+}
+
+
+/**
+ * A polynomial arriving in a config message replaces width and polynomial.
+ */
+int test_polyn_config(void) {
+    int failures = 0;
+    xpc_crc_setup(&uut, xpc_crc_preset(XPC_CRC_16_IBM_3740));
+    // CRC-12 with all-ones init, the init follows the width
+    char polyn12[] = {'\x08', '\x0f'};
+    xpc_crc_polyn_config(&uut, 12, polyn12);
+    printf("12 bit: polyn %llx init %llx\n",
+        (unsigned long long)uut.params.polyn, (unsigned long long)uut.params.init);
+    if(uut.params.width != 12 || uut.params.polyn != 0x80f || uut.params.init != 0xfff) {
+        failures++;
+    }
+    failures += check_engine("configured CRC-12", &uut);
+    // a copy works on its own, its table goes with it
+    xpc_crc_ctx_t copy = uut;
+    memset(uut.lut, 0, sizeof(uut.lut));
+    failures += check_engine("copied CRC-12", &copy);
+    // back to a preset polynomial picks up its compile-time table
+    char polyn16[] = {'\x10', '\x21'};
+    xpc_crc_polyn_config(&uut, 16, polyn16);
+    failures += check_engine("configured CRC-16", &uut);
+    if(uut.preset < 0) {
+        printf("CRC-16 table built at runtime\n");
+        failures++;
+    }
+    // out of range widths are ignored
+    xpc_crc_polyn_config(&uut, 72, polyn16);
+    if(uut.params.width != 16) {
+        failures++;
+    }
+    return failures;
+}
+
+
+int main(void) {
+    int failures = 0;
+    printf("***TESTING PRESETS\n");
+    failures += test_presets();
+    printf("***TESTING CUSTOM PARAMETERS\n");
+    failures += test_custom();
+    printf("***TESTING POLYNOMIAL CONFIGURATION\n");
+    failures += test_polyn_config();
+    return failures ? 1:0;
+}
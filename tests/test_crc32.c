@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tinyxpc/xpc_crc32.h>
+#include <crc.h>
+
+
+static const char *kernel_names[] = {
+    "auto", "slice8", "slice16", "pclmul", "sse42"
+};
+
+static xpc_crc32_ctx_t ref_ctx, uut_ctx;
+
+
+int test_check_values(void) {
+    int failures = 0;
+    struct {
+        uint32_t polyn;
+        uint32_t check;
+    } vectors[] = {
+        {XPC_CRC32_POLYN_IEEE, 0xcbf43926u},
+        {XPC_CRC32_POLYN_CASTAGNOLI, 0xe3069283u},
+    };
+    for(int v = 0; v < 2; v++) {
+        for(int k = XPC_CRC32_KERNEL_AUTO; k <= XPC_CRC32_KERNEL_SSE42; k++) {
+            if(xpc_crc32_setup(&uut_ctx, vectors[v].polyn, k) == NULL) {
+                printf("polyn %08x kernel %s: unsupported\n", vectors[v].polyn, kernel_names[k]);
+                continue;
+            }
+            uint32_t crc = xpc_crc32(&uut_ctx, "123456789", 9);
+            printf("polyn %08x kernel %s: %08x\n", vectors[v].polyn, kernel_names[k], crc);
+            if(crc != vectors[v].check) {
+                printf("MISMATCH, expected %08x\n", vectors[v].check);
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+
+/**
+ * Compare every supported kernel with slice-by-8 over random lengths and
+ * alignments, in one call and split into two updates.
+ */
+int test_kernels_agree(uint32_t polyn) {
+    int failures = 0;
+    size_t cap = 4096 + 64;
+    char *data = malloc(cap);
+    srand(polyn);
+    for(size_t i = 0; i < cap; i++) {
+        data[i] = rand();
+    }
+    xpc_crc32_setup(&ref_ctx, polyn, XPC_CRC32_KERNEL_SLICE8);
+    for(int k = XPC_CRC32_KERNEL_AUTO; k <= XPC_CRC32_KERNEL_SSE42; k++) {
+        if(xpc_crc32_setup(&uut_ctx, polyn, k) == NULL) {
+            continue;
+        }
+        int mismatches = 0;
+        for(int round = 0; round < 2000; round++) {
+            size_t align = rand() % 16;
+            size_t bytes = round < 300 ? round:rand() % 4096;
+            size_t split = bytes ? rand() % bytes:0;
+            char *buf = data + align;
+            uint32_t expected = xpc_crc32(&ref_ctx, buf, bytes);
+            uint64_t crc = xpc_crc32_init(&uut_ctx);
+            crc = xpc_crc32_update(&uut_ctx, crc, buf, split);
+            crc = xpc_crc32_update(&uut_ctx, crc, buf + split, bytes - split);
+            char out[4];
+            xpc_crc32_finalize(&uut_ctx, crc, out);
+            if(xpc_crc32(&uut_ctx, buf, bytes) != expected
+                    || memcmp(out, &expected, 4) != 0) {
+                mismatches++;
+            }
+        }
+        printf("polyn %08x kernel %s: %i mismatches\n", polyn, kernel_names[k], mismatches);
+        failures += mismatches;
+    }
+    free(data);
+    return failures;
+}
+
+
+/**
+ * The IEEE engine must produce the same bytes as the generated reference CRC.
+ */
+int test_reference(void) {
+    int failures = 0;
+    char data[1024];
+    for(size_t i = 0; i < sizeof(data); i++) {
+        data[i] = rand();
+    }
+    xpc_crc32_setup(&uut_ctx, XPC_CRC32_POLYN_IEEE, XPC_CRC32_KERNEL_AUTO);
+    for(size_t bytes = 0; bytes <= sizeof(data); bytes += 7) {
+        crc_t ref = crc_finalize(crc_update(crc_init(), data, bytes));
+        uint32_t ref32 = ref;
+        char *out = xpc_crc32_fn(&uut_ctx, data, bytes);
+        if(memcmp(out, &ref32, 4) != 0) {
+            failures++;
+        }
+    }
+    printf("reference: %i mismatches\n", failures);
+    return failures;
+}
+
+
+int main(void) {
+    int failures = 0;
+    printf("***TESTING CHECK VALUES\n");
+    failures += test_check_values();
+    printf("***TESTING KERNEL AGREEMENT\n");
+    failures += test_kernels_agree(XPC_CRC32_POLYN_IEEE);
+    failures += test_kernels_agree(XPC_CRC32_POLYN_CASTAGNOLI);
+    // any polynomial can be folded, not just the well known ones
+    failures += test_kernels_agree(0x741b8cd7u);
+    printf("***TESTING AGAINST REFERENCE\n");
+    failures += test_reference();
+    return failures ? 1:0;
+}
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tinyxpc/tinyxpc.h>
+#include <tinyxpc/xpc_relay.h>
+#include <tinyxpc/xpc_cobs.h>
+#include <crc.h>
+#include <link_sim.h>
+
+#define MSGS 2000
+#define MSG_SIZE 64
+#define QUEUE 16
+#define WINDOW 16
+// virtual time moved per pass, and the longest a run may take, in us
+#define STEP 100
+#define RUN_LIMIT 120000000u
+
+/**
+ * Relays exchanging numbered messages over a simulated link, measured in
+ * virtual time: every run is reproduced exactly by its seed.
+ */
+typedef struct {
+    const char *name;
+    link_sim_params_t link;
+    bool ack;
+    // fixed retransmission timeout, or the initial one when rto_max is set
+    uint32_t rto;
+    uint32_t rto_min;
+    uint32_t rto_max;
+    // frames COBS encoded, with losses inside frames
+    bool cobs;
+} test_scenario_t;
+
+typedef struct {
+    int delivered;
+    int corrupt;
+    uint64_t elapsed;
+    uint32_t p50;
+    uint32_t p99;
+    uint32_t max;
+    uint64_t resends;
+    uint64_t crc_errors;
+    uint64_t dropped;
+} test_result_t;
+
+typedef struct test_end test_end_t;
+struct test_end {
+    xpc_relay_state_t relay;
+    xpc_cobs_t cobs;
+    char cobs_tx[XPC_COBS_BLOCK + 16];
+    char cobs_rx[256];
+    link_sim_end_t *link;
+    xpc_tx_desc_t queue[QUEUE];
+    xpc_ack_slot_t window[WINDOW];
+    crc_t crc;
+};
+
+typedef struct {
+    link_sim_t *sim;
+    test_end_t ends[2];
+    uint32_t sent_at[MSGS];
+    uint32_t latency[MSGS];
+    bool seen[MSGS];
+    int delivered;
+    int corrupt;
+    uint64_t last_delivery;
+} test_run_t;
+
+static char payloads[MSGS][MSG_SIZE];
+
+bool test_dispatch_fn(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload) {
+    test_run_t *run = (test_run_t*)msg_ctx;
+    uint32_t n = 0;
+    memcpy(&n, payload, sizeof(n));
+    if(msg_hdr->size != MSG_SIZE || n >= MSGS
+            || memcmp(payload, payloads[n], MSG_SIZE) != 0) {
+        run->corrupt++;
+        return true;
+    }
+    if(!run->seen[n]) {
+        run->seen[n] = true;
+        run->latency[run->delivered++] = link_sim_clock(run->sim) - run->sent_at[n];
+        run->last_delivery = run->sim->now;
+    }
+    return true;
+}
+
+char *test_crc_fn(void *crc_ctx, char *buf, size_t bytes) {
+    test_end_t *end = (test_end_t*)crc_ctx;
+    end->crc = crc_finalize(crc_update(crc_init(), buf, bytes));
+    return (char*)&end->crc;
+}
+
+void test_polyn_config(void *crc_ctx, int crc_bits, char *polyn) {
+}
+
+int test_cobs_write(void *link_ctx, const char *buf, size_t bytes) {
+    return link_sim_send(((test_end_t*)link_ctx)->link, buf, bytes);
+}
+
+static int test_cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1:x > y;
+}
+
+static void test_end_config(test_run_t *run, test_scenario_t *sc, int side) {
+    test_end_t *end = &run->ends[side];
+    end->link = &run->sim->end[side];
+    if(sc->cobs) {
+        xpc_cobs_config(
+            &end->cobs, end->cobs_tx, sizeof(end->cobs_tx),
+            end->cobs_rx, sizeof(end->cobs_rx), test_cobs_write, end
+        );
+        xpc_cobs_relay_config(
+            &end->cobs, &end->relay, run, end,
+            test_dispatch_fn, test_crc_fn, test_polyn_config
+        );
+    }
+    else {
+        link_sim_relay_config(
+            end->link, &end->relay, run, end,
+            test_dispatch_fn, test_crc_fn, test_polyn_config
+        );
+    }
+    xpc_relay_config_tx_queue(&end->relay, end->queue, QUEUE);
+    end->relay.conn_config.crc_bits = 32;
+    if(sc->ack) {
+        xpc_relay_config_ack(
+            &end->relay, end->window, WINDOW, link_sim_clock, run->sim,
+            sc->rto, NULL
+        );
+        end->relay.conn_config.flags = CONFIG_FLAGS_REQ_ACK;
+    }
+    if(sc->rto_max) {
+        xpc_relay_config_timeouts(
+            &end->relay, link_sim_clock, run->sim, sc->rto_min, sc->rto_max, 0
+        );
+    }
+}
+
+static void test_end_pump(test_end_t *end) {
+    xpc_wr_op_continue(&end->relay);
+    if(end->cobs.relay != NULL) {
+        char buf[256];
+        xpc_cobs_flush(&end->cobs);
+        size_t n = link_sim_recv(end->link, buf, sizeof(buf));
+        xpc_cobs_input(&end->cobs, buf, n);
+    }
+    else {
+        xpc_rd_op_continue(&end->relay);
+    }
+}
+
+/**
+ * Send MSGS messages one way, as fast as the relay takes them, and measure
+ * delivery.
+ */
+static void test_run(test_scenario_t *sc, uint64_t seed, test_result_t *out) {
+    test_run_t *run = calloc(1, sizeof(test_run_t));
+    run->sim = calloc(1, sizeof(link_sim_t));
+    link_sim_init(run->sim, &sc->link, seed);
+    for(int side = 0; side < 2; side++) {
+        test_end_config(run, sc, side);
+    }
+    xpc_relay_state_t *a = &run->ends[0].relay;
+    xpc_relay_send_reset(a);
+    int sent = 0;
+    while(run->delivered < MSGS && run->sim->now < RUN_LIMIT) {
+        while(sent < MSGS && xpc_send_msg(
+                a, 1, 2, payloads[sent], MSG_SIZE) == TXPC_STATUS_DONE) {
+            run->sent_at[sent++] = link_sim_clock(run->sim);
+        }
+        for(int i = 0; i < 4; i++) {
+            test_end_pump(&run->ends[0]);
+            test_end_pump(&run->ends[1]);
+        }
+        link_sim_advance(run->sim, STEP);
+    }
+
+    qsort(run->latency, run->delivered, sizeof(uint32_t), test_cmp_u32);
+    xpc_relay_stats_t stats_a, stats_b;
+    xpc_relay_stats_snapshot(a, &stats_a);
+    xpc_relay_stats_snapshot(&run->ends[1].relay, &stats_b);
+    *out = (test_result_t){
+        .delivered = run->delivered, .corrupt = run->corrupt,
+        .elapsed = run->last_delivery,
+        .p50 = run->delivered ? run->latency[run->delivered / 2]:0,
+        .p99 = run->delivered ? run->latency[run->delivered * 99 / 100]:0,
+        .max = run->delivered ? run->latency[run->delivered - 1]:0,
+        .resends = stats_a.resends,
+        .crc_errors = stats_b.crc_errors,
+        .dropped = run->ends[1].cobs.dropped
+    };
+    free(run->sim);
+    free(run);
+}
+
+static void test_result_print(test_scenario_t *sc, test_result_t *res) {
+    printf("%s: %i/%i delivered, %i corrupt\n", sc->name,
+        res->delivered, MSGS, res->corrupt);
+    printf("  goodput %llu B/s, latency p50 %.1f p99 %.1f max %.1f ms\n",
+        res->elapsed ? (unsigned long long)(
+            (uint64_t)res->delivered * MSG_SIZE * 1000000 / res->elapsed):0,
+        res->p50 / 1000.0, res->p99 / 1000.0, res->max / 1000.0);
+    printf("  resends %llu, crc errors %llu, frames dropped %llu\n",
+        (unsigned long long)res->resends,
+        (unsigned long long)res->crc_errors,
+        (unsigned long long)res->dropped);
+}
+
+static test_scenario_t scenarios[] = {
+    {
+        .name = "115200 baud, short reads and writes",
+        .link = {
+            .bandwidth = 11520, .delay = 1000, .max_write = 7, .max_read = 5,
+            .tx_buffer = 64
+        }
+    },
+    {
+        .name = "2% loss, 10 ms delay, fixed 200 ms timeout",
+        .link = {
+            .bandwidth = 1000000, .delay = 10000, .jitter = 2000,
+            .drop_rate = 0.02
+        },
+        .ack = true, .rto = 200000
+    },
+    {
+        .name = "2% loss, 10 ms delay, adaptive timeout",
+        .link = {
+            .bandwidth = 1000000, .delay = 10000, .jitter = 2000,
+            .drop_rate = 0.02
+        },
+        .ack = true, .rto = 200000, .rto_min = 5000, .rto_max = 2000000
+    },
+    {
+        .name = "bit errors and loss over COBS, adaptive timeout",
+        .link = {
+            .bandwidth = 11520, .delay = 1000, .jitter = 500,
+            .bit_error_rate = 1e-5, .drop_rate = 0.01, .tx_buffer = 64
+        },
+        .ack = true, .rto = 200000, .rto_min = 5000, .rto_max = 2000000,
+        .cobs = true
+    }
+};
+
+int main(void) {
+    int r = 0;
+    int count = sizeof(scenarios) / sizeof(scenarios[0]);
+    test_result_t results[sizeof(scenarios) / sizeof(scenarios[0])];
+    for(uint32_t n = 0; n < MSGS; n++) {
+        memcpy(payloads[n], &n, sizeof(n));
+        for(size_t i = sizeof(n); i < MSG_SIZE; i++) {
+            payloads[n][i] = (char)(n * 31 + i);
+        }
+    }
+
+    printf("***TESTING SCENARIOS\n");
+    for(int i = 0; i < count; i++) {
+        test_run(&scenarios[i], 1, &results[i]);
+        test_result_print(&scenarios[i], &results[i]);
+        r |= results[i].delivered != MSGS || results[i].corrupt;
+    }
+    // the adaptive timeout recovers from each loss sooner
+    printf("adaptive timeout lowers p99 latency: %s\n",
+        results[2].p99 < results[1].p99 ? "yes":"no");
+    r |= results[2].p99 >= results[1].p99;
+
+    printf("***TESTING REPRODUCIBILITY\n");
+    test_result_t again, other;
+    test_run(&scenarios[3], 1, &again);
+    test_run(&scenarios[3], 2, &other);
+    int same = memcmp(&again, &results[3], sizeof(again)) == 0;
+    printf("same seed, same run: %s\n", same ? "yes":"no");
+    printf("other seed, other run: %s\n",
+        memcmp(&other, &results[3], sizeof(other)) != 0 ? "yes":"no");
+    r |= !same;
+    return r;
+}
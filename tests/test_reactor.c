@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <tinyxpc/xpc_relay.h>
+#include <tinyxpc/xpc_reactor.h>
+
+#define MSGS_PER_SIDE 8
+#define QUEUE_DEPTH 16
+#define RX_BUF 512
+
+typedef struct {
+    xpc_reactor_conn_t conn;
+    xpc_relay_state_t relay;
+    xpc_tx_desc_t queue[QUEUE_DEPTH];
+    char rx_buf[RX_BUF];
+    int fd;
+    int received;
+    int bad;
+} test_endpoint_t;
+
+typedef struct {
+    xpc_reactor_t reactor;
+    size_t expected;
+    size_t received;
+    size_t closed;
+    int ticks;
+    int tick_limit;
+} test_loop_t;
+
+static test_loop_t loop;
+
+static const char *payloads[MSGS_PER_SIDE] = {
+    "zero", "one", "two", "three", "four", "five", "six", "seven"
+};
+
+
+bool test_dispatch_fn(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload) {
+    test_endpoint_t *ep = (test_endpoint_t*)msg_ctx;
+    // messages arrive in order, numbered by from
+    const char *expected = payloads[ep->received % MSGS_PER_SIDE];
+    if(msg_hdr->from != ep->received % MSGS_PER_SIDE
+            || msg_hdr->size != strlen(expected)
+            || memcmp(payload, expected, msg_hdr->size) != 0) {
+        ep->bad++;
+    }
+    ep->received++;
+    if(++loop.received == loop.expected) {
+        xpc_reactor_stop(&loop.reactor);
+    }
+    return true;
+}
+
+void test_close_fn(xpc_reactor_conn_t *conn) {
+    loop.closed++;
+    if(loop.closed == loop.expected) {
+        xpc_reactor_stop(&loop.reactor);
+    }
+}
+
+void test_tick_fn(xpc_reactor_t *reactor, void *tick_ctx) {
+    test_loop_t *ctx = (test_loop_t*)tick_ctx;
+    if(++ctx->ticks >= ctx->tick_limit) {
+        // deadline for tests waiting on traffic
+        xpc_reactor_stop(reactor);
+    }
+}
+
+
+/**
+ * Connect pairs of relays over socketpairs, reset them from one side and send
+ * messages both ways through a single reactor.
+ */
+int test_pairs(size_t pairs) {
+    int failures = 0;
+    test_endpoint_t *eps = calloc(2 * pairs, sizeof(test_endpoint_t));
+    loop = (test_loop_t){.tick_limit = 500};
+    loop.expected = 2 * pairs * MSGS_PER_SIDE;
+    if(xpc_reactor_init(&loop.reactor, 10, test_tick_fn, &loop) == NULL) {
+        printf("reactor init failed\n");
+        free(eps);
+        return 1;
+    }
+    for(size_t i = 0; i < pairs; i++) {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            printf("socketpair failed at %zu\n", i);
+            failures++;
+            pairs = i;
+            loop.expected = 2 * pairs * MSGS_PER_SIDE;
+            break;
+        }
+        for(int side = 0; side < 2; side++) {
+            test_endpoint_t *ep = &eps[2 * i + side];
+            ep->fd = fds[side];
+            xpc_reactor_conn_config(
+                &ep->conn, &ep->relay, ep->fd, ep->fd, ep->rx_buf, RX_BUF,
+                ep, NULL, test_dispatch_fn, NULL, NULL
+            );
+            xpc_relay_config_tx_queue(&ep->relay, ep->queue, QUEUE_DEPTH);
+            if(xpc_reactor_add(&loop.reactor, &ep->conn, test_close_fn) == NULL) {
+                printf("add failed at %zu\n", i);
+                failures++;
+            }
+        }
+        // the reset goes first, messages queue up behind it
+        xpc_relay_send_reset(&eps[2 * i].relay);
+        for(int side = 0; side < 2; side++) {
+            for(int m = 0; m < MSGS_PER_SIDE; m++) {
+                if(xpc_send_msg(
+                        &eps[2 * i + side].relay, 1, m,
+                        (char*)payloads[m], strlen(payloads[m])
+                    ) != TXPC_STATUS_DONE) {
+                    failures++;
+                }
+            }
+        }
+    }
+    xpc_reactor_run(&loop.reactor);
+    int bad = 0;
+    for(size_t i = 0; i < 2 * pairs; i++) {
+        bad += eps[i].bad;
+        if(eps[i].received != MSGS_PER_SIDE) {
+            failures++;
+        }
+    }
+    printf("%zu pairs: %zu/%zu messages, %i corrupt, %i ticks\n",
+        pairs, loop.received, loop.expected, bad, loop.ticks);
+    failures += bad;
+    if(loop.reactor.count != 2 * pairs) {
+        printf("%zu connections left, expected %zu\n", loop.reactor.count, 2 * pairs);
+        failures++;
+    }
+
+    // closing one side closes the connection on the other
+    loop.expected = pairs;
+    loop.closed = 0;
+    loop.ticks = 0;
+    for(size_t i = 0; i < pairs; i++) {
+        xpc_reactor_remove(&loop.reactor, &eps[2 * i].conn);
+        close(eps[2 * i].fd);
+    }
+    xpc_reactor_run(&loop.reactor);
+    printf("%zu/%zu remote closes seen, %zu connections left\n",
+        loop.closed, pairs, loop.reactor.count);
+    if(loop.closed != pairs || loop.reactor.count != 0) {
+        failures++;
+    }
+    for(size_t i = 0; i < pairs; i++) {
+        close(eps[2 * i + 1].fd);
+    }
+    xpc_reactor_destroy(&loop.reactor);
+    free(eps);
+    return failures;
+}
+
+
+/**
+ * Ticks keep coming with no connections.
+ */
+int test_ticks(void) {
+    loop = (test_loop_t){.tick_limit = 5};
+    xpc_reactor_init(&loop.reactor, 2, test_tick_fn, &loop);
+    uint32_t start = xpc_reactor_clock(NULL);
+    xpc_reactor_run(&loop.reactor);
+    uint32_t elapsed = xpc_reactor_clock(NULL) - start;
+    xpc_reactor_destroy(&loop.reactor);
+    printf("%i ticks in %u ms\n", loop.ticks, elapsed);
+    return loop.ticks != 5 || elapsed < 8;
+}
+
+
+/**
+ * A message held back by a coalescing deadline goes out when the timer wheel
+ * gets round to it, with nothing else happening on the connection.
+ */
+int test_deadline(void) {
+    int failures = 0;
+    int fds[2];
+    test_endpoint_t *eps = calloc(2, sizeof(test_endpoint_t));
+    char staging[64];
+    loop = (test_loop_t){.tick_limit = 100, .expected = 1};
+    xpc_reactor_init(&loop.reactor, 5, test_tick_fn, &loop);
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        printf("socketpair failed\n");
+        free(eps);
+        return 1;
+    }
+    for(int side = 0; side < 2; side++) {
+        test_endpoint_t *ep = &eps[side];
+        ep->fd = fds[side];
+        xpc_reactor_conn_config(
+            &ep->conn, &ep->relay, ep->fd, ep->fd, ep->rx_buf, RX_BUF,
+            ep, NULL, test_dispatch_fn, NULL, NULL
+        );
+        xpc_relay_config_tx_queue(&ep->relay, ep->queue, QUEUE_DEPTH);
+        xpc_reactor_add(&loop.reactor, &ep->conn, test_close_fn);
+    }
+    xpc_relay_config_coalesce(
+        &eps[0].relay, staging, sizeof(staging), xpc_reactor_clock, NULL, 30
+    );
+    xpc_relay_send_reset(&eps[0].relay);
+    xpc_send_msg(&eps[0].relay, 1, 0, (char*)payloads[0], strlen(payloads[0]));
+    uint32_t start = xpc_reactor_clock(NULL);
+    xpc_reactor_run(&loop.reactor);
+    uint32_t elapsed = xpc_reactor_clock(NULL) - start;
+    printf("received %i after %s\n", eps[1].received,
+        elapsed >= 30 && elapsed < 30 + 10 * 5 ? "the deadline":"too long");
+    if(eps[1].received != 1 || eps[1].bad || elapsed < 30 || elapsed >= 80) {
+        printf("%u ms\n", elapsed);
+        failures++;
+    }
+    for(int side = 0; side < 2; side++) {
+        xpc_reactor_remove(&loop.reactor, &eps[side].conn);
+        close(eps[side].fd);
+    }
+    xpc_reactor_destroy(&loop.reactor);
+    free(eps);
+    return failures;
+}
+
+
+static test_endpoint_t *doomed;
+
+void test_remove_tick_fn(xpc_reactor_t *reactor, void *tick_ctx) {
+    if(doomed != NULL) {
+        xpc_reactor_remove(reactor, &doomed->conn);
+        close(doomed->fd);
+        // as good as freed
+        memset(doomed, 0xa5, sizeof(*doomed));
+        doomed = NULL;
+    }
+}
+
+
+/**
+ * A tick callback may remove and free a connection which has an event after
+ * the tick in the same batch.
+ */
+int test_remove_in_batch(void) {
+    int fds[2];
+    test_endpoint_t *ep = calloc(1, sizeof(test_endpoint_t));
+    loop = (test_loop_t){0};
+    xpc_reactor_init(&loop.reactor, 5, test_remove_tick_fn, NULL);
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        printf("socketpair failed\n");
+        free(ep);
+        return 1;
+    }
+    ep->fd = fds[0];
+    xpc_reactor_conn_config(
+        &ep->conn, &ep->relay, ep->fd, ep->fd, ep->rx_buf, RX_BUF,
+        ep, NULL, test_dispatch_fn, NULL, NULL
+    );
+    xpc_reactor_add(&loop.reactor, &ep->conn, test_close_fn);
+    // take the connection's first events, then have the timer become ready
+    // ahead of it.
+    xpc_reactor_run_once(&loop.reactor, 0);
+    usleep(10 * 1000);
+    if(write(fds[1], "x", 1) != 1) {
+        printf("write failed\n");
+    }
+    doomed = ep;
+    int events = xpc_reactor_run_once(&loop.reactor, 0);
+    size_t touched = 0;
+    for(size_t i = 0; i < sizeof(*ep); i++) {
+        touched += ((unsigned char*)ep)[i] != 0xa5;
+    }
+    printf("%i events, %zu connections left, %zu bytes touched after free\n",
+        events, loop.reactor.count, touched);
+    close(fds[1]);
+    xpc_reactor_destroy(&loop.reactor);
+    free(ep);
+    return events != 2 || loop.reactor.count != 0 || touched != 0;
+}
+
+
+int main(void) {
+    int failures = 0;
+    // two descriptors per pair, as many pairs as the descriptor limit allows
+    size_t pairs = 2000;
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+        if(limit.rlim_cur < 2 * pairs + 64) {
+            pairs = (limit.rlim_cur - 64) / 2;
+        }
+    }
+    printf("***TESTING TICKS\n");
+    failures += test_ticks();
+    printf("***TESTING DEADLINES\n");
+    failures += test_deadline();
+    printf("***TESTING REMOVAL WITHIN A BATCH\n");
+    failures += test_remove_in_batch();
+    printf("***TESTING ONE PAIR\n");
+    failures += test_pairs(1);
+    printf("***TESTING MANY PAIRS\n");
+    failures += test_pairs(pairs);
+    printf("%i failures\n", failures);
+    return failures != 0;
+}
@@ -3,14 +3,24 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
 #include <tinyxpc/xpc_relay.h>
+#include <tinyxpc/xpc_crc.h>
 #include <crc.h>
 
 
 typedef struct {
     int read_fd, write_fd;
     int read_offset, write_offset;
+    int writev_calls;
+    int write_calls;
+    // bytes test_budget_write_wrapper may still write
+    size_t write_budget;
     char read_buf[255];
+    // read buffer used as a FIFO when payloads are leased
+    int fifo_head, fifo_tail, fifo_frame;
+    char fifo[255];
 } test_io_ctx_t;
 
 int test_read_wrapper(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
@@ -35,9 +45,45 @@ int test_read_wrapper(void *io_ctx, char **buffer, int offset, size_t bytes_max)
     return bytes > 0 ? bytes:0;
 }
 
+int test_fifo_read_wrapper(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+    test_io_ctx_t *ctx = (test_io_ctx_t*)io_ctx;
+    if(*buffer == NULL) {
+        // a new payload goes after everything still held
+        ctx->fifo_frame = ctx->fifo_tail;
+        *buffer = ctx->fifo + ctx->fifo_frame;
+    }
+    int bytes = read(ctx->read_fd, *buffer + offset, bytes_max);
+    if(bytes <= 0) {
+        return 0;
+    }
+    if(*buffer == ctx->fifo + ctx->fifo_frame) {
+        ctx->fifo_tail = ctx->fifo_frame + offset + bytes;
+    }
+    return bytes;
+}
+
+void test_fifo_reset_fn(void *io_ctx, int which, size_t bytes) {
+    test_io_ctx_t *ctx = (test_io_ctx_t*)io_ctx;
+    if(!which) {
+        printf("io write reset called\n");
+        return;
+    }
+    if(bytes == (size_t)-1) {
+        ctx->fifo_head = ctx->fifo_tail = 0;
+    }
+    else {
+        ctx->fifo_head += bytes;
+    }
+    printf("io read reset called, %i bytes held\n", ctx->fifo_tail - ctx->fifo_head);
+    if(ctx->fifo_head == ctx->fifo_tail) {
+        ctx->fifo_head = ctx->fifo_tail = 0;
+    }
+}
+
 int test_write_wrapper(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
     test_io_ctx_t *ctx = (test_io_ctx_t*)io_ctx;
     int bytes = write(ctx->write_fd, *buffer + offset, bytes_max);
+    ctx->write_calls++;
     if(bytes > 0) {
         ctx->write_offset += bytes;
     }
@@ -49,6 +95,33 @@ int test_write_wrapper(void *io_ctx, char **buffer, int offset, size_t bytes_max
     return bytes;
 }
 
+int test_writev_wrapper(void *io_ctx, xpc_iovec_t *iov, int iovcnt) {
+    test_io_ctx_t *ctx = (test_io_ctx_t*)io_ctx;
+    // xpc_iovec_t is laid out like struct iovec
+    int bytes = writev(ctx->write_fd, (struct iovec*)iov, iovcnt);
+    ctx->writev_calls++;
+    if(bytes > 0) {
+        ctx->write_offset += bytes;
+    }
+    else {
+        bytes = 0;
+    }
+    return bytes;
+}
+
+int test_budget_write_wrapper(void *io_ctx, char **buffer, int offset, size_t bytes_max) {
+    test_io_ctx_t *ctx = (test_io_ctx_t*)io_ctx;
+    if(bytes_max > ctx->write_budget) {
+        bytes_max = ctx->write_budget;
+    }
+    if(bytes_max == 0) {
+        return 0;
+    }
+    int bytes = test_write_wrapper(io_ctx, buffer, offset, bytes_max);
+    ctx->write_budget -= bytes;
+    return bytes;
+}
+
 void test_reset_fn(void *io_ctx, int which, size_t bytes) {
     test_io_ctx_t *ctx = (test_io_ctx_t*)io_ctx;
     // we don't handle more than one message at a time in this impl,
@@ -63,6 +136,18 @@ void test_reset_fn(void *io_ctx, int which, size_t bytes) {
     }
 }
 
+void test_quiet_reset_fn(void *io_ctx, int which, size_t bytes) {
+    test_io_ctx_t *ctx = (test_io_ctx_t*)io_ctx;
+    if(which) {
+        ctx->read_offset = 0;
+    }
+    else {
+        ctx->write_offset = 0;
+    }
+}
+
+void test_quiet_notify_fn(void *io_ctx, int which, bool enable) {
+}
 
 void test_io_notify_config(void *io_ctx, int which, bool enable) {
     printf("notify config called\n");
@@ -83,13 +168,72 @@ char *test_crc_fn(void *crc_ctx, char *buf, size_t bytes) {
 }
 
 
+uint64_t test_crc_init_fn(void *crc_ctx) {
+    return crc_init();
+}
+
+
+uint64_t test_crc_update_fn(void *crc_ctx, uint64_t crc, char *buf, size_t bytes) {
+    return crc_update(crc, buf, bytes);
+}
+
+
+void test_crc_finalize_fn(void *crc_ctx, uint64_t crc, char *out) {
+    // same bytes test_crc_fn points at
+    *(crc_t*)out = crc_finalize(crc);
+}
+
+
 void test_crc_polyn_config(void *crc_ctx, int crc_bits, char *crc_polyn) {
     printf("crc config called\n");
     return;
 }
 
 
+// messages the dispatch callbacks took, and the last payload, for the tests
+// to check
+static int test_dispatched;
+static char test_last_payload[256];
+
+static void test_dispatch_log(txpc_hdr_t *msg, char *payload) {
+    size_t bytes = msg->size < sizeof(test_last_payload) ? msg->size:0;
+    test_dispatched++;
+    memcpy(test_last_payload, payload, bytes);
+    test_last_payload[bytes] = 0;
+}
+
+/**
+ * Check what was dispatched since the last check.
+ * @param count the number of messages expected.
+ * @param payload the last one expected, or NULL for any.
+ * @return 1 if something else was dispatched, which is printed.
+ */
+static int test_check_dispatched(int count, const char *payload) {
+    int failed = test_dispatched != count
+        || (payload != NULL && strcmp(test_last_payload, payload) != 0);
+    if(failed) {
+        printf("FAILED: dispatched %i, expected %i\n", test_dispatched, count);
+    }
+    test_dispatched = 0;
+    return failed;
+}
+
+/**
+ * Print a status as "<what>: <status>", and check it.
+ * @return 1 if it is not the expected status.
+ */
+static int test_check_status(
+        const char *what, xpc_status_t status, xpc_status_t expected) {
+    printf("%s: %i\n", what, status);
+    if(status != expected) {
+        printf("FAILED: expected %i\n", expected);
+    }
+    return status != expected;
+}
+
+
 bool test_msg_dispatch_fn(void *msg_ctx, txpc_hdr_t *msg, char *payload) {
+    test_dispatch_log(msg, payload);
     printf("message dispatch called\n");
     payload[msg->size] = 0; // do not print crc at end of payload
     printf("[%i -> %i] %s", msg->from, msg->to, payload);
@@ -97,6 +241,50 @@ bool test_msg_dispatch_fn(void *msg_ctx, txpc_hdr_t *msg, char *payload) {
 }
 
 
+bool test_feed_dispatch_fn(void *msg_ctx, txpc_hdr_t *msg, char *payload) {
+    // the payload points into the fed span, leave the following bytes alone
+    test_dispatch_log(msg, payload);
+    printf("message dispatch called\n");
+    printf("[%i -> %i] %.*s", msg->from, msg->to, msg->size, payload);
+    return true;
+}
+
+
+typedef struct {
+    xpc_relay_state_t *relay;
+    xpc_lease_t *held[4];
+    int count;
+} test_lease_ctx_t;
+
+bool test_lease_dispatch_fn(void *msg_ctx, txpc_hdr_t *msg, char *payload) {
+    test_lease_ctx_t *ctx = (test_lease_ctx_t*)msg_ctx;
+    printf("message dispatch called\n");
+    xpc_lease_t *lease = xpc_relay_lease(ctx->relay);
+    if(lease == NULL) {
+        printf("no lease available, declined\n");
+        return false;
+    }
+    test_dispatch_log(msg, payload);
+    printf("leased [%i -> %i] %.*s", msg->from, msg->to, msg->size, payload);
+    ctx->held[ctx->count++] = lease;
+    return true;
+}
+
+
+uint32_t test_clock_fn(void *clock_ctx) {
+    return *(uint32_t*)clock_ctx;
+}
+
+
+// messages test_ack_fn was told were delivered
+static int test_delivered;
+
+void test_ack_fn(void *msg_ctx, txpc_hdr_t *msg, char *payload, bool delivered) {
+    test_delivered += delivered;
+    printf("ack callback: %.*s delivered: %i\n", msg->size - 1, payload, delivered);
+}
+
+
 void xpc_send_block(int fd, int type, int to, int from, char *payload, size_t bytes) {
     int bytes_written = 0;
     txpc_hdr_t hdr = {.size = bytes, .to = to, .from = from, .type = type};
@@ -445,12 +633,2016 @@ done:
     return r;
 }
 
-int main(void) {
-    printf("***TESTING WITHOUT CRC\n");
-    test_nocrc();
-    printf("***TESTING WITH CRC\n");
-    test_withcrc();
-    printf("***TESTING WITH CRC AND CONFIGURATION\n");
-    test_config_msg();
-    return 0;
+int test_writev(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    crc_ctx_t crc1, crc2;
+    xpc_tx_desc_t queue[2];
+    int failed = 0;
+    test_dispatched = 0;
+
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, &crc1,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config(
+        &uut2, &ctx2, NULL, &crc2,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    // uut1 uses vectored writes, uut2 keeps one write per segment.
+    xpc_relay_config_writev(&uut1, test_writev_wrapper);
+
+    uut1.conn_config.crc_bits = 32;
+    uut2.conn_config.crc_bits = 32;
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    // send reset
+    xpc_relay_send_reset(&uut1);
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+
+    // receive reset and reply
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+
+    // receive reply
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+    ctx1.writev_calls = 0;
+    xpc_send_msg(&uut1, 1, 1, "hello uut2!\n", 12);
+    xpc_wr_op_continue(&uut1);
+    printf("writev calls for one message: %i\n", ctx1.writev_calls);
+    failed |= ctx1.writev_calls != 1;
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    failed |= test_check_dispatched(1, "hello uut2!\n");
+
+    xpc_send_msg(&uut2, 1, 1, "hello uut1!\n", 12);
+    xpc_wr_op_continue(&uut2);
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    failed |= test_check_dispatched(1, "hello uut1!\n");
+
+    // queued messages are started and written in the same pass, their crc
+    // has to be ready by then.
+    printf("UUT1\n");
+    xpc_relay_config_tx_queue(&uut1, queue, 2);
+    xpc_send_msg(&uut1, 1, 1, "first\n", 6);
+    xpc_send_msg(&uut1, 1, 1, "second\n", 7);
+    xpc_wr_op_continue(&uut1);
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_rd_op_continue(&uut2);
+    failed |= test_check_dispatched(2, "second\n");
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+int test_feed(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    crc_ctx_t crc1, crc2;
+    char span[256];
+    size_t span_len = 0;
+    size_t consumed = 0;
+    int failed = 0;
+    test_dispatched = 0;
+
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, &crc1,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    // uut2 only receives through xpc_relay_feed
+    xpc_relay_config(
+        &uut2, &ctx2, NULL, &crc2,
+        test_write_wrapper, NULL, test_reset_fn, test_io_notify_config,
+        test_feed_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+
+    uut1.conn_config.crc_bits = 32;
+    uut2.conn_config.crc_bits = 32;
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    // send reset
+    xpc_relay_send_reset(&uut1);
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+
+    // receive reset and reply
+    printf("UUT2\n");
+    span_len = read(ctx2.read_fd, span, sizeof(span));
+    consumed = xpc_relay_feed(&uut2, span, span_len);
+    xpc_wr_op_continue(&uut2);
+    printf("fed %zu bytes, consumed %zu\n", span_len, consumed);
+    failed |= span_len != 5 || consumed != 5;
+    // an empty feed lets the rx sm see that the reply has been sent
+    xpc_relay_feed(&uut2, span, 0);
+
+    // receive reply
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    // queue up several frames in the pipe, then parse them from one read.
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+    xpc_send_msg(&uut1, 1, 1, "hello uut2!\n", 12);
+    xpc_wr_op_continue(&uut1);
+    xpc_send_msg(&uut1, 2, 1, "second message\n", 15);
+    xpc_wr_op_continue(&uut1);
+    xpc_send_msg(&uut1, 3, 1, "third message\n", 14);
+    xpc_wr_op_continue(&uut1);
+
+    printf("UUT2\n");
+    span_len = read(ctx2.read_fd, span, sizeof(span));
+    // hold back the end of the last frame, as if it had not arrived yet
+    consumed = xpc_relay_feed(&uut2, span, span_len - 3);
+    printf("fed %zu bytes, consumed %zu\n", span_len - 3, consumed);
+    // the last frame waits for the rest of it
+    failed |= test_check_dispatched(2, "second message\n") || consumed != 45;
+    consumed += xpc_relay_feed(&uut2, span + consumed, span_len - consumed);
+    printf("fed %zu bytes, consumed %zu\n", span_len, consumed);
+    failed |= test_check_dispatched(1, "third message\n") || consumed != span_len;
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+int test_tx_queue(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    xpc_tx_desc_t queue[2];
+    xpc_status_t sent[4];
+    int failed = 0;
+    test_dispatched = 0;
+
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, NULL,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config(
+        &uut2, &ctx2, NULL, NULL,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config_tx_queue(&uut1, queue, 2);
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    // send reset
+    xpc_relay_send_reset(&uut1);
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+
+    // receive reset and reply
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+
+    // receive reply
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+    // one inflight, two queued, the fourth does not fit.
+    sent[0] = xpc_send_msg(&uut1, 1, 1, "first\n", 6);
+    sent[1] = xpc_send_msg(&uut1, 1, 1, "second\n", 7);
+    sent[2] = xpc_send_msg(&uut1, 1, 1, "third\n", 6);
+    sent[3] = xpc_send_msg(&uut1, 1, 1, "fourth\n", 7);
+    for(int i = 0; i < 4; i++) {
+        printf("send status: %i\n", sent[i]);
+        failed |= sent[i] != (i < 3 ? TXPC_STATUS_DONE:TXPC_STATUS_INFLIGHT);
+    }
+    // all three go out within one writable notification
+    xpc_wr_op_continue(&uut1);
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_rd_op_continue(&uut2);
+    xpc_rd_op_continue(&uut2);
+    failed |= test_check_dispatched(3, "third\n");
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+int test_ack_window(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    crc_ctx_t crc1, crc2;
+    xpc_tx_desc_t queue[4];
+    xpc_ack_slot_t window[2];
+    uint32_t now = 0;
+    char lost[64];
+    ssize_t dropped = 0;
+    int failed = 0;
+    test_dispatched = 0;
+    test_delivered = 0;
+
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, &crc1,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config(
+        &uut2, &ctx2, NULL, &crc2,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config_tx_queue(&uut1, queue, 4);
+    xpc_relay_config_ack(&uut1, window, 2, test_clock_fn, &now, 100, test_ack_fn);
+
+    // force relays to use crc and acks without requiring full config msg.
+    uut1.conn_config.crc_bits = 32;
+    uut2.conn_config.crc_bits = 32;
+    uut1.conn_config.flags = CONFIG_FLAGS_REQ_ACK;
+    uut2.conn_config.flags = CONFIG_FLAGS_REQ_ACK;
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    // send reset
+    xpc_relay_send_reset(&uut1);
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+
+    // receive reset and reply
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+
+    // receive reply
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+    // the window holds two, the third waits in the queue for an ack.
+    xpc_send_msg(&uut1, 1, 1, "first\n", 6);
+    xpc_send_msg(&uut1, 1, 1, "second\n", 7);
+    xpc_send_msg(&uut1, 1, 1, "third\n", 6);
+    xpc_wr_op_continue(&uut1);
+    printf("unacknowledged: %zu queued: %zu\n", uut1.ack.count, uut1.tx_queue.count);
+    failed |= uut1.ack.count != 2 || uut1.tx_queue.count != 1;
+
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    failed |= test_check_dispatched(2, "second\n");
+
+    // the ack frees the window, and the third message goes out.
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    xpc_wr_op_continue(&uut1);
+    printf("unacknowledged: %zu queued: %zu\n", uut1.ack.count, uut1.tx_queue.count);
+    failed |= uut1.ack.count != 1 || uut1.tx_queue.count != 0 || test_delivered != 2;
+
+    // lose the third message on the way
+    printf("UUT2\n");
+    dropped = read(ctx2.read_fd, lost, sizeof(lost));
+    printf("dropped %zi bytes\n", dropped);
+    // header, payload, sequence number and CRC
+    failed |= dropped != sizeof(txpc_hdr_t) + 6 + 1 + 4;
+
+    // nothing happens until the retransmission timeout
+    printf("UUT1\n");
+    now += 50;
+    xpc_wr_op_continue(&uut1);
+    printf("unacknowledged: %zu\n", uut1.ack.count);
+    failed |= uut1.ack.count != 1;
+    now += 50;
+    xpc_wr_op_continue(&uut1);
+
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    printf("unacknowledged: %zu\n", uut1.ack.count);
+    failed |= test_check_dispatched(1, "third\n") || uut1.ack.count != 0
+        || test_delivered != 3;
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+/**
+ * With CRCs on, the CRC covers the sequence number of a message and the
+ * payload of an ACK, so either damaged on the way is dropped instead of
+ * being taken for another message or acknowledging one never received.
+ */
+int test_ack_damaged(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    crc_ctx_t crc1, crc2;
+    xpc_ack_slot_t window[2];
+    uint32_t now = 0;
+    char frame[64];
+    ssize_t bytes = 0;
+    int failed = 0;
+    test_dispatched = 0;
+    test_delivered = 0;
+
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, &crc1,
+        test_write_wrapper, test_read_wrapper, test_quiet_reset_fn,
+        test_quiet_notify_fn, test_msg_dispatch_fn, test_crc_fn,
+        test_crc_polyn_config
+    );
+    xpc_relay_config(
+        &uut2, &ctx2, NULL, &crc2,
+        test_write_wrapper, test_read_wrapper, test_quiet_reset_fn,
+        test_quiet_notify_fn, test_msg_dispatch_fn, test_crc_fn,
+        test_crc_polyn_config
+    );
+    xpc_relay_config_ack(&uut1, window, 2, test_clock_fn, &now, 100, test_ack_fn);
+    uut1.conn_config.crc_bits = 32;
+    uut2.conn_config.crc_bits = 32;
+    uut1.conn_config.flags = CONFIG_FLAGS_REQ_ACK;
+    uut2.conn_config.flags = CONFIG_FLAGS_REQ_ACK;
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+    // a dropped frame has the relay go on to read the next one
+    fcntl(fd_set1[0], F_SETFL, O_NONBLOCK);
+    fcntl(fd_set2[0], F_SETFL, O_NONBLOCK);
+
+    xpc_relay_send_reset(&uut1);
+    xpc_wr_op_continue(&uut1);
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    xpc_rd_op_continue(&uut1);
+    xpc_wr_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    // the sequence number is damaged: dropped, and the loss NACKed
+    xpc_send_msg(&uut1, 1, 1, "first\n", 6);
+    xpc_wr_op_continue(&uut1);
+    bytes = read(ctx2.read_fd, frame, sizeof(frame));
+    frame[sizeof(txpc_hdr_t) + 6] ^= 0x01;
+    r = write(fd_set1[1], frame, bytes);
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    printf("expecting %i, nack owed %i\n", uut2.ack.rx_next,
+        !!(uut2.signals & SIG_NACK_RECVD));
+    failed |= test_check_dispatched(0, NULL) || uut2.ack.rx_next != 0
+        || !(uut2.signals & SIG_NACK_RECVD);
+    xpc_wr_op_continue(&uut2);
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    xpc_wr_op_continue(&uut1);
+
+    // the ACK for it is damaged: dropped, and the message stays unacknowledged
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    bytes = read(ctx1.read_fd, frame, sizeof(frame));
+    frame[sizeof(txpc_hdr_t) + 1] ^= 0x10;
+    r = write(fd_set2[1], frame, bytes);
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    printf("unacknowledged: %zu\n", uut1.ack.count);
+    failed |= test_check_dispatched(1, "first\n") || uut1.ack.count != 1
+        || test_delivered != 0;
+
+    // the resend is a duplicate, whose ACK gets through
+    now += 100;
+    xpc_wr_op_continue(&uut1);
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    printf("unacknowledged: %zu\n", uut1.ack.count);
+    // the duplicate is not dispatched again
+    failed |= test_check_dispatched(0, NULL) || uut1.ack.count != 0
+        || test_delivered != 1;
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+int test_crc_incremental(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    crc_ctx_t crc1, crc2;
+    xpc_tx_desc_t queue[2];
+    int failed = 0;
+    test_dispatched = 0;
+
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, &crc1,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config(
+        &uut2, &ctx2, NULL, &crc2,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    // uut1 folds the crc in as it goes, uut2 checks it in one pass.
+    xpc_relay_config_crc_incremental(
+        &uut1, test_crc_init_fn, test_crc_update_fn, test_crc_finalize_fn
+    );
+
+    uut1.conn_config.crc_bits = 32;
+    uut2.conn_config.crc_bits = 32;
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    // send reset
+    xpc_relay_send_reset(&uut1);
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+
+    // receive reset and reply
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+
+    // receive reply
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+    xpc_send_msg(&uut1, 1, 1, "hello uut2!\n", 12);
+    xpc_wr_op_continue(&uut1);
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    failed |= test_check_dispatched(1, "hello uut2!\n");
+
+    xpc_send_msg(&uut2, 1, 1, "hello uut1!\n", 12);
+    xpc_wr_op_continue(&uut2);
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    failed |= test_check_dispatched(1, "hello uut1!\n");
+
+    // a queued message gets its header written in the pass that starts it,
+    // the crc must be started before that.
+    printf("UUT1\n");
+    xpc_relay_config_tx_queue(&uut1, queue, 2);
+    xpc_send_msg(&uut1, 1, 1, "first\n", 6);
+    xpc_send_msg(&uut1, 1, 1, "second\n", 7);
+    xpc_wr_op_continue(&uut1);
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_rd_op_continue(&uut2);
+    failed |= test_check_dispatched(2, "second\n");
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+int test_crc_engine_config(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    xpc_crc_ctx_t crc1, crc2;
+    int failed = 0;
+    test_dispatched = 0;
+    xpc_crc_setup(&crc1, xpc_crc_preset(XPC_CRC_16_IBM_3740));
+    xpc_crc_setup(&crc2, xpc_crc_preset(XPC_CRC_16_IBM_3740));
+
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, &crc1,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, xpc_crc_fn, xpc_crc_polyn_config
+    );
+    xpc_relay_config(
+        &uut2, &ctx2, NULL, &crc2,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, xpc_crc_fn, xpc_crc_polyn_config
+    );
+    // uut2 checks with the incremental interface
+    xpc_relay_config_crc_incremental(
+        &uut2, xpc_crc_init, xpc_crc_update, xpc_crc_finalize
+    );
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    // send reset
+    xpc_relay_send_reset(&uut1);
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+
+    // receive reset and reply
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+
+    // receive reply
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+
+    // a 12 bit crc takes two bytes on the wire
+    char crc_polyn[] = {'\x08', '\x0f'};
+    xpc_relay_send_config(&uut1, 12, crc_polyn, 0);
+    xpc_wr_op_continue(&uut1);
+
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    printf("crc width %i polyn %llx\n",
+        crc2.params.width, (unsigned long long)crc2.params.polyn);
+    failed |= crc2.params.width != 12 || crc2.params.polyn != 0x80f;
+
+    printf("UUT1\n");
+    xpc_send_msg(&uut1, 1, 1, "hello uut2!\n", 12);
+    xpc_wr_op_continue(&uut1);
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    failed |= test_check_dispatched(1, "hello uut2!\n");
+
+    xpc_send_msg(&uut2, 1, 1, "hello uut1!\n", 12);
+    xpc_wr_op_continue(&uut2);
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    failed |= test_check_dispatched(1, "hello uut1!\n");
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+int test_lease(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    xpc_lease_t leases[2];
+    test_lease_ctx_t lease_ctx = {.relay = &uut2};
+    int failed = 0;
+    test_dispatched = 0;
+
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, NULL,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    // uut2 holds on to payloads, reading them into a FIFO
+    xpc_relay_config(
+        &uut2, &ctx2, &lease_ctx, NULL,
+        test_write_wrapper, test_fifo_read_wrapper, test_fifo_reset_fn, test_io_notify_config,
+        test_lease_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config_leases(&uut2, leases, 2);
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    // send reset
+    xpc_relay_send_reset(&uut1);
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+
+    // receive reset and reply
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+
+    // receive reply
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+    xpc_send_msg(&uut1, 1, 1, "first\n", 6);
+    xpc_wr_op_continue(&uut1);
+    xpc_send_msg(&uut1, 2, 1, "second\n", 7);
+    xpc_wr_op_continue(&uut1);
+    xpc_send_msg(&uut1, 3, 1, "third\n", 6);
+    xpc_wr_op_continue(&uut1);
+
+    // the first two are leased, the third has to wait for a free lease
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_rd_op_continue(&uut2);
+    xpc_rd_op_continue(&uut2);
+    printf("held: %.*s", lease_ctx.held[0]->msg_hdr.size, lease_ctx.held[0]->payload);
+    failed |= test_check_dispatched(2, "second\n") || lease_ctx.count != 2
+        || memcmp(lease_ctx.held[0]->payload, "first\n", 6) != 0;
+
+    // released out of order: nothing is reclaimed until the oldest goes
+    printf("release second\n");
+    failed |= xpc_relay_release(&uut2, lease_ctx.held[1]) != TXPC_STATUS_DONE;
+    failed |= test_check_status(
+        "release second again", xpc_relay_release(&uut2, lease_ctx.held[1]),
+        TXPC_STATUS_BAD_STATE
+    );
+    printf("release first\n");
+    failed |= xpc_relay_release(&uut2, lease_ctx.held[0]) != TXPC_STATUS_DONE;
+
+    xpc_rd_op_continue(&uut2);
+    failed |= test_check_dispatched(1, "third\n");
+    printf("release third\n");
+    failed |= xpc_relay_release(&uut2, lease_ctx.held[2]) != TXPC_STATUS_DONE;
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+int test_flow(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    xpc_tx_desc_t queue1[2];
+    xpc_tx_desc_t queue2[2];
+    xpc_lease_t leases[2];
+    test_lease_ctx_t lease_ctx = {.relay = &uut2};
+    xpc_relay_state_t *flow = NULL;
+    int failed = 0;
+    test_dispatched = 0;
+
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, NULL,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    // uut2 holds on to payloads, and holds uut1 off once two are held
+    xpc_relay_config(
+        &uut2, &ctx2, &lease_ctx, NULL,
+        test_write_wrapper, test_fifo_read_wrapper, test_fifo_reset_fn, test_io_notify_config,
+        test_lease_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config_tx_queue(&uut1, queue1, 2);
+    xpc_relay_config_tx_queue(&uut2, queue2, 2);
+    xpc_relay_config_leases(&uut2, leases, 2);
+    flow = xpc_relay_config_flow(&uut2, 2, 2);
+    printf("bad watermarks: %p\n", (void*)flow);
+    failed |= flow != NULL;
+    xpc_relay_config_flow(&uut2, 2, 0);
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    // send reset
+    xpc_relay_send_reset(&uut1);
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+
+    // receive reset and reply
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+
+    // receive reply
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    xpc_wr_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    // held off by hand: the message waits in the queue
+    printf("UUT2 XOFF\n");
+    xpc_relay_set_flow(&uut2, false);
+    xpc_wr_op_continue(&uut2);
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    failed |= test_check_status(
+        "send status", xpc_send_msg(&uut1, 1, 1, "first\n", 6), TXPC_STATUS_DONE
+    );
+    failed |= test_check_status(
+        "continue status", xpc_wr_op_continue(&uut1), TXPC_STATUS_INHIBIT
+    );
+    failed |= test_check_status(
+        "send status", xpc_send_msg(&uut1, 1, 1, "second\n", 7), TXPC_STATUS_DONE
+    );
+    failed |= test_check_status(
+        "send status", xpc_send_msg(&uut1, 1, 1, "third\n", 6), TXPC_STATUS_INHIBIT
+    );
+    printf("UUT2 XON\n");
+    xpc_relay_set_flow(&uut2, true);
+    xpc_wr_op_continue(&uut2);
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    failed |= test_check_status(
+        "continue status", xpc_wr_op_continue(&uut1), TXPC_STATUS_DONE
+    );
+
+    // the second lease reaches the high watermark
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    failed |= test_check_dispatched(2, "second\n");
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    failed |= test_check_status(
+        "send status", xpc_send_msg(&uut1, 1, 1, "fourth\n", 7), TXPC_STATUS_DONE
+    );
+    failed |= test_check_status(
+        "continue status", xpc_wr_op_continue(&uut1), TXPC_STATUS_INHIBIT
+    );
+
+    // back down to the low watermark
+    printf("release all\n");
+    xpc_relay_release(&uut2, lease_ctx.held[0]);
+    xpc_relay_release(&uut2, lease_ctx.held[1]);
+    lease_ctx.count = 0;
+    xpc_wr_op_continue(&uut2);
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    failed |= test_check_status(
+        "continue status", xpc_wr_op_continue(&uut1), TXPC_STATUS_DONE
+    );
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    failed |= test_check_dispatched(1, "fourth\n");
+    xpc_relay_release(&uut2, lease_ctx.held[0]);
+
+    // XOFF goes out ahead of queued messages
+    printf("UUT2\n");
+    xpc_send_msg(&uut2, 1, 2, "reply one\n", 10);
+    xpc_send_msg(&uut2, 1, 2, "reply two\n", 10);
+    xpc_send_msg(&uut2, 1, 2, "reply three\n", 12);
+    xpc_relay_set_flow(&uut2, false);
+    xpc_wr_op_continue(&uut2);
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    xpc_rd_op_continue(&uut1);
+    failed |= test_check_status(
+        "send status", xpc_send_msg(&uut1, 1, 1, "fifth\n", 6), TXPC_STATUS_DONE
+    );
+    failed |= test_check_status(
+        "continue status", xpc_wr_op_continue(&uut1), TXPC_STATUS_INHIBIT
+    );
+    xpc_rd_op_continue(&uut1);
+    xpc_rd_op_continue(&uut1);
+    failed |= test_check_dispatched(3, "reply three\n");
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+int test_msgv(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    crc_ctx_t crc1, crc2;
+    char app_hdr[] = "[app] ";
+    char body[] = "scattered ";
+    char trailer[] = "payload\n";
+    xpc_iovec_t iov[] = {
+        {app_hdr, 6}, {body, 0}, {body, 10}, {trailer, 8}
+    };
+    xpc_iovec_t too_many[XPC_MSG_MAX_IOV + 1] = {{0}};
+    char polyn[XPC_CRC_BYTES(128)] = {0};
+    xpc_tx_desc_t queue[2];
+    int failed = 0;
+    test_dispatched = 0;
+
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, &crc1,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config(
+        &uut2, &ctx2, NULL, &crc2,
+        test_write_wrapper, test_read_wrapper, test_reset_fn, test_io_notify_config,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    // uut1 computes the crc across the segments, uut2 checks it in one pass
+    // over the contiguous payload it received.
+    xpc_relay_config_crc_incremental(
+        &uut1, test_crc_init_fn, test_crc_update_fn, test_crc_finalize_fn
+    );
+
+    uut1.conn_config.crc_bits = 32;
+    uut2.conn_config.crc_bits = 32;
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    // send reset
+    xpc_relay_send_reset(&uut1);
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+
+    // receive reset and reply
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+
+    // receive reply
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    // one write per segment
+    printf("UUT1\n");
+    xpc_wr_op_continue(&uut1);
+    failed |= test_check_status(
+        "send status", xpc_send_msgv(&uut1, 1, 1, iov, 4), TXPC_STATUS_DONE
+    );
+    xpc_wr_op_continue(&uut1);
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    failed |= test_check_dispatched(1, "[app] scattered payload\n");
+
+    // all segments in a single vectored write
+    printf("UUT1\n");
+    xpc_relay_config_writev(&uut1, test_writev_wrapper);
+    ctx1.writev_calls = 0;
+    xpc_send_msgv(&uut1, 1, 1, iov, 4);
+    xpc_wr_op_continue(&uut1);
+    printf("writev calls for one message: %i\n", ctx1.writev_calls);
+    failed |= ctx1.writev_calls != 1;
+    printf("UUT2\n");
+    xpc_rd_op_continue(&uut2);
+    failed |= test_check_dispatched(1, "[app] scattered payload\n");
+
+    failed |= test_check_status(
+        "too many segments",
+        xpc_send_msgv(&uut1, 1, 1, too_many, XPC_MSG_MAX_IOV + 1),
+        TXPC_STATUS_BAD_STATE
+    );
+    // uut2 only has crc_fn, which takes a single segment
+    failed |= test_check_status(
+        "scattered without incremental crc",
+        xpc_send_msgv(&uut2, 1, 1, iov, 4), TXPC_STATUS_BAD_STATE
+    );
+    printf("UUT2\n");
+    failed |= test_check_status(
+        "single segment without incremental crc",
+        xpc_send_msgv(&uut2, 1, 1, iov + 2, 1), TXPC_STATUS_DONE
+    );
+    xpc_wr_op_continue(&uut2);
+    printf("UUT1\n");
+    xpc_rd_op_continue(&uut1);
+    failed |= test_check_dispatched(1, "scattered ");
+    // CRCs could still be turned on before it is written
+    uut2.conn_config.crc_bits = 0;
+    failed |= test_check_status(
+        "scattered with crcs off, without incremental crc",
+        xpc_send_msgv(&uut2, 1, 1, iov, 4), TXPC_STATUS_BAD_STATE
+    );
+    uut2.conn_config.crc_bits = 32;
+
+    // nor can a pending scattered message have a CRC over 64 bits
+    printf("UUT1\n");
+    xpc_relay_config_writev(&uut1, NULL);
+    xpc_relay_config_tx_queue(&uut1, queue, 2);
+    xpc_send_msgv(&uut1, 1, 1, iov, 4);
+    failed |= test_check_status(
+        "wide crc sent while scattered",
+        xpc_relay_send_config(&uut1, 128, polyn, false), TXPC_STATUS_BAD_STATE
+    );
+    txpc_hdr_t config = {
+        .type = TXPC_MSG_TYPE_CONFIG, .size = 1 + 1 + XPC_CRC_BYTES(128)
+    };
+    char frame[sizeof(txpc_hdr_t) + 1 + 1 + XPC_CRC_BYTES(128)] = {0};
+    memcpy(frame, &config, sizeof(txpc_hdr_t));
+    frame[sizeof(txpc_hdr_t) + 1] = (char)128;
+    r = write(fd_set2[1], frame, sizeof(frame));
+    xpc_rd_op_continue(&uut1);
+    // the reset goes out after the message
+    xpc_wr_op_continue(&uut1);
+    printf("wide crc received while scattered: bits %i, reset %i\n",
+        uut1.conn_config.crc_bits, !!(uut1.signals & SIG_RST_SEND));
+    failed |= uut1.conn_config.crc_bits != 32 || !(uut1.signals & SIG_RST_SEND);
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+#define STREAM_BYTES 100000
+static char stream_data[STREAM_BYTES];
+
+typedef struct {
+    // chunks are only handed out one per xpc_wr_op_continue
+    bool ready;
+    int done;
+    int completed;
+    // receiving side
+    uint64_t received;
+    int chunks;
+    int bad;
+    int ended;
+    int lost;
+} test_stream_ctx_t;
+
+size_t test_stream_pull(void *stream_ctx, uint64_t offset, char **chunk, size_t bytes_max) {
+    test_stream_ctx_t *ctx = (test_stream_ctx_t*)stream_ctx;
+    if(!ctx->ready) {
+        return 0;
+    }
+    ctx->ready = false;
+    *chunk = stream_data + offset;
+    return bytes_max;
+}
+
+void test_stream_done(void *stream_ctx, bool completed) {
+    test_stream_ctx_t *ctx = (test_stream_ctx_t*)stream_ctx;
+    ctx->done++;
+    ctx->completed = completed;
+    printf("stream done, completed: %i\n", completed);
+}
+
+bool test_stream_chunk(void *msg_ctx, txpc_hdr_t *msg, char *chunk) {
+    test_stream_ctx_t *ctx = (test_stream_ctx_t*)msg_ctx;
+    if(chunk == NULL) {
+        ctx->lost++;
+        printf("chunks lost before a frame of %i bytes\n", msg->size);
+        return true;
+    }
+    if(msg->size == 0) {
+        ctx->ended++;
+        printf("stream end after %i chunks, %llu bytes\n",
+            ctx->chunks, (unsigned long long)ctx->received);
+        return true;
+    }
+    if(ctx->received + msg->size > STREAM_BYTES
+            || memcmp(chunk, stream_data + ctx->received, msg->size) != 0) {
+        ctx->bad++;
+    }
+    ctx->received += msg->size;
+    ctx->chunks++;
+    return true;
+}
+
+int test_stream(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    crc_ctx_t crc1, crc2;
+    xpc_tx_desc_t queue[2];
+    test_stream_ctx_t tx = {0};
+    test_stream_ctx_t rx = {0};
+    char frame[512];
+    ssize_t bytes = 0;
+    int failed = 0;
+    test_dispatched = 0;
+
+    for(size_t i = 0; i < STREAM_BYTES; i++) {
+        stream_data[i] = (i * 7 + i / 251) & 0xff;
+    }
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, &crc1,
+        test_write_wrapper, test_read_wrapper, test_quiet_reset_fn, test_quiet_notify_fn,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config(
+        &uut2, &ctx2, &rx, &crc2,
+        test_write_wrapper, test_read_wrapper, test_quiet_reset_fn, test_quiet_notify_fn,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config_tx_queue(&uut1, queue, 2);
+    xpc_relay_config_stream(&uut2, test_stream_chunk);
+    uut1.conn_config.crc_bits = 32;
+    uut2.conn_config.crc_bits = 32;
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    // send reset
+    xpc_relay_send_reset(&uut1);
+    xpc_wr_op_continue(&uut1);
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    xpc_rd_op_continue(&uut1);
+    xpc_wr_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    failed |= test_check_status("bad chunk size", xpc_relay_send_stream(
+        &uut1, 1, 1, STREAM_BYTES, 0x10000, test_stream_pull, test_stream_done, &tx
+    ), TXPC_STATUS_BAD_STATE);
+    failed |= test_check_status("send status", xpc_relay_send_stream(
+        &uut1, 1, 1, STREAM_BYTES, 200, test_stream_pull, test_stream_done, &tx
+    ), TXPC_STATUS_DONE);
+    failed |= test_check_status("second stream", xpc_relay_send_stream(
+        &uut1, 1, 1, STREAM_BYTES, 200, test_stream_pull, test_stream_done, &tx
+    ), TXPC_STATUS_INFLIGHT);
+    // more than a uint16_t of payload, with a message part way through
+    bool mid_sent = false;
+    while(!tx.done) {
+        tx.ready = true;
+        bool mid = !mid_sent && rx.chunks == 250;
+        if(mid) {
+            xpc_send_msg(&uut1, 1, 1, "mid-stream\n", 11);
+            mid_sent = true;
+        }
+        xpc_wr_op_continue(&uut1);
+        xpc_rd_op_continue(&uut2);
+        if(mid) {
+            xpc_rd_op_continue(&uut2);
+        }
+    }
+    // end frame
+    xpc_rd_op_continue(&uut2);
+    printf("chunks intact: %i, ended: %i\n", !rx.bad, rx.ended);
+    failed |= rx.bad || rx.ended != 1 || rx.chunks != 500
+        || rx.received != STREAM_BYTES || test_check_dispatched(1, "mid-stream\n");
+
+    // an empty stream is just the end frame
+    rx = (test_stream_ctx_t){0};
+    xpc_relay_send_stream(&uut1, 1, 1, 0, 200, test_stream_pull, test_stream_done, &tx);
+    xpc_wr_op_continue(&uut1);
+    xpc_rd_op_continue(&uut2);
+    failed |= rx.ended != 1 || rx.chunks != 0;
+
+    // a reset abandons the stream part way
+    tx.ready = true;
+    xpc_relay_send_stream(&uut1, 1, 1, STREAM_BYTES, 200, test_stream_pull, test_stream_done, &tx);
+    xpc_wr_op_continue(&uut1);
+    xpc_relay_send_reset(&uut1);
+    xpc_wr_op_continue(&uut1);
+    xpc_rd_op_continue(&uut2);
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    xpc_rd_op_continue(&uut1);
+    printf("streams done: %i\n", tx.done);
+    failed |= tx.done != 3 || tx.completed;
+    failed |= test_check_status(
+        "ready without a stream", xpc_relay_stream_ready(&uut1),
+        TXPC_STATUS_BAD_STATE
+    );
+
+    // a damaged chunk is dropped, and reported lost once the frame after it
+    // arrives
+    fcntl(fd_set1[0], F_SETFL, O_NONBLOCK);
+    rx = (test_stream_ctx_t){0};
+    xpc_relay_send_stream(&uut1, 1, 1, 400, 200, test_stream_pull, test_stream_done, &tx);
+    failed |= test_check_status(
+        "ready", xpc_relay_stream_ready(&uut1), TXPC_STATUS_DONE
+    );
+    for(int i = 0; i < 3; i++) {
+        tx.ready = true;
+        xpc_wr_op_continue(&uut1);
+        if(i == 1) {
+            bytes = read(ctx2.read_fd, frame, sizeof(frame));
+            frame[sizeof(txpc_hdr_t) + 10] ^= 0x01;
+            r = write(fd_set1[1], frame, bytes);
+        }
+        xpc_rd_op_continue(&uut2);
+    }
+    printf("chunks: %i, lost: %i, ended: %i, intact: %i\n",
+        rx.chunks, rx.lost, rx.ended, !rx.bad);
+    failed |= rx.chunks != 1 || rx.lost != 1 || rx.ended != 1 || rx.bad;
+    // the next stream starts over
+    xpc_relay_send_stream(&uut1, 1, 1, 0, 200, test_stream_pull, test_stream_done, &tx);
+    xpc_wr_op_continue(&uut1);
+    xpc_rd_op_continue(&uut2);
+    printf("lost: %i, ended: %i\n", rx.lost, rx.ended);
+    failed |= rx.lost != 1 || rx.ended != 2;
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+int test_coalesce(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    crc_ctx_t crc1, crc2;
+    xpc_tx_desc_t queue[8];
+    char staging[64];
+    char payloads[8][4];
+    uint32_t now = 0;
+    xpc_ack_slot_t window[2];
+    test_stream_ctx_t tx = {0};
+    xpc_relay_state_t *coalesce = NULL;
+    int failed = 0;
+    test_dispatched = 0;
+
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, &crc1,
+        test_write_wrapper, test_read_wrapper, test_quiet_reset_fn, test_quiet_notify_fn,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config(
+        &uut2, &ctx2, NULL, &crc2,
+        test_write_wrapper, test_read_wrapper, test_quiet_reset_fn, test_quiet_notify_fn,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config_tx_queue(&uut1, queue, 8);
+    coalesce = xpc_relay_config_coalesce(
+        &uut1, staging, sizeof(staging), NULL, NULL, 10
+    );
+    printf("deadline without clock: %s\n", coalesce ? "accepted":"rejected");
+    failed |= coalesce != NULL;
+    xpc_relay_config_coalesce(
+        &uut1, staging, sizeof(staging), test_clock_fn, &now, 10
+    );
+    uut1.conn_config.crc_bits = 32;
+    uut2.conn_config.crc_bits = 32;
+    for(int i = 0; i < 8; i++) {
+        payloads[i][0] = 'm';
+        payloads[i][1] = '0' + i;
+        payloads[i][2] = '\n';
+    }
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    // the reset is not held back
+    xpc_relay_send_reset(&uut1);
+    xpc_wr_op_continue(&uut1);
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    xpc_rd_op_continue(&uut1);
+    xpc_wr_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    // five 12 byte frames wait for the deadline
+    ctx1.write_calls = 0;
+    for(int i = 0; i < 5; i++) {
+        xpc_send_msg(&uut1, 1, 1, payloads[i], 3);
+    }
+    xpc_wr_op_continue(&uut1);
+    printf("staged %zu bytes in %i writes\n", uut1.coalesce.fill, ctx1.write_calls);
+    failed |= uut1.coalesce.fill != 60 || ctx1.write_calls != 0;
+    now += 9;
+    xpc_wr_op_continue(&uut1);
+    printf("before the deadline: %i writes\n", ctx1.write_calls);
+    failed |= ctx1.write_calls != 0;
+    now += 1;
+    xpc_wr_op_continue(&uut1);
+    printf("at the deadline: %i writes\n", ctx1.write_calls);
+    failed |= ctx1.write_calls != 1;
+    for(int i = 0; i < 5; i++) {
+        xpc_rd_op_continue(&uut2);
+    }
+    failed |= test_check_dispatched(5, "m4\n");
+
+    // eight do not fit, the buffer is written when full and the rest flushed
+    ctx1.write_calls = 0;
+    for(int i = 0; i < 8; i++) {
+        xpc_send_msg(&uut1, 1, 1, payloads[i], 3);
+    }
+    xpc_wr_op_continue(&uut1);
+    printf("filled the buffer: %i writes, %zu bytes staged\n",
+        ctx1.write_calls, uut1.coalesce.fill);
+    failed |= ctx1.write_calls != 1 || uut1.coalesce.fill != 32;
+    failed |= test_check_status("flush", xpc_relay_flush(&uut1), TXPC_STATUS_DONE);
+    printf("after flush: %i writes, %zu bytes staged\n",
+        ctx1.write_calls, uut1.coalesce.fill);
+    failed |= ctx1.write_calls != 2 || uut1.coalesce.fill != 0;
+    for(int i = 0; i < 8; i++) {
+        xpc_rd_op_continue(&uut2);
+    }
+    failed |= test_check_dispatched(8, "m7\n");
+
+    // without a deadline, each call writes what it staged
+    xpc_relay_config_coalesce(&uut1, staging, sizeof(staging), NULL, NULL, 0);
+    ctx1.write_calls = 0;
+    for(int i = 0; i < 3; i++) {
+        xpc_send_msg(&uut1, 1, 1, payloads[i], 3);
+    }
+    xpc_wr_op_continue(&uut1);
+    printf("three messages in %i writes\n", ctx1.write_calls);
+    failed |= ctx1.write_calls != 1;
+    for(int i = 0; i < 3; i++) {
+        xpc_rd_op_continue(&uut2);
+    }
+    failed |= test_check_dispatched(3, "m2\n");
+
+    // the retransmission timeout and the end of a stream wait for the write
+    xpc_relay_config_coalesce(
+        &uut1, staging, sizeof(staging), test_clock_fn, &now, 10
+    );
+    xpc_relay_config_ack(&uut1, window, 2, test_clock_fn, &now, 100, test_ack_fn);
+    uut1.conn_config.flags = CONFIG_FLAGS_REQ_ACK;
+    uut2.conn_config.flags = CONFIG_FLAGS_REQ_ACK;
+    xpc_send_msg(&uut1, 1, 1, payloads[0], 3);
+    xpc_relay_send_stream(&uut1, 1, 1, 0, 200, test_stream_pull, test_stream_done, &tx);
+    xpc_wr_op_continue(&uut1);
+    printf("staged: sent %i, stream done %i\n",
+        window[0].state == XPC_ACK_SLOT_SENT, tx.done);
+    failed |= window[0].state == XPC_ACK_SLOT_SENT || tx.done != 0;
+    now += 10;
+    xpc_wr_op_continue(&uut1);
+    printf("written: sent %i at %u, stream done %i\n",
+        window[0].state == XPC_ACK_SLOT_SENT, window[0].sent_at, tx.done);
+    failed |= window[0].state != XPC_ACK_SLOT_SENT || window[0].sent_at != 20
+        || tx.done != 1;
+    xpc_rd_op_continue(&uut2);
+    xpc_rd_op_continue(&uut2);
+    failed |= test_check_dispatched(1, "m0\n");
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+#define CHANNEL_BULK 640
+#define CHANNEL_FRAG 64
+
+typedef struct {
+    // frames read so far
+    int frames;
+    // payloads sent, by from address
+    char *sent[3];
+    // messages dispatched, those not matching what was sent, and the frames
+    // read when each address last had one dispatched
+    int dispatched;
+    int bad;
+    int frames_at[3];
+} test_channel_ctx_t;
+
+bool test_channel_dispatch_fn(void *msg_ctx, txpc_hdr_t *msg, char *payload) {
+    test_channel_ctx_t *ctx = (test_channel_ctx_t*)msg_ctx;
+    ctx->dispatched++;
+    ctx->bad += msg->size != (msg->from ? CHANNEL_BULK:4)
+        || memcmp(payload, ctx->sent[msg->from], msg->size) != 0;
+    ctx->frames_at[msg->from] = ctx->frames;
+    printf("[%i -> %i] %i bytes after %i frames, intact: %i\n",
+        msg->from, msg->to, msg->size, ctx->frames,
+        !memcmp(payload, ctx->sent[msg->from], msg->size));
+    return true;
+}
+
+static void test_channel_read(xpc_relay_state_t *relay, test_channel_ctx_t *ctx, int frames) {
+    for(int i = 0; i < frames; i++) {
+        xpc_rd_op_continue(relay);
+        ctx->frames++;
+    }
+}
+
+int test_channels(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    crc_ctx_t crc1, crc2;
+    xpc_tx_desc_t queue[2];
+    xpc_channel_t chans1[3], chans2[3], scratch;
+    xpc_tx_desc_t slots[3][2];
+    static char rx[3][CHANNEL_BULK];
+    static char bulk[2][CHANNEL_BULK];
+    char control[] = "halt";
+    test_channel_ctx_t rx_ctx = {.sent = {control, bulk[0], bulk[1]}};
+    // a fragment frame with a 32 bit crc
+    size_t frame = sizeof(txpc_hdr_t) + CHANNEL_FRAG + XPC_FRAG_TRAILER + 4;
+    xpc_channel_t *weightless = NULL;
+    int failed = 0;
+
+    for(size_t i = 0; i < CHANNEL_BULK; i++) {
+        bulk[0][i] = i * 7;
+        bulk[1][i] = i * 13 + 1;
+    }
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, &crc1,
+        test_budget_write_wrapper, test_read_wrapper, test_quiet_reset_fn, test_quiet_notify_fn,
+        test_msg_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config(
+        &uut2, &ctx2, &rx_ctx, &crc2,
+        test_write_wrapper, test_read_wrapper, test_quiet_reset_fn, test_quiet_notify_fn,
+        test_channel_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config_tx_queue(&uut1, queue, 2);
+    weightless = xpc_channel_config(&scratch, 0, 0, NULL, 0, NULL, 0);
+    printf("weight 0: %s\n", weightless ? "accepted":"rejected");
+    failed |= weightless != NULL;
+    // a control channel, and two bulk channels sharing the link 1:3
+    xpc_channel_config(&chans1[0], 0, 1, slots[0], 2, NULL, 0);
+    xpc_channel_config(&chans1[1], 1, 1, slots[1], 2, NULL, 0);
+    xpc_channel_config(&chans1[2], 1, 3, slots[2], 2, NULL, 0);
+    // the receiver's first channel only takes two fragments
+    xpc_channel_config(&chans2[0], 0, 1, NULL, 0, rx[0], 2 * CHANNEL_FRAG);
+    xpc_channel_config(&chans2[1], 0, 1, NULL, 0, rx[1], CHANNEL_BULK);
+    xpc_channel_config(&chans2[2], 0, 1, NULL, 0, rx[2], CHANNEL_BULK);
+    xpc_relay_config_channels(&uut1, chans1, 3, CHANNEL_FRAG);
+    xpc_relay_config_channels(&uut2, chans2, 3, CHANNEL_FRAG);
+    uut1.conn_config.crc_bits = 32;
+    uut2.conn_config.crc_bits = 32;
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    // send reset
+    ctx1.write_budget = (size_t)-1;
+    xpc_relay_send_reset(&uut1);
+    xpc_wr_op_continue(&uut1);
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    xpc_rd_op_continue(&uut1);
+    xpc_wr_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    failed |= test_check_status(
+        "no such channel", xpc_relay_send_channel(&uut1, 3, 2, 0, control, 4),
+        TXPC_STATUS_BAD_STATE
+    );
+    failed |= test_check_status(
+        "receive only", xpc_relay_send_channel(&uut2, 0, 2, 0, control, 4),
+        TXPC_STATUS_BAD_STATE
+    );
+
+    // a control message sent while both bulk messages are going out waits
+    // for the fragment being written, no longer
+    xpc_relay_send_channel(&uut1, 1, 2, 1, bulk[0], CHANNEL_BULK);
+    xpc_relay_send_channel(&uut1, 2, 2, 2, bulk[1], CHANNEL_BULK);
+    ctx1.write_budget = 3 * frame;
+    xpc_wr_op_continue(&uut1);
+    xpc_relay_send_channel(&uut1, 0, 2, 0, control, 4);
+    ctx1.write_budget = (size_t)-1;
+    xpc_wr_op_continue(&uut1);
+    test_channel_read(&uut2, &rx_ctx, 2 * CHANNEL_BULK / CHANNEL_FRAG + 1);
+    failed |= rx_ctx.dispatched != 3 || rx_ctx.frames_at[0] != 4;
+
+    // a reset part way through a message starts it over
+    rx_ctx.frames = 0;
+    xpc_relay_send_channel(&uut1, 1, 2, 1, bulk[0], CHANNEL_BULK);
+    ctx1.write_budget = 2 * frame;
+    xpc_wr_op_continue(&uut1);
+    xpc_relay_send_reset(&uut1);
+    ctx1.write_budget = (size_t)-1;
+    xpc_wr_op_continue(&uut1);
+    test_channel_read(&uut2, &rx_ctx, 3);
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    xpc_rd_op_continue(&uut1);
+    xpc_wr_op_continue(&uut1);
+    test_channel_read(&uut2, &rx_ctx, CHANNEL_BULK / CHANNEL_FRAG);
+    failed |= rx_ctx.dispatched != 4 || rx_ctx.frames_at[1] != 12;
+
+    // too large for the receiver's buffer, and dropped
+    xpc_relay_send_channel(&uut1, 0, 2, 0, bulk[0], CHANNEL_BULK);
+    xpc_wr_op_continue(&uut1);
+    test_channel_read(&uut2, &rx_ctx, CHANNEL_BULK / CHANNEL_FRAG);
+    printf("dropped: %llu %llu %llu\n",
+        (unsigned long long)chans2[0].rx_dropped,
+        (unsigned long long)chans2[1].rx_dropped,
+        (unsigned long long)chans2[2].rx_dropped);
+    failed |= rx_ctx.dispatched != 4 || chans2[0].rx_dropped != 1
+        || chans2[1].rx_dropped != 0 || chans2[2].rx_dropped != 0;
+
+    // a fragment lost on the way breaks up its message, and the next one
+    // arrives whole
+    rx_ctx.frames = 0;
+    xpc_relay_send_channel(&uut1, 2, 2, 2, bulk[1], CHANNEL_BULK);
+    ctx1.write_budget = 3 * frame;
+    xpc_wr_op_continue(&uut1);
+    test_channel_read(&uut2, &rx_ctx, 2);
+    r = read(ctx2.read_fd, rx[0], frame);
+    ctx1.write_budget = (size_t)-1;
+    xpc_wr_op_continue(&uut1);
+    test_channel_read(&uut2, &rx_ctx, CHANNEL_BULK / CHANNEL_FRAG - 3);
+    printf("lost fragment, dropped: %llu\n",
+        (unsigned long long)chans2[2].rx_dropped);
+    failed |= rx_ctx.dispatched != 4 || chans2[2].rx_dropped != 1;
+    xpc_relay_send_channel(&uut1, 2, 2, 2, bulk[1], CHANNEL_BULK);
+    xpc_wr_op_continue(&uut1);
+    test_channel_read(&uut2, &rx_ctx, CHANNEL_BULK / CHANNEL_FRAG);
+    failed |= rx_ctx.dispatched != 5 || rx_ctx.frames_at[2] != 18;
+
+    // fragments are not acknowledged, so acknowledged mode sends none
+    xpc_relay_send_channel(&uut1, 1, 2, 1, bulk[0], CHANNEL_BULK);
+    uut1.conn_config.flags = CONFIG_FLAGS_REQ_ACK;
+    failed |= test_check_status(
+        "fragmented in acknowledged mode",
+        xpc_relay_send_channel(&uut1, 1, 2, 1, bulk[0], CHANNEL_BULK),
+        TXPC_STATUS_BAD_STATE
+    );
+    xpc_wr_op_continue(&uut1);
+    printf("queued before acknowledged mode: %zu left\n", chans1[1].count);
+    uut1.conn_config.flags = 0;
+    failed |= chans1[1].count != 0 || rx_ctx.bad != 0;
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+/**
+ * Exchange one message, taking rtt clock units for the round trip.
+ */
+static int test_round_trip(
+        xpc_relay_state_t *uut1, xpc_relay_state_t *uut2, uint32_t *now,
+        uint32_t rtt, char *msg) {
+    xpc_send_msg(uut1, 1, 1, msg, strlen(msg));
+    xpc_wr_op_continue(uut1);
+    *now += rtt;
+    xpc_rd_op_continue(uut2);
+    xpc_wr_op_continue(uut2);
+    xpc_rd_op_continue(uut1);
+    return test_check_dispatched(1, msg) || uut1->ack.count != 0;
+}
+
+int test_timeouts(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    test_io_ctx_t ctx3 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    xpc_relay_state_t uut3 = {0};
+    crc_ctx_t crc1, crc2;
+    xpc_ack_slot_t window[4];
+    uint32_t now = 1000;
+    uint32_t at = 0;
+    char lost[64];
+    ssize_t dropped = 0;
+    uint32_t steady[] = {60, 50, 43, 38, 34, 31};
+    xpc_relay_state_t *timeouts = NULL;
+    size_t consumed[4];
+    int failed = 0;
+    test_dispatched = 0;
+
+    xpc_relay_config(
+        &uut1, &ctx1, NULL, &crc1,
+        test_write_wrapper, test_read_wrapper, test_quiet_reset_fn, test_quiet_notify_fn,
+        test_feed_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config(
+        &uut2, &ctx2, NULL, &crc2,
+        test_write_wrapper, test_read_wrapper, test_quiet_reset_fn, test_quiet_notify_fn,
+        test_feed_dispatch_fn, test_crc_fn, test_crc_polyn_config
+    );
+    xpc_relay_config_ack(&uut1, window, 4, NULL, NULL, 100, NULL);
+    timeouts = xpc_relay_config_timeouts(&uut1, test_clock_fn, &now, 50, 10, 0);
+    printf("rto_min above rto_max: %s\n", timeouts ? "accepted":"rejected");
+    failed |= timeouts != NULL;
+    // uut1 adapts its retransmission timeout, uut2 drops partial frames
+    xpc_relay_config_timeouts(&uut1, test_clock_fn, &now, 10, 400, 0);
+    xpc_relay_config_timeouts(&uut2, test_clock_fn, &now, 0, 0, 50);
+    uut1.conn_config.crc_bits = 32;
+    uut2.conn_config.crc_bits = 32;
+    uut1.conn_config.flags = CONFIG_FLAGS_REQ_ACK;
+    uut2.conn_config.flags = CONFIG_FLAGS_REQ_ACK;
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    xpc_relay_send_reset(&uut1);
+    xpc_wr_op_continue(&uut1);
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    xpc_rd_op_continue(&uut1);
+    xpc_wr_op_continue(&uut1);
+    printf("--->reset test complete\n");
+
+    // the timeout closes in on a steady round trip from the initial 100
+    for(int i = 0; i < 6; i++) {
+        failed |= test_round_trip(&uut1, &uut2, &now, 20, "steady\n");
+        printf("round trip 20: rto %u\n", uut1.ack.rto);
+        failed |= uut1.ack.rto != steady[i];
+    }
+
+    // a lost message is resent after the timeout, which then doubles.  Its
+    // ACK may be for either transmission, so gives no sample.
+    uint32_t rto = uut1.ack.rto;
+    xpc_send_msg(&uut1, 1, 1, "lost\n", 5);
+    xpc_wr_op_continue(&uut1);
+    failed |= !xpc_relay_next_deadline(&uut1, &at);
+    dropped = read(ctx2.read_fd, lost, sizeof(lost));
+    printf("dropped %zi bytes, resend due in %u\n", dropped, at - now);
+    failed |= dropped != 15 || at - now != rto;
+    now += rto - 1;
+    xpc_wr_op_continue(&uut1);
+    printf("before the timeout: rto %u\n", uut1.ack.rto);
+    failed |= uut1.ack.rto != rto;
+    now += 1;
+    xpc_wr_op_continue(&uut1);
+    printf("timed out: rto %u\n", uut1.ack.rto);
+    failed |= uut1.ack.rto != 2 * rto;
+    now += 200;
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    xpc_rd_op_continue(&uut1);
+    printf("resent message acked: rto %u unacknowledged %zu\n",
+        uut1.ack.rto, uut1.ack.count);
+    failed |= uut1.ack.rto != 2 * rto || uut1.ack.count != 0
+        || test_check_dispatched(1, "lost\n");
+    failed |= test_round_trip(&uut1, &uut2, &now, 20, "sampled\n");
+    printf("round trip 20: rto %u\n", uut1.ack.rto);
+    failed |= uut1.ack.rto != 29;
+    bool pending = xpc_relay_next_deadline(&uut1, &at);
+    printf("deadline pending: %i\n", pending);
+    failed |= pending;
+
+    // only the header and part of a message arrive
+    txpc_hdr_t hdr = {.type = TXPC_MSG_TYPE_MSG, .size = 10, .to = 1, .from = 1};
+    r = write(fd_set1[1], &hdr, sizeof(hdr));
+    r = write(fd_set1[1], "par", 3);
+    xpc_rd_op_continue(&uut2);
+    xpc_relay_next_deadline(&uut2, &at);
+    printf("partial frame: state %i, dropped in %u\n",
+        uut2.inflight_rd_op.op, at - now);
+    failed |= uut2.inflight_rd_op.op == 0 || at - now != 50;
+    now += 50;
+    xpc_rd_op_continue(&uut2);
+    printf("timed out: state %i, reset sending %i\n", uut2.inflight_rd_op.op,
+        uut2.inflight_wr_op.op == TXPC_OP_RESET);
+    failed |= uut2.inflight_rd_op.op != 0 || uut2.inflight_wr_op.op != TXPC_OP_RESET
+        || test_check_dispatched(0, NULL);
+    xpc_wr_op_continue(&uut2);
+    xpc_rd_op_continue(&uut1);
+    xpc_wr_op_continue(&uut1);
+    xpc_rd_op_continue(&uut2);
+    xpc_wr_op_continue(&uut2);
+    printf("--->reset test complete\n");
+    failed |= test_round_trip(&uut1, &uut2, &now, 20, "resynchronized\n");
+
+    // fed bytes left over wait the same way, and are taken whole once dropped
+    xpc_relay_config(
+        &uut3, &ctx3, NULL, NULL,
+        test_write_wrapper, NULL, test_quiet_reset_fn, test_quiet_notify_fn,
+        test_feed_dispatch_fn, NULL, NULL
+    );
+    xpc_relay_config_timeouts(&uut3, test_clock_fn, &now, 0, 0, 50);
+    txpc_hdr_t head = {.type = TXPC_MSG_TYPE_MSG, .size = 8, .to = 1, .from = 1};
+    char *partial = (char*)&head;
+    consumed[0] = xpc_relay_feed(&uut3, partial, 2);
+    now += 30;
+    consumed[1] = xpc_relay_feed(&uut3, partial, 3);
+    now += 30;
+    consumed[2] = xpc_relay_feed(&uut3, partial, 3);
+    now += 20;
+    consumed[3] = xpc_relay_feed(&uut3, partial, 3);
+    printf("fed: consumed %zu, %zu, %zu, %zu, reset sending %i\n",
+        consumed[0], consumed[1], consumed[2], consumed[3],
+        uut3.inflight_wr_op.op == TXPC_OP_RESET);
+    failed |= consumed[0] || consumed[1] || consumed[2] || consumed[3] != 3
+        || uut3.inflight_wr_op.op != TXPC_OP_RESET;
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+/**
+ * Headers no endpoint sends, a type that does not exist or a control frame
+ * with a size, drop the rest of the input and reset the connection.
+ */
+int test_bad_headers(void) {
+    int fd_set1[2] = {0};
+    int fd_set2[2] = {0};
+    int r = pipe(fd_set1);
+    if(r == -1) {
+        goto done;
+    }
+    r = pipe(fd_set2);
+    if(r == -1) {
+        close(fd_set1[0]);
+        close(fd_set1[1]);
+        goto done;
+    }
+
+    test_io_ctx_t ctx1 = {0};
+    test_io_ctx_t ctx2 = {0};
+    xpc_relay_state_t uut1 = {0};
+    xpc_relay_state_t uut2 = {0};
+    txpc_hdr_t bad[4] = {
+        {.type = 0x0f, .size = 0, .to = 1, .from = 1},
+        {.type = TXPC_MSG_TYPE_XOFF, .size = 4, .to = 0, .from = 0},
+        {.type = TXPC_MSG_TYPE_CONFIG, .size = 0, .to = 0, .from = 0},
+        // flags, a 32 bit CRC, and one byte of its polynomial
+        {.type = TXPC_MSG_TYPE_CONFIG, .size = 3, .to = 0, .from = 0}
+    };
+    char short_polyn[3] = {0, 32, 0};
+    int failed = 0;
+    test_dispatched = 0;
+
+    ctx1.write_fd = fd_set1[1];
+    ctx2.read_fd = fd_set1[0];
+
+    ctx2.write_fd = fd_set2[1];
+    ctx1.read_fd = fd_set2[0];
+
+    for(int i = 0; i < 4; i++) {
+        xpc_relay_config(
+            &uut1, &ctx1, NULL, NULL,
+            test_write_wrapper, test_read_wrapper, test_quiet_reset_fn,
+            test_quiet_notify_fn, test_feed_dispatch_fn, NULL, NULL
+        );
+        xpc_relay_config(
+            &uut2, &ctx2, NULL, NULL,
+            test_write_wrapper, test_read_wrapper, test_quiet_reset_fn,
+            test_quiet_notify_fn, test_feed_dispatch_fn, NULL, NULL
+        );
+        xpc_relay_send_reset(&uut1);
+        xpc_wr_op_continue(&uut1);
+        xpc_rd_op_continue(&uut2);
+        xpc_wr_op_continue(&uut2);
+        xpc_rd_op_continue(&uut1);
+        xpc_wr_op_continue(&uut1);
+        printf("--->reset test complete\n");
+
+        r = write(fd_set1[1], &bad[i], sizeof(txpc_hdr_t));
+        if(i == 3) {
+            r = write(fd_set1[1], short_polyn, sizeof(short_polyn));
+        }
+        xpc_rd_op_continue(&uut2);
+        printf("header type %i size %i: reset sending %i\n", bad[i].type,
+            bad[i].size, uut2.inflight_wr_op.op == TXPC_OP_RESET);
+        failed |= uut2.inflight_wr_op.op != TXPC_OP_RESET;
+        xpc_wr_op_continue(&uut2);
+        xpc_rd_op_continue(&uut1);
+        xpc_wr_op_continue(&uut1);
+        xpc_rd_op_continue(&uut2);
+        xpc_wr_op_continue(&uut2);
+        printf("--->reset test complete\n");
+        xpc_send_msg(&uut1, 1, 1, "resynchronized\n", 15);
+        xpc_wr_op_continue(&uut1);
+        xpc_rd_op_continue(&uut2);
+        failed |= test_check_dispatched(1, "resynchronized\n");
+    }
+
+    // fed, a bad header is refused before its claimed body arrives
+    char fed[5 + 20 * 8];
+    size_t fed_len = 0;
+    txpc_hdr_t huge = {.type = 0x0f, .size = 60000, .to = 1, .from = 1};
+    memcpy(fed, &huge, sizeof(txpc_hdr_t));
+    fed_len += sizeof(txpc_hdr_t);
+    for(int i = 0; i < 20; i++) {
+        txpc_hdr_t hdr = {.type = TXPC_MSG_TYPE_MSG, .size = 3, .to = 1, .from = 1};
+        memcpy(fed + fed_len, &hdr, sizeof(txpc_hdr_t));
+        memcpy(fed + fed_len + sizeof(txpc_hdr_t), "ok\n", 3);
+        fed_len += sizeof(txpc_hdr_t) + 3;
+    }
+    xpc_relay_config(
+        &uut2, &ctx2, NULL, NULL,
+        test_write_wrapper, NULL, test_quiet_reset_fn,
+        test_quiet_notify_fn, test_feed_dispatch_fn, NULL, NULL
+    );
+    size_t consumed = xpc_relay_feed(&uut2, fed, fed_len);
+    printf("fed header type %i size %i: consumed %zu of %zu, reset sending %i\n",
+        huge.type, huge.size, consumed, fed_len,
+        uut2.inflight_wr_op.op == TXPC_OP_RESET);
+    // whatever the frames after it were, none of them is dispatched
+    failed |= consumed != fed_len || uut2.inflight_wr_op.op != TXPC_OP_RESET
+        || test_check_dispatched(0, NULL);
+    r = failed;
+
+    close(fd_set1[0]);
+    close(fd_set1[1]);
+    close(fd_set2[0]);
+    close(fd_set2[1]);
+done:
+    return r;
+}
+
+int main(void) {
+    int r = 0;
+    printf("***TESTING WITHOUT CRC\n");
+    r |= test_nocrc();
+    printf("***TESTING WITH CRC\n");
+    r |= test_withcrc();
+    printf("***TESTING WITH CRC AND CONFIGURATION\n");
+    r |= test_config_msg();
+    printf("***TESTING WITH CRC AND VECTORED WRITES\n");
+    r |= test_writev();
+    printf("***TESTING WITH CRC AND FED READS\n");
+    r |= test_feed();
+    printf("***TESTING TRANSMIT QUEUE\n");
+    r |= test_tx_queue();
+    printf("***TESTING ACKNOWLEDGED DELIVERY\n");
+    r |= test_ack_window();
+    printf("***TESTING DAMAGED SEQUENCE NUMBERS AND ACKS\n");
+    r |= test_ack_damaged();
+    printf("***TESTING WITH INCREMENTAL CRC\n");
+    r |= test_crc_incremental();
+    printf("***TESTING WITH CRC ENGINE AND 12 BIT CONFIGURATION\n");
+    r |= test_crc_engine_config();
+    printf("***TESTING RECEIVE LEASES\n");
+    r |= test_lease();
+    printf("***TESTING FLOW CONTROL\n");
+    r |= test_flow();
+    printf("***TESTING STREAMS\n");
+    r |= test_stream();
+    printf("***TESTING SCATTERED SENDS\n");
+    r |= test_msgv();
+    printf("***TESTING COALESCED WRITES\n");
+    r |= test_coalesce();
+    printf("***TESTING CHANNELS\n");
+    r |= test_channels();
+    printf("***TESTING TIMEOUTS\n");
+    r |= test_timeouts();
+    printf("***TESTING DAMAGED HEADERS\n");
+    r |= test_bad_headers();
+    return r;
 }
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <tinyxpc/xpc_relay_async.hpp>
+#include <loop.hpp>
+
+#define MSGS 8
+
+using AsyncLoop = tinyxpc::AsyncRelay<Loop, Crc32>;
+// two leases, so a receiver can hold them all
+using HeldLoop = tinyxpc::AsyncRelay<Loop, Crc32, 2>;
+
+template<typename R, typename P>
+concept sends = requires(R &relay, P &&payload) {
+    relay.send(1, 2, std::forward<P>(payload));
+};
+static_assert(sends<AsyncLoop, const char (&)[8]>);
+static_assert(sends<AsyncLoop, std::string&>);
+// the payload is written after the statement sending it has ended
+static_assert(!sends<AsyncLoop, std::string>);
+
+static const std::array<std::string_view, MSGS> requests = {
+    "zero", "one", "two", "three", "four", "five", "six", "seven"
+};
+
+template<typename A, typename B>
+static void test_pair(A &a, B &b) {
+    a.transport().peer = &b.transport();
+    b.transport().peer = &a.transport();
+}
+
+struct EchoResult {
+    xpc_status_t reset = TXPC_STATUS_INFLIGHT;
+    int sent = 0;
+    int replies = 0;
+    int mismatched = 0;
+    bool done = false;
+};
+
+// sends every request before reading any reply
+static tinyxpc::Task echo_client(AsyncLoop &relay, EchoResult &result) {
+    result.reset = co_await relay.reset();
+    for(std::string_view request : requests) {
+        if(co_await relay.send(1, 2, request) == TXPC_STATUS_DONE) {
+            result.sent++;
+        }
+    }
+    for(std::string_view request : requests) {
+        tinyxpc::Message reply = co_await relay.receive();
+        result.replies++;
+        std::string_view text = reply.text();
+        // each reply is its request with a '!' appended
+        if(text.size() != request.size() + 1 || text.substr(0, request.size()) != request) {
+            result.mismatched++;
+        }
+    }
+    result.done = true;
+}
+
+static tinyxpc::Task echo_server(AsyncLoop &relay, int &served) {
+    // replies are sent from here, so they outlive their writes
+    static char replies[MSGS][16];
+    for(int i = 0; i < MSGS; i++) {
+        tinyxpc::Message request = co_await relay.receive();
+        std::string_view text = request.text();
+        int n = std::snprintf(
+            replies[i], sizeof(replies[i]), "%.*s!", (int)text.size(), text.data()
+        );
+        co_await relay.send(request.from(), request.to(), std::string_view(replies[i], n));
+        served++;
+    }
+}
+
+/**
+ * A reset, then sends queued behind a short transmit queue and receives
+ * waiting on the remote, all from two tasks on one executor.
+ */
+int test_echo(void) {
+    tinyxpc::Executor executor;
+    AsyncLoop a(executor), b(executor);
+    xpc_tx_desc_t queue[2];
+    xpc_relay_config_tx_queue(a.get(), queue, 2);
+    test_pair(a, b);
+    EchoResult result;
+    int served = 0;
+    executor.spawn(echo_client(a, result));
+    executor.spawn(echo_server(b, served));
+    executor.run();
+    std::printf("reset %i, sent %i, served %i, replies %i, mismatched %i\n",
+        result.reset, result.sent, served, result.replies, result.mismatched);
+    return !result.done || result.reset != TXPC_STATUS_DONE || result.sent != MSGS
+        || served != MSGS || result.replies != MSGS || result.mismatched != 0
+        || executor.tasks() != 0;
+}
+
+static tinyxpc::Task send_all(AsyncLoop &relay) {
+    co_await relay.reset();
+    for(std::string_view request : requests) {
+        co_await relay.send(1, 2, request);
+    }
+}
+
+struct HoldResult {
+    std::size_t held = 0;
+    int in_order = 0;
+};
+
+/**
+ * A receiver holding every lease holds up the rest of the messages, which
+ * arrive in order once it lets go.
+ */
+static tinyxpc::Task receive_held(HeldLoop &relay, HoldResult &result) {
+    std::array<std::optional<tinyxpc::Message>, 2> held;
+    for(int i = 0; i < MSGS; i += 2) {
+        held[0].emplace(co_await relay.receive());
+        held[1].emplace(co_await relay.receive());
+        result.held = std::max(result.held, relay.get()->leases.count);
+        for(int j = 0; j < 2; j++) {
+            if(held[j]->text() == requests[i + j]) {
+                result.in_order++;
+            }
+            held[j].reset();
+        }
+    }
+}
+
+int test_held(void) {
+    tinyxpc::Executor executor;
+    AsyncLoop a(executor);
+    HeldLoop b(executor);
+    test_pair(a, b);
+    HoldResult result;
+    executor.spawn(send_all(a));
+    executor.spawn(receive_held(b, result));
+    executor.run();
+    std::printf("leases held at most %zu, received in order %i\n",
+        result.held, result.in_order);
+    return result.held != 2 || result.in_order != MSGS;
+}
+
+#define UNREAD 4
+
+struct InboxResult {
+    xpc_status_t reset = TXPC_STATUS_INFLIGHT;
+    int received = 0;
+    int in_order = 0;
+    int waits = 0;
+};
+
+static tinyxpc::Task send_unread(AsyncLoop &relay, InboxResult &result) {
+    co_await relay.reset();
+    for(int i = 0; i < UNREAD; i++) {
+        co_await relay.send(1, 2, requests[i]);
+    }
+    // answered past the messages waiting at the remote
+    result.reset = co_await relay.reset();
+}
+
+static tinyxpc::Task receive_all(AsyncLoop &relay, InboxResult &result) {
+    for(int i = 0; i <= UNREAD; i++) {
+        tinyxpc::Message msg = co_await relay.receive();
+        result.received++;
+        if(msg.text() == requests[i]) {
+            result.in_order++;
+        }
+    }
+}
+
+static tinyxpc::Task send_last(AsyncLoop &relay) {
+    co_await relay.send(1, 2, requests[UNREAD]);
+}
+
+struct InboxWait {
+    tinyxpc::Executor *executor;
+    AsyncLoop *sender;
+    InboxResult *result;
+};
+
+// stands in for poll(): the last message arrives while the executor waits
+static void test_wait(void *ctx) {
+    InboxWait *wait = static_cast<InboxWait*>(ctx);
+    if(wait->result->waits++ == 0) {
+        wait->executor->spawn(send_last(*wait->sender));
+    }
+}
+
+/**
+ * Messages nobody receives yet are kept in the inbox, so the relay reads on
+ * past them, and they are received later, in order.  An idle executor waits
+ * instead of spinning.
+ */
+int test_inbox(void) {
+    tinyxpc::Executor executor;
+    AsyncLoop a(executor), b(executor);
+    test_pair(a, b);
+    InboxResult result;
+    executor.spawn(send_unread(a, result));
+    executor.run();
+    std::size_t held = b.get()->leases.count;
+    std::printf("reset %i, held %zu, tasks %zu\n", result.reset, held, executor.tasks());
+    int r = result.reset != TXPC_STATUS_DONE || held != UNREAD || executor.tasks() != 0;
+
+    InboxWait wait = {&executor, &a, &result};
+    executor.set_wait(test_wait, &wait);
+    executor.spawn(receive_all(b, result));
+    executor.run();
+    std::printf("received %i, in order %i, waits %i, held %zu\n",
+        result.received, result.in_order, result.waits, b.get()->leases.count);
+    return r || result.received != UNREAD + 1 || result.in_order != UNREAD + 1
+        || result.waits != 1 || b.get()->leases.count != 0 || executor.tasks() != 0;
+}
+
+// a message sent in fragments, then one sent whole
+static tinyxpc::Task send_fragmented(AsyncLoop &relay, xpc_status_t &queued) {
+    static char bulk[] = "reassembled from fragments";
+    co_await relay.reset();
+    queued = xpc_relay_send_channel(relay.get(), 0, 1, 2, bulk, sizeof(bulk) - 1);
+    co_await relay.send(1, 2, "whole");
+}
+
+static tinyxpc::Task receive_one(AsyncLoop &relay, std::optional<tinyxpc::Message> &msg) {
+    msg.emplace(co_await relay.receive());
+}
+
+/**
+ * A reassembled message cannot be kept, so it is dropped instead of holding
+ * up the messages behind it.
+ */
+int test_reassembled(void) {
+    tinyxpc::Executor executor;
+    AsyncLoop a(executor), b(executor);
+    xpc_tx_desc_t queue[2];
+    std::array<xpc_channel_t, 2> channels;
+    static char rx_buf[64];
+    xpc_channel_config(&channels[0], 0, 1, queue, 2, nullptr, 0);
+    xpc_channel_config(&channels[1], 0, 1, nullptr, 0, rx_buf, sizeof(rx_buf));
+    xpc_relay_config_channels(a.get(), &channels[0], 1, 8);
+    xpc_relay_config_channels(b.get(), &channels[1], 1, 8);
+    test_pair(a, b);
+    xpc_status_t queued = TXPC_STATUS_INFLIGHT;
+    std::optional<tinyxpc::Message> msg;
+    executor.spawn(send_fragmented(a, queued));
+    executor.spawn(receive_one(b, msg));
+    executor.run();
+    std::printf("queued %i, received %s, dropped %zu, tasks %zu\n", queued,
+        msg ? std::string(msg->text()).c_str():"nothing", b.dropped(), executor.tasks());
+    return queued != TXPC_STATUS_DONE || !msg || msg->text() != "whole"
+        || b.dropped() != 1 || executor.tasks() != 0;
+}
+
+int main(void) {
+    int r = 0;
+    std::printf("***TESTING AWAITED SENDS AND RECEIVES\n");
+    r |= test_echo();
+    std::printf("***TESTING HELD MESSAGES\n");
+    r |= test_held();
+    std::printf("***TESTING THE INBOX\n");
+    r |= test_inbox();
+    std::printf("***TESTING REASSEMBLED MESSAGES\n");
+    r |= test_reassembled();
+    return r;
+}
@@ -0,0 +1,146 @@
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <tinyxpc/xpc_relay.hpp>
+#include <loop.hpp>
+
+using namespace std::literals;
+
+// CRC-32/ISO-HDLC generator, most significant byte first
+static const char crc_polyn[4] = {0x04, (char)0xc1, 0x1d, (char)0xb7};
+
+// keeps the messages sent to port 7, and the text of the last one
+struct Keeper {
+    int received = 0;
+    char last[64] = {0};
+    std::array<std::optional<tinyxpc::Message>, 4> kept;
+    std::size_t kept_count = 0;
+
+    bool operator()(tinyxpc::Message &&msg) {
+        received++;
+        std::string_view text = msg.text();
+        std::snprintf(last, sizeof(last), "%.*s", (int)text.size(), text.data());
+        if(msg.to() == 7 && kept_count < kept.size() && msg.keep()) {
+            kept[kept_count++].emplace(std::move(msg));
+        }
+        return true;
+    }
+};
+
+using TestRelay = tinyxpc::Relay<Loop, Crc32, Keeper>;
+static_assert(!std::is_polymorphic_v<TestRelay>);
+static_assert(std::is_move_constructible_v<tinyxpc::Message>);
+static_assert(!std::is_copy_constructible_v<tinyxpc::Message>);
+
+// whether R::send takes a payload of type P (an rvalue unless a reference)
+template<typename R, typename P>
+concept sends = requires(R &relay, P &&payload) {
+    relay.send(1, 2, std::forward<P>(payload));
+};
+static_assert(sends<TestRelay, const char (&)[8]>);
+static_assert(sends<TestRelay, std::string&>);
+static_assert(sends<TestRelay, std::string_view>);
+// payloads are not copied, so a temporary string cannot be sent
+static_assert(!sends<TestRelay, std::string>);
+
+static void test_pump(TestRelay &a, TestRelay &b) {
+    for(int i = 0; i < 4; i++) {
+        a.write();
+        b.write();
+        a.read();
+        b.read();
+    }
+}
+
+static void test_pair(TestRelay &a, TestRelay &b) {
+    a.transport().peer = &b.transport();
+    b.transport().peer = &a.transport();
+    a.send_reset();
+    test_pump(a, b);
+    // the initiator needs another pass to take up sending
+    a.write();
+}
+
+int test_send(void) {
+    TestRelay a, b;
+    test_pair(a, b);
+    a.send_config(32, crc_polyn, false);
+    test_pump(a, b);
+    int crc_bits = b.get()->conn_config.crc_bits;
+    int configured = b.crc().configured;
+    int sent = a.send(1, 2, "string_view"sv);
+    test_pump(a, b);
+    std::printf("crc bits %i, configured %i, sent %i, received %i: %s\n",
+        crc_bits, configured, sent, b.handler().received, b.handler().last);
+    int r = crc_bits != 32 || configured != 32 || sent != TXPC_STATUS_DONE
+        || b.handler().received != 1 || std::strcmp(b.handler().last, "string_view");
+
+    static const std::array<char, 4> bytes = {'s', 'p', 'a', 'n'};
+    sent = b.send(2, 1, std::span<const char>(bytes));
+    test_pump(a, b);
+    std::printf("sent %i, received %i: %s\n", sent, a.handler().received, a.handler().last);
+    r = r || sent != TXPC_STATUS_DONE || a.handler().received != 1
+        || std::strcmp(a.handler().last, "span");
+
+    // a literal goes without its terminator
+    sent = a.send(1, 2, "literal");
+    test_pump(a, b);
+    std::size_t size = b.get()->inflight_rd_op.msg_hdr.size;
+    std::printf("sent %i, received %i: %s (%zu bytes)\n",
+        sent, b.handler().received, b.handler().last, size);
+    r = r || sent != TXPC_STATUS_DONE || b.handler().received != 2
+        || std::strcmp(b.handler().last, "literal") || size != 7;
+
+    std::string text = "std::string";
+    sent = b.send(2, 1, text);
+    test_pump(a, b);
+    std::printf("sent %i, received %i: %s\n", sent, a.handler().received, a.handler().last);
+    return r || sent != TXPC_STATUS_DONE || a.handler().received != 2
+        || std::strcmp(a.handler().last, "std::string");
+}
+
+/**
+ * Kept messages hold their payloads after dispatch, and hand them back to
+ * the relay when destroyed.
+ */
+int test_keep(void) {
+    TestRelay a, b;
+    xpc_lease_t leases[4];
+    xpc_tx_desc_t queue[4];
+    xpc_relay_config_leases(b.get(), leases, 4);
+    xpc_relay_config_tx_queue(a.get(), queue, 4);
+    test_pair(a, b);
+    a.send(7, 1, "first kept"sv);
+    a.send(1, 1, "dropped"sv);
+    a.send(7, 1, "second kept"sv);
+    test_pump(a, b);
+    Keeper &keeper = b.handler();
+    std::string_view first = keeper.kept[0]->text();
+    std::string_view second = keeper.kept[1]->text();
+    std::printf("received %i, kept %zu: %.*s, %.*s\n", keeper.received,
+        keeper.kept_count, (int)first.size(), first.data(),
+        (int)second.size(), second.data());
+    int r = keeper.received != 3 || keeper.kept_count != 2
+        || first != "first kept" || second != "second kept";
+    std::size_t held = b.get()->leases.count;
+    keeper.kept[0].reset();
+    keeper.kept[1].reset();
+    std::printf("leases held %zu, then %zu; bytes discarded %zu\n",
+        held, b.get()->leases.count, b.transport().discarded);
+    return r || held != 2 || b.get()->leases.count != 0
+        || b.transport().discarded == 0;
+}
+
+int main(void) {
+    int r = 0;
+    std::printf("***TESTING C++ SENDS\n");
+    r |= test_send();
+    std::printf("***TESTING KEPT MESSAGES\n");
+    r |= test_keep();
+    return r;
+}
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tinyxpc/tinyxpc.h>
+#include <tinyxpc/xpc_relay.h>
+#include <tinyxpc/xpc_router.h>
+#include <mem_link.h>
+
+#define LINK_RX 256
+#define LINK_QUEUE 4
+#define LINK_LEASES 8
+#define NODES 3
+#define BURST 100
+
+/**
+ * One end of an in-memory link, with the transmit queue and leases a hub end
+ * needs, and a log of the messages a node end receives.
+ */
+typedef struct {
+    mem_link_t link;
+    xpc_tx_desc_t queue[LINK_QUEUE];
+    xpc_lease_t leases[LINK_LEASES];
+    int received;
+    char log[128][16];
+    uint8_t log_from[128];
+} test_end_t;
+
+static void test_end_config(test_end_t *end, test_end_t *peer, void *msg_ctx, dispatch_fn *cb) {
+    memset(end, 0, sizeof(*end));
+    mem_link_config(&end->link, &peer->link, msg_ctx, cb, false);
+    end->link.capacity = LINK_RX;
+    xpc_relay_config_tx_queue(&end->link.relay, end->queue, LINK_QUEUE);
+    xpc_relay_config_leases(&end->link.relay, end->leases, LINK_LEASES);
+}
+
+bool test_node_dispatch_fn(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload) {
+    test_end_t *node = (test_end_t*)msg_ctx;
+    if(node->received < 128) {
+        memcpy(node->log[node->received], payload, msg_hdr->size);
+        node->log[node->received][msg_hdr->size] = 0;
+        node->log_from[node->received] = msg_hdr->from;
+    }
+    node->received++;
+    return true;
+}
+
+static int local_received;
+
+bool test_local_fn(void *local_ctx, xpc_router_port_t *ingress, txpc_hdr_t *msg_hdr, char *payload) {
+    printf("local: from %i on port %i: %.*s\n",
+        msg_hdr->from, ingress->index, msg_hdr->size, payload);
+    local_received++;
+    return true;
+}
+
+// hub with a port per node; node i has address i + 1 and hangs off port i.
+static xpc_router_t router;
+static xpc_router_port_t *port_table[NODES];
+static xpc_router_port_t ports[NODES];
+static xpc_router_fwd_t fwd_slots[NODES][8];
+static test_end_t hub_end[NODES];
+static test_end_t node_end[NODES];
+
+static void test_hub_setup(void) {
+    xpc_router_config(&router, port_table, NODES, test_local_fn, NULL);
+    for(int i = 0; i < NODES; i++) {
+        test_end_config(&hub_end[i], &node_end[i], &ports[i], xpc_router_dispatch);
+        test_end_config(&node_end[i], &hub_end[i], &node_end[i], test_node_dispatch_fn);
+        xpc_router_port_config(&ports[i], &router, &hub_end[i].link.relay, fwd_slots[i], 8);
+    }
+    for(int i = 0; i < NODES; i++) {
+        xpc_router_set_route(&ports[i], 0, 0, XPC_ROUTE_LOCAL);
+        for(int j = 0; j < NODES; j++) {
+            xpc_router_set_route(&ports[i], j + 1, j + 1, j);
+        }
+        xpc_relay_send_reset(&node_end[i].link.relay);
+    }
+}
+
+static void test_hub_pump(int rounds) {
+    for(int round = 0; round < rounds; round++) {
+        for(int i = 0; i < NODES; i++) {
+            mem_link_pump(&node_end[i].link);
+            mem_link_pump(&hub_end[i].link);
+        }
+        xpc_router_poll(&router);
+    }
+}
+
+static int test_hub_leaks(void) {
+    int leaks = 0;
+    for(int i = 0; i < NODES; i++) {
+        leaks += hub_end[i].link.relay.leases.count + ports[i].egress.count;
+    }
+    printf("%i payloads still held by the hub\n", leaks);
+    return leaks;
+}
+
+
+int test_routing(void) {
+    int failures = 0;
+    test_hub_setup();
+    xpc_send_msg(&node_end[0].link.relay, 2, 1, "a to b", 6);
+    xpc_send_msg(&node_end[0].link.relay, 3, 1, "a to c", 6);
+    xpc_send_msg(&node_end[1].link.relay, 1, 2, "b to a", 6);
+    xpc_send_msg(&node_end[2].link.relay, 0, 3, "c to hub", 8);
+    xpc_send_msg(&node_end[2].link.relay, 9, 3, "c to nowhere", 12);
+    test_hub_pump(20);
+    for(int i = 0; i < NODES; i++) {
+        for(int m = 0; m < node_end[i].received; m++) {
+            printf("node %i: from %i: %s\n", i + 1, node_end[i].log_from[m], node_end[i].log[m]);
+        }
+    }
+    printf("dropped at port 2: %llu\n", (unsigned long long)ports[2].dropped);
+    if(node_end[0].received != 1 || strcmp(node_end[0].log[0], "b to a") != 0
+            || node_end[1].received != 1 || strcmp(node_end[1].log[0], "a to b") != 0
+            || node_end[2].received != 1 || node_end[2].log_from[0] != 1
+            || local_received != 1 || ports[2].dropped != 1) {
+        failures++;
+    }
+    failures += test_hub_leaks();
+    return failures;
+}
+
+
+int test_backpressure(void) {
+    int failures = 0;
+    static char payloads[BURST][8];
+    test_hub_setup();
+    test_hub_pump(5);
+    node_end[1].link.paused = true;
+    int sent = 0;
+    for(int round = 0; round < 200; round++) {
+        while(sent < BURST) {
+            snprintf(payloads[sent], 8, "m%03u", (unsigned)sent % 1000);
+            if(xpc_send_msg(&node_end[0].link.relay, 2, 1, payloads[sent], 4) != TXPC_STATUS_DONE) {
+                break;
+            }
+            sent++;
+        }
+        test_hub_pump(1);
+    }
+    printf("paused: %i sent, %i received, %llu declined\n",
+        sent, node_end[1].received, (unsigned long long)ports[0].declined);
+    if(node_end[1].received != 0 || ports[0].declined == 0 || sent == BURST) {
+        // the sender must have been held back before sending everything
+        failures++;
+    }
+    node_end[1].link.paused = false;
+    for(int round = 0; round < 400 && node_end[1].received < BURST; round++) {
+        while(sent < BURST) {
+            snprintf(payloads[sent], 8, "m%03u", (unsigned)sent % 1000);
+            if(xpc_send_msg(&node_end[0].link.relay, 2, 1, payloads[sent], 4) != TXPC_STATUS_DONE) {
+                break;
+            }
+            sent++;
+        }
+        test_hub_pump(1);
+    }
+    int out_of_order = 0;
+    for(int m = 0; m < node_end[1].received && m < BURST; m++) {
+        char expected[8];
+        snprintf(expected, 8, "m%03u", (unsigned)m % 1000);
+        out_of_order += strcmp(node_end[1].log[m], expected) != 0;
+    }
+    printf("resumed: %i received, %i out of order, %llu forwarded\n",
+        node_end[1].received, out_of_order, (unsigned long long)ports[0].forwarded);
+    if(node_end[1].received != BURST || out_of_order) {
+        failures++;
+    }
+    failures += test_hub_leaks();
+    return failures;
+}
+
+
+int test_reassembled(void) {
+    int failures = 0;
+    static xpc_channel_t node_channel, hub_channel;
+    static xpc_tx_desc_t channel_queue[2];
+    static char rx_buf[64];
+    test_hub_setup();
+    xpc_channel_config(&node_channel, 0, 1, channel_queue, 2, NULL, 0);
+    xpc_channel_config(&hub_channel, 0, 1, NULL, 0, rx_buf, sizeof(rx_buf));
+    xpc_relay_config_channels(&node_end[0].link.relay, &node_channel, 1, 4);
+    xpc_relay_config_channels(&hub_end[0].link.relay, &hub_channel, 1, 4);
+    test_hub_pump(5);
+    xpc_status_t queued = xpc_relay_send_channel(
+        &node_end[0].link.relay, 0, 2, 1, "in fragments", 12
+    );
+    xpc_send_msg(&node_end[0].link.relay, 2, 1, "whole", 5);
+    test_hub_pump(20);
+    printf("queued %i, node 2 received %i: %s, dropped at port 0: %llu\n",
+        queued, node_end[1].received, node_end[1].received ? node_end[1].log[0]:"",
+        (unsigned long long)ports[0].dropped);
+    if(queued != TXPC_STATUS_DONE || node_end[1].received != 1
+            || strcmp(node_end[1].log[0], "whole") != 0 || ports[0].dropped != 1) {
+        failures++;
+    }
+    failures += test_hub_leaks();
+    return failures;
+}
+
+
+int main(void) {
+    int failures = 0;
+    printf("***TESTING ROUTING\n");
+    failures += test_routing();
+    printf("***TESTING BACKPRESSURE\n");
+    failures += test_backpressure();
+    printf("***TESTING REASSEMBLED MESSAGES\n");
+    failures += test_reassembled();
+    printf("%i failures\n", failures);
+    return failures != 0;
+}
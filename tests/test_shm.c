@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <tinyxpc/xpc_relay.h>
+#include <tinyxpc/xpc_shm.h>
+
+#define STREAM_MSGS 5000
+#define LEASES 4
+#define PINGS 20000
+
+static char pattern[512];
+
+typedef struct {
+    xpc_relay_state_t *relay;
+    int received;
+    int bad;
+    // leases held by the test, oldest first
+    xpc_lease_t *held[LEASES];
+    int held_count;
+    int leased;
+} test_rx_ctx_t;
+
+
+bool test_stream_dispatch_fn(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload) {
+    test_rx_ctx_t *ctx = (test_rx_ctx_t*)msg_ctx;
+    // from is the offset into the pattern, to the low byte of the count
+    if(msg_hdr->to != (ctx->received & 0xff)
+            || memcmp(payload, pattern + msg_hdr->from, msg_hdr->size) != 0) {
+        ctx->bad++;
+    }
+    ctx->received++;
+    if(ctx->received % 3 == 0 && ctx->held_count < LEASES) {
+        xpc_lease_t *lease = xpc_relay_lease(ctx->relay);
+        if(lease != NULL) {
+            ctx->held[ctx->held_count++] = lease;
+            ctx->leased++;
+        }
+    }
+    return true;
+}
+
+static void test_release_oldest(test_rx_ctx_t *ctx) {
+    xpc_lease_t *lease = ctx->held[0];
+    // the ring must not have been written over while the payload was held
+    if(memcmp(lease->payload, pattern + lease->msg_hdr.from, lease->msg_hdr.size) != 0) {
+        ctx->bad++;
+    }
+    xpc_relay_release(ctx->relay, lease);
+    memmove(ctx->held, ctx->held + 1, --ctx->held_count * sizeof(ctx->held[0]));
+}
+
+
+/**
+ * Stream messages of varying sizes through a one page ring, many times over,
+ * with some payloads leased on the receiving side.  Both endpoints live in
+ * this process, each with its own mapping.
+ */
+int test_stream(void) {
+    int failures = 0;
+    xpc_shm_t tx_end, rx_end;
+    xpc_relay_state_t tx_relay, rx_relay;
+    xpc_tx_desc_t queue[8];
+    xpc_lease_t leases[LEASES];
+    test_rx_ctx_t tx_ctx = {.relay = &tx_relay}, rx_ctx = {.relay = &rx_relay};
+
+    int fd = xpc_shm_create(1);
+    if(fd == -1 || xpc_shm_attach(&tx_end, fd, 0) == NULL
+            || xpc_shm_attach(&rx_end, fd, 1) == NULL) {
+        printf("shm setup failed\n");
+        return 1;
+    }
+    close(fd);
+    printf("capacity %zu\n", tx_end.capacity);
+
+    // the second mapping continues the first
+    tx_end.tx_data[tx_end.capacity - 1] = 'a';
+    tx_end.tx_data[0] = 'b';
+    if(rx_end.rx_data[2 * rx_end.capacity - 1] != 'a' || rx_end.rx_data[rx_end.capacity] != 'b') {
+        printf("ring is not double mapped\n");
+        failures++;
+    }
+
+    xpc_shm_relay_config(&tx_end, &tx_relay, &tx_ctx, NULL, test_stream_dispatch_fn, NULL, NULL);
+    xpc_relay_config_tx_queue(&tx_relay, queue, 8);
+    xpc_shm_relay_config(&rx_end, &rx_relay, &rx_ctx, NULL, test_stream_dispatch_fn, NULL, NULL);
+    xpc_relay_config_leases(&rx_relay, leases, LEASES);
+
+    xpc_relay_send_reset(&tx_relay);
+    size_t bytes = 0;
+    int stalls = 0;
+    for(int i = 0; i < STREAM_MSGS; i++) {
+        size_t size = (i * 37) % 256 + 1;
+        int offset = i % 200;
+        while(xpc_send_msg(&tx_relay, i & 0xff, offset, pattern + offset, size)
+                == TXPC_STATUS_INFLIGHT) {
+            xpc_shm_poll(&tx_end);
+            if(xpc_shm_poll(&rx_end) == 0) {
+                stalls++;
+            }
+            if(rx_ctx.held_count >= LEASES - 1) {
+                test_release_oldest(&rx_ctx);
+            }
+        }
+        bytes += size;
+    }
+    for(int i = 0; i < 1000 && rx_ctx.received < STREAM_MSGS; i++) {
+        xpc_shm_poll(&tx_end);
+        xpc_shm_poll(&rx_end);
+        while(rx_ctx.held_count > 0) {
+            test_release_oldest(&rx_ctx);
+        }
+    }
+    printf("%i/%i messages, %zu payload bytes, %i leased, %i corrupt\n",
+        rx_ctx.received, STREAM_MSGS, bytes, rx_ctx.leased, rx_ctx.bad);
+    if(rx_ctx.received != STREAM_MSGS || rx_ctx.bad || rx_ctx.leased == 0) {
+        failures++;
+    }
+    // everything was released, so the ring is empty
+    if(atomic_load(&rx_end.rx->tail) != atomic_load(&rx_end.rx->head)) {
+        printf("ring not drained\n");
+        failures++;
+    }
+    xpc_shm_detach(&tx_end);
+    xpc_shm_detach(&rx_end);
+    return failures;
+}
+
+
+typedef struct {
+    xpc_relay_state_t *relay;
+    char reply[256];
+    int received;
+    bool quit;
+} test_echo_ctx_t;
+
+bool test_echo_dispatch_fn(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload) {
+    test_echo_ctx_t *ctx = (test_echo_ctx_t*)msg_ctx;
+    ctx->received++;
+    if(msg_hdr->to == 0xff) {
+        ctx->quit = true;
+        return true;
+    }
+    // the payload goes away with the frame, send back a copy
+    memcpy(ctx->reply, payload, msg_hdr->size);
+    xpc_send_msg(ctx->relay, msg_hdr->from, msg_hdr->to, ctx->reply, msg_hdr->size);
+    return true;
+}
+
+bool test_count_dispatch_fn(void *msg_ctx, txpc_hdr_t *msg_hdr, char *payload) {
+    test_echo_ctx_t *ctx = (test_echo_ctx_t*)msg_ctx;
+    ctx->received++;
+    return true;
+}
+
+static int test_echo_child(int fd) {
+    xpc_shm_t end;
+    xpc_relay_state_t relay;
+    test_echo_ctx_t ctx = {.relay = &relay};
+    if(xpc_shm_attach(&end, fd, 1) == NULL) {
+        return 1;
+    }
+    xpc_shm_relay_config(&end, &relay, &ctx, NULL, test_echo_dispatch_fn, NULL, NULL);
+    while(!ctx.quit) {
+        if(xpc_shm_wait(&end, 5000) == 0) {
+            return 2;
+        }
+        xpc_shm_poll(&end);
+    }
+    xpc_shm_detach(&end);
+    return 0;
+}
+
+/**
+ * Ping-pong with a child process, one message in flight at a time.
+ */
+int test_pingpong(void) {
+    int failures = 0;
+    xpc_shm_t end;
+    xpc_relay_state_t relay;
+    xpc_tx_desc_t queue[2];
+    test_echo_ctx_t ctx = {.relay = &relay};
+
+    int fd = xpc_shm_create(16384);
+    if(fd == -1) {
+        printf("shm create failed\n");
+        return 1;
+    }
+    pid_t child = fork();
+    if(child == 0) {
+        _exit(test_echo_child(fd));
+    }
+    xpc_shm_attach(&end, fd, 0);
+    close(fd);
+    xpc_shm_relay_config(&end, &relay, &ctx, NULL, test_count_dispatch_fn, NULL, NULL);
+    xpc_relay_config_tx_queue(&relay, queue, 2);
+
+    xpc_relay_send_reset(&relay);
+    struct timespec start, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i = 0; i < PINGS && !failures; i++) {
+        xpc_send_msg(&relay, 1, 2, pattern + (i % 64), 16);
+        xpc_shm_poll(&end);
+        while(ctx.received == i) {
+            if(xpc_shm_wait(&end, 5000) == 0) {
+                printf("timed out after %i replies\n", ctx.received);
+                failures++;
+                break;
+            }
+            xpc_shm_poll(&end);
+        }
+    }
+    int replies = ctx.received;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double ns = (end_time.tv_sec - start.tv_sec) * 1e9
+        + (end_time.tv_nsec - start.tv_nsec);
+    printf("%i round trips, %.0f ns each\n", replies, ns / replies);
+
+    xpc_send_msg(&relay, 0xff, 0, NULL, 0);
+    xpc_shm_poll(&end);
+    int status = 0;
+    waitpid(child, &status, 0);
+    printf("child exit status %i\n", WIFEXITED(status) ? WEXITSTATUS(status):-1);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        failures++;
+    }
+    xpc_shm_detach(&end);
+    return failures;
+}
+
+
+int main(void) {
+    int failures = 0;
+    for(size_t i = 0; i < sizeof(pattern); i++) {
+        pattern[i] = i * 7 + 3;
+    }
+    printf("***TESTING STREAM\n");
+    failures += test_stream();
+    printf("***TESTING PING PONG\n");
+    failures += test_pingpong();
+    printf("%i failures\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <tinyxpc/tinyxpc.h>
+#include <tinyxpc/xpc_relay.h>
+#include <mem_link.h>
+
+#define STREAM_MSGS 200000
+#define STREAM_SIZE 24
+
+// joined by a reset from a
+static void test_connect(mem_link_t *a, mem_link_t *b) {
+    mem_link_pair(a, b, true);
+    xpc_relay_send_reset(&a->relay);
+    for(int i = 0; i < 4; i++) {
+        mem_link_pump(a);
+        mem_link_pump(b);
+    }
+}
+
+static void test_stats_print(const char *name, xpc_relay_stats_t *stats) {
+    printf("%s tx: bytes %llu reset %llu config %llu msg %llu calls %llu short %llu\n",
+        name, (unsigned long long)stats->tx.bytes,
+        (unsigned long long)stats->tx.frames[TXPC_MSG_TYPE_RESET],
+        (unsigned long long)stats->tx.frames[TXPC_MSG_TYPE_CONFIG],
+        (unsigned long long)stats->tx.frames[TXPC_MSG_TYPE_MSG],
+        (unsigned long long)stats->tx.io_calls,
+        (unsigned long long)stats->tx.io_short);
+    printf("%s rx: bytes %llu reset %llu config %llu msg %llu calls %llu short %llu\n",
+        name, (unsigned long long)stats->rx.bytes,
+        (unsigned long long)stats->rx.frames[TXPC_MSG_TYPE_RESET],
+        (unsigned long long)stats->rx.frames[TXPC_MSG_TYPE_CONFIG],
+        (unsigned long long)stats->rx.frames[TXPC_MSG_TYPE_MSG],
+        (unsigned long long)stats->rx.io_calls,
+        (unsigned long long)stats->rx.io_short);
+    printf("%s: crc errors %llu resets %llu declined %llu inhibited %llu\n",
+        name, (unsigned long long)stats->crc_errors,
+        (unsigned long long)stats->resets,
+        (unsigned long long)stats->dispatch_declined,
+        (unsigned long long)stats->inhibited);
+}
+
+/**
+ * Count frames, bytes and IO calls over a reset and a few messages, with
+ * writes cut short, a CRC error and a declined message.
+ */
+int test_counters(void) {
+    int r = 1;
+    mem_link_t a, b;
+    xpc_relay_stats_t stats;
+    test_connect(&a, &b);
+    // every write is cut to 4 bytes
+    a.write_max = 4;
+    xpc_send_msg(&a.relay, 1, 2, "hello", 5);
+    for(int i = 0; i < 8; i++) {
+        mem_link_pump(&a);
+        mem_link_pump(&b);
+    }
+    a.write_max = 0;
+
+    // a CRC mismatch, then a message declined once
+    xpc_relay_send_config(&a.relay, 32, "\x04\xc1\x1d\xb7", false);
+    mem_link_pump(&a);
+    mem_link_pump(&b);
+    xpc_send_msg(&a.relay, 1, 2, "corrupt", 7);
+    xpc_wr_op_continue(&a.relay);
+    b.rx[b.tail - 1] ^= 1;
+    mem_link_pump(&b);
+    b.decline = 1;
+    xpc_send_msg(&a.relay, 1, 2, "declined", 8);
+    mem_link_pump(&a);
+    mem_link_pump(&b);
+    mem_link_pump(&b);
+
+    xpc_relay_stats_snapshot(&a.relay, &stats);
+    test_stats_print("a", &stats);
+    xpc_relay_stats_snapshot(&b.relay, &stats);
+    test_stats_print("b", &stats);
+    printf("b received %i\n", b.received);
+    if(stats.crc_errors != 1 || stats.dispatch_declined != 1
+            || stats.rx.frames[TXPC_MSG_TYPE_MSG] != 3 || b.received != 2) {
+        goto done;
+    }
+    r = 0;
+done:
+    return r;
+}
+
+typedef struct {
+    xpc_relay_state_t *relay;
+    volatile int running;
+    long snapshots;
+    long bad;
+} test_monitor_t;
+
+/**
+ * Snapshot a relay streaming messages of one size.  A consistent snapshot
+ * always has the byte count add up to the frames counted.
+ */
+void *test_monitor(void *arg) {
+    test_monitor_t *mon = (test_monitor_t*)arg;
+    xpc_relay_stats_t stats, last = {0};
+    while(__atomic_load_n(&mon->running, __ATOMIC_RELAXED)) {
+        xpc_relay_stats_snapshot(mon->relay, &stats);
+        uint64_t expect = stats.tx.frames[TXPC_MSG_TYPE_RESET] * sizeof(txpc_hdr_t)
+            + stats.tx.frames[TXPC_MSG_TYPE_MSG] * (sizeof(txpc_hdr_t) + STREAM_SIZE);
+        if(stats.tx.bytes != expect || stats.tx.bytes < last.tx.bytes
+                || stats.tx.io_calls < last.tx.io_calls) {
+            mon->bad++;
+        }
+        last = stats;
+        mon->snapshots++;
+    }
+    return NULL;
+}
+
+int test_concurrent_snapshot(void) {
+    int r = 1;
+    mem_link_t a, b;
+    test_connect(&a, &b);
+    test_monitor_t mon = {.relay = &a.relay, .running = 1};
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, test_monitor, &mon) != 0) {
+        goto done;
+    }
+    char payload[STREAM_SIZE] = "counted elsewhere";
+    int sent = 0;
+    while(b.received < STREAM_MSGS) {
+        if(sent < STREAM_MSGS
+                && xpc_send_msg(&a.relay, 1, 2, payload, STREAM_SIZE) == TXPC_STATUS_DONE) {
+            sent++;
+        }
+        // split frames across writes now and then
+        a.write_max = sent % 7 == 0 ? 3:0;
+        mem_link_pump(&a);
+        mem_link_pump(&b);
+    }
+    __atomic_store_n(&mon.running, 0, __ATOMIC_RELAXED);
+    pthread_join(thread, NULL);
+
+    xpc_relay_stats_t stats;
+    xpc_relay_stats_snapshot(&a.relay, &stats);
+    printf("sent %llu messages, %s snapshots\n",
+        (unsigned long long)stats.tx.frames[TXPC_MSG_TYPE_MSG],
+        mon.snapshots > 0 ? "took":"no");
+    printf("inconsistent snapshots: %li\n", mon.bad);
+    r = mon.bad != 0 || stats.tx.frames[TXPC_MSG_TYPE_MSG] != STREAM_MSGS;
+done:
+    return r;
+}
+
+int main(void) {
+    int r = 0;
+    printf("***TESTING COUNTERS\n");
+    r |= test_counters();
+    printf("***TESTING SNAPSHOTS FROM ANOTHER THREAD\n");
+    r |= test_concurrent_snapshot();
+    return r;
+}
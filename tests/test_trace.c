@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tinyxpc/tinyxpc.h>
+#include <tinyxpc/xpc_relay.h>
+#include <mem_link.h>
+
+// a clock which ticks once per reading
+uint32_t test_clock(void *clock_ctx) {
+    return (*(uint32_t*)clock_ctx)++;
+}
+
+static const char *test_event_name(uint32_t event) {
+    switch(event) {
+        case XPC_TRACE_WR_STATE: return "wr_state";
+        case XPC_TRACE_RD_STATE: return "rd_state";
+        case XPC_TRACE_WR_IO: return "wr_io";
+        case XPC_TRACE_RD_IO: return "rd_io";
+        case XPC_TRACE_FEED: return "feed";
+        case XPC_TRACE_CRC: return "crc";
+        case XPC_TRACE_DISPATCH_START: return "dispatch_start";
+        case XPC_TRACE_DISPATCH_DONE: return "dispatch_done";
+    }
+    return "?";
+}
+
+static void test_trace_print(const char *name, xpc_relay_state_t *relay) {
+    xpc_trace_rec_t recs[16];
+    uint64_t cursor = 0;
+    size_t n = 0;
+    while((n = xpc_relay_trace_read(relay, &cursor, recs, 16)) > 0) {
+        for(size_t i = 0; i < n; i++) {
+            printf("%s %3u %s %i %i\n", name, recs[i].time,
+                test_event_name(recs[i].event), recs[i].a, recs[i].b);
+        }
+    }
+}
+
+/**
+ * Record a reset exchange and one message on both ends.
+ */
+int test_transitions(void) {
+    int r = 1;
+    mem_link_t a, b;
+    xpc_trace_rec_t ring_a[64], ring_b[64];
+    uint32_t clock = 0;
+    mem_link_pair(&a, &b, false);
+    xpc_relay_config_trace(&a.relay, ring_a, 64, test_clock, &clock);
+    xpc_relay_config_trace(&b.relay, ring_b, 64, test_clock, &clock);
+
+    xpc_relay_send_reset(&a.relay);
+    for(int i = 0; i < 4; i++) {
+        mem_link_pump(&a);
+        mem_link_pump(&b);
+    }
+    xpc_send_msg(&a.relay, 1, 2, "traced", 6);
+    mem_link_pump(&a);
+    mem_link_pump(&b);
+    test_trace_print("a", &a.relay);
+    test_trace_print("b", &b.relay);
+
+    // the message went through every read state
+    int seen = 0;
+    xpc_sm_state_t path[][2] = {
+        {TXPC_OP_NONE, TXPC_OP_WAIT_MSG},
+        {TXPC_OP_WAIT_MSG, TXPC_OP_WAIT_DISPATCH},
+        {TXPC_OP_WAIT_DISPATCH, TXPC_OP_NONE}
+    };
+    for(uint64_t i = 0; i < b.relay.trace.count && seen < 3; i++) {
+        xpc_trace_rec_t *rec = &ring_b[i];
+        if(rec->event == XPC_TRACE_RD_STATE
+                && rec->a == (int32_t)path[seen][0]
+                && rec->b == (int32_t)path[seen][1]) {
+            seen++;
+        }
+    }
+    printf("read path %s\n", seen == 3 ? "complete":"incomplete");
+    r = seen != 3 || b.received != 1;
+    return r;
+}
+
+/**
+ * Overrun a small ring and check that reading skips what was lost.
+ */
+int test_overrun(void) {
+    int r = 1;
+    mem_link_t a, b;
+    xpc_trace_rec_t ring[8], out[8];
+    mem_link_pair(&a, &b, false);
+    if(xpc_relay_config_trace(&a.relay, ring, 6, NULL, NULL) != NULL) {
+        printf("capacity of 6 accepted\n");
+        goto done;
+    }
+    xpc_relay_config_trace(&a.relay, ring, 8, NULL, NULL);
+    for(int i = 0; i < 10; i++) {
+        xpc_send_msg(&a.relay, 1, 2, "overrun", 7);
+        mem_link_pump(&a);
+        mem_link_pump(&b);
+    }
+    uint64_t cursor = 0;
+    size_t n = xpc_relay_trace_read(&a.relay, &cursor, out, 8);
+    printf("emitted %llu, read %zu, cursor %llu\n",
+        (unsigned long long)a.relay.trace.count, n,
+        (unsigned long long)cursor);
+    printf("read again: %zu\n", xpc_relay_trace_read(&a.relay, &cursor, out, 8));
+    r = n != 8 || cursor != a.relay.trace.count;
+done:
+    return r;
+}
+
+int main(void) {
+    int r = 0;
+    printf("***TESTING STATE TRANSITIONS\n");
+    r |= test_transitions();
+    printf("***TESTING RING OVERRUN\n");
+    r |= test_overrun();
+    return r;
+}